@@ -0,0 +1,84 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#ifndef TORRENT_CUCKOO_FILTER_HPP_INCLUDED
+#define TORRENT_CUCKOO_FILTER_HPP_INCLUDED
+
+#include "libTAU/config.hpp"
+#include "libTAU/sha1_hash.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace libTAU::aux {
+
+	// a set of sha1 hashes that may answer "present" for a hash that was
+	// never inserted, but never answers "not present" for one that was.
+	// Unlike bloom_filter, hashes can be removed again. Each hash is
+	// stored as a 16 bit fingerprint in one of two buckets of four slots,
+	// a false positive takes a fingerprint collision in one of eight
+	// slots, about 1 in 8000 lookups. Keys are expected to be uniformly
+	// distributed already (sha1 digests), they are not hashed again.
+	struct TORRENT_EXTRA_EXPORT cuckoo_filter
+	{
+		cuckoo_filter() = default;
+
+		// empty filter with room for at least capacity hashes. A filter
+		// without capacity answers every lookup with "maybe present"
+		explicit cuckoo_filter(std::size_t capacity) { reset(capacity); }
+
+		// drop all hashes and resize
+		void reset(std::size_t capacity);
+
+		// returns false if the filter is too full to take k, the filter
+		// must then be rebuilt with a larger capacity. Inserting the same
+		// hash twice stores it twice, it must be erased twice
+		bool insert(sha1_hash const& k);
+
+		// remove one copy of k. Only hashes that were inserted may be
+		// erased, erasing anything else may remove a colliding hash
+		bool erase(sha1_hash const& k);
+
+		bool find(sha1_hash const& k) const;
+
+		// number of hashes stored
+		std::size_t size() const { return m_size; }
+
+		// number of slots
+		std::size_t capacity() const { return m_slots.size(); }
+
+		// memory used by the slots, in bytes
+		std::size_t memory() const { return m_slots.size() * sizeof(std::uint16_t); }
+
+	private:
+
+		static constexpr std::size_t bucket_size = 4;
+
+		// fingerprints moved before an insert gives up
+		static constexpr int max_kicks = 500;
+
+		std::size_t alt_bucket(std::size_t bucket, std::uint16_t fp) const;
+
+		bool bucket_insert(std::size_t bucket, std::uint16_t fp);
+
+		bool bucket_find(std::size_t bucket, std::uint16_t fp) const;
+
+		bool bucket_erase(std::size_t bucket, std::uint16_t fp);
+
+		// bucket_size fingerprints per bucket, 0 is an empty slot
+		std::vector<std::uint16_t> m_slots;
+
+		// number of buckets - 1, the number of buckets is a power of 2
+		std::size_t m_mask = 0;
+
+		std::size_t m_size = 0;
+	};
+}
+
+#endif // TORRENT_CUCKOO_FILTER_HPP_INCLUDED
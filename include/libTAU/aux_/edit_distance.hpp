@@ -0,0 +1,106 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#ifndef TORRENT_EDIT_DISTANCE_HPP_INCLUDED
+#define TORRENT_EDIT_DISTANCE_HPP_INCLUDED
+
+#include "libTAU/config.hpp"
+#include "libTAU/span.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace libTAU::aux {
+
+	// the Levenshtein distance between a source and a target sequence, and
+	// the edit path from the whole of both back toward their beginnings,
+	// as used to reconcile our hash prefix arrays with a peer's.
+	//
+	// The distance matrix is computed a column (target element) at a time
+	// with the bit-parallel algorithm of Myers and Hyyro, 64 rows per word.
+	// Only every sqrt(target size)-th column is kept, the columns of a block
+	// are computed again from its checkpoint when the path gets there. No
+	// memory is allocated, it all comes from the scratch given to the
+	// constructor, of scratch_size() words.
+	//
+	// The path is the one of the full matrix with ties broken the same way:
+	// a substitution (or match) first, then an insertion (a target element
+	// the source lacks), then a deletion (a source element the target lacks).
+	// It stops at the first cell of distance 0, the rest of both sequences
+	// are then equal.
+	struct TORRENT_EXTRA_EXPORT edit_distance
+	{
+		enum class operation : std::uint8_t { substitute, insert, remove };
+
+		// a step of the path, taken from the cell of the first source_size
+		// elements of the source and target_size elements of the target
+		struct step
+		{
+			operation op;
+			std::size_t source_size;
+			std::size_t target_size;
+		};
+
+		// words of scratch needed for sequences of these sizes
+		static std::size_t scratch_size(std::size_t source_size, std::size_t target_size);
+
+		// scratch must hold scratch_size() words and outlive this object
+		edit_distance(span<char const> source, span<char const> target
+			, span<std::uint64_t> scratch);
+
+		edit_distance(edit_distance const&) = delete;
+		edit_distance& operator=(edit_distance const&) = delete;
+
+		int distance() const { return m_distance; }
+
+		// the next step of the path, false once a cell of distance 0 is
+		// reached
+		bool next(step& s);
+
+		// the cell the path is at
+		std::size_t source_size() const { return m_i; }
+		std::size_t target_size() const { return m_j; }
+
+	private:
+
+		std::uint64_t* column(std::size_t j);
+		void advance(std::uint64_t* col, std::size_t j) const;
+		void load_block(std::size_t first);
+		int value(std::size_t i, std::size_t j);
+		int delta(std::size_t i, std::size_t j);
+
+		span<char const> m_source;
+		span<char const> m_target;
+
+		// words per column
+		std::size_t m_words;
+
+		// columns per block
+		std::size_t m_block;
+
+		// the words of the source rows matching each element value
+		span<std::uint64_t> m_peq;
+
+		// the columns 0, m_block, 2 * m_block...
+		span<std::uint64_t> m_checkpoints;
+
+		// the columns m_block_first to m_block_first + m_block
+		span<std::uint64_t> m_columns;
+		std::size_t m_block_first;
+
+		int m_distance;
+
+		// path position and its distance
+		std::size_t m_i;
+		std::size_t m_j;
+		int m_value;
+	};
+}
+
+#endif // TORRENT_EDIT_DISTANCE_HPP_INCLUDED
@@ -62,6 +62,8 @@ see LICENSE file.
 #include "libTAU/kademlia/dht_state.hpp"
 #include "libTAU/kademlia/announce_flags.hpp"
 #include "libTAU/kademlia/items_db_sqlite.hpp"
+#include "libTAU/aux_/storage_executor.hpp"
+#include "libTAU/blockchain/repository_reader_pool.hpp"
 #include "libTAU/kademlia/bs_nodes_storage.hpp"
 #include "libTAU/kademlia/types.hpp"
 #include "libTAU/kademlia/node_entry.hpp"
@@ -614,6 +616,12 @@ namespace aux {
 
 			sqlite3* get_items_database() override;
 
+			aux::storage_executor* get_storage_executor() override;
+
+			// thread safe, may be used from outside the network thread
+			blockchain::repository_reader_pool& repository_readers()
+			{ return m_repository_readers; }
+
 			void set_external_address(tcp::endpoint const& local_endpoint
 				, address const& ip
 				, ip_source_t source_type, address const& source) override;
@@ -688,6 +696,10 @@ namespace aux {
 			bool add_new_friend(const dht::public_key& pubkey);
 			bool delete_friend(const dht::public_key& pubkey);
             bool add_new_message(const communication::message& msg);
+            communication::message_page get_message_page(const dht::public_key& peer
+                , const communication::message_cursor& cursor, int limit);
+            std::vector<communication::message_match> search_messages(const std::string& query, int limit
+                , communication::message_search_order order);
 		    bool publish_data(const aux::bytes& key, const aux::bytes& value);
 		    bool subscribe_from_peer(const dht::public_key& pubkey, const aux::bytes& data);
 		    bool send_to_peer(const dht::public_key& pubkey, const aux::bytes& data);
@@ -717,6 +729,8 @@ namespace aux {
         	bool send_online_signal(const aux::bytes &chain_id);
         	bool connect_chain(const aux::bytes &chain_id);
         	bool touch_chain(const aux::bytes &chain_id);
+        	void set_chain_retention(const aux::bytes &chain_id, int epochs);
+        	void vacuum_sqldb();
             void get_all_chains(std::set<std::vector<char>>* cids);
 
 			std::int64_t session_current_time_ms() const
@@ -822,6 +836,13 @@ namespace aux {
             leveldb::DB* m_kvdb;
             sqlite3* m_sqldb;
 
+			// runs sqlite jobs off the network thread, with its own
+			// connection to the sqldb
+			aux::storage_executor m_storage_executor;
+
+			// read-only connections for session_handle blockchain queries
+			blockchain::repository_reader_pool m_repository_readers;
+
             std::int64_t m_timer_coe = 1;
 			
 	 		std::tuple<dht::public_key, dht::secret_key> m_keypair;
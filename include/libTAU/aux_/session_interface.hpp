@@ -55,6 +55,7 @@ namespace aux {
 	struct alert_manager;
 	struct torrent;
 	struct external_ip;
+	struct storage_executor;
 }
 
 	// hidden
@@ -203,6 +204,9 @@ namespace libTAU::aux {
 		virtual leveldb::DB* kvdb() = 0;
 		virtual sqlite3* sqldb() = 0;
 
+		// nullptr while the storage executor is not running
+		virtual aux::storage_executor* get_storage_executor() = 0;
+
 		virtual std::int64_t timer_coe() = 0;
 
 		virtual dht::public_key* pubkey() = 0;
@@ -0,0 +1,54 @@
+/*
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#ifndef LIBTAU_SQLITE_STMT_HPP
+#define LIBTAU_SQLITE_STMT_HPP
+
+
+#include <memory>
+
+#include <sqlite3.h>
+
+namespace libTAU::aux {
+
+    // finalize a prepared statement when its cache entry is dropped
+    struct stmt_deleter {
+        void operator()(sqlite3_stmt *stmt) const { sqlite3_finalize(stmt); }
+    };
+
+    using stmt_ptr = std::unique_ptr<sqlite3_stmt, stmt_deleter>;
+
+    // a statement borrowed from the cache, it is reset and its bindings
+    // are cleared when going out of scope, so every return path leaves
+    // the cached statement ready for the next call
+    struct cached_stmt {
+        explicit cached_stmt(sqlite3_stmt *stmt) : m_stmt(stmt) {}
+
+        cached_stmt(cached_stmt &&other) noexcept : m_stmt(other.m_stmt) { other.m_stmt = nullptr; }
+
+        cached_stmt(cached_stmt const&) = delete;
+        cached_stmt& operator=(cached_stmt const&) = delete;
+
+        ~cached_stmt() {
+            if (m_stmt != nullptr) {
+                sqlite3_reset(m_stmt);
+                sqlite3_clear_bindings(m_stmt);
+            }
+        }
+
+        sqlite3_stmt *get() const { return m_stmt; }
+
+        explicit operator bool() const { return m_stmt != nullptr; }
+
+    private:
+        sqlite3_stmt *m_stmt;
+    };
+}
+
+
+#endif //LIBTAU_SQLITE_STMT_HPP
@@ -0,0 +1,119 @@
+/*
+
+Copyright (c) 2022, Xianshui Sheng
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#ifndef LIBTAU_STORAGE_EXECUTOR_HPP
+#define LIBTAU_STORAGE_EXECUTOR_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <sqlite3.h>
+
+#include "libTAU/config.hpp"
+#include "libTAU/io_context.hpp"
+#include "libTAU/time.hpp"
+#include "libTAU/performance_counters.hpp"
+
+namespace libTAU {
+namespace aux {
+
+	// the subsystem a storage job is posted on behalf of. Jobs posted by
+	// the same subsystem are executed in the order they were posted.
+	enum class storage_subsystem : std::uint8_t
+	{
+		blockchain,
+		communication,
+		dht,
+	};
+
+	// runs sqlite work on a dedicated thread, with its own connection to the
+	// session database. A slow commit or WAL checkpoint on this connection
+	// never stalls the network thread. Results are handed back by posting
+	// completion handlers to the io_context.
+	//
+	// there is a single storage thread, jobs run strictly in FIFO order,
+	// which also gives the per-subsystem ordering guarantee.
+	//
+	// mutable DHT items, pruning, and message and friend writes run here.
+	// Blockchain repository writes do not: block application reads its own
+	// writes synchronously, they still run on the network thread.
+	struct TORRENT_EXTRA_EXPORT storage_executor
+	{
+		storage_executor(io_context& ioc, counters& cnt);
+		~storage_executor();
+
+		storage_executor(storage_executor const&) = delete;
+		storage_executor& operator=(storage_executor const&) = delete;
+
+		// open the executor connection to the database at db_path and
+		// start the storage thread
+		bool start(std::string const& db_path);
+
+		// run all jobs already queued, then close the connection and join
+		// the storage thread
+		void stop();
+
+		bool is_running() const { return m_running; }
+
+		// job is called on the storage thread with the executor connection.
+		// Once stop() has been called, jobs are rejected and false is
+		// returned. The job is then never run, statements it was to finalize
+		// on the executor connection must be finalized by the caller. That
+		// is safe, the storage thread has exited or only drains the jobs
+		// queued before
+		bool post(storage_subsystem s, std::function<void(sqlite3*)> job);
+
+		// job is called on the storage thread, handler is then called with
+		// the result of job on the network thread. Returns false if the job
+		// is rejected, as post(), the handler is not called then
+		template <typename Ret>
+		bool async_call(storage_subsystem s, std::function<Ret(sqlite3*)> job
+			, std::function<void(Ret)> handler)
+		{
+			return post(s, [this, j = std::move(job), h = std::move(handler)](sqlite3* db)
+			{
+				Ret ret = j(db);
+				libTAU::post(m_ioc, [h, r = std::move(ret)]() mutable { h(std::move(r)); });
+			});
+		}
+
+	private:
+
+		struct storage_job
+		{
+			storage_subsystem subsystem;
+			std::function<void(sqlite3*)> fun;
+			time_point queued;
+		};
+
+		void thread_fun();
+
+		io_context& m_ioc;
+		counters& m_counters;
+
+		// connection owned by the storage thread
+		sqlite3* m_db = nullptr;
+
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		std::deque<storage_job> m_queue;
+		bool m_abort = false;
+		bool m_running = false;
+
+		std::thread m_thread;
+	};
+}
+}
+
+#endif // LIBTAU_STORAGE_EXECUTOR_HPP
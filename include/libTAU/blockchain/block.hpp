@@ -35,11 +35,14 @@ namespace blockchain {
     public:
         block() = default;
 
-        // @param Construct with entry
+        // @param Construct with entry, as block(std::string) with its
+        // bencoding
         explicit block(const entry& e);
 
-        // @param Construct with bencode
-        explicit block(const std::string& encode): block(bdecode(encode)) {}
+        // @param Construct with bencode, as returned by get_encode(). Fields
+        // are read straight from the encoding, which is kept as received:
+        // sha1() and get_encode() use it instead of encoding the block again
+        explicit block(std::string encode);
 
         block(aux::bytes mChainId, block_version mVersion, int64_t mTimestamp, int64_t mBlockNumber,
               const sha1_hash &mPreviousBlockHash, uint64_t mBaseTarget, uint64_t mCumulativeDifficulty,
@@ -150,8 +153,8 @@ namespace blockchain {
 
         entry get_entry_without_signature() const;
 
-        // populate block data from entry
-        void populate(const entry& e);
+        // populate block data from a decoded list, false if malformed
+        bool populate(const bdecode_node& n);
 
         // chain id
         aux::bytes m_chain_id{};
@@ -214,6 +217,9 @@ namespace blockchain {
 
         // sha1 hash
         sha1_hash m_hash;
+
+        // encoding as received or signed, empty until then
+        std::string m_encode;
     };
 }
 }
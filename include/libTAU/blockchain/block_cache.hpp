@@ -0,0 +1,102 @@
+/*
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#ifndef LIBTAU_BLOCK_CACHE_HPP
+#define LIBTAU_BLOCK_CACHE_HPP
+
+
+#include <list>
+#include <map>
+#include <memory>
+#include <unordered_map>
+
+#include "libTAU/sha1_hash.hpp"
+#include "libTAU/performance_counters.hpp"
+#include "libTAU/aux_/common_data.h"
+#include "libTAU/blockchain/block.hpp"
+
+namespace libTAU::blockchain {
+
+    // a bounded cache of decoded blocks, keyed by chain and block hash.
+    // Blocks are immutable once built, cached blocks are shared rather than
+    // copied. Main chain and side branch blocks live in two LRU lists with
+    // separate budgets, so a burst of fork blocks from peers cannot evict
+    // the recent main chain that verification keeps walking.
+    struct TORRENT_EXTRA_EXPORT block_cache {
+
+        explicit block_cache(counters &mCounters) : m_counters(mCounters) {}
+
+        ~block_cache();
+
+        block_cache(const block_cache &) = delete;
+        block_cache& operator=(const block_cache &) = delete;
+
+        // memory budget in bytes, a quarter is reserved for side branch
+        // blocks. 0 disables the cache
+        void set_budget(std::int64_t budget);
+
+        bool enabled() const { return m_main_budget > 0; }
+
+        // nullptr if not cached
+        std::shared_ptr<const block> get(const aux::bytes &chain_id, const sha1_hash &hash);
+
+        // size is the estimated memory used by blk
+        void put(std::shared_ptr<const block> blk, bool main_chain, std::int64_t size);
+
+        // move a cached block between the main chain and side branch lists
+        void set_main_chain(const aux::bytes &chain_id, const sha1_hash &hash, bool main_chain);
+
+        void set_all_non_main_chain(const aux::bytes &chain_id);
+
+        void erase(const aux::bytes &chain_id, const sha1_hash &hash);
+
+        void erase_less_than_number(const aux::bytes &chain_id, std::int64_t block_number);
+
+        void erase_chain(const aux::bytes &chain_id);
+
+        void clear();
+
+    private:
+
+        struct cached_block {
+            std::shared_ptr<const block> blk;
+            std::int64_t size;
+            bool main_chain;
+        };
+
+        using lru_list = std::list<cached_block>;
+
+        lru_list& list_of(bool main_chain) { return main_chain ? m_main : m_side; }
+
+        std::int64_t& size_of(bool main_chain) { return main_chain ? m_main_size : m_side_size; }
+
+        void erase(std::unordered_map<sha1_hash, lru_list::iterator>::iterator it
+                , std::unordered_map<sha1_hash, lru_list::iterator> &index);
+
+        // evict least recently used blocks until the list fits its budget
+        void evict(bool main_chain);
+
+        counters &m_counters;
+
+        // least recently used first
+        lru_list m_main;
+        lru_list m_side;
+
+        // chain id -> block hash -> list entry
+        std::map<aux::bytes, std::unordered_map<sha1_hash, lru_list::iterator>> m_index;
+
+        std::int64_t m_main_budget = 0;
+        std::int64_t m_side_budget = 0;
+
+        std::int64_t m_main_size = 0;
+        std::int64_t m_side_size = 0;
+    };
+}
+
+
+#endif //LIBTAU_BLOCK_CACHE_HPP
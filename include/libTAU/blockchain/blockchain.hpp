@@ -10,6 +10,7 @@ see LICENSE file.
 #define LIBTAU_BLOCKCHAIN_HPP
 
 
+#include <functional>
 #include <map>
 #include <set>
 #include <utility>
@@ -28,9 +29,14 @@ see LICENSE file.
 #include "libTAU/blockchain/pool_hash_set.hpp"
 #include "libTAU/blockchain/hash_array.hpp"
 #include "libTAU/blockchain/peer_info.hpp"
+#include "libTAU/blockchain/prune_cycle.hpp"
 #include "libTAU/blockchain/repository.hpp"
 #include "libTAU/blockchain/repository_impl.hpp"
+#include "libTAU/blockchain/repository_leveldb.hpp"
+#include "libTAU/blockchain/repository_shared.hpp"
+#include "libTAU/blockchain/repository_track.hpp"
 #include "libTAU/blockchain/state_array.hpp"
+#include "libTAU/blockchain/state_commitment.hpp"
 #include "libTAU/blockchain/tx_pool.hpp"
 #include "libTAU/blockchain/transaction_wrapper.hpp"
 #include "libTAU/common/entry_type.hpp"
@@ -73,6 +79,9 @@ namespace blockchain {
     // blockchain max getting times
     constexpr std::int64_t blockchain_max_getting_times = 20;
 
+    // delay before a block held back by a busy database is tried again (ms)
+    constexpr int blockchain_busy_retry_interval = 200;
+
     // blockchain last put time(5min)
     constexpr std::int64_t blockchain_min_put_interval = 5 * 60 * 1000;
 
@@ -115,6 +124,9 @@ namespace blockchain {
         FAIL,
         MISSING,
         NO_FORK_POINT,
+        // nothing was written, the database was held by another connection
+        // or the group before was lost. Try the block again later
+        BUSY,
     };
 
     enum dht_item_type {
@@ -420,8 +432,9 @@ namespace blockchain {
             public std::enable_shared_from_this<blockchain>, blockchain_logger  {
     public:
         blockchain(io_context& mIoc, aux::session_interface &mSes, counters &mCounters) :
-        m_ioc(mIoc), m_ses(mSes), m_counters(mCounters), m_refresh_timer(mIoc), m_dht_tasks_timer(mIoc) {
-            m_repository = std::make_shared<repository_impl>(m_ses.sqldb());
+        m_ioc(mIoc), m_ses(mSes), m_counters(mCounters), m_refresh_timer(mIoc), m_dht_tasks_timer(mIoc), m_group_commit_timer(mIoc), m_prune_timer(mIoc), m_busy_retry_timer(mIoc) {
+            // block application runs on the in-memory overlay, flushed once per transaction
+            m_repository = std::make_shared<repository_track>(make_backend_repository());
         }
 
         // start blockchain
@@ -430,6 +443,10 @@ namespace blockchain {
         // stop
         bool stop();
 
+        // commit the open group of block writes, before something else
+        // writes on the session connection and would join it
+        void flush_writes();
+
         // create chain id
         aux::bytes create_chain_id(aux::bytes type, std::string community_name);
 
@@ -441,6 +458,11 @@ namespace blockchain {
         // click on community
         bool touch_chain(const aux::bytes &chain_id);
 
+        // keep epochs epochs of blocks of a chain, instead of
+        // settings_pack::blockchain_prune_epochs. 0 keeps everything, a
+        // negative value goes back to the setting
+        void set_chain_retention(const aux::bytes &chain_id, int epochs);
+
         // follow a chain by chain id and peers
         bool followChain(const aux::bytes &chain_id, const std::set<dht::public_key>& peers);
 
@@ -531,6 +553,9 @@ namespace blockchain {
 
 
     private:
+        // the storage backend picked by settings_pack::blockchain_repository_backend
+        std::shared_ptr<repository> make_backend_repository();
+
         // initialize member variables
         bool init();
 
@@ -568,6 +593,33 @@ namespace blockchain {
 
         void refresh_dht_task_timer(error_code const& e);
 
+        // commit the open repository group once its latency window elapsed
+        void refresh_group_commit_timer(error_code const& e);
+
+        // block transactions reported committed were lost with their group,
+        // reload the head blocks and drop the state derived from them.
+        // Returns whether it did
+        bool reload_after_lost_group();
+
+        // result of a block transaction that failed to begin or commit
+        RESULT transaction_failed(const aux::bytes &chain_id);
+
+        // run job after blockchain_busy_retry_interval, in place of a job
+        // scheduled for the chain before
+        void retry_when_busy(const aux::bytes &chain_id, std::function<void()> job);
+
+        void refresh_busy_retry_timer(error_code const& e);
+
+        // process a genesis block created here, retried while the db is busy
+        void process_own_genesis_block(const aux::bytes &chain_id, const block &blk, const std::vector<state_array> &arrays);
+
+        // one background prune step, then incremental vacuum
+        void refresh_prune_timer(error_code const& e);
+
+        // work on the prune cycle of a chain, visiting at most budget blocks
+        // or kv objects. Returns the number visited
+        int prune_chain(const aux::bytes &chain_id, int budget);
+
 //        void refresh_chain_status(error_code const &e, const aux::bytes &chain_id);
 
 //        void refresh_getting(error_code const&, const aux::bytes &chain_id);
@@ -654,6 +706,12 @@ namespace blockchain {
         void find_best_solution(std::vector<transaction>& txs, const aux::bytes& hash_prefix_array,
                                 std::set<transaction> &missing_txs);
 
+        // apply accounts touched since the last call to the state commitment
+        void refresh_state_commitment(const aux::bytes &chain_id);
+
+        // true if the local state is the state committed in blk
+        bool is_state_in_place(const aux::bytes &chain_id, const block &blk);
+
         void generate_genesis_state(const aux::bytes &chain_id, sha1_hash &stateRoot, std::vector<state_array> &arrays);
 
         void generate_news_data(const aux::bytes &chain_id, sha1_hash &newsRoot, std::vector<transaction> &newsArrays);
@@ -881,8 +939,17 @@ namespace blockchain {
         // dht task deadline timer
         aux::deadline_timer m_dht_tasks_timer;
 
+        // group commit deadline timer
+        aux::deadline_timer m_group_commit_timer;
+
+        // group commit latency window, unit: ms
+        int m_group_commit_latency = 0;
+
         bool m_pause = false;
 
+        // scratch of find_best_solution(), kept between calls
+        std::vector<std::uint64_t> m_edit_scratch;
+
         // chain timers
         std::map<aux::bytes, aux::deadline_timer> m_chain_timers;
 
@@ -954,6 +1021,30 @@ namespace blockchain {
         // head blocks
         std::map<aux::bytes, block> m_head_blocks;
 
+        // state root of the local state, updated incrementally
+        std::map<aux::bytes, state_commitment> m_state_commitments;
+
+        // background pruning deadline timer
+        aux::deadline_timer m_prune_timer;
+
+        // blocks held back by a busy database, see retry_when_busy()
+        aux::deadline_timer m_busy_retry_timer;
+        std::map<aux::bytes, std::function<void()>> m_busy_retry_jobs;
+
+        // prune settings, see settings_pack::blockchain_prune_epochs
+        int m_prune_epochs = 0;
+        int m_prune_interval = 0;
+        int m_prune_batch_size = 0;
+        int m_vacuum_pages = 0;
+
+        // retention (epochs) of chains set by set_chain_retention()
+        std::map<aux::bytes, int> m_chain_retention;
+
+        std::map<aux::bytes, prune_cycle> m_prune_cycles;
+
+        // the chain pruned last, chains take turns
+        aux::bytes m_prune_chain;
+
 //        std::map<aux::bytes, head_block_info> m_head_block_info;
 
 //        std::map<aux::bytes, std::pair<dht::public_key, peer_info>> m_remote_peer_cache;
@@ -0,0 +1,89 @@
+/*
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#ifndef LIBTAU_PRUNE_CYCLE_HPP
+#define LIBTAU_PRUNE_CYCLE_HPP
+
+
+#include <cstdint>
+#include <functional>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "libTAU/performance_counters.hpp"
+#include "libTAU/sha1_hash.hpp"
+#include "libTAU/aux_/common.h"
+#include "libTAU/blockchain/block.hpp"
+#include "libTAU/blockchain/repository.hpp"
+
+namespace libTAU::blockchain {
+
+    // one pass of background pruning over a chain: delete blocks older
+    // than the retention horizon, mark the kv objects the rest of the
+    // chain references and sweep the others.
+    //
+    // The marks follow the head: blocks connected on top of the marked
+    // chain are marked before the next sweep step. If the head moved any
+    // other way (a rebranch), the main chain is marked again from the new
+    // head down. Side branch blocks kept by prune_blocks(), including those
+    // a rebranch took off the main chain, are marked before every sweep
+    // step too.
+    struct TORRENT_EXTRA_EXPORT prune_cycle {
+        enum phase_t { start, blocks, mark, sweep, done };
+
+        // adds kv objects referenced outside of the blocks, e.g. by the tx
+        // pool or by state being synced. Called before each sweep step
+        using pending_references = std::function<void(std::set<sha1_hash>&)>;
+
+        // work on the cycle of chain_id, keeping epochs epochs below head,
+        // visiting at most budget blocks or kv objects. A done cycle starts
+        // again once head is an epoch further. Returns the number visited
+        int step(repository &repo, counters &cnt, const aux::bytes &chain_id, const block &head, int epochs
+            , int budget, pending_references const& pending);
+
+        // mark the kv objects blk references
+        void mark_kv_references(const block &blk);
+
+        phase_t phase = start;
+
+        // set if prune_blocks() failed, the cycle is done
+        bool failed = false;
+
+        // head block the marks are up to date with
+        std::int64_t head_number = 0;
+        sha1_hash head_hash;
+
+        // delete blocks below main_number, side branch blocks below side_number
+        std::int64_t main_number = 0;
+        std::int64_t side_number = 0;
+
+        // next main chain block to mark, walking down to main_number
+        std::int64_t mark_number = 0;
+
+        // side branch blocks marked already
+        std::set<sha1_hash> side_blocks;
+
+        // hash arrays still to read, with their level: 1 lists level 0
+        // hash arrays, 0 lists state arrays or txs
+        std::vector<std::pair<sha1_hash, int>> arrays;
+
+        // kv objects referenced by the retained blocks
+        std::set<sha1_hash> live;
+
+        // kv objects stored after kv_end are never swept
+        std::int64_t kv_position = 0;
+        std::int64_t kv_end = 0;
+
+        std::int64_t pruned_blocks = 0;
+        std::int64_t pruned_kv_objects = 0;
+    };
+}
+
+
+#endif //LIBTAU_PRUNE_CYCLE_HPP
@@ -34,6 +34,9 @@ namespace libTAU::blockchain {
     const std::string table_community_info_list = "community_info";
 //    const std::string table_txs = "txs";
     const std::string table_news_txs = "news_txs";
+    const std::string table_head_blocks = "head_blocks";
+    const std::string table_schema_version = "schema_version";
+    const std::string table_chain_ordinals = "chain_ordinals";
 
     // repository: 存储账户、区块、状态链接器以及相应高度的索引数据，每个账户的状态是一个通过状态链接器链接起来的一个链式结构。
     // 每个账户会指向一个block hash，通过block hash可以到区块里面查找到对应该账户的状态，同时，通过block hash也能获得对应
@@ -67,9 +70,25 @@ namespace libTAU::blockchain {
 
         static std::string news_txs_db_name(const aux::bytes &chain_id);
 
+        static std::string head_blocks_db_name();
+
+        static std::string schema_version_db_name();
+
+        // the accounts update_account() leaves when called with accounts in
+        // order: the last one of each public key, without empty accounts,
+        // sorted by public key
+        static std::vector<account> final_accounts(const std::vector<account> &accounts);
+
         // init db, create chains table
         virtual bool init() = 0;
 
+        /**
+         * Begin a transaction. It takes the write lock at once, so it cannot
+         * fail halfway on a lock held by another connection. Nested
+         * transactions are savepoints: rollback() only undoes the changes
+         * made since the matching begin_transaction(). Fails as well when it
+         * finds the open group lost, see take_lost_group()
+         */
         virtual bool begin_transaction() = 0;
 
         /**
@@ -84,6 +103,45 @@ namespace libTAU::blockchain {
          */
         virtual bool rollback() = 0;
 
+        /**
+         * Whether the last begin_transaction(), commit() or flush() failed
+         * because another connection held the database. Nothing was
+         * written, the whole transaction can be tried again later
+         */
+        virtual bool transaction_busy() const = 0;
+
+        /**
+         * True once after a group failed to commit, or was rolled back by
+         * the database, with transactions whose commit() returned true in
+         * it. Their changes are not in the database, whatever was derived
+         * from them is to be loaded again
+         */
+        virtual bool take_lost_group() = 0;
+
+        /**
+         * Group commit: coalesce consecutive begin_transaction/commit pairs
+         * into one database transaction, committed after max_transactions
+         * pairs or max_latency milliseconds, whichever comes first. Each pair
+         * is a savepoint, so rollback only undoes its own changes.
+         * max_transactions <= 1 disables group commit. A group that fails to
+         * commit is rolled back as a whole, transactions whose commit()
+         * returned true included, see take_lost_group().
+         */
+        virtual void set_group_commit(int max_transactions, int max_latency) = 0;
+
+        /**
+         * Commit the open group. Unless force is set, the group is only
+         * committed once its latency window has elapsed
+         */
+        virtual bool flush(bool force) = 0;
+
+        // memory budget (bytes) of the decoded block cache, 0 disables it
+        virtual void set_block_cache_size(std::int64_t size) = 0;
+
+        // return up to pages free pages to the file system, returns the
+        // bytes reclaimed
+        virtual std::int64_t incremental_vacuum(int pages) = 0;
+
         // chain set api
         virtual std::set<aux::bytes> get_all_chains() = 0;
 
@@ -122,6 +180,16 @@ namespace libTAU::blockchain {
 
         virtual bool delete_data_in_kv_db_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) = 0;
 
+        // the position of the latest kv object, kv objects stored later
+        // are after it. 0 if there is none
+        virtual std::int64_t get_kv_position(const aux::bytes &chain_id) = 0;
+
+        // hashes of up to limit kv objects stored after position and not
+        // after end, oldest first. position is moved past the objects visited.
+        // Only transactions, hash arrays and state arrays are listed, pic
+        // slices and published data are not the sweep's to delete
+        virtual std::vector<sha1_hash> get_kv_hashes(const aux::bytes &chain_id, std::int64_t &position, std::int64_t end, int limit) = 0;
+
         // state db api
         virtual bool create_state_db(const aux::bytes &chain_id) = 0;
 
@@ -129,6 +197,11 @@ namespace libTAU::blockchain {
 
         virtual bool clear_all_state(const aux::bytes &chain_id) = 0;
 
+        // replace the whole state of a chain, e.g. with the state arrays of a
+        // genesis block. Same result as clear_all_state() and update_account()
+        // for every account in order, in bulk
+        virtual bool replace_all_state(const aux::bytes &chain_id, const std::vector<account> &accounts);
+
         virtual account get_account(const aux::bytes &chain_id, const dht::public_key &pubKey) = 0;
 
         virtual bool is_account_existed(const aux::bytes &chain_id, const dht::public_key &pubKey) = 0;
@@ -139,10 +212,20 @@ namespace libTAU::blockchain {
 
         virtual bool delete_account(const aux::bytes &chain_id, const dht::public_key &pubKey) = 0;
 
+        // all accounts in effective state order
         virtual std::vector<account> get_all_effective_state(const aux::bytes &chain_id) = 0;
 
+        // accounts written since the last call, the call clears them. reset
+        // is set if the whole state was cleared or dropped meanwhile, or if
+        // a transaction that wrote it was undone, the accounts taken before
+        // may no longer be stored as they were
+        virtual std::set<dht::public_key> take_touched_accounts(const aux::bytes &chain_id, bool &reset) = 0;
+
         virtual dht::public_key get_peer_from_state_db_randomly(const aux::bytes &chain_id) = 0;
 
+        // up to num distinct peers, picked randomly
+        virtual std::set<dht::public_key> get_peers_from_state_db_randomly(const aux::bytes &chain_id, int num) = 0;
+
         // block db api
         virtual bool create_block_db(const aux::bytes &chain_id) = 0;
 
@@ -170,6 +253,13 @@ namespace libTAU::blockchain {
 
         virtual bool delete_all_blocks_less_than_number(const aux::bytes &chain_id, std::int64_t block_number) = 0;
 
+        // delete up to limit blocks below main_number, and side branch blocks
+        // below side_number. Returns the number deleted, -1 on error
+        virtual int prune_blocks(const aux::bytes &chain_id, std::int64_t main_number, std::int64_t side_number, int limit) = 0;
+
+        // hashes of the side branch blocks from block_number on
+        virtual std::vector<sha1_hash> get_side_branch_block_hashes(const aux::bytes &chain_id, std::int64_t block_number) = 0;
+
         virtual bool set_block_non_main_chain(const aux::bytes &chain_id, const sha1_hash &hash) = 0;
 
         virtual bool set_block_main_chain(const aux::bytes &chain_id, const sha1_hash &hash) = 0;
@@ -185,6 +275,9 @@ namespace libTAU::blockchain {
 
         virtual std::set<dht::public_key> get_enough_peers_from_peer_db_randomly(const aux::bytes &chain_id) = 0;
 
+        // up to num distinct peers, picked randomly
+        virtual std::set<dht::public_key> get_peers_from_peer_db_randomly(const aux::bytes &chain_id, int num) = 0;
+
         virtual bool delete_peer_in_peer_db(const aux::bytes &chain_id, const dht::public_key &pubKey) = 0;
 
         virtual bool add_peer_in_peer_db(const aux::bytes &chain_id, const dht::public_key &pubKey) = 0;
@@ -10,16 +10,36 @@ see LICENSE file.
 #define LIBTAU_REPOSITORY_IMPL_HPP
 
 
+#include <map>
+#include <memory>
+#include <string>
+
 #include <sqlite3.h>
 //#include <leveldb/db.h>
 //#include <leveldb/write_batch.h>
+#include "libTAU/performance_counters.hpp"
+#include "libTAU/time.hpp"
+#include "libTAU/aux_/sqlite_stmt.hpp"
+#include "libTAU/blockchain/block_cache.hpp"
 #include "libTAU/blockchain/repository.hpp"
 #include "libTAU/blockchain/repository_track.hpp"
 
 namespace libTAU::blockchain {
-    struct repository_impl final : repository {
 
-        explicit repository_impl(sqlite3 *mSqlite) : m_sqlite(mSqlite) {}
+    // version of the sqlite schema written by repository_impl,
+    // databases with an older version are migrated in init()
+    constexpr int repository_schema_version = 4;
+
+    // rows of the schema version table, one per table layout
+    constexpr int per_chain_schema_id = 0;
+    constexpr int shared_schema_id = 1;
+
+    using aux::stmt_ptr;
+    using aux::cached_stmt;
+
+    struct repository_impl : repository {
+
+        repository_impl(sqlite3 *mSqlite, counters &mCounters) : m_sqlite(mSqlite), m_counters(mCounters), m_block_cache(mCounters) {}
 
         bool init() override;
 
@@ -29,6 +49,18 @@ namespace libTAU::blockchain {
 
         bool rollback() override;
 
+        bool transaction_busy() const override;
+
+        bool take_lost_group() override;
+
+        void set_group_commit(int max_transactions, int max_latency) override;
+
+        bool flush(bool force) override;
+
+        void set_block_cache_size(std::int64_t size) override;
+
+        std::int64_t incremental_vacuum(int pages) override;
+
         std::set<aux::bytes> get_all_chains() override;
 
         bool add_new_chain(const aux::bytes &chain_id) override;
@@ -63,12 +95,21 @@ namespace libTAU::blockchain {
 
         bool delete_data_in_kv_db_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) override;
 
+        std::int64_t get_kv_position(const aux::bytes &chain_id) override;
+
+        std::vector<sha1_hash> get_kv_hashes(const aux::bytes &chain_id, std::int64_t &position, std::int64_t end, int limit) override;
+
         bool create_state_db(const aux::bytes &chain_id) override;
 
         bool delete_state_db(const aux::bytes &chain_id) override;
 
         bool clear_all_state(const aux::bytes &chain_id) override;
 
+        // rows are inserted in primary key order by a single statement, with
+        // the indexes in place. Meant to run in a transaction, rolling it
+        // back restores the old state
+        bool replace_all_state(const aux::bytes &chain_id, const std::vector<account> &accounts) override;
+
         account get_account(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
 
         bool is_account_existed(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
@@ -81,8 +122,12 @@ namespace libTAU::blockchain {
 
         std::vector<account> get_all_effective_state(const aux::bytes &chain_id) override;
 
+        std::set<dht::public_key> take_touched_accounts(const aux::bytes &chain_id, bool &reset) override;
+
         dht::public_key get_peer_from_state_db_randomly(const aux::bytes &chain_id) override;
 
+        std::set<dht::public_key> get_peers_from_state_db_randomly(const aux::bytes &chain_id, int num) override;
+
         bool create_block_db(const aux::bytes &chain_id) override;
 
         bool delete_block_db(const aux::bytes &chain_id) override;
@@ -105,6 +150,10 @@ namespace libTAU::blockchain {
 
         bool delete_all_blocks_less_than_number(const aux::bytes &chain_id, std::int64_t block_number) override;
 
+        int prune_blocks(const aux::bytes &chain_id, std::int64_t main_number, std::int64_t side_number, int limit) override;
+
+        std::vector<sha1_hash> get_side_branch_block_hashes(const aux::bytes &chain_id, std::int64_t block_number) override;
+
         bool set_block_non_main_chain(const aux::bytes &chain_id, const sha1_hash &hash) override;
 
         bool set_block_main_chain(const aux::bytes &chain_id, const sha1_hash &hash) override;
@@ -119,6 +168,8 @@ namespace libTAU::blockchain {
 
         std::set<dht::public_key> get_enough_peers_from_peer_db_randomly(const aux::bytes &chain_id) override;
 
+        std::set<dht::public_key> get_peers_from_peer_db_randomly(const aux::bytes &chain_id, int num) override;
+
         bool delete_peer_in_peer_db(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
 
         bool add_peer_in_peer_db(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
@@ -303,11 +354,128 @@ namespace libTAU::blockchain {
 //
 //        std::string get_all_cache() override;
 
-    private:
+    protected:
+
+        // return the cached statement for sql on table, preparing it on first use
+        cached_stmt prepare_cached(const std::string &table, const std::string &sql);
+
+        // finalize all cached statements of table before it is dropped
+        void invalidate_stmt_cache(const std::string &table);
+
+        // run sql without result rows
+        bool exec(const char *sql);
+
+        // up to num distinct PUBKEY values of table, picked by probing random
+        // rowids. Each probe is an O(log n) rowid lookup, unlike
+        // ORDER BY RANDOM() which scans and sorts the whole table
+        std::set<dht::public_key> sample_pubkeys(const std::string &table, int num);
+
+        bool create_schema_version_db();
+
+        // schema version of a table layout, 0 if never written
+        int get_schema_version(int layout);
+
+        bool set_schema_version(int layout, int version);
+
+        // upgrade an existing database to repository_schema_version
+        bool migrate_schema();
+
+        // add block table indexes and head block pointers
+        bool migrate_to_v1();
+
+        // add effective state order indexes
+        bool migrate_to_v2();
+
+        // add the PRUNABLE column to kv tables
+        bool migrate_to_v4();
+
+        // whether table has column, false if there is no such table
+        bool has_column(const std::string &table, const char *column);
+
+        // block tables created from schema version 3 on keep the encoded
+        // block and break out only the indexed columns, older ones keep a
+        // column per field
+        bool encoded_block_table(const aux::bytes &chain_id);
+
+        // main chain block row of a table with a column per field
+        bool save_main_chain_block_columns(const block &blk);
+
+        void touch_account(const aux::bytes &chain_id, const dht::public_key &pubKey);
+
+        void touch_all_state(const aux::bytes &chain_id);
+
+        // the open transaction is undone, its accounts may have been taken
+        // already. The states it wrote are reset for take_touched_accounts()
+        void reset_uncommitted_states();
+
+        // sqlite rolled back the open transaction or group on its own
+        bool transaction_lost() const;
+
+        // forget the transaction or group sqlite rolled back
+        void lose_transaction();
+
+        // the last statement failed because of another connection's lock
+        bool busy_error() const;
+
+        bool create_head_block_db();
+
+        // head block pointer: hash and number of the main chain block with max number
+        bool get_head_block_pointer(const aux::bytes &chain_id, sha1_hash &hash, std::int64_t &number);
+
+        bool set_head_block_pointer(const aux::bytes &chain_id, const sha1_hash &hash, std::int64_t number);
+
+        bool delete_head_block_pointer(const aux::bytes &chain_id);
+
+        // re-select head block pointer from main chain blocks
+        virtual bool refresh_head_block_pointer(const aux::bytes &chain_id);
 
         // sqlite3 instance
         sqlite3 *m_sqlite;
 
+        // session counters, used for statement cache hits/misses
+        counters &m_counters;
+
+        // prepared statements: table name -> sql -> statement
+        std::map<std::string, std::map<std::string, stmt_ptr>> m_stmt_cache;
+
+        // group commit limits, disabled when m_group_max_transactions <= 1
+        int m_group_max_transactions = 1;
+        int m_group_max_latency = 0;
+
+        // an outer transaction is open, holding committed savepoints
+        bool m_group_open = false;
+
+        // savepoints committed into the open group
+        int m_group_transactions = 0;
+
+        // begin_transaction() calls not yet committed or rolled back. The
+        // outermost one is the database transaction unless a group is open,
+        // all others are savepoints
+        int m_transaction_depth = 0;
+
+        // see transaction_busy()
+        bool m_busy = false;
+
+        // see take_lost_group()
+        bool m_lost_group = false;
+
+        time_point m_group_start;
+
+        // decoded blocks, in front of get_block_by_hash
+        block_cache m_block_cache;
+
+        // layout of the block table of a chain, see encoded_block_table()
+        std::map<aux::bytes, bool> m_encoded_block_tables;
+
+        // accounts written since take_touched_accounts(), per chain
+        std::map<aux::bytes, std::set<dht::public_key>> m_touched_accounts;
+
+        // chains whose state was cleared or dropped since take_touched_accounts()
+        std::set<aux::bytes> m_reset_states;
+
+        // chains whose state was written in the open transaction
+        std::set<aux::bytes> m_uncommitted_states;
+
         // leveldb instance
 //        leveldb::DB* m_leveldb;
 //
@@ -0,0 +1,320 @@
+/*
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#ifndef LIBTAU_REPOSITORY_LEVELDB_HPP
+#define LIBTAU_REPOSITORY_LEVELDB_HPP
+
+
+#include <functional>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <leveldb/db.h>
+#include "libTAU/performance_counters.hpp"
+#include "libTAU/time.hpp"
+#include "libTAU/blockchain/block_cache.hpp"
+#include "libTAU/blockchain/repository.hpp"
+
+namespace libTAU::blockchain {
+
+    // repository on the session LevelDB instance. Every table of
+    // repository_impl becomes a key prefix:
+    //
+    //   0, tag, chain id length (2 bytes), chain id, fields
+    //
+    // numbers in keys are big endian, fields ordered descending are stored
+    // inverted so that a forward scan returns them first. The leading 0
+    // keeps these keys apart from the other users of the instance.
+    //
+    // LevelDB has no transactions: writes are staged in memory and applied
+    // with a single WriteBatch when the outermost transaction (or the open
+    // group, see set_group_commit()) commits, so a block is applied
+    // atomically. Reads see staged writes. The session holds the only
+    // handle on the database, a transaction is never busy.
+    //
+    // kv objects the prune sweep may delete are numbered in the order they
+    // were saved, that number is their kv position.
+    struct TORRENT_EXTRA_EXPORT repository_leveldb final : repository {
+
+        repository_leveldb(leveldb::DB *mDb, counters &mCounters) : m_db(mDb), m_counters(mCounters), m_block_cache(mCounters) {}
+
+        bool init() override;
+
+        bool begin_transaction() override;
+
+        bool commit() override;
+
+        bool rollback() override;
+
+        bool transaction_busy() const override;
+
+        bool take_lost_group() override;
+
+        void set_group_commit(int max_transactions, int max_latency) override;
+
+        bool flush(bool force) override;
+
+        void set_block_cache_size(std::int64_t size) override;
+
+        std::int64_t incremental_vacuum(int pages) override;
+
+        std::set<aux::bytes> get_all_chains() override;
+
+        bool add_new_chain(const aux::bytes &chain_id) override;
+
+        bool delete_chain(const aux::bytes &chain_id) override;
+
+        bool create_kv_db(const aux::bytes &chain_id) override;
+
+        bool delete_kv_db(const aux::bytes &chain_id) override;
+
+        bool save_hash_array(const aux::bytes &chain_id, const hash_array &hashArray) override;
+
+        hash_array get_hash_array_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        state_array get_state_array_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        bool save_state_array(const aux::bytes &chain_id, const state_array &stateArray) override;
+
+        bool save_tx(const aux::bytes &chain_id, const transaction &tx) override;
+
+        transaction get_tx_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        bool save_pic_slice(const aux::bytes &chain_id, const aux::bytes &key, const aux::bytes &slice) override;
+
+        aux::bytes get_pic_slice(const aux::bytes &chain_id, const aux::bytes &key) override;
+
+        bool is_data_in_kv_db(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        bool delete_data_in_kv_db_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        std::int64_t get_kv_position(const aux::bytes &chain_id) override;
+
+        std::vector<sha1_hash> get_kv_hashes(const aux::bytes &chain_id, std::int64_t &position, std::int64_t end, int limit) override;
+
+        bool create_state_db(const aux::bytes &chain_id) override;
+
+        bool delete_state_db(const aux::bytes &chain_id) override;
+
+        bool clear_all_state(const aux::bytes &chain_id) override;
+
+        account get_account(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
+
+        bool is_account_existed(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
+
+        bool update_account(const aux::bytes &chain_id, const account &act) override;
+
+        bool save_account(const aux::bytes &chain_id, const account &act) override;
+
+        bool delete_account(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
+
+        std::vector<account> get_all_effective_state(const aux::bytes &chain_id) override;
+
+        std::set<dht::public_key> take_touched_accounts(const aux::bytes &chain_id, bool &reset) override;
+
+        dht::public_key get_peer_from_state_db_randomly(const aux::bytes &chain_id) override;
+
+        std::set<dht::public_key> get_peers_from_state_db_randomly(const aux::bytes &chain_id, int num) override;
+
+        bool create_block_db(const aux::bytes &chain_id) override;
+
+        bool delete_block_db(const aux::bytes &chain_id) override;
+
+        block get_head_block(const aux::bytes &chain_id) override;
+
+        std::string get_test_tx_string(const aux::bytes &chain_id) override;
+
+        int get_test_tx_size(const aux::bytes &chain_id) override;
+
+        block get_block_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        bool save_block_if_not_exist(const block &blk) override;
+
+        bool save_main_chain_block(const block &blk) override;
+
+        bool delete_block_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        block get_main_chain_block_by_number(const aux::bytes &chain_id, std::int64_t block_number) override;
+
+        bool delete_all_blocks_less_than_number(const aux::bytes &chain_id, std::int64_t block_number) override;
+
+        int prune_blocks(const aux::bytes &chain_id, std::int64_t main_number, std::int64_t side_number, int limit) override;
+
+        std::vector<sha1_hash> get_side_branch_block_hashes(const aux::bytes &chain_id, std::int64_t block_number) override;
+
+        bool set_block_non_main_chain(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        bool set_block_main_chain(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        bool set_all_block_non_main_chain(const aux::bytes &chain_id) override;
+
+        bool create_peer_db(const aux::bytes &chain_id) override;
+
+        bool delete_peer_db(const aux::bytes &chain_id) override;
+
+        dht::public_key get_peer_from_peer_db_randomly(const aux::bytes &chain_id) override;
+
+        std::set<dht::public_key> get_enough_peers_from_peer_db_randomly(const aux::bytes &chain_id) override;
+
+        std::set<dht::public_key> get_peers_from_peer_db_randomly(const aux::bytes &chain_id, int num) override;
+
+        bool delete_peer_in_peer_db(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
+
+        bool add_peer_in_peer_db(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
+
+        bool clear_peer_db(const aux::bytes &chain_id) override;
+
+        bool create_acl_db(const aux::bytes &chain_id) override;
+
+        bool delete_acl_db(const aux::bytes &chain_id) override;
+
+        std::set<dht::public_key> get_all_peer_in_acl_db(const aux::bytes &chain_id) override;
+
+        bool clear_acl_db(const aux::bytes &chain_id) override;
+
+        bool add_peer_in_acl_db(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
+
+        bool create_online_list_db(const aux::bytes &chain_id) override;
+
+        bool delete_online_list_db(const aux::bytes &chain_id) override;
+
+        std::set<dht::public_key> get_all_peer_in_online_list_db(const aux::bytes &chain_id) override;
+
+        bool clear_online_list_db(const aux::bytes &chain_id) override;
+
+        bool add_peer_in_online_list_db(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
+
+        bool create_community_info_db() override;
+
+        bool delete_community_info_db() override;
+
+        bool update_touching_time(const aux::bytes &chain_id, std::int64_t touching_time) override;
+
+        std::int64_t get_touching_time(const aux::bytes &chain_id) override;
+
+        bool delete_touching_time(const aux::bytes &chain_id) override;
+
+        bool create_news_tx_db(const aux::bytes &chain_id) override;
+
+        bool delete_news_tx_db(const aux::bytes &chain_id) override;
+
+        bool save_news_tx(const aux::bytes &chain_id, const transaction &tx) override;
+
+        transaction get_news_tx_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        std::vector<transaction> get_latest_news_txs(const aux::bytes &chain_id) override;
+
+    private:
+
+        // a write staged in m_pending, nullopt deletes the key
+        using pending_value = std::optional<std::string>;
+
+        // how to undo a staged write when its transaction rolls back
+        struct undo_entry {
+            std::string key;
+            // the key was staged before, with value
+            bool staged;
+            pending_value value;
+        };
+
+        // get the value of key, staged writes first
+        bool get(const std::string &key, std::string &value);
+
+        bool put(const std::string &key, std::string value);
+
+        bool del(const std::string &key);
+
+        // stage a write, applied right away outside of transactions
+        bool stage(const std::string &key, pending_value value);
+
+        // call fn with every key starting with prefix, in key order from
+        // start on, until it returns false. Staged writes are merged in
+        void scan(const std::string &prefix, const std::string &start
+                , const std::function<bool(const std::string &, const std::string &)> &fn);
+
+        void scan(const std::string &prefix
+                , const std::function<bool(const std::string &, const std::string &)> &fn) { scan(prefix, prefix, fn); }
+
+        bool delete_prefix(const std::string &prefix);
+
+        // apply all staged writes in one batch. They are dropped if that
+        // fails
+        bool write_pending();
+
+        // up to num distinct keys of prefix, each a pubkey, picked by
+        // seeking random pubkeys
+        std::set<dht::public_key> sample_pubkeys(const std::string &prefix, int num);
+
+        bool save_block(const block &blk, bool main_chain);
+
+        // main chain flag and number of a stored block
+        bool get_block_info(const aux::bytes &chain_id, const sha1_hash &hash, bool &main_chain, std::int64_t &number);
+
+        bool set_main_chain(const aux::bytes &chain_id, const sha1_hash &hash, bool main_chain);
+
+        // a prunable object gets the next kv position of the chain, see
+        // get_kv_hashes()
+        bool put_kv(const aux::bytes &chain_id, const std::string &key, const std::string &value, bool prunable);
+
+        bool get_kv(const aux::bytes &chain_id, const std::string &key, std::string &value);
+
+        bool delete_kv(const aux::bytes &chain_id, const std::string &key);
+
+        void touch_account(const aux::bytes &chain_id, const dht::public_key &pubKey);
+
+        void touch_all_state(const aux::bytes &chain_id);
+
+        // the staged writes are undone, their accounts may have been taken
+        // already. The states they wrote are reset for take_touched_accounts()
+        void reset_uncommitted_states();
+
+        leveldb::DB *m_db;
+
+        // session counters, used for group commit stats
+        counters &m_counters;
+
+        // staged writes, not in m_db yet
+        std::map<std::string, pending_value> m_pending;
+
+        // one undo log per open transaction, innermost last
+        std::vector<std::vector<undo_entry>> m_undo;
+
+        // group commit limits, disabled when m_group_max_transactions <= 1
+        int m_group_max_transactions = 1;
+        int m_group_max_latency = 0;
+
+        // m_pending holds committed transactions of an open group
+        bool m_group_open = false;
+
+        // transactions committed into the open group
+        int m_group_transactions = 0;
+
+        time_point m_group_start;
+
+        // see take_lost_group()
+        bool m_lost_group = false;
+
+        // decoded blocks, in front of get_block_by_hash
+        block_cache m_block_cache;
+
+        // accounts written since take_touched_accounts(), per chain
+        std::map<aux::bytes, std::set<dht::public_key>> m_touched_accounts;
+
+        // chains whose state was cleared or dropped since take_touched_accounts()
+        std::set<aux::bytes> m_reset_states;
+
+        // chains whose state was written by the staged writes
+        std::set<aux::bytes> m_uncommitted_states;
+    };
+}
+
+
+#endif //LIBTAU_REPOSITORY_LEVELDB_HPP
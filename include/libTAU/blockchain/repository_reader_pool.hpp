@@ -0,0 +1,105 @@
+/*
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#ifndef LIBTAU_REPOSITORY_READER_POOL_HPP
+#define LIBTAU_REPOSITORY_READER_POOL_HPP
+
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+#include "libTAU/performance_counters.hpp"
+#include "libTAU/time.hpp"
+#include "libTAU/blockchain/repository_impl.hpp"
+#include "libTAU/blockchain/repository_shared.hpp"
+
+namespace libTAU::blockchain {
+
+    // a pool of read-only connections to the session database. Queries that
+    // only read committed state are served from the calling thread, instead
+    // of being queued onto the network thread. In WAL mode readers are never
+    // blocked by the writer, and the writer is never blocked by readers.
+    //
+    // Readers only see committed data. A block transaction still open on the
+    // network thread, or a commit group not flushed yet, is not seen, where
+    // a query queued onto the network thread would read its writes.
+    struct TORRENT_EXPORT repository_reader_pool {
+
+        // a connection borrowed from the pool. A read transaction is open for
+        // the lifetime of the reader, so all queries see the same snapshot
+        struct reader {
+            reader() = default;
+            reader(repository_reader_pool *pool, int index);
+            ~reader();
+
+            reader(reader &&other) noexcept;
+            reader& operator=(reader &&) = delete;
+            reader(const reader &) = delete;
+            reader& operator=(const reader &) = delete;
+
+            repository* operator->() const;
+
+            explicit operator bool() const { return m_pool != nullptr; }
+
+        private:
+            repository_reader_pool *m_pool = nullptr;
+            int m_index = -1;
+        };
+
+        explicit repository_reader_pool(counters &mCounters) : m_counters(mCounters) {}
+
+        ~repository_reader_pool();
+
+        repository_reader_pool(const repository_reader_pool &) = delete;
+        repository_reader_pool& operator=(const repository_reader_pool &) = delete;
+
+        // open size read-only connections to the database at db_path. With
+        // shared_schema, the tables are read with repository_shared
+        bool open(const std::string &db_path, int size, bool shared_schema);
+
+        // wait for all readers to be returned, then close the connections
+        void close();
+
+        bool is_open() const;
+
+        // borrow a connection, waiting up to max_wait for one if all are in
+        // use. The returned reader is empty if the pool is not open or none
+        // was returned in time, the caller then queries elsewhere
+        reader acquire(time_duration max_wait);
+
+    private:
+
+        struct connection {
+            sqlite3 *db = nullptr;
+            // each connection has its own repository, so that cached
+            // statements are never shared between threads
+            std::unique_ptr<repository_impl> repo;
+        };
+
+        void release(int index);
+
+        counters &m_counters;
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_cond;
+
+        std::vector<connection> m_connections;
+
+        // indices of connections not currently borrowed
+        std::vector<int> m_free;
+
+        bool m_open = false;
+    };
+}
+
+
+#endif //LIBTAU_REPOSITORY_READER_POOL_HPP
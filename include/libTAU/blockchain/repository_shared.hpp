@@ -0,0 +1,243 @@
+/*
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#ifndef LIBTAU_REPOSITORY_SHARED_HPP
+#define LIBTAU_REPOSITORY_SHARED_HPP
+
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+#include "libTAU/performance_counters.hpp"
+#include "libTAU/time.hpp"
+#include "libTAU/blockchain/repository_impl.hpp"
+
+namespace libTAU::blockchain {
+
+    // version of the shared table layout, stored under shared_schema_id
+    constexpr int shared_repository_schema_version = 3;
+
+    // sqlite repository with one set of tables for all chains. Rows of the
+    // per chain tables of repository_impl (blocks, state, kv, peer, acl,
+    // online list and news txs) are keyed by (CHAIN, ...), where CHAIN is
+    // the chain ordinal. The schema no longer grows with every followed
+    // chain, so parsing it at startup, and re-preparing statements after a
+    // chain is followed or unfollowed, costs the same for 1 or 5000 chains.
+    //
+    // The ordinal of a chain is its short chain id, the first
+    // short_chain_id_length bytes of the chain id read as a big endian
+    // number. Short ids may collide, so the ordinal is allocated once and
+    // stored in the chain ordinals table, a colliding chain takes the next
+    // free number. Ordinals are never released, they stay valid for the
+    // reader connections caching them.
+    //
+    // The followed chains, head block pointers, community info and the
+    // transaction handling are the same as repository_impl. Rows of the
+    // per chain tables left by repository_impl are copied into the shared
+    // tables by init(), the migration is one way. Dropping a table scans
+    // the whole schema, so the old tables are dropped a few at a time by
+    // incremental_vacuum() instead of all at once on startup.
+    //
+    // Blocks are stored as their canonical encoding, rows written before
+    // schema version 2 keep a column per field and are read as such.
+    struct TORRENT_EXTRA_EXPORT repository_shared final : repository_impl {
+
+        repository_shared(sqlite3 *mSqlite, counters &mCounters) : repository_impl(mSqlite, mCounters) {}
+
+        bool init() override;
+
+        bool rollback() override;
+
+        bool flush(bool force) override;
+
+        // also drops some of the per chain tables left by the migration
+        std::int64_t incremental_vacuum(int pages) override;
+
+        // drop per chain tables left by the migration until budget is
+        // spent, returns the number of tables dropped
+        int drop_migrated_tables(time_duration budget);
+
+        bool create_kv_db(const aux::bytes &chain_id) override;
+
+        bool delete_kv_db(const aux::bytes &chain_id) override;
+
+        bool save_hash_array(const aux::bytes &chain_id, const hash_array &hashArray) override;
+
+        hash_array get_hash_array_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        state_array get_state_array_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        bool save_state_array(const aux::bytes &chain_id, const state_array &stateArray) override;
+
+        bool save_tx(const aux::bytes &chain_id, const transaction &tx) override;
+
+        transaction get_tx_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        bool save_pic_slice(const aux::bytes &chain_id, const aux::bytes &key, const aux::bytes &slice) override;
+
+        aux::bytes get_pic_slice(const aux::bytes &chain_id, const aux::bytes &key) override;
+
+        bool is_data_in_kv_db(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        bool delete_data_in_kv_db_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        // rowids are shared by all chains, the position is the last rowid
+        // of the kv table
+        std::int64_t get_kv_position(const aux::bytes &chain_id) override;
+
+        std::vector<sha1_hash> get_kv_hashes(const aux::bytes &chain_id, std::int64_t &position, std::int64_t end, int limit) override;
+
+        bool create_state_db(const aux::bytes &chain_id) override;
+
+        bool delete_state_db(const aux::bytes &chain_id) override;
+
+        bool clear_all_state(const aux::bytes &chain_id) override;
+
+        bool replace_all_state(const aux::bytes &chain_id, const std::vector<account> &accounts) override;
+
+        account get_account(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
+
+        bool is_account_existed(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
+
+        bool save_account(const aux::bytes &chain_id, const account &act) override;
+
+        bool delete_account(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
+
+        std::vector<account> get_all_effective_state(const aux::bytes &chain_id) override;
+
+        dht::public_key get_peer_from_state_db_randomly(const aux::bytes &chain_id) override;
+
+        std::set<dht::public_key> get_peers_from_state_db_randomly(const aux::bytes &chain_id, int num) override;
+
+        bool create_block_db(const aux::bytes &chain_id) override;
+
+        bool delete_block_db(const aux::bytes &chain_id) override;
+
+        std::string get_test_tx_string(const aux::bytes &chain_id) override;
+
+        int get_test_tx_size(const aux::bytes &chain_id) override;
+
+        block get_block_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        bool save_block_if_not_exist(const block &blk) override;
+
+        bool save_main_chain_block(const block &blk) override;
+
+        bool delete_block_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        block get_main_chain_block_by_number(const aux::bytes &chain_id, std::int64_t block_number) override;
+
+        bool delete_all_blocks_less_than_number(const aux::bytes &chain_id, std::int64_t block_number) override;
+
+        int prune_blocks(const aux::bytes &chain_id, std::int64_t main_number, std::int64_t side_number, int limit) override;
+
+        std::vector<sha1_hash> get_side_branch_block_hashes(const aux::bytes &chain_id, std::int64_t block_number) override;
+
+        bool set_block_non_main_chain(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        bool set_block_main_chain(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        bool set_all_block_non_main_chain(const aux::bytes &chain_id) override;
+
+        bool create_peer_db(const aux::bytes &chain_id) override;
+
+        bool delete_peer_db(const aux::bytes &chain_id) override;
+
+        dht::public_key get_peer_from_peer_db_randomly(const aux::bytes &chain_id) override;
+
+        std::set<dht::public_key> get_enough_peers_from_peer_db_randomly(const aux::bytes &chain_id) override;
+
+        std::set<dht::public_key> get_peers_from_peer_db_randomly(const aux::bytes &chain_id, int num) override;
+
+        bool delete_peer_in_peer_db(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
+
+        bool add_peer_in_peer_db(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
+
+        bool clear_peer_db(const aux::bytes &chain_id) override;
+
+        bool create_acl_db(const aux::bytes &chain_id) override;
+
+        bool delete_acl_db(const aux::bytes &chain_id) override;
+
+        std::set<dht::public_key> get_all_peer_in_acl_db(const aux::bytes &chain_id) override;
+
+        bool clear_acl_db(const aux::bytes &chain_id) override;
+
+        bool add_peer_in_acl_db(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
+
+        bool create_online_list_db(const aux::bytes &chain_id) override;
+
+        bool delete_online_list_db(const aux::bytes &chain_id) override;
+
+        std::set<dht::public_key> get_all_peer_in_online_list_db(const aux::bytes &chain_id) override;
+
+        bool clear_online_list_db(const aux::bytes &chain_id) override;
+
+        bool add_peer_in_online_list_db(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
+
+        bool create_news_tx_db(const aux::bytes &chain_id) override;
+
+        bool delete_news_tx_db(const aux::bytes &chain_id) override;
+
+        bool save_news_tx(const aux::bytes &chain_id, const transaction &tx) override;
+
+        transaction get_news_tx_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) override;
+
+        std::vector<transaction> get_latest_news_txs(const aux::bytes &chain_id) override;
+
+    private:
+
+        bool refresh_head_block_pointer(const aux::bytes &chain_id) override;
+
+        bool create_shared_tables();
+
+        // copy the per chain tables of every followed chain into the shared
+        // tables
+        bool migrate_per_chain_tables();
+
+        // ordinal of chain_id, 0 if it has none. With create, a missing
+        // ordinal is allocated
+        std::int64_t chain_ordinal(const aux::bytes &chain_id, bool create);
+
+        // delete all rows of a chain from a shared table
+        bool delete_chain_rows(const std::string &table, const aux::bytes &chain_id);
+
+        // prunable objects may be deleted by the prune sweep once no block
+        // references them
+        bool put_kv(const aux::bytes &chain_id, const char *key, int key_size, const std::string &value, bool prunable);
+
+        bool get_kv(const aux::bytes &chain_id, const char *key, int key_size, std::string &value);
+
+        // public key sets: peer, acl and online list
+        bool add_pubkey(const std::string &table, const aux::bytes &chain_id, const dht::public_key &pubKey);
+
+        bool delete_pubkey(const std::string &table, const aux::bytes &chain_id, const dht::public_key &pubKey);
+
+        std::set<dht::public_key> get_all_pubkeys(const std::string &table, const aux::bytes &chain_id);
+
+        // up to num distinct public keys of a chain, picked by seeking
+        // random keys in the (CHAIN,PUBKEY) primary key
+        std::set<dht::public_key> sample_chain_pubkeys(const std::string &table, const aux::bytes &chain_id, int num);
+
+        bool save_block(const block &blk, bool main_chain, bool replace);
+
+        bool set_main_chain(const aux::bytes &chain_id, const sha1_hash &hash, bool main_chain);
+
+        // chain id -> ordinal, filled on lookup
+        std::map<aux::bytes, std::int64_t> m_ordinals;
+
+        // cleared once no per chain table is found
+        bool m_migrated_tables_left = true;
+    };
+}
+
+
+#endif //LIBTAU_REPOSITORY_SHARED_HPP
@@ -11,13 +11,16 @@ see LICENSE file.
 
 #include <utility>
 #include <map>
+#include <memory>
+#include <set>
+#include <vector>
 #include "libTAU/blockchain/repository.hpp"
 
 namespace libTAU::blockchain {
 
     struct repository_track final : repository {
 
-        explicit repository_track(repository *mRepository) : m_repository(mRepository) {}
+        explicit repository_track(std::shared_ptr<repository> mRepository) : m_repository(std::move(mRepository)) {}
 
         bool init() override;
 
@@ -27,6 +30,18 @@ namespace libTAU::blockchain {
 
         bool rollback() override;
 
+        bool transaction_busy() const override;
+
+        bool take_lost_group() override;
+
+        void set_group_commit(int max_transactions, int max_latency) override;
+
+        bool flush(bool force) override;
+
+        void set_block_cache_size(std::int64_t size) override;
+
+        std::int64_t incremental_vacuum(int pages) override;
+
         std::set<aux::bytes> get_all_chains() override;
 
         bool add_new_chain(const aux::bytes &chain_id) override;
@@ -61,12 +76,19 @@ namespace libTAU::blockchain {
 
         bool delete_data_in_kv_db_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) override;
 
+        std::int64_t get_kv_position(const aux::bytes &chain_id) override;
+
+        std::vector<sha1_hash> get_kv_hashes(const aux::bytes &chain_id, std::int64_t &position, std::int64_t end, int limit) override;
+
         bool create_state_db(const aux::bytes &chain_id) override;
 
         bool delete_state_db(const aux::bytes &chain_id) override;
 
         bool clear_all_state(const aux::bytes &chain_id) override;
 
+        // in bulk in the backing repository, after the overlay is flushed
+        bool replace_all_state(const aux::bytes &chain_id, const std::vector<account> &accounts) override;
+
         account get_account(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
 
         bool is_account_existed(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
@@ -79,8 +101,12 @@ namespace libTAU::blockchain {
 
         std::vector<account> get_all_effective_state(const aux::bytes &chain_id) override;
 
+        std::set<dht::public_key> take_touched_accounts(const aux::bytes &chain_id, bool &reset) override;
+
         dht::public_key get_peer_from_state_db_randomly(const aux::bytes &chain_id) override;
 
+        std::set<dht::public_key> get_peers_from_state_db_randomly(const aux::bytes &chain_id, int num) override;
+
         bool create_block_db(const aux::bytes &chain_id) override;
 
         bool delete_block_db(const aux::bytes &chain_id) override;
@@ -103,6 +129,10 @@ namespace libTAU::blockchain {
 
         bool delete_all_blocks_less_than_number(const aux::bytes &chain_id, std::int64_t block_number) override;
 
+        int prune_blocks(const aux::bytes &chain_id, std::int64_t main_number, std::int64_t side_number, int limit) override;
+
+        std::vector<sha1_hash> get_side_branch_block_hashes(const aux::bytes &chain_id, std::int64_t block_number) override;
+
         bool set_block_non_main_chain(const aux::bytes &chain_id, const sha1_hash &hash) override;
 
         bool set_block_main_chain(const aux::bytes &chain_id, const sha1_hash &hash) override;
@@ -117,6 +147,8 @@ namespace libTAU::blockchain {
 
         std::set<dht::public_key> get_enough_peers_from_peer_db_randomly(const aux::bytes &chain_id) override;
 
+        std::set<dht::public_key> get_peers_from_peer_db_randomly(const aux::bytes &chain_id, int num) override;
+
         bool delete_peer_in_peer_db(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
 
         bool add_peer_in_peer_db(const aux::bytes &chain_id, const dht::public_key &pubKey) override;
@@ -302,15 +334,59 @@ namespace libTAU::blockchain {
 
     private:
 
-        repository *m_repository;
+        // how a written account reaches the backing repository. An account
+        // saved with all zeros is kept, an updated one is deleted
+        enum class account_op : std::uint8_t {
+            update,
+            save,
+            erase,
+        };
+
+        enum class block_op : std::uint8_t {
+            save_if_not_exist,
+            save_main_chain,
+            set_main_chain,
+            set_non_main_chain,
+        };
+
+        struct journal_entry {
+            block_op op;
+            aux::bytes chain_id;
+            sha1_hash hash;
+            // only set for saves
+            block blk;
+        };
+
+        // write the overlay into the backing repository, inside its open
+        // transaction, and empty it. On failure the overlay is kept and the
+        // transaction is failed, see m_failed
+        bool flush_overlay();
+
+        void discard_overlay();
+
+        std::shared_ptr<repository> m_repository;
+
+        // open transactions, the overlay is only used inside one
+        int m_depth = 0;
+
+        // a write of the overlay failed. Every flush fails and every commit
+        // rolls back until the outermost transaction ends
+        bool m_failed = false;
+
+        // accounts read or written in the open transaction
+        std::map<aux::bytes, std::map<dht::public_key, account>> m_accounts;
+
+        // accounts written in the open transaction, by their last write
+        std::map<aux::bytes, std::map<dht::public_key, account_op>> m_dirty_accounts;
 
-        std::map<std::string, std::string> m_cache;
+        // chains whose state was cleared in the open transaction
+        std::set<aux::bytes> m_cleared_states;
 
-        // main chain connected blocks
-        std::vector<block> m_connected_blocks;
+        // blocks saved in the open transaction
+        std::map<std::pair<aux::bytes, sha1_hash>, block> m_blocks;
 
-        // main chain discarded blocks
-        std::vector<block> m_discarded_blocks;
+        // block writes in the order they were made
+        std::vector<journal_entry> m_block_journal;
     };
 }
 
@@ -0,0 +1,93 @@
+/*
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#ifndef LIBTAU_STATE_COMMITMENT_HPP
+#define LIBTAU_STATE_COMMITMENT_HPP
+
+
+#include <vector>
+
+#include "libTAU/sha1_hash.hpp"
+#include "libTAU/kademlia/types.hpp"
+#include "libTAU/blockchain/account.hpp"
+#include "libTAU/blockchain/hash_array.hpp"
+#include "libTAU/blockchain/state_array.hpp"
+
+namespace libTAU::blockchain {
+
+    // the state root of a chain, kept up to date between epoch blocks.
+    // Accounts are laid out in effective state order (balance, power, nonce
+    // and public key, all descending), MAX_ACCOUNT_SIZE_IN_ENTRY accounts per
+    // state array, MAX_HASH_SIZE_IN_ENTRY state array hashes per level 0 hash
+    // array, and a single level 1 hash array on top.
+    //
+    // update() only rebuilds the state arrays whose accounts changed or
+    // shifted, and the hash arrays above them. The result is identical to a
+    // full rebuild from the same state.
+    //
+    // Arrays rebuilt stay unsaved over any number of updates, until
+    // mark_saved() is called after they were written to the kv db.
+    struct TORRENT_EXTRA_EXPORT state_commitment {
+
+        // true if accounts a comes before b in effective state order
+        static bool effective_order(const account &a, const account &b);
+
+        bool valid() const { return m_valid; }
+
+        void invalidate();
+
+        // rebuild from all accounts, in effective state order
+        void reset(const std::vector<account> &accounts);
+
+        // apply accounts changed or added since the last update, and
+        // accounts removed since. Only valid after reset()
+        void update(const std::vector<account> &changed, const std::vector<dht::public_key> &removed);
+
+        // all zeros if there is no account
+        sha1_hash root() const { return m_level1.sha1(); }
+
+        const std::vector<state_array> &state_arrays() const { return m_leaves; }
+
+        // level 1 first, then level 0 in order
+        std::vector<hash_array> hash_arrays() const;
+
+        // state arrays rebuilt since the last mark_saved()
+        std::vector<state_array> unsaved_state_arrays() const;
+
+        // hash arrays rebuilt since the last mark_saved()
+        std::vector<hash_array> unsaved_hash_arrays() const;
+
+        // all arrays are in the kv db
+        void mark_saved();
+
+    private:
+
+        // rebuild state arrays flagged in m_dirty_leaves, or resized, and
+        // the hash arrays above them
+        void rebuild(const std::vector<account> &accounts);
+
+        bool m_valid = false;
+
+        std::vector<state_array> m_leaves;
+        std::vector<hash_array> m_level0;
+        hash_array m_level1;
+
+        // rebuilt by the running reset() or update()
+        std::vector<bool> m_dirty_leaves;
+        std::vector<bool> m_dirty_level0;
+        bool m_dirty_level1 = false;
+
+        // rebuilt since the last mark_saved()
+        std::vector<bool> m_unsaved_leaves;
+        std::vector<bool> m_unsaved_level0;
+        bool m_unsaved_level1 = false;
+    };
+}
+
+
+#endif //LIBTAU_STATE_COMMITMENT_HPP
@@ -41,6 +41,10 @@ namespace blockchain {
         // @param Construct with entry
         explicit transaction(const entry& e);
 
+        // @param Construct with a decoded list, fields are read straight
+        // from it and the hash is taken over its encoding as is
+        explicit transaction(const bdecode_node& n);
+
         // @param Construct with bencode
         explicit transaction(const std::string& encode): transaction(bdecode(encode)) {}
 
@@ -146,6 +150,9 @@ namespace blockchain {
         // populate transaction data from entry
         void populate(const entry& e);
 
+        // populate transaction data from a decoded list, false if malformed
+        bool populate(const bdecode_node& n);
+
         // chain id
         aux::bytes m_chain_id{};
 
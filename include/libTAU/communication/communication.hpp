@@ -32,6 +32,7 @@ see LICENSE file.
 #include "libTAU/communication/message_wrapper.hpp"
 #include "libTAU/communication/message_db_impl.hpp"
 #include "libTAU/communication/message_db_interface.hpp"
+#include "libTAU/communication/sync_scheduler.hpp"
 #include "libTAU/kademlia/node_entry.hpp"
 
 namespace libTAU {
@@ -63,6 +64,9 @@ namespace libTAU {
         // default refresh time of main task(300)(s)
         constexpr int communication_default_refresh_time = 300;
 
+        // interval of the sync scheduler dispatch while operations are pending(ms)
+        constexpr int communication_sync_interval = 100;
+
         // max message list size(used in Levenshtein Distance)
         constexpr int communication_max_message_list_size = 10;
 
@@ -93,8 +97,15 @@ namespace libTAU {
         public:
 
             communication(aux::bytes device_id, aux::session_interface &mSes, io_context &mIoc, counters &mCounters) :
-                    m_device_id(std::move(device_id)), m_ioc(mIoc), m_ses(mSes), m_counters(mCounters)/*, m_refresh_timer(mIoc)*/ {
-                m_message_db = std::make_shared<message_db_impl>(m_ses.sqldb());
+                    m_device_id(std::move(device_id)), m_ioc(mIoc), m_ses(mSes), m_counters(mCounters)/*, m_refresh_timer(mIoc)*/
+                    , m_sync_timer(mIoc)
+                    , m_scheduler([this](sha256_hash const& target, sync_scheduler::nodes_callback done) {
+                        find_sync_nodes(target, std::move(done));
+                    }, m_ses.settings().get_int(settings_pack::communication_sync_rate)) {
+                m_message_db = std::make_shared<message_db_impl>(m_ses.sqldb(), m_counters
+                        , m_ses.settings().get_bool(settings_pack::compress_messages)
+                        , m_ses.settings().get_bool(settings_pack::enable_message_search)
+                        , m_ses.get_storage_executor());
             }
 
             // start communication
@@ -136,6 +147,12 @@ namespace libTAU {
             // add a new message
             bool add_new_message(const message& msg, bool post_alert = false);
 
+            // a page of the messages exchanged with peer, older than cursor
+            message_page get_message_page(const dht::public_key &peer, const message_cursor &cursor, int limit);
+
+            // messages matching an FTS5 query
+            std::vector<message_match> search_messages(const std::string &query, int limit, message_search_order order);
+
             // reset when account changed
             void account_changed();
 
@@ -247,6 +264,9 @@ namespace libTAU {
             std::shared_ptr<communication> self()
             { return shared_from_this(); }
 
+            // logs a message write that failed after it was queued
+            message_db_interface::message_write_handler message_write_done();
+
 //#ifndef TORRENT_DISABLE_LOGGING
             bool should_log(aux::LOG_LEVEL log_level) const override;
             void log(aux::LOG_LEVEL log_level, char const* fmt, ...) const noexcept override TORRENT_FORMAT(3,4);
@@ -254,6 +274,15 @@ namespace libTAU {
 
 //            void refresh_timeout(error_code const& e);
 
+            // look up the nodes closest to target for a group of the sync scheduler
+            void find_sync_nodes(sha256_hash const& target, sync_scheduler::nodes_callback done);
+
+            // queue a DHT operation toward a friend in the sync scheduler
+            void schedule(sync_operation op);
+
+            // dispatch the operations the rate allows, and wait for the rest
+            void sync_timeout(error_code const& e);
+
 //            void send_all_unconfirmed_messages(dht::public_key const& peer);
 
             void on_dht_put_mutable_item(dht::item const& i, int n);
@@ -278,6 +307,12 @@ namespace libTAU {
             // deadline timer
 //            aux::deadline_timer m_refresh_timer;
 
+            // dispatch timer of pending DHT operations
+            aux::deadline_timer m_sync_timer;
+
+            // paces and groups DHT operations toward friends
+            sync_scheduler m_scheduler;
+
             // message db
             std::shared_ptr<message_db_interface> m_message_db;
 
@@ -286,6 +321,9 @@ namespace libTAU {
             // all friends
             std::vector<dht::public_key> m_friends;
 
+            // scratch of find_best_solution(), kept between calls
+            std::vector<std::uint64_t> m_edit_scratch;
+
 //            std::map<dht::public_key, std::int64_t> m_all_messages_last_put_time;
 
             // message wrapper
@@ -0,0 +1,74 @@
+/*
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#ifndef LIBTAU_MESSAGE_COMPRESSOR_HPP
+#define LIBTAU_MESSAGE_COMPRESSOR_HPP
+
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "libTAU/aux_/common.h"
+#include "libTAU/aux_/export.hpp"
+
+namespace libTAU {
+    namespace communication {
+
+        // largest dictionary trained from stored messages
+        constexpr std::size_t message_dictionary_size = 16 * 1024;
+
+        // compresses message payloads with a zstd dictionary trained from
+        // stored messages. A short message shares little with itself, the
+        // words and structure it shares with other messages are what the
+        // dictionary brings. Dictionaries are identified by the id they are
+        // stored under, the one with the highest id compresses new payloads
+        // and the older ones still decompress the payloads they compressed.
+        // Without TORRENT_ENABLE_ZSTD nothing is compressed or decompressed
+        struct TORRENT_EXTRA_EXPORT message_compressor {
+
+            message_compressor();
+
+            ~message_compressor();
+
+            message_compressor(const message_compressor &) = delete;
+            message_compressor& operator=(const message_compressor &) = delete;
+
+            // whether libTAU was built with zstd
+            static bool available();
+
+            // train a dictionary of at most dict_size bytes, empty if samples
+            // are too few or too small to train one
+            static std::string train(const std::vector<aux::bytes> &samples, std::size_t dict_size);
+
+            // load a dictionary stored under id
+            bool add_dictionary(std::int64_t id, const std::string &dict);
+
+            // id of the dictionary compressing new payloads, 0 if none
+            std::int64_t current_dictionary() const { return m_current; }
+
+            // compress payload with the current dictionary, false if there is
+            // none or the result is not smaller than payload
+            bool compress(const aux::bytes &payload, std::string &out);
+
+            // decompress data compressed with the dictionary stored under id
+            bool decompress(std::int64_t id, const char *data, int size, aux::bytes &payload);
+
+        private:
+
+            struct impl;
+            std::unique_ptr<impl> m_impl;
+
+            std::int64_t m_current = 0;
+        };
+    }
+}
+
+
+#endif //LIBTAU_MESSAGE_COMPRESSOR_HPP
@@ -10,27 +10,65 @@ see LICENSE file.
 #define LIBTAU_MESSAGE_DB_IMPL_HPP
 
 
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include <sqlite3.h>
 //#include <leveldb/db.h>
 
+#include "libTAU/performance_counters.hpp"
+#include "libTAU/aux_/cuckoo_filter.hpp"
+#include "libTAU/aux_/sqlite_stmt.hpp"
+#include "libTAU/aux_/storage_executor.hpp"
+#include "libTAU/communication/message_compressor.hpp"
 #include "libTAU/communication/message_db_interface.hpp"
 
 namespace libTAU {
     namespace communication {
 
+        // hashes of the stored messages are kept in a filter, most lookups
+        // of a message that is not stored are answered without a query.
+        // With compression on, payloads are stored compressed with a
+        // dictionary trained from the stored messages, and decompressed on
+        // read. With search on, payloads are also indexed in an FTS5 table,
+        // which keeps its own uncompressed copy for snippets. A message is
+        // linked to its row there by MESSAGES.SEARCH_ID.
+        //
+        // With an executor, messages and friends are written on its
+        // connection. Until a write completes, the message saved or deleted
+        // is served from a pending map, reads on this connection see it at
+        // once. Searches only find a message once it is written
         struct message_db_impl final : message_db_interface {
 
-            explicit message_db_impl(sqlite3 *mSqlite) : m_sqlite(mSqlite) {}
+            message_db_impl(sqlite3 *mSqlite, counters &mCounters, bool compress = false, bool search = false
+                            , aux::storage_executor *executor = nullptr)
+                : m_sqlite(mSqlite), m_counters(mCounters), m_executor(executor), m_compress(compress), m_search(search)
+                , m_writer(std::make_shared<writer>()), m_pending(std::make_shared<pending_messages>()) {}
+
+            ~message_db_impl() override;
 
-            // init db
+            // init db, load the compression dictionaries, and build the
+            // message filter from the stored messages
             bool init() override;
 
+            // train a dictionary from the latest stored messages, on the
+            // executor. It compresses the messages saved once it is loaded.
+            // False if a training is running already
+            bool train_dictionary();
+
             bool create_table_friends() override;
 
             // get all friends
             std::vector<dht::public_key> get_all_friends() override;
 
-            // save a friend in db
+            // save a friend in db. Writes return before they are done, a
+            // write that fails is counted in
+            // communication_message_write_failures
             bool save_friend(const dht::public_key &pubKey) override;
 
             // delete a friend
@@ -38,7 +76,9 @@ namespace libTAU {
 
             bool create_table_messages() override;
 
-            bool save_message_if_not_exist(const message &msg) override;
+            // returns once the save is queued, a message already stored
+            // counts as written
+            bool save_message_if_not_exist(const message &msg, message_write_handler done = nullptr) override;
 
             message get_message_by_hash(const sha1_hash &hash) override;
 
@@ -48,15 +88,129 @@ namespace libTAU {
             std::vector<communication::message>
             get_latest_ten_transactions(const dht::public_key &sender, const dht::public_key &receiver) override;
 
+            // keyset paging over the conversation index, reads at most
+            // limit + 1 rows per direction whatever the history size
+            message_page get_message_page(const dht::public_key &self, const dht::public_key &peer,
+                                          const message_cursor &cursor, int limit) override;
+
+            // full text search, nothing matches while search is off
+            std::vector<message_match> search_messages(const std::string &query, int limit,
+                                                       message_search_order order) override;
+
             bool delete_message_by_hash(const sha1_hash &hash) override;
 
             bool is_message_in_db(const sha1_hash &hash) override;
 
         private:
 
+            // prepared statements of a connection: sql -> statement
+            using stmt_map = std::map<std::string, aux::stmt_ptr>;
+
+            // statements prepared on the executor connection, only used on
+            // the storage thread
+            struct writer {
+                stmt_map stmts;
+            };
+
+            // a save or delete not written yet
+            struct pending_message {
+                // the message saved, empty for a delete
+                message msg;
+                bool deleted = false;
+                std::uint32_t seq = 0;
+            };
+
+            using pending_messages = std::map<sha1_hash, pending_message>;
+
+            // return the cached statement for sql, preparing it on first use
+            aux::cached_stmt prepare_cached(const std::string &sql);
+
+            // run job on the executor connection, then done with its result
+            // on this thread. Without an executor, or once it has stopped,
+            // job runs on this connection at once
+            template <typename Ret>
+            void write(std::function<Ret(sqlite3 *, stmt_map &)> job, std::function<void(Ret)> done);
+
+            // the pending save or delete of hash, nullptr if there is none
+            pending_message const *find_pending(const sha1_hash &hash) const;
+
+            // the pending saves of messages from sender to receiver older
+            // than cursor
+            void get_pending_before(const dht::public_key &sender, const dht::public_key &receiver,
+                                    const message_cursor &cursor, std::vector<std::pair<message_view, bool>> &rows) const;
+
+            // fill the message filter with the hashes of all stored
+            // messages, growing it until they fit
+            bool rebuild_filter(std::size_t capacity);
+
+            void update_filter_gauges();
+
+            bool has_column(const char *table, const char *column);
+
+            bool create_search_index();
+
+            // index the messages without a SEARCH_ID on the executor, a
+            // batch per job until none is left. The first time it indexes
+            // the whole history, which is not found by searches until then
+            void update_search_index();
+
+            // read the PAYLOAD column and the DICT column after it,
+            // decompressing the payload if it is compressed
+            bool read_payload(sqlite3_stmt *stmt, int column, aux::bytes &payload);
+
+            // up to limit rows of messages from sender to receiver older
+            // than cursor, newest first. A row is paired with false if its
+            // payload could not be read
+            bool get_messages_before(const dht::public_key &sender, const dht::public_key &receiver,
+                                     const message_cursor &cursor, int limit,
+                                     std::vector<std::pair<message_view, bool>> &rows);
+
             // sqlite3 instance
             sqlite3 *m_sqlite;
 
+            // session counters, used for the message filter metrics
+            counters &m_counters;
+
+            // runs the writes, nullptr to write on m_sqlite
+            aux::storage_executor *m_executor;
+
+            // hashes of the stored messages
+            aux::cuckoo_filter m_filter;
+
+            // dictionaries of the stored payloads
+            message_compressor m_compressor;
+
+            // compress new payloads
+            bool m_compress;
+
+            // index new payloads, and answer searches
+            bool m_search;
+
+            // MESSAGES_FTS exists, deletes are applied to it
+            bool m_search_table = false;
+
+            // messages saved uncompressed since the last training
+            int m_uncompressed_messages = 0;
+
+            // a dictionary is being trained
+            bool m_training = false;
+
+            // the search index is being built, saves are not indexed
+            bool m_indexing = false;
+
+            // saves left to the search index build
+            std::uint32_t m_unindexed_saves = 0;
+
+            // prepared statements on m_sqlite
+            stmt_map m_stmt_cache;
+
+            std::shared_ptr<writer> m_writer;
+
+            // hash -> write queued on the executor. Handlers of writes that
+            // complete after this db is gone see it expired
+            std::shared_ptr<pending_messages> m_pending;
+            std::uint32_t m_pending_seq = 0;
+
             // level db instance
 //            leveldb::DB* m_leveldb;
         };
@@ -9,11 +9,13 @@ see LICENSE file.
 #ifndef LIBTAU_MESSAGE_DB_INTERFACE_HPP
 #define LIBTAU_MESSAGE_DB_INTERFACE_HPP
 
+#include <functional>
 #include <vector>
 
 #include "libTAU/aux_/common.h"
 #include "libTAU/aux_/export.hpp"
 #include "libTAU/communication/message.hpp"
+#include "libTAU/communication/message_page.hpp"
 
 
 namespace libTAU {
@@ -26,6 +28,10 @@ namespace libTAU {
         // 并且，该哈希列表也用来生成对应的莱温斯坦数组，只需取哈希的第一个字节，并按对应顺序排列即可
         struct TORRENT_EXPORT message_db_interface {
 
+            // called with the hash of a message saved, and whether it was
+            // written, once the write is done
+            using message_write_handler = std::function<void(const sha1_hash &, bool)>;
+
             // init db
             virtual bool init() = 0;
 
@@ -44,8 +50,10 @@ namespace libTAU {
             // create table friends
             virtual bool create_table_messages() = 0;
 
-            // save message
-            virtual bool save_message_if_not_exist(const communication::message& msg) = 0;
+            // save message. A db may return before the write is done, its
+            // result is passed to done
+            virtual bool save_message_if_not_exist(const communication::message& msg,
+                                                   message_write_handler done = nullptr) = 0;
 
             // get message by hash
             virtual communication::message get_message_by_hash(const sha1_hash &hash) = 0;
@@ -58,6 +66,15 @@ namespace libTAU {
             virtual std::vector<communication::message>
             get_latest_ten_transactions(const dht::public_key &sender, const dht::public_key &receiver) = 0;
 
+            // up to limit messages between self and peer, both directions,
+            // older than cursor
+            virtual message_page get_message_page(const dht::public_key &self, const dht::public_key &peer,
+                                                  const message_cursor &cursor, int limit) = 0;
+
+            // up to limit messages matching an FTS5 query
+            virtual std::vector<message_match> search_messages(const std::string &query, int limit,
+                                                               message_search_order order) = 0;
+
             // delete message
             virtual bool delete_message_by_hash(const sha1_hash &hash) = 0;
 
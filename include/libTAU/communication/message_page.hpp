@@ -0,0 +1,85 @@
+/*
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#ifndef LIBTAU_MESSAGE_PAGE_HPP
+#define LIBTAU_MESSAGE_PAGE_HPP
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "libTAU/sha1_hash.hpp"
+#include "libTAU/aux_/common.h"
+#include "libTAU/aux_/export.hpp"
+#include "libTAU/kademlia/types.hpp"
+
+namespace libTAU {
+    namespace communication {
+
+        // a stored message, as listed in a history page. Unlike message, it
+        // carries no decoded entry, only the columns of the row
+        struct TORRENT_EXPORT message_view {
+            sha1_hash hash;
+            dht::public_key sender;
+            dht::public_key receiver;
+            std::int64_t timestamp = 0;
+            aux::bytes payload;
+        };
+
+        // position in the history of a conversation. A page holds the
+        // messages older than the cursor, in (timestamp, hash) order. The
+        // default cursor is newer than any message
+        struct TORRENT_EXPORT message_cursor {
+            std::int64_t timestamp = (std::numeric_limits<std::int64_t>::max)();
+            sha1_hash hash = (sha1_hash::max)();
+        };
+
+        // messages sent and received in a conversation, newest first
+        struct TORRENT_EXPORT message_page {
+            // messages whose payload cannot be read are left out, a page
+            // may hold fewer messages than asked for and still have more
+            std::vector<message_view> messages;
+
+            // cursor of the next, older, page
+            message_cursor next;
+
+            // false if there are no older messages
+            bool more = false;
+        };
+
+        // order of search results
+        enum class message_search_order : std::uint8_t {
+            // bm25 rank, every match is scored before the best ones are
+            // returned, so a query matching much of the history is slow
+            best_match,
+
+            // the most recently stored matches, read from the index until
+            // limit is reached
+            newest,
+        };
+
+        // a stored message matching a search
+        struct TORRENT_EXPORT message_match {
+            sha1_hash hash;
+            dht::public_key sender;
+            dht::public_key receiver;
+            std::int64_t timestamp = 0;
+
+            // the words of the payload around the match, matched terms
+            // within [ and ]
+            std::string snippet;
+
+            // bm25 rank, lower is a better match. Only set when searching
+            // for the best matches
+            double rank = 0;
+        };
+    }
+}
+
+#endif //LIBTAU_MESSAGE_PAGE_HPP
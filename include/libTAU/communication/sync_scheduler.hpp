@@ -0,0 +1,184 @@
+/*
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#ifndef LIBTAU_SYNC_SCHEDULER_HPP
+#define LIBTAU_SYNC_SCHEDULER_HPP
+
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "libTAU/sha1_hash.hpp"
+#include "libTAU/aux_/export.hpp"
+#include "libTAU/kademlia/node_entry.hpp"
+#include "libTAU/kademlia/types.hpp"
+
+namespace libTAU {
+    namespace communication {
+
+        // a DHT operation toward a friend: an item put or got, or a signal
+        struct TORRENT_EXTRA_EXPORT sync_operation {
+            // where the operation goes in the DHT, the target of the item
+            sha256_hash target;
+
+            // the friend it is for
+            dht::public_key peer;
+
+            // run with the nodes closest to target found by the lookup of its
+            // group, empty if the lookup found none or timed out
+            std::function<void(std::vector<dht::node_entry> const&)> run;
+
+            // false for an operation that finds its own way, e.g. a relay. It
+            // is only paced, and run without nodes
+            bool lookup = true;
+        };
+
+        // paces the DHT operations of communication, and shares node lookups
+        // between them.
+        //
+        // The operation toward the most recently active friend leads a group:
+        // the pending operations whose targets share the first
+        // group_prefix_bits bits of its target wait with it for a single
+        // lookup of the nodes around the lead. Every operation whose target is
+        // well within the distance of the farthest node found is then run
+        // with the found nodes closest to its own target, the others go back
+        // to the queue. No more than ops_per_second operations are taken per
+        // second, a rate of 0 takes every pending operation on the next
+        // dispatch.
+        //
+        // Operations without a lookup take their turn in the same order, but
+        // never lead or join a group. A lookup that has not completed
+        // lookup_timeout ms after it started is given up on, its operations
+        // are run without nodes
+        class TORRENT_EXTRA_EXPORT sync_scheduler {
+        public:
+
+            using nodes_callback = std::function<void(std::vector<dht::node_entry> const&)>;
+
+            // look up the nodes closest to target, and call done with them,
+            // now or later
+            using lookup_function = std::function<void(sha256_hash const &target, nodes_callback done)>;
+
+            // prefix bits shared by the targets of a group
+            static constexpr int default_group_prefix_bits = 8;
+
+            // nodes an operation is given
+            static constexpr int nodes_per_operation = 8;
+
+            // operations waiting for a single lookup
+            static constexpr int max_group_size = 64;
+
+            // an operation is run with the nodes of a lookup when its target
+            // is at least 2^reach_margin_bits times closer to the lead than
+            // the farthest node found. Beyond that the closest nodes of the
+            // target are less likely to have been found
+            static constexpr int reach_margin_bits = 2;
+
+            // ms a lookup may take before its operations run without it
+            static constexpr std::int64_t lookup_timeout = 30000;
+
+            explicit sync_scheduler(lookup_function lookup, int ops_per_second = 0
+                    , int group_prefix_bits = default_group_prefix_bits);
+
+            void set_rate(int ops_per_second);
+
+            void set_group_prefix_bits(int bits);
+
+            // peer was active at now (ms). The operations added for it from
+            // now on run before those for less recently active friends
+            void peer_active(const dht::public_key &peer, std::int64_t now);
+
+            void add(sync_operation op);
+
+            // give up on the lookups timed out at now (ms), then start the
+            // lookups and run the operations without one the budget allows.
+            // Returns how many lookups were started
+            int dispatch(std::int64_t now);
+
+            // drop every pending operation, the lookups in flight are ignored
+            // when they complete
+            void clear();
+
+            // operations waiting for a dispatch
+            std::size_t pending() const { return m_operations.size() + m_direct.size(); }
+
+            // lookups started, and neither completed nor timed out yet
+            int in_flight() const { return int(m_in_flight.size()); }
+
+            // lookups started and operations run since construction
+            std::int64_t lookups() const { return m_lookups; }
+            std::int64_t operations() const { return m_dispatched; }
+
+        private:
+
+            using queue_key = std::pair<std::int64_t, std::uint64_t>;
+
+            struct pending_operation {
+                sync_operation op;
+
+                // position in m_queue, kept when the operation goes back to it
+                queue_key key;
+            };
+
+            void insert(pending_operation p);
+
+            // a group waiting for its lookup
+            struct lookup_group {
+                std::vector<pending_operation> operations;
+
+                // when the lookup started (ms)
+                std::int64_t start;
+            };
+
+            void complete(std::vector<pending_operation> &group
+                    , std::vector<dht::node_entry> const &nodes);
+
+            using operations_t = std::multimap<sha256_hash, pending_operation>;
+
+            lookup_function m_lookup;
+
+            int m_rate;
+
+            int m_group_prefix_bits;
+
+            // pending operations, by target. Targets sharing a prefix are
+            // next to each other
+            operations_t m_operations;
+
+            // pending operations, by (-activity of the friend, sequence
+            // number), the first one leads the next group
+            std::map<queue_key, operations_t::iterator> m_queue;
+
+            // pending operations without a lookup, in the order of m_queue
+            std::map<queue_key, sync_operation> m_direct;
+
+            // lookups in flight, by sequence number. Numbers grow with the
+            // start time, the first one times out first
+            std::map<std::uint64_t, lookup_group> m_in_flight;
+
+            // friend -> last activity (ms)
+            std::map<dht::public_key, std::int64_t> m_activity;
+
+            std::uint64_t m_sequence = 0;
+
+            // operations that may be taken, refilled at m_rate per second up
+            // to a second worth of them
+            double m_budget = 0;
+            std::int64_t m_last_dispatch = -1;
+
+            std::int64_t m_lookups = 0;
+            std::int64_t m_dispatched = 0;
+        };
+    }
+}
+
+
+#endif //LIBTAU_SYNC_SCHEDULER_HPP
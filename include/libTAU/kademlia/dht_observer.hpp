@@ -28,6 +28,7 @@ struct entry;
 
 namespace aux {
 struct listen_socket_handle;
+struct storage_executor;
 }
 
 namespace dht {
@@ -79,6 +80,8 @@ namespace dht {
 		virtual std::int64_t get_time() = 0;
 		virtual void on_dht_relay(public_key const& from, entry const& payload) = 0;
 		virtual sqlite3* get_items_database() = 0;
+		// may return nullptr, in which case storage runs on the calling thread
+		virtual aux::storage_executor* get_storage_executor() = 0;
 
 	protected:
 		~dht_observer() = default;
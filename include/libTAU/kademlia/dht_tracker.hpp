@@ -124,6 +124,14 @@ namespace libTAU::dht {
 			, std::string salt = std::string()
 			, std::int64_t timestamp = -1);
 
+		// get mutable item directly from specified endpoints, found by a
+		// lookup shared with other items
+		void get_item(public_key const& key
+			, std::vector<node_entry> const& eps
+			, std::function<void(item const&, bool)> cb
+			, std::string salt = std::string()
+			, std::int64_t timestamp = -1);
+
 		// for immutable_item.
 		// the callback function will be called when put operation is done.
 		// the int parameter indicates the success numbers of put operation.
@@ -197,6 +205,13 @@ namespace libTAU::dht {
 			, std::int8_t invoke_limit
 			, std::string salt = std::string());
 
+		// put mutable_item directly into specified endpoints, found by a
+		// lookup shared with other items
+		void put_item(entry const& data
+			, std::vector<node_entry> const& eps
+			, std::function<void(item const&, int)> cb
+			, std::string salt = std::string());
+
 		// relay protocol
 		void send(public_key const& to
 			, entry const& payload
@@ -217,6 +232,11 @@ namespace libTAU::dht {
 
 		void get_peers(public_key const& pk, std::string salt = std::string());
 
+		// look up the nodes closest to target in the network, cb is called
+		// once with the nodes found by every node
+		void find_nodes(sha256_hash const& target
+			, std::function<void(std::vector<node_entry> const&)> cb);
+
 		// fills the vector with the count nodes from routing table buckets that
 		// are nearest to the given id.
 		// TODO: the strategy of finding live nodes from routing table.
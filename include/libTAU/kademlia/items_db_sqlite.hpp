@@ -13,18 +13,38 @@ see LICENSE file.
 #include <libTAU/kademlia/dht_observer.hpp>
 #include <libTAU/kademlia/dht_storage.hpp>
 
+#include <map>
+#include <memory>
+
 #include "libTAU/time.hpp"
 #include "libTAU/aux_/time.hpp" // for time_now
 
 namespace libTAU {
 namespace dht {
 
+	// targets are BLOBs, so that they sort as bytes and a prefix is a range
+	// of the primary key
 	static const std::string create_items_table =
 		"CREATE TABLE IF NOT EXISTS mutable_items ("
-			 "target VARCHAR(32) NOT NULL PRIMARY KEY,"
+			 "target BLOB NOT NULL PRIMARY KEY,"
 			 "ts INT,"
 			 "item VARCHAR(2000) NOT NULL);";
 
+	static const std::string select_items_table_columns =
+		"PRAGMA table_info(mutable_items);";
+
+	// tables created before stored targets as VARCHAR(32). The bytes are
+	// kept, only their type changes
+	static const std::string migrate_items_table =
+		"CREATE TABLE mutable_items_blob ("
+			 "target BLOB NOT NULL PRIMARY KEY,"
+			 "ts INT,"
+			 "item VARCHAR(2000) NOT NULL);"
+		"INSERT INTO mutable_items_blob (target, ts, item) "
+			 "SELECT CAST(target AS BLOB), ts, item FROM mutable_items;"
+		"DROP TABLE mutable_items;"
+		"ALTER TABLE mutable_items_blob RENAME TO mutable_items;";
+
 	static const std::string create_ts_index =
 		"CREATE INDEX IF NOT EXISTS index_ts ON mutable_items (ts);";
 
@@ -34,6 +54,10 @@ namespace dht {
 	static const std::string select_item_by_target =
 		"SELECT * FROM mutable_items WHERE target=?";
 
+	// targets above the first, below the second
+	static const std::string select_targets_in_range =
+		"SELECT target FROM mutable_items WHERE target > ? AND target < ?;";
+
 	static const std::string insert_or_replace_items =
 		"INSERT OR REPLACE INTO mutable_items (target, ts, item) VALUES (?, ?, ?);";
 
@@ -128,9 +152,41 @@ namespace dht {
 
 	private:
 
+		// statements prepared on the storage executor connection. Only
+		// touched from the storage thread
+		struct writer_statements
+		{
+			sqlite3_stmt* insert_or_replace_items = NULL;
+			sqlite3_stmt* items_count = NULL;
+			sqlite3_stmt* delete_items = NULL;
+			sqlite3_stmt* select_ts_threshold = NULL;
+
+			int prepare(sqlite3* db);
+			void finalize();
+		};
+
+		// an item that has been handed to the storage executor, but whose
+		// write has not completed yet. Reads are served from here, so that
+		// a get right after a put sees the new item
+		struct pending_item
+		{
+			std::int64_t ts;
+			std::string item;
+			std::uint32_t seq;
+		};
+
+		using pending_items = std::map<sha256_hash, pending_item>;
+
 		void init();
+		bool migrate_items_target(sqlite3* db);
 		void prepare_statements();
 
+		bool fill_mutable_item(std::int64_t ts_value, std::string const& item_str
+			, timestamp ts, bool force_fill, entry& item) const;
+
+		void on_put_done(int ok, sha256_hash const& target) const;
+		void on_tick_done(int ok, int count, int deleted) const;
+
 		void sql_error(int err_code, const char* err_str) const;
 		void sql_log(int code, const char* msg) const;
 		void sql_time_cost(int const milliseconds, const char* msg) const;
@@ -141,11 +197,16 @@ namespace dht {
 		// sql statements
 		sqlite3_stmt* m_select_ts_by_target_stmt = NULL;
 		sqlite3_stmt* m_select_item_by_target_stmt = NULL;
+		sqlite3_stmt* m_select_targets_in_range_stmt = NULL;
 		sqlite3_stmt* m_insert_or_replace_items_stmt = NULL;
 		sqlite3_stmt* m_items_count_stmt = NULL;
 		sqlite3_stmt* m_delete_items_stmt = NULL;
 		sqlite3_stmt* m_select_ts_threshold_stmt = NULL;
 
+		std::shared_ptr<writer_statements> m_writer;
+		std::shared_ptr<pending_items> m_pending;
+		std::uint32_t m_pending_seq = 0;
+
 		// put item cache
 		std::string m_mutable_item;
 
@@ -226,6 +226,13 @@ public:
 		, std::int8_t invoke_limit
 		, std::function<void(item const&, bool)> f);
 
+	// get mutable item from the given endpoints, without traversal
+	void get_item(public_key const& pk
+		, std::string const& salt
+		, std::int64_t timestamp
+		, std::vector<node_entry> const& eps
+		, std::function<void(item const&, bool)> f);
+
 	void put_item(sha256_hash const& target
 		, entry const& data
 		, public_key const& to
@@ -270,6 +277,13 @@ public:
 		, std::int8_t invoke_limit
 		, std::function<void(item const&, int)> f);
 
+	// put mutable item to the given endpoints, without traversal
+	void put_item(public_key const& pk
+		, std::string const& salt
+		, entry const& data
+		, std::vector<node_entry> const& eps
+		, std::function<void(item const&, int)> f);
+
 	// relay protocol
 	void send(public_key const& to
 		, entry const& payload
@@ -289,6 +303,10 @@ public:
 
 	void get_peers(public_key const& pk, std::string const& salt);
 
+	// look up the nodes closest to target, f is called with the live
+	// ones the traversal found
+	void find_nodes(node_id const& target, find_data::nodes_callback f);
+
 	// fills the vector with the count nodes from routing table buckets that
 	// are nearest to the given id.
 	void find_live_nodes(node_id const& id
@@ -18,6 +18,7 @@ see LICENSE file.
 #include <vector>
 #include <set>
 #include <unordered_set>
+#include <unordered_map>
 #include <cstdint>
 #include <tuple>
 #include <array>
@@ -92,6 +93,44 @@ struct TORRENT_EXTRA_EXPORT ip_set
 	std::unordered_multiset<address_v6::bytes_type, ipv6_hash> m_ip6s;
 };
 
+struct TORRENT_EXTRA_EXPORT endpoint_hash
+{
+	using argument_type = udp::endpoint;
+	using result_type = std::size_t;
+	result_type operator()(udp::endpoint const& ep) const;
+};
+
+// where a node is in the routing table
+struct node_location
+{
+	int bucket;
+
+	// in live_nodes, otherwise in replacements
+	bool live;
+
+	// the index of the node when it was added. Erasing and sorting entries
+	// of a bucket move the nodes after them, this is where lookups start
+	int slot;
+};
+
+// every node in the routing table, by endpoint. The bucket and bucket side
+// are always exact, the slot is corrected by lookups
+struct TORRENT_EXTRA_EXPORT endpoint_index
+{
+	void insert(udp::endpoint const& ep, node_location const& l);
+
+	// erase the node at ep in this bucket side
+	void erase(udp::endpoint const& ep, int bucket, bool live);
+
+	void clear() { m_nodes.clear(); }
+
+	std::size_t size() const { return m_nodes.size(); }
+
+	// a multimap because there can be multiple routing table entries for an
+	// endpoint when restrict_routing_ips is set to false
+	std::unordered_multimap<udp::endpoint, node_location, endpoint_hash> m_nodes;
+};
+
 // Each routing table bucket represents node IDs with a certain number of bits
 // of prefix in common with our own node ID. Each bucket fits 8 nodes (and
 // sometimes more, closer to the top). In order to minimize the number of hops
@@ -201,6 +240,10 @@ public:
 	std::tuple<node_entry*, routing_table::table_t::iterator, bucket_t*>
 	find_node(udp::endpoint const& ep);
 
+	// compares the endpoint index with the nodes in the buckets, it's
+	// linear in the size of the table
+	bool endpoint_index_consistent() const;
+
 	int bucket_size(int bucket) const
 	{
 		int num_buckets = int(m_buckets.size());
@@ -266,6 +309,10 @@ private:
 	table_t::iterator find_bucket(node_id const& id);
 	void remove_node_internal(node_entry* n, bucket_t& b);
 
+	// add or remove every node of a bucket in m_endpoints
+	void index_bucket(int bucket);
+	void unindex_bucket(int bucket);
+
 	void split_bucket();
 
 	// if the bucket is not full, try to fill it with nodes from the
@@ -306,6 +353,10 @@ private:
 	// per IP in the whole table.
 	ip_set m_ips;
 
+	// where each node in the table is, by endpoint. It's used to find
+	// the node of an incoming packet without scanning every bucket
+	endpoint_index m_endpoints;
+
 	// constant called k in paper
 	int const m_bucket_size;
 
@@ -314,7 +365,8 @@ private:
 
 TORRENT_EXTRA_EXPORT routing_table::add_node_status_t
 replace_node_impl(node_entry const& e, bucket_t& b, ip_set& ips
-	, int bucket_index, int bucket_size_limit, bool last_bucket
+	, endpoint_index& endpoints, int bucket_index, bool live
+	, int bucket_size_limit, bool last_bucket
 #ifndef TORRENT_DISABLE_LOGGING
 	, dht_logger* log
 #endif
@@ -111,6 +111,52 @@ namespace libTAU {
 			// 16384, 32768, 65536, 131072, 262144, 524288, 1048576
 			socket_recv_size3,
 
+			// prepared statement cache of the blockchain repository
+			blockchain_stmt_cache_hits,
+			blockchain_stmt_cache_misses,
+
+			// group commit: number of database transactions committed, and
+			// the number of block transactions coalesced into them
+			blockchain_group_commits,
+			blockchain_group_transactions,
+
+			// open groups lost, rolled back by a failed commit or by sqlite
+			blockchain_group_commit_failures,
+
+			// decoded block cache lookups and evictions
+			blockchain_block_cache_hits,
+			blockchain_block_cache_misses,
+			blockchain_block_cache_evictions,
+
+			// background pruning: blocks and kv objects deleted, bytes
+			// returned by incremental vacuum and the time (microseconds)
+			// spent in prune steps
+			blockchain_pruned_blocks,
+			blockchain_pruned_kv_objects,
+			blockchain_vacuum_bytes,
+			blockchain_prune_time,
+
+			// jobs run by the storage executor thread, and the total
+			// time (microseconds) they spent queued and executing
+			storage_jobs,
+			storage_job_queue_time,
+			storage_job_exec_time,
+
+			// message lookups answered by the message filter without
+			// querying the database, and those that reached the database,
+			// split by whether the message was found
+			communication_message_filter_negatives,
+			communication_message_filter_true_positives,
+			communication_message_filter_false_positives,
+
+			// messages saved without being added to the search index, they
+			// are indexed on the next start
+			communication_message_search_index_failures,
+
+			// message and friend writes that failed on the storage
+			// executor, they are not retried
+			communication_message_write_failures,
+
 			num_stats_counters
 		};
 
@@ -153,6 +199,17 @@ namespace libTAU {
 
 			num_queued_tracker_announces,
 
+			// jobs waiting in the storage executor queue
+			storage_queue_depth,
+
+			// bytes held by the decoded block cache
+			blockchain_block_cache_size,
+
+			// message hashes held by the message filter, and its size in
+			// bytes
+			communication_message_filter_items,
+			communication_message_filter_size,
+
 			num_counters,
 			num_gauges_counters = num_counters - num_stats_counters
 		};
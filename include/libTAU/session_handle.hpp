@@ -58,6 +58,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libTAU/session_types.hpp" // for session_flags_t
 
 #include "libTAU/communication/message.hpp" // for adding new message
+#include "libTAU/communication/message_page.hpp"
 
 #include "libTAU/blockchain/account.hpp" 
 #include "libTAU/blockchain/block.hpp"
@@ -356,6 +357,21 @@ namespace libTAU {
 		// add a new message
 		bool add_new_message(communication::message msg);
 
+		// up to limit messages exchanged with peer, sent and received,
+		// older than cursor and newest first. Pass the next cursor of a
+		// page to get the page after it. The cost of a page does not
+		// depend on the size of the history
+		communication::message_page get_message_page(const dht::public_key& peer
+			, communication::message_cursor cursor = {}, int limit = 50);
+
+		// up to limit stored messages matching query, in SQLite FTS5
+		// syntax, e.g. ``dinner tonight`` or ``"see you" OR call*``. The
+		// best matches are ranked out of all matches, a query matching much
+		// of the history is faster searched for the newest matches. Nothing
+		// matches unless settings_pack::enable_message_search is on
+		std::vector<communication::message_match> search_messages(std::string query, int limit = 20
+			, communication::message_search_order order = communication::message_search_order::best_match);
+
 		// create chain id
 		std::vector<char> create_chain_id(std::vector<char> type, std::vector<char> community_name);
 
@@ -380,7 +396,8 @@ namespace libTAU {
 		// submit news transaction
         bool submit_news_transaction(const blockchain::transaction & tx, const std::vector<std::vector<char>> & pslice);
 
-		// get account info
+		// get account info. With sqldb_reader_connections, it is read from
+		// the committed state only, a block being applied is not seen
         blockchain::account get_account_info(std::vector<char> chain_id, dht::public_key publicKey);
 		// get top and tip blocks
         std::vector<blockchain::block> get_top_tip_block(std::vector<char> chain_id, int num);
@@ -415,10 +432,23 @@ namespace libTAU {
 		// touch chain
         bool touch_chain(std::vector<char> chain_id);
 
+		// keep epochs epochs of blocks of a chain when pruning, instead of
+		// settings_pack::blockchain_prune_epochs. 0 keeps everything, a
+		// negative value goes back to the setting
+        void set_chain_retention(std::vector<char> chain_id, int epochs);
+
+		// convert a session database created before incremental auto vacuum
+		// so blockchain pruning returns free pages to the file system. This
+		// is a full VACUUM, it runs on the storage thread but writes from
+		// the network thread fail while it runs, call it while the session
+		// is idle. A failed conversion is recorded in the database and
+		// logged at startup
+        void vacuum_sqldb();
+
 		// un-focus on chain
         void unset_priority_chain();
 
-		// get block by number
+		// get main chain block by number, read like get_account_info()
         blockchain::block get_block_by_number(std::vector<char> chain_id, std::int64_t block_number);
 
 		// get block by hash
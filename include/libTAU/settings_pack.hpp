@@ -929,6 +929,16 @@ namespace aux {
             //start blockchain module
             enable_blockchain,
 
+            // store message payloads compressed with a dictionary trained
+            // from the stored messages. Only has an effect when libTAU is
+            // built with zstd
+            compress_messages,
+
+            // index message payloads in an FTS5 table, for
+            // session_handle::search_messages(). Turning it on indexes the
+            // messages stored before, on start
+            enable_message_search,
+
 			max_bool_setting_internal
 		};
 
@@ -1953,6 +1963,61 @@ namespace aux {
             //log level
             log_level,
 
+			// the number of read-only sqlite connections serving blockchain
+			// queries from session_handle. 0 queues them onto the network thread.
+			// These connections only see committed data: get_account_info() and
+			// get_block_by_number() do not see a block transaction still open,
+			// where the network thread would. A query that finds no free
+			// connection within 50 ms is queued onto the network thread. Not
+			// used by leveldb_repository
+			sqldb_reader_connections,
+
+			// group commit of blockchain writes: at most this many block
+			// transactions are coalesced into one sqlite transaction. 1 commits
+			// every block on its own. A group that fails to commit loses every
+			// block transaction in it, also those already reported committed.
+			// blockchain then reloads its head blocks from the database and
+			// rebuilds the state derived from them. Losses are counted in
+			// blockchain_group_commit_failures. Queries served by
+			// sqldb_reader_connections see a group once it is committed.
+			// Without the storage executor, other subsystems write on the
+			// session connection and groups are not used
+			blockchain_group_commit_transactions,
+
+			// the longest time (ms) a group of block transactions is held open
+			// before it is committed
+			blockchain_group_commit_latency,
+
+			// memory budget (KiB) of the decoded block cache shared by all
+			// chains, a quarter of it is kept for side branch blocks. 0 disables
+			// the cache
+			blockchain_block_cache_size,
+
+			// where blockchain data is stored, see repository_backend_t. Only
+			// read when the session starts
+			blockchain_repository_backend,
+
+			// background pruning keeps this many epochs of blocks below the
+			// head of every chain, and the kv objects they reference. 0 keeps
+			// everything. session_handle::set_chain_retention() overrides it
+			// per chain
+			blockchain_prune_epochs,
+
+			// time (ms) between two prune steps
+			blockchain_prune_interval,
+
+			// the most blocks or kv objects one prune step visits
+			blockchain_prune_batch_size,
+
+			// the most free pages one prune step returns to the file system
+			// with incremental vacuum
+			blockchain_vacuum_pages,
+
+			// the most DHT operations toward friends communication starts per
+			// second. Operations whose targets are close in the DHT share a
+			// node lookup. 0 means unlimited
+			communication_sync_rate,
+
 			max_int_setting_internal
 		};
 
@@ -2025,6 +2090,24 @@ namespace aux {
 			peer_proportional = 1
 		};
 
+		// the storage backends of settings_pack::blockchain_repository_backend
+		enum repository_backend_t : std::uint8_t
+		{
+			// one set of tables per chain in the session sqlite database
+			sqlite_repository,
+
+			// tables shared by all chains in the session sqlite database,
+			// rows keyed by a chain ordinal. Startup and schema changes do
+			// not grow with the number of chains. A database written by
+			// sqlite_repository is migrated on first use
+			sqlite_shared_repository,
+
+			// key prefixes in the session leveldb database. Faster on
+			// insert heavy sync, but no reader connections for queries.
+			// Nothing is migrated from the sqlite backends
+			leveldb_repository
+		};
+
 		// the encoding policy options for use with
 		// settings_pack::out_enc_policy and settings_pack::in_enc_policy.
 		enum enc_policy : std::uint8_t
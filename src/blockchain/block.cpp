@@ -12,11 +12,22 @@ see LICENSE file.
 
 namespace libTAU::blockchain {
     block::block(const entry& e) {
-        populate(e);
-
         std::string encode;
         bencode(std::back_inserter(encode), e);
-        m_hash = hasher(encode).final();
+        *this = block(std::move(encode));
+    }
+
+    block::block(std::string encode) : m_encode(std::move(encode)) {
+        error_code ec;
+        bdecode_node n = bdecode(m_encode, ec);
+        if (ec || !populate(n)) {
+            *this = block();
+            return;
+        }
+
+        // the hash covers the bytes as received, the signature the encoding
+        // of the fields (see verify_signature())
+        m_hash = hasher(m_encode).final();
     }
 
     const sha1_hash &block::genesis_block_hash() const {
@@ -36,6 +47,10 @@ namespace libTAU::blockchain {
     }
 
     std::string block::get_encode() const {
+        if (!m_encode.empty()) {
+            return m_encode;
+        }
+
         std::string encode;
         auto e = get_entry();
         bencode(std::back_inserter(encode), e);
@@ -53,13 +68,17 @@ namespace libTAU::blockchain {
 //    }
 
     void block::sign(const dht::public_key &pk, const dht::secret_key &sk) {
-        m_signature = ed25519_sign(get_encode_without_signature(), pk, sk);
+        m_encode.clear();
+        auto const unsigned_encode = get_encode_without_signature();
+        m_signature = ed25519_sign(unsigned_encode, pk, sk);
 
-        auto encode = get_encode();
-        m_hash = hasher(encode).final();
+        m_encode = get_encode();
+        m_hash = hasher(m_encode).final();
     }
 
     bool block::verify_signature() const {
+        // encoded from the fields rather than cut from m_encode, a block
+        // received in another encoding is signed over its fields as well
         return ed25519_verify(m_signature, get_encode_without_signature(), m_miner);
     }
 
@@ -110,66 +129,63 @@ namespace libTAU::blockchain {
     }
 
 
-    void block::populate(const entry &e) {
-        auto const& lst = e.list();
-
-        if (lst.size() == 12) {
-            // chain id
-            auto chain_id = lst[0].string();
-            m_chain_id = aux::bytes(chain_id.begin(), chain_id.end());
-            // version
-            int version = aux::intFromLittleEndianString(lst[1].string());
-            m_version = static_cast<block_version>(version);
-            // timestamp
-            m_timestamp = aux::int64FromLittleEndianString(lst[2].string());
-            // block number
-            m_block_number = aux::int64FromLittleEndianString(lst[3].string());
-            // previous block hash
-            m_previous_block_hash = sha1_hash(lst[4].string().data());
-            // base target
-            m_base_target = aux::uint64FromLittleEndianString(lst[5].string());
-            // cumulative difficulty
-            m_cumulative_difficulty = aux::uint64FromLittleEndianString(lst[6].string());
-            // generation signature
-            m_generation_signature = sha1_hash(lst[7].string().data());
-            // multiplex hash
-            m_multiplex_hash = sha1_hash(lst[8].string().data());
-            // news root
-            m_news_root = sha1_hash(lst[9].string().data());
-            // miner
-            m_miner = dht::public_key(lst[10].string().data());
-            // signature
-            m_signature = dht::signature(lst[11].string().data());
-        } else if (lst.size() == 13) {
-            // chain id
-            auto chain_id = lst[0].string();
-            m_chain_id = aux::bytes(chain_id.begin(), chain_id.end());
-            // version
-            int version = aux::intFromLittleEndianString(lst[1].string());
-            m_version = static_cast<block_version>(version);
-            // timestamp
-            m_timestamp = aux::int64FromLittleEndianString(lst[2].string());
-            // block number
-            m_block_number = aux::int64FromLittleEndianString(lst[3].string());
-            // previous block hash
-            m_previous_block_hash = sha1_hash(lst[4].string().data());
-            // base target
-            m_base_target = aux::uint64FromLittleEndianString(lst[5].string());
-            // cumulative difficulty
-            m_cumulative_difficulty = aux::uint64FromLittleEndianString(lst[6].string());
-            // generation signature
-            m_generation_signature = sha1_hash(lst[7].string().data());
-            // multiplex hash
-            m_multiplex_hash = sha1_hash(lst[8].string().data());
-            // news root
-            m_news_root = sha1_hash(lst[9].string().data());
-            // miner
-            m_miner = dht::public_key(lst[10].string().data());
+    bool block::populate(const bdecode_node &n) {
+        if (n.type() != bdecode_node::list_t) {
+            return false;
+        }
+        int const size = n.list_size();
+        if (size != 12 && size != 13) {
+            return false;
+        }
+
+        auto field = [&](int i, std::size_t len) {
+            auto const v = n.list_at(i);
+            return v.type() == bdecode_node::string_t && static_cast<std::size_t>(v.string_length()) == len;
+        };
+        for (int i: {4, 7, 8, 9}) {
+            if (!field(i, libTAU::sha1_hash::size())) {
+                return false;
+            }
+        }
+        if (!field(10, dht::public_key::len) || !field(size - 1, dht::signature::len)) {
+            return false;
+        }
+
+        // chain id
+        auto chain_id = n.list_string_value_at(0);
+        m_chain_id = aux::bytes(chain_id.begin(), chain_id.end());
+        // version
+        int version = aux::intFromLittleEndianString(std::string(n.list_string_value_at(1)));
+        m_version = static_cast<block_version>(version);
+        // timestamp
+        m_timestamp = aux::int64FromLittleEndianString(std::string(n.list_string_value_at(2)));
+        // block number
+        m_block_number = aux::int64FromLittleEndianString(std::string(n.list_string_value_at(3)));
+        // previous block hash
+        m_previous_block_hash = sha1_hash(n.list_at(4).string_ptr());
+        // base target
+        m_base_target = aux::uint64FromLittleEndianString(std::string(n.list_string_value_at(5)));
+        // cumulative difficulty
+        m_cumulative_difficulty = aux::uint64FromLittleEndianString(std::string(n.list_string_value_at(6)));
+        // generation signature
+        m_generation_signature = sha1_hash(n.list_at(7).string_ptr());
+        // multiplex hash
+        m_multiplex_hash = sha1_hash(n.list_at(8).string_ptr());
+        // news root
+        m_news_root = sha1_hash(n.list_at(9).string_ptr());
+        // miner
+        m_miner = dht::public_key(n.list_at(10).string_ptr());
+        if (size == 13) {
             // tx
-            m_tx = transaction(lst[11]);
-            // signature
-            m_signature = dht::signature(lst[12].string().data());
+            m_tx = transaction(n.list_at(11));
+            if (m_tx.empty()) {
+                return false;
+            }
         }
+        // signature
+        m_signature = dht::signature(n.list_at(size - 1).string_ptr());
+
+        return true;
     }
 
     std::set<dht::public_key> block::get_block_peers() const {
@@ -0,0 +1,186 @@
+/*
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include "libTAU/blockchain/block_cache.hpp"
+
+namespace libTAU::blockchain {
+
+    block_cache::~block_cache() {
+        clear();
+    }
+
+    void block_cache::set_budget(std::int64_t budget) {
+        m_side_budget = budget / 4;
+        m_main_budget = budget - m_side_budget;
+
+        if (!enabled()) {
+            clear();
+            return;
+        }
+
+        evict(true);
+        evict(false);
+    }
+
+    std::shared_ptr<const block> block_cache::get(const aux::bytes &chain_id, const sha1_hash &hash) {
+        if (!enabled()) return nullptr;
+
+        auto chain_it = m_index.find(chain_id);
+        if (chain_it != m_index.end()) {
+            auto it = chain_it->second.find(hash);
+            if (it != chain_it->second.end()) {
+                // move to most recently used
+                auto &l = list_of(it->second->main_chain);
+                l.splice(l.end(), l, it->second);
+
+                m_counters.inc_stats_counter(counters::blockchain_block_cache_hits);
+                return it->second->blk;
+            }
+        }
+
+        m_counters.inc_stats_counter(counters::blockchain_block_cache_misses);
+        return nullptr;
+    }
+
+    void block_cache::put(std::shared_ptr<const block> blk, bool main_chain, std::int64_t size) {
+        if (!enabled() || blk == nullptr || blk->empty()) return;
+
+        auto &index = m_index[blk->chain_id()];
+        auto it = index.find(blk->sha1());
+        if (it != index.end()) {
+            set_main_chain(blk->chain_id(), blk->sha1(), main_chain);
+            return;
+        }
+
+        auto hash = blk->sha1();
+        auto &l = list_of(main_chain);
+        l.push_back(cached_block{std::move(blk), size, main_chain});
+        index[hash] = std::prev(l.end());
+
+        size_of(main_chain) += size;
+        m_counters.inc_stats_counter(counters::blockchain_block_cache_size, size);
+
+        evict(main_chain);
+    }
+
+    void block_cache::set_main_chain(const aux::bytes &chain_id, const sha1_hash &hash, bool main_chain) {
+        auto chain_it = m_index.find(chain_id);
+        if (chain_it == m_index.end()) return;
+
+        auto it = chain_it->second.find(hash);
+        if (it == chain_it->second.end()) return;
+
+        auto &e = *it->second;
+        if (e.main_chain == main_chain) return;
+
+        size_of(e.main_chain) -= e.size;
+        size_of(main_chain) += e.size;
+        e.main_chain = main_chain;
+
+        // splice keeps the iterator in the index valid
+        auto &from = list_of(!main_chain);
+        auto &to = list_of(main_chain);
+        to.splice(to.end(), from, it->second);
+
+        evict(main_chain);
+    }
+
+    void block_cache::set_all_non_main_chain(const aux::bytes &chain_id) {
+        auto chain_it = m_index.find(chain_id);
+        if (chain_it == m_index.end()) return;
+
+        for (auto const &item: chain_it->second) {
+            auto &e = *item.second;
+            if (!e.main_chain) continue;
+
+            m_main_size -= e.size;
+            m_side_size += e.size;
+            e.main_chain = false;
+            m_side.splice(m_side.end(), m_main, item.second);
+        }
+
+        evict(false);
+    }
+
+    void block_cache::erase(const aux::bytes &chain_id, const sha1_hash &hash) {
+        auto chain_it = m_index.find(chain_id);
+        if (chain_it == m_index.end()) return;
+
+        auto it = chain_it->second.find(hash);
+        if (it != chain_it->second.end()) {
+            erase(it, chain_it->second);
+        }
+    }
+
+    void block_cache::erase_less_than_number(const aux::bytes &chain_id, std::int64_t block_number) {
+        auto chain_it = m_index.find(chain_id);
+        if (chain_it == m_index.end()) return;
+
+        auto &index = chain_it->second;
+        for (auto it = index.begin(); it != index.end();) {
+            if (it->second->blk->block_number() < block_number) {
+                auto next = std::next(it);
+                erase(it, index);
+                it = next;
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void block_cache::erase_chain(const aux::bytes &chain_id) {
+        auto chain_it = m_index.find(chain_id);
+        if (chain_it == m_index.end()) return;
+
+        auto &index = chain_it->second;
+        while (!index.empty()) {
+            erase(index.begin(), index);
+        }
+        m_index.erase(chain_it);
+    }
+
+    void block_cache::clear() {
+        m_counters.inc_stats_counter(counters::blockchain_block_cache_size, -(m_main_size + m_side_size));
+
+        m_main.clear();
+        m_side.clear();
+        m_index.clear();
+        m_main_size = 0;
+        m_side_size = 0;
+    }
+
+    void block_cache::erase(std::unordered_map<sha1_hash, lru_list::iterator>::iterator it
+            , std::unordered_map<sha1_hash, lru_list::iterator> &index) {
+        auto const main_chain = it->second->main_chain;
+        auto const size = it->second->size;
+
+        list_of(main_chain).erase(it->second);
+        index.erase(it);
+
+        size_of(main_chain) -= size;
+        m_counters.inc_stats_counter(counters::blockchain_block_cache_size, -size);
+    }
+
+    void block_cache::evict(bool main_chain) {
+        auto &l = list_of(main_chain);
+        auto const budget = main_chain ? m_main_budget : m_side_budget;
+
+        while (size_of(main_chain) > budget && !l.empty()) {
+            auto const &blk = l.front().blk;
+            auto chain_it = m_index.find(blk->chain_id());
+            auto it = chain_it->second.find(blk->sha1());
+
+            erase(it, chain_it->second);
+            if (chain_it->second.empty()) {
+                m_index.erase(chain_it);
+            }
+
+            m_counters.inc_stats_counter(counters::blockchain_block_cache_evictions);
+        }
+    }
+}
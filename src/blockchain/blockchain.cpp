@@ -9,6 +9,8 @@ see LICENSE file.
 #include <cinttypes> // for PRId64 et.al.
 #include <utility>
 
+#include "libTAU/aux_/edit_distance.hpp"
+#include "libTAU/aux_/session_settings.hpp"
 #include "libTAU/blockchain/blockchain.hpp"
 #include "libTAU/blockchain/consensus.hpp"
 #include "libTAU/common/entry_type.hpp"
@@ -21,6 +23,19 @@ using namespace std::placeholders;
 namespace libTAU::blockchain {
     using namespace aux;
 
+    std::shared_ptr<repository> blockchain::make_backend_repository() {
+        int const backend = m_ses.settings().get_int(settings_pack::blockchain_repository_backend);
+        if (backend == settings_pack::leveldb_repository && m_ses.kvdb() != nullptr) {
+            return std::make_shared<repository_leveldb>(m_ses.kvdb(), m_counters);
+        }
+
+        if (backend == settings_pack::sqlite_shared_repository) {
+            return std::make_shared<repository_shared>(m_ses.sqldb(), m_counters);
+        }
+
+        return std::make_shared<repository_impl>(m_ses.sqldb(), m_counters);
+    }
+
     bool blockchain::init() {
         try {
             // db init
@@ -65,6 +80,31 @@ namespace libTAU::blockchain {
 
         m_stop = false;
 
+        auto const& settings = m_ses.settings();
+        m_group_commit_latency = settings.get_int(settings_pack::blockchain_group_commit_latency);
+        int group_commit_transactions = settings.get_int(settings_pack::blockchain_group_commit_transactions);
+        // without the storage executor, messages and dht items are written on
+        // the session connection too, and would join an open group
+        if (group_commit_transactions > 1 && m_ses.get_storage_executor() == nullptr) {
+            log(LOG_INFO, "INFO: No storage executor, group commit is off.");
+            group_commit_transactions = 1;
+        }
+        m_repository->set_group_commit(group_commit_transactions, m_group_commit_latency);
+        m_repository->set_block_cache_size(std::int64_t(settings.get_int(settings_pack::blockchain_block_cache_size)) * 1024);
+        if (m_group_commit_latency > 0) {
+            m_group_commit_timer.expires_after(milliseconds(m_group_commit_latency));
+            m_group_commit_timer.async_wait(std::bind(&blockchain::refresh_group_commit_timer, self(), _1));
+        }
+
+        m_prune_epochs = settings.get_int(settings_pack::blockchain_prune_epochs);
+        m_prune_interval = settings.get_int(settings_pack::blockchain_prune_interval);
+        m_prune_batch_size = settings.get_int(settings_pack::blockchain_prune_batch_size);
+        m_vacuum_pages = settings.get_int(settings_pack::blockchain_vacuum_pages);
+        if (m_prune_interval > 0) {
+            m_prune_timer.expires_after(milliseconds(m_prune_interval));
+            m_prune_timer.async_wait(std::bind(&blockchain::refresh_prune_timer, self(), _1));
+        }
+
         m_dht_tasks_timer.expires_after(milliseconds(50));
         m_dht_tasks_timer.async_wait(std::bind(&blockchain::refresh_dht_task_timer, self(), _1));
 
@@ -94,6 +134,12 @@ namespace libTAU::blockchain {
 
         m_dht_tasks_timer.cancel();
 
+        m_group_commit_timer.cancel();
+        m_prune_timer.cancel();
+        m_busy_retry_timer.cancel();
+        m_busy_retry_jobs.clear();
+        m_repository->flush(true);
+
 //        for (auto const& chain_id: m_chains) {
 //            m_repository->clear_acl_db(chain_id);
 //            auto const &acl = m_access_list[chain_id];
@@ -685,6 +731,8 @@ namespace libTAU::blockchain {
 //        m_online_list.clear();
 //        m_blocks.clear();
         m_head_blocks.clear();
+        m_state_commitments.clear();
+        m_prune_cycles.clear();
         m_getting_immutable_items.clear();
 //        m_gossip_peers.clear();
     }
@@ -702,6 +750,8 @@ namespace libTAU::blockchain {
 //        m_online_list.erase(chain_id);
 //        m_blocks[chain_id].clear();
         m_head_blocks.erase(chain_id);
+        m_state_commitments.erase(chain_id);
+        m_prune_cycles.erase(chain_id);
         m_getting_immutable_items.clear();
 //        m_gossip_peers[chain_id].clear();
     }
@@ -819,6 +869,161 @@ namespace libTAU::blockchain {
         }
     }
 
+    void blockchain::flush_writes() {
+        if (!m_repository->flush(true)) {
+            log(LOG_ERR, "ERROR: Group commit fail.");
+        }
+        reload_after_lost_group();
+    }
+
+    void blockchain::refresh_group_commit_timer(const error_code &e) {
+        if ((e.value() != 0 && e.value() != boost::asio::error::operation_aborted) || m_stop) return;
+
+        if (!m_repository->flush(false)) {
+            log(LOG_ERR, "ERROR: Group commit fail.");
+        }
+        reload_after_lost_group();
+
+        m_group_commit_timer.expires_after(milliseconds(m_group_commit_latency));
+        m_group_commit_timer.async_wait(std::bind(&blockchain::refresh_group_commit_timer, self(), _1));
+    }
+
+    bool blockchain::reload_after_lost_group() {
+        if (!m_repository->take_lost_group()) {
+            return false;
+        }
+
+        log(LOG_ERR, "ERROR: Group commit lost, reload chains from db.");
+        for (auto const& chain_id: m_chains) {
+            auto head_block = m_repository->get_head_block(chain_id);
+            auto &current = m_head_blocks[chain_id];
+            if (head_block.empty()) {
+                m_head_blocks.erase(chain_id);
+            } else if (head_block != current) {
+                current = head_block;
+                m_ses.alerts().emplace_alert<blockchain_new_head_block_alert>(head_block);
+            }
+
+            // accounts are back to their committed state
+            m_tx_pools[chain_id].recheck_all_transactions();
+        }
+
+        // rebuilt from the state in the db when next needed
+        m_state_commitments.clear();
+        m_prune_cycles.clear();
+
+        return true;
+    }
+
+    RESULT blockchain::transaction_failed(const aux::bytes &chain_id) {
+        // either way nothing of the block was written
+        bool const lost = reload_after_lost_group();
+        if (lost || m_repository->transaction_busy()) {
+            log(LOG_INFO, "INFO: chain:%s, db busy, retry block later.", aux::toHex(chain_id).c_str());
+            return BUSY;
+        }
+
+        return FAIL;
+    }
+
+    void blockchain::retry_when_busy(const aux::bytes &chain_id, std::function<void()> job) {
+        bool const idle = m_busy_retry_jobs.empty();
+        m_busy_retry_jobs[chain_id] = std::move(job);
+        if (idle) {
+            m_busy_retry_timer.expires_after(milliseconds(blockchain_busy_retry_interval));
+            m_busy_retry_timer.async_wait(std::bind(&blockchain::refresh_busy_retry_timer, self(), _1));
+        }
+    }
+
+    void blockchain::process_own_genesis_block(const aux::bytes &chain_id, const block &blk, const std::vector<state_array> &arrays) {
+        // no peer has this block yet, it cannot be dropped
+        if (process_genesis_block(chain_id, blk, arrays) == BUSY) {
+            retry_when_busy(chain_id, [this, chain_id, blk, arrays]() {
+                process_own_genesis_block(chain_id, blk, arrays);
+            });
+        }
+    }
+
+    void blockchain::refresh_busy_retry_timer(const error_code &e) {
+        if ((e.value() != 0 && e.value() != boost::asio::error::operation_aborted) || m_stop) return;
+
+        // a job may schedule itself again
+        auto jobs = std::move(m_busy_retry_jobs);
+        m_busy_retry_jobs.clear();
+        for (auto const& job: jobs) {
+            job.second();
+        }
+    }
+
+    void blockchain::refresh_prune_timer(const error_code &e) {
+        if ((e.value() != 0 && e.value() != boost::asio::error::operation_aborted) || m_stop) return;
+
+        try {
+            auto const start = time_now();
+
+            // chains take turns, until the step budget is spent
+            int budget = m_prune_batch_size;
+            for (std::size_t i = 0; i < m_chains.size() && budget > 0; i++) {
+                auto it = m_chains.upper_bound(m_prune_chain);
+                if (it == m_chains.end()) {
+                    it = m_chains.begin();
+                }
+                m_prune_chain = *it;
+
+                budget -= prune_chain(m_prune_chain, budget);
+            }
+
+            // free pages also come from dropped chains, not only from pruning
+            auto reclaimed = m_repository->incremental_vacuum(m_vacuum_pages);
+            if (reclaimed > 0) {
+                m_counters.inc_stats_counter(counters::blockchain_vacuum_bytes, reclaimed);
+            }
+
+            m_counters.inc_stats_counter(counters::blockchain_prune_time, total_microseconds(time_now() - start));
+        } catch (std::exception &e) {
+            log(LOG_ERR, "Exception prune [CHAIN] %s in file[%s], func[%s], line[%d]", e.what(), __FILE__, __FUNCTION__ , __LINE__);
+        }
+
+        m_prune_timer.expires_after(milliseconds(m_prune_interval));
+        m_prune_timer.async_wait(std::bind(&blockchain::refresh_prune_timer, self(), _1));
+    }
+
+    int blockchain::prune_chain(const aux::bytes &chain_id, int budget) {
+        auto it_retention = m_chain_retention.find(chain_id);
+        int epochs = it_retention != m_chain_retention.end() ? it_retention->second : m_prune_epochs;
+        auto it_head = m_head_blocks.find(chain_id);
+        if (epochs <= 0 || it_head == m_head_blocks.end() || it_head->second.empty()) {
+            return 0;
+        }
+
+        auto &cycle = m_prune_cycles[chain_id];
+        auto const phase = cycle.phase;
+
+        int spent = cycle.step(*m_repository, m_counters, chain_id, it_head->second, epochs, budget, [&](std::set<sha1_hash> &live) {
+            // txs waiting in the pool and state being synced are not referenced by blocks yet
+            for (auto const &tx: m_tx_pools[chain_id].get_all_transactions()) {
+                live.insert(tx.sha1());
+            }
+            for (auto const &item: m_access_list[chain_id]) {
+                for (auto const &hashArray: item.second.m_state_hash_arrays) {
+                    live.insert(hashArray.first);
+                    live.insert(hashArray.second.HashArray().begin(), hashArray.second.HashArray().end());
+                }
+            }
+        });
+
+        if (cycle.phase == prune_cycle::done && (phase != prune_cycle::done || spent > 0)) {
+            if (cycle.failed) {
+                log(LOG_ERR, "ERROR: chain:%s, prune blocks fail.", aux::toHex(chain_id).c_str());
+            } else {
+                log(LOG_INFO, "INFO: chain:%s, pruned %" PRId64 " blocks and %" PRId64 " kv objects below block %" PRId64,
+                    aux::toHex(chain_id).c_str(), cycle.pruned_blocks, cycle.pruned_kv_objects, cycle.main_number);
+            }
+        }
+
+        return spent;
+    }
+
 //    void blockchain::reset_chain_status(const aux::bytes &chain_id) {
 //        m_chain_status[chain_id] = GET_GOSSIP_PEERS;
 //    }
@@ -1364,6 +1569,9 @@ namespace libTAU::blockchain {
     }
 
     RESULT blockchain::process_genesis_block(const bytes &chain_id, const block &blk, const std::vector<state_array> &arrays) {
+        // the head block may be gone with a lost group
+        reload_after_lost_group();
+
         log(LOG_ERR, "INFO: chain:%s process block[%s].",
             aux::toHex(chain_id).c_str(), blk.to_string().c_str());
         if (blk.empty())
@@ -1378,23 +1586,28 @@ namespace libTAU::blockchain {
                 if (result != SUCCESS)
                     return result;
 
-                m_repository->begin_transaction();
+                // state arrays built from the local state, like the ones of a
+                // genesis block mined here, need not be imported again
+                bool const state_in_place = is_state_in_place(chain_id, blk);
 
-                if (!m_repository->clear_all_state(chain_id)) {
-                    log(LOG_ERR, "INFO: chain:%s, clear all state fail.", aux::toHex(chain_id).c_str());
-                    m_repository->rollback();
-                    return FAIL;
+                if (!m_repository->begin_transaction()) {
+                    log(LOG_ERR, "INFO: chain:%s, begin transaction fail.", aux::toHex(chain_id).c_str());
+                    return transaction_failed(chain_id);
                 }
-                for (auto const& stateArray: arrays) {
-                    log(LOG_ERR, "INFO: chain:%s process state array[%s].",
-                        aux::toHex(chain_id).c_str(), stateArray.to_string().c_str());
-                    for (auto const& act: stateArray.StateArray()) {
-                        if (!m_repository->update_account(chain_id, act)) {
-                            log(LOG_ERR, "INFO: chain:%s, save account[%s] fail.",
-                                aux::toHex(chain_id).c_str(), act.to_string().c_str());
-                            m_repository->rollback();
-                            return FAIL;
-                        }
+
+                if (!state_in_place) {
+                    std::vector<account> state;
+                    for (auto const& stateArray: arrays) {
+                        log(LOG_ERR, "INFO: chain:%s process state array[%s].",
+                            aux::toHex(chain_id).c_str(), stateArray.to_string().c_str());
+                        auto const& accounts = stateArray.StateArray();
+                        state.insert(state.end(), accounts.begin(), accounts.end());
+                    }
+                    if (!m_repository->replace_all_state(chain_id, state)) {
+                        log(LOG_ERR, "INFO: chain:%s, import %zu accounts fail.",
+                            aux::toHex(chain_id).c_str(), state.size());
+                        m_repository->rollback();
+                        return FAIL;
                     }
                 }
 
@@ -1445,7 +1658,10 @@ namespace libTAU::blockchain {
                     return FAIL;
                 }
 
-                m_repository->commit();
+                if (!m_repository->commit()) {
+                    log(LOG_ERR, "INFO: chain:%s, commit fail.", aux::toHex(chain_id).c_str());
+                    return transaction_failed(chain_id);
+                }
 
                 std::set<libTAU::blockchain::account> accounts;
                 for (auto const& stateArray: arrays) {
@@ -1472,21 +1688,24 @@ namespace libTAU::blockchain {
         } else {
             std::set<dht::public_key> peers = blk.get_block_peers();
 
-            m_repository->begin_transaction();
+            bool const state_in_place = is_state_in_place(chain_id, blk);
 
-            if (!m_repository->clear_all_state(chain_id)) {
-                log(LOG_ERR, "INFO: chain:%s, clear all state fail.", aux::toHex(chain_id).c_str());
-                m_repository->rollback();
-                return FAIL;
+            if (!m_repository->begin_transaction()) {
+                log(LOG_ERR, "INFO: chain:%s, begin transaction fail.", aux::toHex(chain_id).c_str());
+                return transaction_failed(chain_id);
             }
-            for (auto const& stateArray: arrays) {
-                for (auto const& act: stateArray.StateArray()) {
-                    if (!m_repository->update_account(chain_id, act)) {
-                        log(LOG_ERR, "INFO: chain:%s, save account[%s] fail.",
-                            aux::toHex(chain_id).c_str(), act.to_string().c_str());
-                        m_repository->rollback();
-                        return FAIL;
-                    }
+
+            if (!state_in_place) {
+                std::vector<account> state;
+                for (auto const& stateArray: arrays) {
+                    auto const& accounts = stateArray.StateArray();
+                    state.insert(state.end(), accounts.begin(), accounts.end());
+                }
+                if (!m_repository->replace_all_state(chain_id, state)) {
+                    log(LOG_ERR, "INFO: chain:%s, import %zu accounts fail.",
+                        aux::toHex(chain_id).c_str(), state.size());
+                    m_repository->rollback();
+                    return FAIL;
                 }
             }
 
@@ -1537,7 +1756,10 @@ namespace libTAU::blockchain {
                 return FAIL;
             }
 
-            m_repository->commit();
+            if (!m_repository->commit()) {
+                log(LOG_ERR, "INFO: chain:%s, commit fail.", aux::toHex(chain_id).c_str());
+                return transaction_failed(chain_id);
+            }
 
             std::set<libTAU::blockchain::account> accounts;
             for (auto const& stateArray: arrays) {
@@ -1579,6 +1801,9 @@ namespace libTAU::blockchain {
     }
 
     RESULT blockchain::process_block(const aux::bytes &chain_id, const block &blk) {
+        // the head block may be gone with a lost group
+        reload_after_lost_group();
+
         log(LOG_ERR, "INFO: chain:%s process block[%s].",
             aux::toHex(chain_id).c_str(), blk.to_string().c_str());
         if (blk.empty())
@@ -1593,7 +1818,10 @@ namespace libTAU::blockchain {
                 if (result != SUCCESS)
                     return result;
 
-                m_repository->begin_transaction();
+                if (!m_repository->begin_transaction()) {
+                    log(LOG_ERR, "INFO: chain:%s, begin transaction fail.", aux::toHex(chain_id).c_str());
+                    return transaction_failed(chain_id);
+                }
 
                 auto const& tx = blk.tx();
                 if (!tx.empty() && tx.type() == type_transfer) {
@@ -1642,7 +1870,10 @@ namespace libTAU::blockchain {
                     return FAIL;
                 }
 
-                m_repository->commit();
+                if (!m_repository->commit()) {
+                    log(LOG_ERR, "INFO: chain:%s, commit fail.", aux::toHex(chain_id).c_str());
+                    return transaction_failed(chain_id);
+                }
 
                 m_head_blocks[chain_id] = blk;
 
@@ -1776,13 +2007,23 @@ namespace libTAU::blockchain {
                         clear_chain_all_state_in_cache_and_db(chain_id);
                     }
 
-                    process_genesis_block(chain_id, it->second.m_genesis_block, arrays);
+                    auto result = process_genesis_block(chain_id, it->second.m_genesis_block, arrays);
 
-                    if (it->second.m_head_block.cumulative_difficulty() >
+                    if (result != BUSY && (it->second.m_head_block.cumulative_difficulty() >
                         m_head_blocks[chain_id].cumulative_difficulty() ||
                         (it->second.m_head_block.cumulative_difficulty() ==
-                         m_head_blocks[chain_id].cumulative_difficulty() && peer > *m_ses.pubkey())) {
-                        try_to_rebranch(chain_id, it->second.m_head_block, false, peer, signalPeer);
+                         m_head_blocks[chain_id].cumulative_difficulty() && peer > *m_ses.pubkey()))) {
+                        result = try_to_rebranch(chain_id, it->second.m_head_block, false, peer, signalPeer);
+                    }
+
+                    if (result == BUSY) {
+                        // the received state is still in the db, go over it again
+                        aux::bytes const id = chain_id;
+                        dht::public_key const p = peer;
+                        dht::public_key const sp = signalPeer;
+                        retry_when_busy(chain_id, [this, id, p, sp]() {
+                            state_reception_event(id, p, sp);
+                        });
                     }
                 }
             }
@@ -1826,21 +2067,33 @@ namespace libTAU::blockchain {
 //    }
 
     bool blockchain::clear_all_chain_data_in_db(const bytes &chain_id) {
-        m_repository->begin_transaction();
+        if (!m_repository->begin_transaction()) {
+            log(LOG_ERR, "INFO: chain:%s, begin transaction fail.", aux::toHex(chain_id).c_str());
+            reload_after_lost_group();
+            return false;
+        }
         if (!m_repository->clear_all_state(chain_id)) {
             log(LOG_ERR, "INFO: chain:%s, clear all state fail.", aux::toHex(chain_id).c_str());
+            m_repository->rollback();
             return false;
         }
         if (!m_repository->set_all_block_non_main_chain(chain_id)) {
             log(LOG_ERR, "INFO: chain:%s, set all block non main chain fail.", aux::toHex(chain_id).c_str());
+            m_repository->rollback();
+            return false;
+        }
+        if (!m_repository->commit()) {
+            log(LOG_ERR, "INFO: chain:%s, commit fail.", aux::toHex(chain_id).c_str());
+            reload_after_lost_group();
             return false;
         }
-        m_repository->commit();
         return true;
     }
 
     bool blockchain::clear_chain_all_state_in_cache_and_db(const aux::bytes &chain_id) {
         m_head_blocks.erase(chain_id);
+        m_state_commitments.erase(chain_id);
+        m_prune_cycles.erase(chain_id);
         return clear_all_chain_data_in_db(chain_id);
     }
 
@@ -1953,6 +2206,9 @@ namespace libTAU::blockchain {
     }
 
     RESULT blockchain::try_to_rebranch(const aux::bytes &chain_id, const block &target, bool absolute, dht::public_key peer, const dht::public_key &signalPeer) {
+        // the head block may be gone with a lost group
+        reload_after_lost_group();
+
         log(LOG_INFO, "INFO chain[%s] try to rebranch to block[%s]",
             aux::toHex(chain_id).c_str(), target.to_string().c_str());
 
@@ -2069,7 +2325,10 @@ namespace libTAU::blockchain {
 
         std::set<dht::public_key> peers;
 
-        m_repository->begin_transaction();
+        if (!m_repository->begin_transaction()) {
+            log(LOG_ERR, "INFO: chain:%s, begin transaction fail.", aux::toHex(chain_id).c_str());
+            return transaction_failed(chain_id);
+        }
 
         // Rollback blocks
         for (auto &blk: rollback_blocks) {
@@ -2190,7 +2449,10 @@ namespace libTAU::blockchain {
             }
         }
 
-        m_repository->commit();
+        if (!m_repository->commit()) {
+            log(LOG_ERR, "INFO: chain:%s, commit fail.", aux::toHex(chain_id).c_str());
+            return transaction_failed(chain_id);
+        }
 
         // after all above is success
         m_head_blocks[chain_id] = target;
@@ -2327,6 +2589,14 @@ namespace libTAU::blockchain {
                 } else if (result == SUCCESS) {
                     // clear all ancestor blocks
                     remove_all_ancestor_blocks_from_cache(peer_head_block);
+                } else if (result == BUSY) {
+                    // keep the blocks and the peer, nothing was written
+                    aux::bytes const id = chain_id;
+                    dht::public_key const p = peer;
+                    dht::public_key const sp = signalPeer;
+                    retry_when_busy(chain_id, [this, id, p, sp]() {
+                        try_to_rebranch_to_most_difficult_chain(id, p, sp);
+                    });
                 }
             } else {
                 block blk = it->second.m_head_block;
@@ -2564,31 +2834,6 @@ namespace libTAU::blockchain {
         }
     } // anonymous namespace
 
-    namespace {
-        /**
-         * 选用编辑代价最小的，并返回该操作代表的操作数
-         * @param swap 替换的代价
-         * @param insert 插入的代价
-         * @param del 删除的代价
-         * @return 0:替换，1：插入，2：删除
-         */
-        size_t optCode(size_t swap, size_t insert, size_t del) {
-            // 如果替换编辑距离最少，则返回0标识，
-            // 即使三种操作距离一样，优先选择替换操作
-            if (swap <= insert && swap <= del) {
-                return 0;
-            }
-
-            // 如果插入操作编辑最少，返回1标识，如果插入和删除距离一样，优先选择插入
-            if (insert < swap && insert <= del) {
-                return 1;
-            }
-
-            // 如果删除操作编辑最少，返回2标识
-            return 2;
-        }
-    }
-
     void blockchain::find_best_solution(std::vector<transaction> &txs, const aux::bytes &hash_prefix_array,
                                         std::set<transaction> &missing_txs) {
         // 如果对方没有信息，则本地消息全为缺失消息
@@ -2621,59 +2866,19 @@ namespace libTAU::blockchain {
                 return;
             }
 
-            // 状态转移矩阵
-            size_t dist[sourceLength + 1][targetLength + 1];
-            // 操作矩阵
-            size_t operations[sourceLength + 1][targetLength + 1];
-
-            // 初始化，[i, 0]转换到空，需要编辑的距离，也即删除的数量
-            for (size_t i = 0; i < sourceLength + 1; i++) {
-                dist[i][0] = i;
-                if (i > 0) {
-                    operations[i][0] = 2;
-                }
-            }
-
-            // 初始化，空转换到[0, j]，需要编辑的距离，也即增加的数量
-            for (size_t j = 0; j < targetLength + 1; j++) {
-                dist[0][j] = j;
-                if (j > 0) {
-                    operations[0][j] = 1;
-                }
-            }
-
-            // 开始填充状态转移矩阵，第0位为空，所以从1开始有数据，[i, j]为当前子串最小编辑操作
-            for (size_t i = 1; i < sourceLength + 1; i++) {
-                for (size_t j = 1; j < targetLength + 1; j++) {
-                    // 第i个数据，实际的index需要i-1，替换的代价，相同无需替换，代价为0，不同代价为1
-                    size_t cost = source[i - 1] == target[j - 1] ? 0 : 1;
-                    // [i, j]在[i, j-1]的基础上，最小的编辑操作为增加1
-                    size_t insert = dist[i][j - 1] + 1;
-                    // [i, j]在[i-1, j]的基础上，最小的编辑操作为删除1
-                    size_t del = dist[i - 1][j] + 1;
-                    // [i, j]在[i-1, j-1]的基础上，最大的编辑操作为1次替换
-                    size_t swap = dist[i - 1][j - 1] + cost;
-
-                    // 在[i-1, j]， [i, j-1]， [i-1, j-1]三种转换到[i, j]的最小操作中，取最小值
-                    dist[i][j] = std::min(std::min(insert, del), swap);
-
-                    // 选择一种最少编辑的操作
-                    operations[i][j] = optCode(swap, insert, del);
-                }
-            }
-
             // 回溯编辑路径，统计中间信息
-            auto i = sourceLength;
-            auto j = targetLength;
-            while (0 != dist[i][j]) {
-                if (0 == operations[i][j]) {
+            m_edit_scratch.resize(aux::edit_distance::scratch_size(sourceLength, targetLength));
+            aux::edit_distance distance(source, target, m_edit_scratch);
+            aux::edit_distance::step s{};
+            while (distance.next(s)) {
+                auto const i = s.source_size;
+                auto const j = s.target_size;
+                if (aux::edit_distance::operation::substitute == s.op) {
                     // 如果是替换操作，则将target对应的替换消息加入列表
                     if (source[i - 1] != target[j - 1]) {
                         missing_txs.insert(txs[j - 1]);
                     }
-                    i--;
-                    j--;
-                } else if (1 == operations[i][j]) {
+                } else if (aux::edit_distance::operation::insert == s.op) {
                     // 如果是插入操作，则将target对应的插入消息加入列表
                     // 注意由于消息是按照时间戳从小到大排列，如果缺第一个，并且此时双方满载，则判定为被挤出去而产生的差异，并非真的缺少
                     if (1 != j || targetLength != blockchain_max_tx_list_size ||
@@ -2687,11 +2892,8 @@ namespace libTAU::blockchain {
                             k++;
                         }
                     }
-
-                    j--;
-                } else if (2 == operations[i][j]) {
+                } else if (aux::edit_distance::operation::remove == s.op) {
                     // 如果是删除操作，可能是对方新消息，忽略
-                    i--;
                 }
             }
 
@@ -2707,64 +2909,65 @@ namespace libTAU::blockchain {
         }
     }
 
-    void blockchain::generate_genesis_state(const bytes &chain_id, sha1_hash &stateRoot, std::vector<state_array> &arrays) {
-        auto all_state = m_repository->get_all_effective_state(chain_id);
-        if (!all_state.empty()) {
-            std::vector<account> states;
-            for (auto const &state: all_state) {
-                states.push_back(state);
-                if (states.size() == MAX_ACCOUNT_SIZE_IN_ENTRY) {
-                    state_array stateArray(states);
-                    if (!m_repository->save_state_array(chain_id, stateArray)) {
-                        log(LOG_ERR, "ERROR: chain:%s, save state array[%s] fail.",
-                            aux::toHex(chain_id).c_str(), stateArray.to_string().c_str());
-                    }
-                    arrays.push_back(stateArray);
-
-                    states.clear();
-                }
-            }
+    void blockchain::refresh_state_commitment(const bytes &chain_id) {
+        auto &commitment = m_state_commitments[chain_id];
 
-            // the last one
-            if (!states.empty()) {
-                state_array stateArray(states);
-                if (!m_repository->save_state_array(chain_id, stateArray)) {
-                    log(LOG_ERR, "ERROR: chain:%s, save state array[%s] fail.",
-                        aux::toHex(chain_id).c_str(), stateArray.to_string().c_str());
-                }
-                arrays.push_back(stateArray);
+        bool reset = false;
+        auto touched = m_repository->take_touched_accounts(chain_id, reset);
+        if (reset || !commitment.valid()) {
+            commitment.reset(m_repository->get_all_effective_state(chain_id));
+            return;
+        }
 
-                states.clear();
+        std::vector<account> changed;
+        std::vector<dht::public_key> removed;
+        for (auto const &peer: touched) {
+            auto act = m_repository->get_account(chain_id, peer);
+            // an account may be saved with all zeros
+            if (!act.empty() || m_repository->is_account_existed(chain_id, peer)) {
+                changed.push_back(act);
+            } else {
+                removed.push_back(peer);
             }
+        }
 
-            if (!arrays.empty()) {
-                std::vector<sha1_hash> level0_hashArray;
-                std::vector<sha1_hash> level1_hashArray;
-                for (auto const &array: arrays) {
-                    level0_hashArray.push_back(array.sha1());
-                    if (level0_hashArray.size() == MAX_HASH_SIZE_IN_ENTRY) {
-                        hash_array stateHashArray(level0_hashArray);
-                        m_repository->save_hash_array(chain_id, stateHashArray);
-                        level1_hashArray.push_back(stateHashArray.sha1());
-
-                        level0_hashArray.clear();
-                    }
-                }
+        commitment.update(changed, removed);
+    }
 
-                // the last one
-                if (!level0_hashArray.empty()) {
-                    hash_array stateHashArray(level0_hashArray);
-                    m_repository->save_hash_array(chain_id, stateHashArray);
-                    level1_hashArray.push_back(stateHashArray.sha1());
+    bool blockchain::is_state_in_place(const bytes &chain_id, const block &blk) {
+        refresh_state_commitment(chain_id);
 
-                    level0_hashArray.clear();
-                }
+        return m_state_commitments[chain_id].root() == blk.state_root();
+    }
 
-                hash_array stateHashArray(level1_hashArray);
-                m_repository->save_hash_array(chain_id, stateHashArray);
-                stateRoot = stateHashArray.sha1();
+    void blockchain::generate_genesis_state(const bytes &chain_id, sha1_hash &stateRoot, std::vector<state_array> &arrays) {
+        refresh_state_commitment(chain_id);
+        auto &commitment = m_state_commitments[chain_id];
+
+        // arrays not rebuilt since they were last saved are in kv db already
+        bool ok = true;
+        for (auto const &stateArray: commitment.unsaved_state_arrays()) {
+            if (!m_repository->save_state_array(chain_id, stateArray)) {
+                log(LOG_ERR, "ERROR: chain:%s, save state array[%s] fail.",
+                    aux::toHex(chain_id).c_str(), stateArray.to_string().c_str());
+                ok = false;
             }
         }
+        for (auto const &hashArray: commitment.unsaved_hash_arrays()) {
+            if (!m_repository->save_hash_array(chain_id, hashArray)) {
+                log(LOG_ERR, "ERROR: chain:%s, save hash array[%s] fail.",
+                    aux::toHex(chain_id).c_str(), hashArray.to_string().c_str());
+                ok = false;
+            }
+        }
+
+        stateRoot = commitment.root();
+        arrays = commitment.state_arrays();
+
+        // unsaved arrays are written again next time
+        if (ok) {
+            commitment.mark_saved();
+        }
     }
 
     void blockchain::generate_news_data(const bytes &chain_id, sha1_hash &newsRoot, std::vector<transaction> &newsArrays) {
@@ -3148,18 +3351,26 @@ namespace libTAU::blockchain {
                     log(LOG_INFO, "Chain[%s] genesis block[%s]", aux::toHex(chain_id).c_str(), blk.to_string().c_str());
                     std::vector<hash_array> hashArrays;
                     std::vector<state_array> stateArrays;
-                    auto level1HashArray = m_repository->get_hash_array_by_hash(chain_id, blk.state_root());
-                    if (!level1HashArray.empty()) {
-                        hashArrays.push_back(level1HashArray);
-                        for (auto const& hash: level1HashArray.HashArray()) {
-                            auto level0HashArray = m_repository->get_hash_array_by_hash(chain_id, hash);
-                            if (!level0HashArray.empty()) {
-                                hashArrays.push_back(level0HashArray);
-
-                                for (auto const& state_array_hash: level0HashArray.HashArray()) {
-                                    auto stateArray = m_repository->get_state_array_by_hash(chain_id, state_array_hash);
-                                    if (!stateArray.empty()) {
-                                        stateArrays.push_back(stateArray);
+                    auto const &commitment = m_state_commitments[chain_id];
+                    if (commitment.valid() && !commitment.state_arrays().empty()
+                        && commitment.root() == blk.state_root()) {
+                        // the state of the genesis block is still in memory
+                        hashArrays = commitment.hash_arrays();
+                        stateArrays = commitment.state_arrays();
+                    } else {
+                        auto level1HashArray = m_repository->get_hash_array_by_hash(chain_id, blk.state_root());
+                        if (!level1HashArray.empty()) {
+                            hashArrays.push_back(level1HashArray);
+                            for (auto const& hash: level1HashArray.HashArray()) {
+                                auto level0HashArray = m_repository->get_hash_array_by_hash(chain_id, hash);
+                                if (!level0HashArray.empty()) {
+                                    hashArrays.push_back(level0HashArray);
+
+                                    for (auto const& state_array_hash: level0HashArray.HashArray()) {
+                                        auto stateArray = m_repository->get_state_array_by_hash(chain_id, state_array_hash);
+                                        if (!stateArray.empty()) {
+                                            stateArrays.push_back(stateArray);
+                                        }
                                     }
                                 }
                             }
@@ -3167,7 +3378,7 @@ namespace libTAU::blockchain {
                     }
 
                     std::vector<transaction> news_txs;
-                    level1HashArray = m_repository->get_hash_array_by_hash(chain_id, blk.news_root());
+                    auto level1HashArray = m_repository->get_hash_array_by_hash(chain_id, blk.news_root());
                     if (!level1HashArray.empty()) {
                         hashArrays.push_back(level1HashArray);
                         for (auto const& hash: level1HashArray.HashArray()) {
@@ -4841,11 +5052,22 @@ namespace libTAU::blockchain {
         peers.insert(*pk);
         followChain(chain_id, peers);
 
-        process_genesis_block(chain_id, b, stateArrays);
+        process_own_genesis_block(chain_id, b, stateArrays);
 
         return true;
     }
 
+    void blockchain::set_chain_retention(const aux::bytes &chain_id, int epochs) {
+        if (epochs < 0) {
+            m_chain_retention.erase(chain_id);
+        } else {
+            m_chain_retention[chain_id] = epochs;
+        }
+
+        // start over with the new horizon
+        m_prune_cycles.erase(chain_id);
+    }
+
     bool blockchain::touch_chain(const bytes &chain_id) {
         // update time(s)
 //        log(LOG_INFO, "INFO: touch chain:%s", aux::toHex(chain_id).c_str());
@@ -5043,10 +5265,12 @@ namespace libTAU::blockchain {
                 auto previous_hash = head_block.previous_block_hash();
                 while (!previous_hash.is_all_zeros() && topNum > 0) {
                     auto b = m_repository->get_block_by_hash(chain_id, previous_hash);
-                    if (!b.empty()) {
-                        blocks.push_back(b);
-                        previous_hash = b.previous_block_hash();
+                    if (b.empty()) {
+                        break;
                     }
+                    blocks.push_back(b);
+                    topNum--;
+                    previous_hash = b.previous_block_hash();
                 }
             }
         }
@@ -0,0 +1,173 @@
+/*
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include <algorithm>
+
+#include "libTAU/blockchain/constants.hpp"
+#include "libTAU/blockchain/prune_cycle.hpp"
+
+namespace libTAU::blockchain {
+
+    void prune_cycle::mark_kv_references(const block &blk) {
+        if (blk.empty()) {
+            return;
+        }
+
+        if (!blk.tx().empty()) {
+            live.insert(blk.tx().sha1());
+        }
+
+        // only epoch blocks carry a state root
+        if (blk.block_number() % CHAIN_EPOCH_BLOCK_SIZE == 0 && !blk.state_root().is_all_zeros()) {
+            live.insert(blk.state_root());
+            arrays.emplace_back(blk.state_root(), 1);
+        }
+
+        if (!blk.news_root().is_all_zeros()) {
+            live.insert(blk.news_root());
+            arrays.emplace_back(blk.news_root(), 1);
+        }
+    }
+
+    int prune_cycle::step(repository &repo, counters &cnt, const aux::bytes &chain_id, const block &head, int epochs
+        , int budget, pending_references const& pending) {
+        if (phase == done) {
+            // one cycle per epoch
+            if (head.block_number() < head_number + CHAIN_EPOCH_BLOCK_SIZE) {
+                return 0;
+            }
+            *this = prune_cycle();
+        }
+
+        if (phase == start) {
+            head_number = head.block_number();
+            head_hash = head.sha1();
+            // whole epochs are kept, from their epoch block on
+            main_number = (head_number / CHAIN_EPOCH_BLOCK_SIZE - epochs) * CHAIN_EPOCH_BLOCK_SIZE;
+            // a side branch more than an epoch behind the head is orphaned
+            side_number = head_number - CHAIN_EPOCH_BLOCK_SIZE;
+            mark_number = head_number;
+            kv_end = repo.get_kv_position(chain_id);
+            phase = blocks;
+        }
+
+        int spent = 0;
+
+        if (phase == blocks) {
+            int pruned = repo.prune_blocks(chain_id, main_number, side_number, budget);
+            if (pruned < 0) {
+                failed = true;
+                phase = done;
+                return 1;
+            }
+            cnt.inc_stats_counter(counters::blockchain_pruned_blocks, pruned);
+            pruned_blocks += pruned;
+            spent += pruned;
+
+            if (pruned < budget) {
+                phase = mark;
+            }
+        }
+
+        while (spent < budget && (phase == mark || phase == sweep)) {
+            if (phase == mark) {
+                spent++;
+                if (!arrays.empty()) {
+                    auto item = arrays.back();
+                    arrays.pop_back();
+
+                    auto hashArray = repo.get_hash_array_by_hash(chain_id, item.first);
+                    for (auto const &hash: hashArray.HashArray()) {
+                        live.insert(hash);
+                        if (item.second > 0) {
+                            arrays.emplace_back(hash, item.second - 1);
+                        }
+                    }
+                } else if (mark_number >= std::max(main_number, std::int64_t(0))) {
+                    mark_kv_references(repo.get_main_chain_block_by_number(chain_id, mark_number));
+                    mark_number--;
+                } else {
+                    // news being synced is not referenced by blocks yet
+                    for (auto const &tx: repo.get_latest_news_txs(chain_id)) {
+                        live.insert(tx.sha1());
+                    }
+                    phase = sweep;
+                }
+                continue;
+            }
+
+            if (head.sha1() != head_hash) {
+                if (head.block_number() > head_number
+                    && repo.get_main_chain_block_by_number(chain_id, head_number).sha1() == head_hash) {
+                    // blocks connected on top of the marked chain
+                    while (spent < budget && head_number < head.block_number()) {
+                        auto blk = repo.get_main_chain_block_by_number(chain_id, head_number + 1);
+                        mark_kv_references(blk);
+                        head_number++;
+                        head_hash = blk.sha1();
+                        spent++;
+                    }
+                } else {
+                    // rebranched, the main chain below the old head changed.
+                    // Mark it again from the new head down, earlier marks stay
+                    head_number = head.block_number();
+                    head_hash = head.sha1();
+                    mark_number = head_number;
+                    spent++;
+                }
+                phase = mark;
+                continue;
+            }
+
+            // side branch blocks prune_blocks() keeps, forks as well as
+            // blocks a rebranch took off the main chain
+            bool marked_all = true;
+            for (auto const &hash: repo.get_side_branch_block_hashes(chain_id, side_number)) {
+                if (side_blocks.find(hash) != side_blocks.end()) {
+                    continue;
+                }
+                if (spent >= budget) {
+                    marked_all = false;
+                    break;
+                }
+                mark_kv_references(repo.get_block_by_hash(chain_id, hash));
+                side_blocks.insert(hash);
+                spent++;
+            }
+            if (!arrays.empty()) {
+                phase = mark;
+                continue;
+            }
+            if (!marked_all) {
+                continue;
+            }
+
+            if (pending) {
+                pending(live);
+            }
+
+            auto hashes = repo.get_kv_hashes(chain_id, kv_position, kv_end, std::max(budget - spent, 1));
+            spent += std::max(static_cast<int>(hashes.size()), 1);
+            for (auto const &hash: hashes) {
+                if (live.find(hash) == live.end()
+                    && repo.delete_data_in_kv_db_by_hash(chain_id, hash)) {
+                    cnt.inc_stats_counter(counters::blockchain_pruned_kv_objects);
+                    pruned_kv_objects++;
+                }
+            }
+
+            if (kv_position >= kv_end) {
+                live.clear();
+                side_blocks.clear();
+                phase = done;
+            }
+        }
+
+        return spent;
+    }
+}
@@ -6,11 +6,49 @@ You may use, distribute and modify this code under the terms of the BSD license,
 see LICENSE file.
 */
 
+#include <algorithm>
 
 #include <libTAU/blockchain/repository.hpp>
 
 namespace libTAU::blockchain {
 
+    std::vector<account> repository::final_accounts(const std::vector<account> &accounts) {
+        std::vector<account> sorted(accounts);
+        // stable, the last of equal keys stays last
+        std::stable_sort(sorted.begin(), sorted.end(), [](const account &a, const account &b) {
+            return a.peer() < b.peer();
+        });
+
+        std::vector<account> result;
+        result.reserve(sorted.size());
+        for (auto it = sorted.begin(); it != sorted.end(); ++it) {
+            auto next = std::next(it);
+            if (next != sorted.end() && next->peer() == it->peer()) {
+                continue;
+            }
+            // update_account() deletes an empty account
+            if (!it->empty()) {
+                result.push_back(*it);
+            }
+        }
+
+        return result;
+    }
+
+    bool repository::replace_all_state(const aux::bytes &chain_id, const std::vector<account> &accounts) {
+        if (!clear_all_state(chain_id)) {
+            return false;
+        }
+
+        for (auto const& act: final_accounts(accounts)) {
+            if (!save_account(chain_id, act)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
     std::string repository::chains_db_name() {
         return "t" + table_chains;
     }
@@ -75,6 +113,14 @@ namespace libTAU::blockchain {
         return "t" + aux::toHex(hash) + table_news_txs;
     }
 
+    std::string repository::head_blocks_db_name() {
+        return "t" + table_head_blocks;
+    }
+
+    std::string repository::schema_version_db_name() {
+        return "t" + table_schema_version;
+    }
+
 //    bool repository::save_main_chain_block(const block &blk) {
 //        return save_block(blk, true);
 //    }
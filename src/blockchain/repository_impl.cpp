@@ -7,11 +7,71 @@ see LICENSE file.
 */
 
 #include "libTAU/hasher.hpp"
+#include "libTAU/aux_/random.hpp"
+#include "libTAU/aux_/time.hpp"
 #include "libTAU/blockchain/state_linker.hpp"
 #include "libTAU/blockchain/repository_impl.hpp"
 
 namespace libTAU::blockchain {
 
+    namespace {
+        // a block of an encoded block table, empty if the column is NULL
+        block read_encoded_block(sqlite3_stmt *stmt, int column) {
+            const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, column));
+            auto length = sqlite3_column_bytes(stmt, column);
+            if (length <= 0) {
+                return block();
+            }
+
+            return block(std::string(p, static_cast<std::size_t>(length)));
+        }
+
+        // a block of a table with a column per field, from CHAIN_ID,VERSION,
+        // TIMESTAMP,NUMBER,PREVIOUS_HASH,BASE_TARGET,DIFFICULTY,
+        // GENERATION_SIGNATURE,STATE_ROOT,NEWS_ROOT,TX,MINER,SIGNATURE
+        block read_block_columns(sqlite3_stmt *stmt, const sha1_hash &hash) {
+            const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
+            auto length = sqlite3_column_bytes(stmt, 0);
+            aux::bytes chainID(p, p + length);
+
+            auto version = static_cast<block_version>(sqlite3_column_int(stmt, 1));
+
+            std::int64_t timestamp = sqlite3_column_int64(stmt, 2);
+            std::int64_t number = sqlite3_column_int64(stmt, 3);
+
+            p = static_cast<const char *>(sqlite3_column_blob(stmt, 4));
+            sha1_hash previous_hash(p);
+
+            auto base_target = static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 5));
+            auto difficulty = static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 6));
+
+            p = static_cast<const char *>(sqlite3_column_blob(stmt, 7));
+            sha1_hash generation_signature(p);
+
+            p = static_cast<const char *>(sqlite3_column_blob(stmt, 8));
+            sha1_hash state_root(p);
+
+            p = static_cast<const char *>(sqlite3_column_blob(stmt, 9));
+            sha1_hash news_root(p);
+
+            p = static_cast<const char *>(sqlite3_column_blob(stmt, 10));
+            length = sqlite3_column_bytes(stmt, 10);
+            transaction tx;
+            if (length > 0) {
+                std::string tx_encode(p, length);
+                tx = transaction(tx_encode);
+            }
+
+            p = static_cast<const char *>(sqlite3_column_blob(stmt, 11));
+            dht::public_key miner(p);
+
+            p = static_cast<const char *>(sqlite3_column_blob(stmt, 12));
+            dht::signature sig(p);
+
+            return block(chainID, version, timestamp, number, previous_hash, base_target, difficulty, generation_signature, state_root, news_root, tx, miner, sig, hash);
+        }
+    }
+
 //    namespace {
 //        std::string chain_id_to_short_hash(const aux::bytes &chain_id) {
 //            // prevent SQL injection
@@ -21,6 +81,32 @@ namespace libTAU::blockchain {
 //        }
 //    }
 
+    cached_stmt repository_impl::prepare_cached(const std::string &table, const std::string &sql) {
+        auto &stmts = m_stmt_cache[table];
+        auto it = stmts.find(sql);
+        if (it != stmts.end()) {
+            m_counters.inc_stats_counter(counters::blockchain_stmt_cache_hits);
+            return cached_stmt(it->second.get());
+        }
+
+        m_counters.inc_stats_counter(counters::blockchain_stmt_cache_misses);
+
+        sqlite3_stmt *stmt = nullptr;
+        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
+        if (ok != SQLITE_OK) {
+            sqlite3_finalize(stmt);
+            return cached_stmt(nullptr);
+        }
+
+        stmts.emplace(sql, stmt_ptr(stmt));
+
+        return cached_stmt(stmt);
+    }
+
+    void repository_impl::invalidate_stmt_cache(const std::string &table) {
+        m_stmt_cache.erase(table);
+    }
+
     bool repository_impl::init() {
         std::string sql = "CREATE TABLE IF NOT EXISTS ";
         sql.append(chains_db_name());
@@ -33,13 +119,19 @@ namespace libTAU::blockchain {
             return false;
         }
 
-        return true;
+        if (!create_head_block_db() || !create_schema_version_db()) {
+            return false;
+        }
+
+        return migrate_schema();
 
 //        return create_community_info_db();
     }
 
-    bool repository_impl::begin_transaction() {
-        std::string sql = "BEGIN TRANSACTION;";
+    bool repository_impl::create_schema_version_db() {
+        std::string sql = "CREATE TABLE IF NOT EXISTS ";
+        sql.append(schema_version_db_name());
+        sql.append("(ID INTEGER PRIMARY KEY NOT NULL,VERSION INTEGER);");
 
         char *zErrMsg = nullptr;
         int ok = sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, &zErrMsg);
@@ -51,11 +143,182 @@ namespace libTAU::blockchain {
         return true;
     }
 
-    bool repository_impl::commit() {
-        std::string sql = "COMMIT;";
+    int repository_impl::get_schema_version(int layout) {
+        int version = 0;
+
+        std::string table = schema_version_db_name();
+        std::string sql = "SELECT VERSION FROM ";
+        sql.append(table);
+        sql.append(" WHERE ID=?");
+
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+            sqlite3_bind_int(stmt.get(), 1, layout);
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                version = sqlite3_column_int(stmt.get(), 0);
+            }
+        }
+
+        return version;
+    }
+
+    bool repository_impl::set_schema_version(int layout, int version) {
+        std::string table = schema_version_db_name();
+        std::string sql = "REPLACE INTO ";
+        sql.append(table);
+        sql.append(" VALUES(?,?)");
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_int(stmt.get(), 1, layout);
+        sqlite3_bind_int(stmt.get(), 2, version);
+
+        int ok = sqlite3_step(stmt.get());
+        if (ok != SQLITE_DONE) {
+            return false;
+        }
+
+        return true;
+    }
+
+    bool repository_impl::migrate_schema() {
+        int version = get_schema_version(per_chain_schema_id);
+        if (version >= repository_schema_version) {
+            return true;
+        }
+
+        if (!begin_transaction()) {
+            return false;
+        }
+
+        // version 1: index block tables and keep an explicit head block pointer
+        if (version < 1 && !migrate_to_v1()) {
+            rollback();
+            return false;
+        }
+
+        // version 2: index state tables in effective state order
+        if (version < 2 && !migrate_to_v2()) {
+            rollback();
+            return false;
+        }
+
+        // version 3: new block tables keep the encoded block. Adding the
+        // column to existing ones is a schema change per chain, they keep
+        // their layout instead, see encoded_block_table()
+
+        // version 4: kv objects record whether the prune sweep may delete them
+        if (version < 4 && !migrate_to_v4()) {
+            rollback();
+            return false;
+        }
+
+        if (!set_schema_version(per_chain_schema_id, repository_schema_version)) {
+            rollback();
+            return false;
+        }
+
+        return commit();
+    }
+
+    bool repository_impl::migrate_to_v1() {
+        for (auto const& chain_id: get_all_chains()) {
+            // create block table indexes if not exist
+            if (!create_block_db(chain_id)) {
+                return false;
+            }
+            if (!refresh_head_block_pointer(chain_id)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool repository_impl::migrate_to_v2() {
+        for (auto const& chain_id: get_all_chains()) {
+            // create state table index if not exist
+            if (!create_state_db(chain_id)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool repository_impl::migrate_to_v4() {
+        for (auto const& chain_id: get_all_chains()) {
+            std::string table = kv_db_name(chain_id);
+            // no kv table, or created with the column already
+            if (!has_column(table, "HASH") || has_column(table, "PRUNABLE")) {
+                continue;
+            }
+
+            // existing objects get NULL: which of them are pic slices keyed
+            // by a 20 byte key is unknown, so none of them is swept
+            invalidate_stmt_cache(table);
+            std::string sql = "ALTER TABLE ";
+            sql.append(table);
+            sql.append(" ADD COLUMN PRUNABLE INT");
+            if (!exec(sql.c_str())) {
+                return false;
+            }
+        }
 
+        return true;
+    }
+
+    bool repository_impl::has_column(const std::string &table, const char *column) {
+        std::string sql = "SELECT 1 FROM pragma_table_info(?) WHERE name=?";
+        auto stmt = prepare_cached(std::string(), sql);
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_text(stmt.get(), 1, table.c_str(), static_cast<int>(table.size()), nullptr);
+        sqlite3_bind_text(stmt.get(), 2, column, -1, nullptr);
+
+        return sqlite3_step(stmt.get()) == SQLITE_ROW;
+    }
+
+    bool repository_impl::encoded_block_table(const aux::bytes &chain_id) {
+        auto it = m_encoded_block_tables.find(chain_id);
+        if (it != m_encoded_block_tables.end()) {
+            return it->second;
+        }
+
+        bool encoded = has_column(blocks_db_name(chain_id), "ENCODE");
+        m_encoded_block_tables[chain_id] = encoded;
+
+        return encoded;
+    }
+
+    void repository_impl::touch_account(const aux::bytes &chain_id, const dht::public_key &pubKey) {
+        m_touched_accounts[chain_id].insert(pubKey);
+        if (sqlite3_get_autocommit(m_sqlite) == 0) {
+            m_uncommitted_states.insert(chain_id);
+        }
+    }
+
+    void repository_impl::touch_all_state(const aux::bytes &chain_id) {
+        m_touched_accounts.erase(chain_id);
+        m_reset_states.insert(chain_id);
+        if (sqlite3_get_autocommit(m_sqlite) == 0) {
+            m_uncommitted_states.insert(chain_id);
+        }
+    }
+
+    void repository_impl::reset_uncommitted_states() {
+        for (auto const &chain_id: m_uncommitted_states) {
+            m_touched_accounts.erase(chain_id);
+            m_reset_states.insert(chain_id);
+        }
+        m_uncommitted_states.clear();
+    }
+
+    bool repository_impl::exec(const char *sql) {
         char *zErrMsg = nullptr;
-        int ok = sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, &zErrMsg);
+        int ok = sqlite3_exec(m_sqlite, sql, nullptr, nullptr, &zErrMsg);
         if (ok != SQLITE_OK) {
             sqlite3_free(zErrMsg);
             return false;
@@ -64,77 +327,391 @@ namespace libTAU::blockchain {
         return true;
     }
 
+    std::set<dht::public_key> repository_impl::sample_pubkeys(const std::string &table, int num) {
+        std::set<dht::public_key> peers;
+        if (num <= 0) {
+            return peers;
+        }
+
+        // rowid range. Each end is a b-tree edge lookup, as long as MIN and
+        // MAX are not asked for in the same statement (that is a full scan)
+        std::int64_t min_rowid = 0;
+        std::int64_t max_rowid = 0;
+        {
+            std::string sql = "SELECT MIN(rowid) FROM ";
+            sql.append(table);
+            auto stmt = prepare_cached(table, sql);
+            if (!stmt || sqlite3_step(stmt.get()) != SQLITE_ROW || sqlite3_column_type(stmt.get(), 0) == SQLITE_NULL) {
+                return peers;
+            }
+            min_rowid = sqlite3_column_int64(stmt.get(), 0);
+        }
+        {
+            std::string sql = "SELECT MAX(rowid) FROM ";
+            sql.append(table);
+            auto stmt = prepare_cached(table, sql);
+            if (!stmt || sqlite3_step(stmt.get()) != SQLITE_ROW) {
+                return peers;
+            }
+            max_rowid = sqlite3_column_int64(stmt.get(), 0);
+        }
+
+        // few enough rowids to take them all
+        if (max_rowid - min_rowid < 2 * static_cast<std::int64_t>(num)) {
+            std::vector<dht::public_key> all;
+            std::string sql = "SELECT PUBKEY FROM ";
+            sql.append(table);
+            auto stmt = prepare_cached(table, sql);
+            if (stmt) {
+                while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                    const char *pK = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                    all.emplace_back(pK);
+                }
+            }
+            aux::random_shuffle(all);
+            for (auto const &peer: all) {
+                if (static_cast<int>(peers.size()) >= num) {
+                    break;
+                }
+                peers.insert(peer);
+            }
+
+            return peers;
+        }
+
+        // the first rows at or after a random rowid. Rows following a gap
+        // left by deleted rows are a bit more likely to be picked
+        std::string sql = "SELECT PUBKEY FROM ";
+        sql.append(table);
+        sql.append(" WHERE rowid>=? ORDER BY rowid LIMIT ?");
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
+            return peers;
+        }
+
+        auto probe = [&](std::int64_t rowid, int limit) {
+            sqlite3_reset(stmt.get());
+            sqlite3_bind_int64(stmt.get(), 1, rowid);
+            sqlite3_bind_int(stmt.get(), 2, limit);
+            while (static_cast<int>(peers.size()) < num && sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                const char *pK = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                peers.insert(dht::public_key(pK));
+            }
+        };
+
+        std::uniform_int_distribution<std::int64_t> dist(min_rowid, max_rowid);
+        for (int i = 0; i < 4 * num && static_cast<int>(peers.size()) < num; i++) {
+            probe(dist(aux::random_engine()), 1);
+        }
+
+        // sparse rowids, fill up with a run of consecutive rows
+        if (static_cast<int>(peers.size()) < num) {
+            probe(dist(aux::random_engine()), 2 * num);
+        }
+        if (static_cast<int>(peers.size()) < num) {
+            probe(min_rowid, 2 * num);
+        }
+
+        return peers;
+    }
+
+    bool repository_impl::begin_transaction() {
+        m_busy = false;
+
+        // sqlite rolls back the whole transaction on some errors (disk full,
+        // I/O error), the open group is lost in that case. What the caller
+        // read before is stale then, see take_lost_group()
+        if (transaction_lost()) {
+            lose_transaction();
+            if (m_lost_group) {
+                return false;
+            }
+        }
+
+        if (m_transaction_depth > 0 || m_group_open) {
+            // nested, or a member of the open group: a savepoint, so that
+            // rollback() only undoes the changes made since
+            if (!exec("SAVEPOINT group_member;")) {
+                return false;
+            }
+            m_transaction_depth++;
+            return true;
+        }
+
+        // take the write lock up front, a deferred transaction that read
+        // first could not be upgraded once another connection committed.
+        // If another connection holds it past the busy timeout, the whole
+        // transaction is to be retried later, see transaction_busy()
+        if (!exec("BEGIN IMMEDIATE TRANSACTION;")) {
+            m_busy = busy_error();
+            return false;
+        }
+
+        if (m_group_max_transactions > 1) {
+            m_group_open = true;
+            m_group_transactions = 0;
+            m_group_start = aux::time_now();
+
+            if (!exec("SAVEPOINT group_member;")) {
+                return false;
+            }
+        }
+        m_transaction_depth++;
+
+        return true;
+    }
+
+    bool repository_impl::commit() {
+        m_busy = false;
+
+        if (m_transaction_depth == 0) {
+            // nothing of the caller is open, commit the open group if any
+            return flush(true);
+        }
+
+        if (transaction_lost()) {
+            lose_transaction();
+            return false;
+        }
+
+        if (m_transaction_depth > 1 || m_group_open) {
+            // merge into the enclosing transaction, or into the open group
+            if (!exec("RELEASE group_member;")) {
+                rollback();
+                return false;
+            }
+            m_transaction_depth--;
+            if (m_transaction_depth > 0) {
+                return true;
+            }
+
+            m_group_transactions++;
+
+            // merged into the group even if it could not be committed yet
+            return flush(m_group_transactions >= m_group_max_transactions) || m_group_open;
+        }
+
+        m_transaction_depth = 0;
+        if (!exec("COMMIT;")) {
+            m_busy = busy_error();
+            // a busy commit leaves the transaction open
+            if (sqlite3_get_autocommit(m_sqlite) == 0) {
+                exec("ROLLBACK;");
+            }
+            m_block_cache.clear();
+            reset_uncommitted_states();
+            return false;
+        }
+        m_uncommitted_states.clear();
+
+        return true;
+    }
+
     bool repository_impl::rollback() {
-        std::string sql = "ROLLBACK;";
+        // blocks read inside the transaction may be gone after it
+        m_block_cache.clear();
+
+        if (m_transaction_depth == 0) {
+            // nothing of the caller to undo. The transactions already
+            // merged into the open group stay
+            return true;
+        }
+
+        reset_uncommitted_states();
+
+        if (transaction_lost()) {
+            // undone already, by sqlite
+            lose_transaction();
+            return true;
+        }
+
+        if (m_transaction_depth > 1 || m_group_open) {
+            // only undo the changes since the matching begin_transaction.
+            // The chains written by the group before it are reset too
+            bool ok = exec("ROLLBACK TO group_member;");
+            ok = exec("RELEASE group_member;") && ok;
+            m_transaction_depth--;
+            return ok;
+        }
+
+        m_transaction_depth = 0;
+
+        return exec("ROLLBACK;");
+    }
+
+    bool repository_impl::transaction_busy() const {
+        return m_busy;
+    }
+
+    bool repository_impl::transaction_lost() const {
+        return (m_transaction_depth > 0 || m_group_open) && sqlite3_get_autocommit(m_sqlite) != 0;
+    }
+
+    bool repository_impl::take_lost_group() {
+        bool const lost = m_lost_group;
+        m_lost_group = false;
+        return lost;
+    }
+
+    void repository_impl::lose_transaction() {
+        if (m_group_open) {
+            m_counters.inc_stats_counter(counters::blockchain_group_commit_failures);
+            // members whose commit() returned true are gone with it
+            if (m_group_transactions > 0) {
+                m_lost_group = true;
+            }
+        }
+        m_group_open = false;
+        m_transaction_depth = 0;
+        m_block_cache.clear();
+        reset_uncommitted_states();
+    }
+
+    bool repository_impl::busy_error() const {
+        int const code = sqlite3_errcode(m_sqlite) & 0xff;
+        return code == SQLITE_BUSY || code == SQLITE_LOCKED;
+    }
+
+    void repository_impl::set_group_commit(int max_transactions, int max_latency) {
+        flush(true);
+
+        m_group_max_transactions = max_transactions;
+        m_group_max_latency = max_latency;
+    }
+
+    void repository_impl::set_block_cache_size(std::int64_t size) {
+        m_block_cache.set_budget(size);
+    }
+
+    std::int64_t repository_impl::incremental_vacuum(int pages) {
+        if (pages <= 0) {
+            return 0;
+        }
+
+        // pragmas belong to no table
+        auto pragma_value = [this](const std::string &sql) -> std::int64_t {
+            auto stmt = prepare_cached(std::string(), sql);
+            if (!stmt || sqlite3_step(stmt.get()) != SQLITE_ROW) {
+                return 0;
+            }
+            return sqlite3_column_int64(stmt.get(), 0);
+        };
+
+        std::int64_t free_pages = pragma_value("PRAGMA freelist_count");
+        if (free_pages <= 0) {
+            return 0;
+        }
+
+        // a no-op unless auto_vacuum is INCREMENTAL
+        std::string sql = "PRAGMA incremental_vacuum(";
+        sql.append(std::to_string(pages));
+        sql.append(")");
 
         char *zErrMsg = nullptr;
         int ok = sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, &zErrMsg);
         if (ok != SQLITE_OK) {
             sqlite3_free(zErrMsg);
+            return 0;
+        }
+
+        std::int64_t reclaimed = free_pages - pragma_value("PRAGMA freelist_count");
+        if (reclaimed <= 0) {
+            return 0;
+        }
+
+        return reclaimed * pragma_value("PRAGMA page_size");
+    }
+
+    bool repository_impl::flush(bool force) {
+        m_busy = false;
+
+        if (!m_group_open || m_transaction_depth > 0) {
+            return true;
+        }
+
+        if (transaction_lost()) {
+            lose_transaction();
             return false;
         }
 
+        if (!force && aux::time_now() - m_group_start < milliseconds(m_group_max_latency)) {
+            return true;
+        }
+
+        if (!exec("COMMIT;")) {
+            // readers kept the commit from finishing, the group stays open
+            // for the next flush
+            if (busy_error() && sqlite3_get_autocommit(m_sqlite) == 0) {
+                m_busy = true;
+                return false;
+            }
+            exec("ROLLBACK;");
+            lose_transaction();
+            return false;
+        }
+        m_group_open = false;
+        m_uncommitted_states.clear();
+
+        m_counters.inc_stats_counter(counters::blockchain_group_commits);
+        m_counters.inc_stats_counter(counters::blockchain_group_transactions, m_group_transactions);
+
         return true;
     }
 
     std::set<aux::bytes> repository_impl::get_all_chains() {
         std::set<aux::bytes> chains;
 
-        sqlite3_stmt * stmt;
+        std::string table = chains_db_name();
         std::string sql = "SELECT CHAIN_ID FROM ";
-        sql.append(chains_db_name());
+        sql.append(table);
 
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            for (;sqlite3_step(stmt) == SQLITE_ROW;) {
-                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
-                auto length = sqlite3_column_bytes(stmt, 0);
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+            for (;sqlite3_step(stmt.get()) == SQLITE_ROW;) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                auto length = sqlite3_column_bytes(stmt.get(), 0);
                 aux::bytes chain_id(p, p + length);
                 chains.insert(chain_id);
             }
         }
 
-        sqlite3_finalize(stmt);
-
         return chains;
     }
 
     bool repository_impl::add_new_chain(const aux::bytes &chain_id) {
-        sqlite3_stmt * stmt;
+        std::string table = chains_db_name();
         std::string sql = "REPLACE INTO ";
-        sql.append(chains_db_name());
+        sql.append(table);
         sql.append(" VALUES(?)");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
-        sqlite3_bind_blob(stmt, 1, chain_id.data(), chain_id.size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 1, chain_id.data(), chain_id.size(), nullptr);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
 
     bool repository_impl::delete_chain(const aux::bytes &chain_id) {
-        sqlite3_stmt * stmt;
+        std::string table = chains_db_name();
         std::string sql = "DELETE FROM ";
-        sql.append(chains_db_name());
+        sql.append(table);
         sql.append(" WHERE CHAIN_ID=?");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
-        sqlite3_bind_blob(stmt, 1, chain_id.data(), chain_id.size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 1, chain_id.data(), chain_id.size(), nullptr);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
@@ -150,7 +727,7 @@ namespace libTAU::blockchain {
     bool repository_impl::create_kv_db(const aux::bytes &chain_id) {
         std::string sql = "CREATE TABLE IF NOT EXISTS ";
         sql.append(kv_db_name(chain_id));
-        sql.append("(HASH BLOB PRIMARY KEY NOT NULL, VALUE BLOB);");
+        sql.append("(HASH BLOB PRIMARY KEY NOT NULL, VALUE BLOB, PRUNABLE INT);");
 
         char *zErrMsg = nullptr;
         int ok = sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, &zErrMsg);
@@ -163,6 +740,7 @@ namespace libTAU::blockchain {
     }
 
     bool repository_impl::delete_kv_db(const aux::bytes &chain_id) {
+        invalidate_stmt_cache(kv_db_name(chain_id));
         std::string sql = "DROP TABLE ";
         sql.append(kv_db_name(chain_id));
 
@@ -177,24 +755,23 @@ namespace libTAU::blockchain {
     }
 
     bool repository_impl::save_hash_array(const aux::bytes &chain_id, const hash_array &hashArray) {
-        sqlite3_stmt * stmt;
+        std::string table = kv_db_name(chain_id);
         std::string sql = "REPLACE INTO ";
-        sql.append(kv_db_name(chain_id));
-        sql.append(" VALUES(?,?)");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        sql.append(table);
+        sql.append(" VALUES(?,?,1)");
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
         sha1_hash hash = hashArray.sha1();
         std::string e = hashArray.get_encode();
-        sqlite3_bind_blob(stmt, 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
-        sqlite3_bind_blob(stmt, 2, e.data(), e.size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 2, e.data(), e.size(), nullptr);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
@@ -202,95 +779,89 @@ namespace libTAU::blockchain {
     hash_array repository_impl::get_hash_array_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
         hash_array hashArray;
 
-        sqlite3_stmt * stmt;
+        std::string table = kv_db_name(chain_id);
         std::string sql = "SELECT VALUE FROM ";
-        sql.append(kv_db_name(chain_id));
+        sql.append(table);
         sql.append(" WHERE HASH=?");
 
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            sqlite3_bind_blob(stmt, 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
-            if (sqlite3_step(stmt) == SQLITE_ROW) {
-                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
-                auto length = sqlite3_column_bytes(stmt, 0);
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+            sqlite3_bind_blob(stmt.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                auto length = sqlite3_column_bytes(stmt.get(), 0);
 
                 std::string encode(p, p + length);
                 hashArray = hash_array(encode);
             }
         }
 
-        sqlite3_finalize(stmt);
-
         return hashArray;
     }
 
     state_array repository_impl::get_state_array_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
         state_array stateArray;
 
-        sqlite3_stmt * stmt;
+        std::string table = kv_db_name(chain_id);
         std::string sql = "SELECT VALUE FROM ";
-        sql.append(kv_db_name(chain_id));
+        sql.append(table);
         sql.append(" WHERE HASH=?");
 
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            sqlite3_bind_blob(stmt, 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
-            if (sqlite3_step(stmt) == SQLITE_ROW) {
-                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
-                auto length = sqlite3_column_bytes(stmt, 0);
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+            sqlite3_bind_blob(stmt.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                auto length = sqlite3_column_bytes(stmt.get(), 0);
 
                 std::string encode(p, p + length);
                 stateArray = state_array(encode);
             }
         }
 
-        sqlite3_finalize(stmt);
-
         return stateArray;
     }
 
     bool repository_impl::save_state_array(const aux::bytes &chain_id, const state_array &stateArray) {
-        sqlite3_stmt * stmt;
+        std::string table = kv_db_name(chain_id);
         std::string sql = "REPLACE INTO ";
-        sql.append(kv_db_name(chain_id));
-        sql.append(" VALUES(?,?)");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        sql.append(table);
+        sql.append(" VALUES(?,?,1)");
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
         sha1_hash hash = stateArray.sha1();
         std::string e = stateArray.get_encode();
-        sqlite3_bind_blob(stmt, 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
-        sqlite3_bind_blob(stmt, 2, e.data(), e.size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 2, e.data(), e.size(), nullptr);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
 
     bool repository_impl::save_tx(const aux::bytes &chain_id, const transaction &tx) {
-        sqlite3_stmt * stmt;
+        std::string table = kv_db_name(chain_id);
         std::string sql = "REPLACE INTO ";
-        sql.append(kv_db_name(chain_id));
-        sql.append(" VALUES(?,?)");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        sql.append(table);
+        sql.append(" VALUES(?,?,1)");
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
         sha1_hash hash = tx.sha1();
         std::string e = tx.get_encode();
-        sqlite3_bind_blob(stmt, 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
-        sqlite3_bind_blob(stmt, 2, e.data(), e.size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 2, e.data(), e.size(), nullptr);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
@@ -298,46 +869,44 @@ namespace libTAU::blockchain {
     transaction repository_impl::get_tx_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
         transaction tx;
 
-        sqlite3_stmt * stmt;
+        std::string table = kv_db_name(chain_id);
         std::string sql = "SELECT VALUE FROM ";
-        sql.append(kv_db_name(chain_id));
+        sql.append(table);
         sql.append(" WHERE HASH=?");
 
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            sqlite3_bind_blob(stmt, 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
-            if (sqlite3_step(stmt) == SQLITE_ROW) {
-                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
-                auto length = sqlite3_column_bytes(stmt, 0);
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+            sqlite3_bind_blob(stmt.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                auto length = sqlite3_column_bytes(stmt.get(), 0);
 
                 std::string encode(p, p + length);
                 tx = transaction(encode);
             }
         }
 
-        sqlite3_finalize(stmt);
-
         return tx;
     }
 
     bool repository_impl::save_pic_slice(const aux::bytes &chain_id, const aux::bytes &key, const aux::bytes &slice) {
-        sqlite3_stmt * stmt;
+        std::string table = kv_db_name(chain_id);
         std::string sql = "REPLACE INTO ";
-        sql.append(kv_db_name(chain_id));
-        sql.append(" VALUES(?,?)");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        sql.append(table);
+        // not referenced by blocks, the prune sweep leaves it alone
+        sql.append(" VALUES(?,?,NULL)");
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
 
-        sqlite3_bind_blob(stmt, 1, key.data(), key.size(), nullptr);
-        sqlite3_bind_blob(stmt, 2, slice.data(), slice.size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 1, key.data(), key.size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 2, slice.data(), slice.size(), nullptr);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
@@ -345,75 +914,122 @@ namespace libTAU::blockchain {
     aux::bytes repository_impl::get_pic_slice(const aux::bytes &chain_id, const aux::bytes &key) {
         libTAU::aux::bytes slice;
 
-        sqlite3_stmt * stmt;
+        std::string table = kv_db_name(chain_id);
         std::string sql = "SELECT VALUE FROM ";
-        sql.append(kv_db_name(chain_id));
+        sql.append(table);
         sql.append(" WHERE HASH=?");
 
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            sqlite3_bind_blob(stmt, 1, key.data(), key.size(), nullptr);
-            if (sqlite3_step(stmt) == SQLITE_ROW) {
-                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
-                auto length = sqlite3_column_bytes(stmt, 0);
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+            sqlite3_bind_blob(stmt.get(), 1, key.data(), key.size(), nullptr);
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                auto length = sqlite3_column_bytes(stmt.get(), 0);
 
                 slice = aux::bytes(p, p + length);
             }
         }
 
-        sqlite3_finalize(stmt);
-
         return slice;
     }
 
     bool repository_impl::is_data_in_kv_db(const aux::bytes &chain_id, const sha1_hash &hash) {
         bool ret = false;
 
-        sqlite3_stmt * stmt;
+        std::string table = kv_db_name(chain_id);
         std::string sql = "SELECT COUNT(*) FROM ";
-        sql.append(kv_db_name(chain_id));
+        sql.append(table);
         sql.append(" WHERE HASH=?");
 
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            sqlite3_bind_blob(stmt, 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
-            if (sqlite3_step(stmt) == SQLITE_ROW) {
-                int num = sqlite3_column_int(stmt, 0);
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+            sqlite3_bind_blob(stmt.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                int num = sqlite3_column_int(stmt.get(), 0);
                 if (num > 0) {
                     ret = true;
                 }
             }
         }
 
-        sqlite3_finalize(stmt);
-
         return ret;
     }
 
     bool repository_impl::delete_data_in_kv_db_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
-        sqlite3_stmt * stmt;
+        std::string table = kv_db_name(chain_id);
         std::string sql = "DELETE FROM ";
-        sql.append(kv_db_name(chain_id));
+        sql.append(table);
         sql.append(" WHERE HASH=?");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
-        sqlite3_bind_blob(stmt, 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
 
+    std::int64_t repository_impl::get_kv_position(const aux::bytes &chain_id) {
+        std::string table = kv_db_name(chain_id);
+        std::string sql = "SELECT MAX(rowid) FROM ";
+        sql.append(table);
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt || sqlite3_step(stmt.get()) != SQLITE_ROW) {
+            return 0;
+        }
+
+        // REPLACE gives a rewritten object a new rowid as well
+        return sqlite3_column_int64(stmt.get(), 0);
+    }
+
+    std::vector<sha1_hash> repository_impl::get_kv_hashes(const aux::bytes &chain_id, std::int64_t &position, std::int64_t end, int limit) {
+        std::vector<sha1_hash> hashes;
+
+        std::string table = kv_db_name(chain_id);
+        std::string sql = "SELECT rowid,HASH FROM ";
+        sql.append(table);
+        sql.append(" WHERE rowid>? AND rowid<=? AND PRUNABLE=1 ORDER BY rowid LIMIT ?");
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
+            return hashes;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, position);
+        sqlite3_bind_int64(stmt.get(), 2, end);
+        sqlite3_bind_int(stmt.get(), 3, limit);
+
+        bool visited = false;
+        while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+            visited = true;
+            position = sqlite3_column_int64(stmt.get(), 0);
+
+            const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 1));
+            if (p != nullptr && sqlite3_column_bytes(stmt.get(), 1) == libTAU::sha1_hash::size()) {
+                hashes.emplace_back(p);
+            }
+        }
+
+        if (!visited) {
+            position = end;
+        }
+
+        return hashes;
+    }
+
     bool repository_impl::create_state_db(const aux::bytes &chain_id) {
         std::string sql = "CREATE TABLE IF NOT EXISTS ";
         sql.append(state_db_name(chain_id));
         sql.append("(PUBKEY BLOB PRIMARY KEY NOT NULL,BALANCE INTEGER,NONCE INTEGER,POWER INTEGER);");
+        // effective state order, get_all_effective_state walks it without sorting
+        sql.append("CREATE INDEX IF NOT EXISTS ");
+        sql.append(state_db_name(chain_id));
+        sql.append("_effective ON ");
+        sql.append(state_db_name(chain_id));
+        sql.append("(BALANCE DESC,POWER DESC,NONCE DESC,PUBKEY DESC);");
 
         char *zErrMsg = nullptr;
         int ok = sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, &zErrMsg);
@@ -426,6 +1042,8 @@ namespace libTAU::blockchain {
     }
 
     bool repository_impl::delete_state_db(const aux::bytes &chain_id) {
+        invalidate_stmt_cache(state_db_name(chain_id));
+        touch_all_state(chain_id);
         std::string sql = "DROP TABLE ";
         sql.append(state_db_name(chain_id));
 
@@ -440,19 +1058,51 @@ namespace libTAU::blockchain {
     }
 
     bool repository_impl::clear_all_state(const aux::bytes &chain_id) {
-        sqlite3_stmt * stmt;
+        touch_all_state(chain_id);
+
+        std::string table = state_db_name(chain_id);
         std::string sql = "DELETE FROM ";
-        sql.append(state_db_name(chain_id));
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        sql.append(table);
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
+
+        return true;
+    }
+
+    bool repository_impl::replace_all_state(const aux::bytes &chain_id, const std::vector<account> &accounts) {
+        if (!clear_all_state(chain_id)) {
+            return false;
+        }
+
+        // the index stays: this runs inside the block transaction, where a
+        // schema change would invalidate every prepared statement and could
+        // not be undone cheaply. Rows come in primary key order
+        std::string table = state_db_name(chain_id);
+        std::string sql = "INSERT INTO ";
+        sql.append(table);
+        sql.append(" VALUES(?,?,?,?)");
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
+            return false;
+        }
+
+        for (auto const& act: final_accounts(accounts)) {
+            sqlite3_reset(stmt.get());
+            sqlite3_bind_blob(stmt.get(), 1, act.peer().bytes.data(), dht::public_key::len, nullptr);
+            sqlite3_bind_int64(stmt.get(), 2, act.balance());
+            sqlite3_bind_int64(stmt.get(), 3, act.nonce());
+            sqlite3_bind_int64(stmt.get(), 4, act.power());
+            if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+                return false;
+            }
+        }
 
         return true;
     }
@@ -460,18 +1110,18 @@ namespace libTAU::blockchain {
     account repository_impl::get_account(const aux::bytes &chain_id, const dht::public_key &pubKey) {
         account act(pubKey);
 
-        sqlite3_stmt * stmt;
+        std::string table = state_db_name(chain_id);
         std::string sql = "SELECT BALANCE,NONCE,POWER FROM ";
-        sql.append(state_db_name(chain_id));
+        sql.append(table);
         sql.append(" WHERE PUBKEY=?");
 
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            sqlite3_bind_blob(stmt, 1, pubKey.bytes.data(), dht::public_key::len, nullptr);
-            if (sqlite3_step(stmt) == SQLITE_ROW) {
-                std::int64_t balance = sqlite3_column_int64(stmt, 0);
-                std::int64_t nonce = sqlite3_column_int64(stmt, 1);
-                std::int64_t power = sqlite3_column_int64(stmt, 2);
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+            sqlite3_bind_blob(stmt.get(), 1, pubKey.bytes.data(), dht::public_key::len, nullptr);
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                std::int64_t balance = sqlite3_column_int64(stmt.get(), 0);
+                std::int64_t nonce = sqlite3_column_int64(stmt.get(), 1);
+                std::int64_t power = sqlite3_column_int64(stmt.get(), 2);
 
                 act.set_balance(balance);
                 act.set_nonce(nonce);
@@ -479,29 +1129,25 @@ namespace libTAU::blockchain {
             }
         }
 
-        sqlite3_finalize(stmt);
-
         return act;
     }
 
     bool repository_impl::is_account_existed(const aux::bytes &chain_id, const dht::public_key &pubKey) {
         bool is_existed = false;
 
-        sqlite3_stmt * stmt;
+        std::string table = state_db_name(chain_id);
         std::string sql = "SELECT * FROM ";
-        sql.append(state_db_name(chain_id));
+        sql.append(table);
         sql.append(" WHERE PUBKEY=?");
 
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            sqlite3_bind_blob(stmt, 1, pubKey.bytes.data(), dht::public_key::len, nullptr);
-            if (sqlite3_step(stmt) == SQLITE_ROW) {
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+            sqlite3_bind_blob(stmt.get(), 1, pubKey.bytes.data(), dht::public_key::len, nullptr);
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
                 is_existed = true;
             }
         }
 
-        sqlite3_finalize(stmt);
-
         return is_existed;
     }
 
@@ -514,44 +1160,46 @@ namespace libTAU::blockchain {
     }
 
     bool repository_impl::save_account(const aux::bytes &chain_id, const account &act) {
-        sqlite3_stmt * stmt;
+        touch_account(chain_id, act.peer());
+
+        std::string table = state_db_name(chain_id);
         std::string sql = "REPLACE INTO ";
-        sql.append(state_db_name(chain_id));
+        sql.append(table);
         sql.append(" VALUES(?,?,?,?)");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
-        sqlite3_bind_blob(stmt, 1, act.peer().bytes.data(), dht::public_key::len, nullptr);
-        sqlite3_bind_int64(stmt, 2, act.balance());
-        sqlite3_bind_int64(stmt, 3, act.nonce());
-        sqlite3_bind_int64(stmt, 4, act.power());
+        sqlite3_bind_blob(stmt.get(), 1, act.peer().bytes.data(), dht::public_key::len, nullptr);
+        sqlite3_bind_int64(stmt.get(), 2, act.balance());
+        sqlite3_bind_int64(stmt.get(), 3, act.nonce());
+        sqlite3_bind_int64(stmt.get(), 4, act.power());
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
 
     bool repository_impl::delete_account(const aux::bytes &chain_id, const dht::public_key &pubKey) {
-        sqlite3_stmt * stmt;
+        touch_account(chain_id, pubKey);
+
+        std::string table = state_db_name(chain_id);
         std::string sql = "DELETE FROM ";
-        sql.append(state_db_name(chain_id));
+        sql.append(table);
         sql.append(" WHERE PUBKEY=?");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
-        sqlite3_bind_blob(stmt, 1, pubKey.bytes.data(), dht::public_key::len, nullptr);
+        sqlite3_bind_blob(stmt.get(), 1, pubKey.bytes.data(), dht::public_key::len, nullptr);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
@@ -559,96 +1207,229 @@ namespace libTAU::blockchain {
     std::vector<account> repository_impl::get_all_effective_state(const aux::bytes &chain_id) {
         std::vector<account> accounts;
 
-        sqlite3_stmt * stmt;
+        std::string table = state_db_name(chain_id);
         std::string sql = "SELECT * FROM ";
-        sql.append(state_db_name(chain_id));
+        sql.append(table);
         sql.append(" ORDER BY BALANCE DESC,POWER DESC,NONCE DESC,PUBKEY DESC");
 
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-//            sqlite3_bind_int(stmt, 1, MAX_ACCOUNT_SIZE);
-            for (;sqlite3_step(stmt) == SQLITE_ROW;) {
-                const char *pK = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+//            sqlite3_bind_int(stmt.get(), 1, MAX_ACCOUNT_SIZE);
+            for (;sqlite3_step(stmt.get()) == SQLITE_ROW;) {
+                const char *pK = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
                 dht::public_key peer(pK);
 
-                std::int64_t balance = sqlite3_column_int64(stmt, 1);
-                std::int64_t nonce = sqlite3_column_int64(stmt, 2);
-                std::int64_t power = sqlite3_column_int64(stmt, 3);
+                std::int64_t balance = sqlite3_column_int64(stmt.get(), 1);
+                std::int64_t nonce = sqlite3_column_int64(stmt.get(), 2);
+                std::int64_t power = sqlite3_column_int64(stmt.get(), 3);
 
                 accounts.emplace_back(peer, balance, nonce, power);
             }
         }
 
-        sqlite3_finalize(stmt);
-
-        return accounts;
+        return accounts;
+    }
+
+    std::set<dht::public_key> repository_impl::take_touched_accounts(const aux::bytes &chain_id, bool &reset) {
+        std::set<dht::public_key> touched;
+
+        reset = m_reset_states.erase(chain_id) > 0;
+        auto it = m_touched_accounts.find(chain_id);
+        if (it != m_touched_accounts.end()) {
+            touched = std::move(it->second);
+            m_touched_accounts.erase(it);
+        }
+
+        return touched;
+    }
+
+    dht::public_key repository_impl::get_peer_from_state_db_randomly(const aux::bytes &chain_id) {
+        auto peers = sample_pubkeys(state_db_name(chain_id), 1);
+        if (peers.empty()) {
+            return dht::public_key{};
+        }
+
+        return *peers.begin();
+    }
+
+    std::set<dht::public_key> repository_impl::get_peers_from_state_db_randomly(const aux::bytes &chain_id, int num) {
+        return sample_pubkeys(state_db_name(chain_id), num);
+    }
+
+    bool repository_impl::create_block_db(const aux::bytes &chain_id) {
+        m_encoded_block_tables.erase(chain_id);
+        std::string sql = "CREATE TABLE IF NOT EXISTS ";
+        sql.append(blocks_db_name(chain_id));
+        // the canonical block encoding, only the queried columns broken out
+        sql.append("(HASH BLOB PRIMARY KEY NOT NULL,NUMBER INTEGER,MAIN_CHAIN INT,ENCODE BLOB);");
+        // main chain lookup by number and pruning by number
+        sql.append("CREATE INDEX IF NOT EXISTS ");
+        sql.append(blocks_db_name(chain_id));
+        sql.append("_main_chain_number ON ");
+        sql.append(blocks_db_name(chain_id));
+        sql.append("(MAIN_CHAIN,NUMBER);");
+        sql.append("CREATE INDEX IF NOT EXISTS ");
+        sql.append(blocks_db_name(chain_id));
+        sql.append("_number ON ");
+        sql.append(blocks_db_name(chain_id));
+        sql.append("(NUMBER);");
+
+        char *zErrMsg = nullptr;
+        int ok = sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, &zErrMsg);
+        if (ok != SQLITE_OK) {
+            sqlite3_free(zErrMsg);
+            return false;
+        }
+
+        return true;
+    }
+
+    bool repository_impl::delete_block_db(const aux::bytes &chain_id) {
+        m_block_cache.erase_chain(chain_id);
+        m_encoded_block_tables.erase(chain_id);
+        invalidate_stmt_cache(blocks_db_name(chain_id));
+        std::string sql = "DROP TABLE ";
+        sql.append(blocks_db_name(chain_id));
+
+        char *zErrMsg = nullptr;
+        int ok = sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, &zErrMsg);
+        if (ok != SQLITE_OK) {
+            sqlite3_free(zErrMsg);
+            return false;
+        }
+
+        return delete_head_block_pointer(chain_id);
+    }
+
+    bool repository_impl::create_head_block_db() {
+        std::string sql = "CREATE TABLE IF NOT EXISTS ";
+        sql.append(head_blocks_db_name());
+        sql.append("(CHAIN_ID BLOB PRIMARY KEY NOT NULL,HASH BLOB,NUMBER INTEGER);");
+
+        char *zErrMsg = nullptr;
+        int ok = sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, &zErrMsg);
+        if (ok != SQLITE_OK) {
+            sqlite3_free(zErrMsg);
+            return false;
+        }
+
+        return true;
     }
 
-    dht::public_key repository_impl::get_peer_from_state_db_randomly(const aux::bytes &chain_id) {
-        dht::public_key peer{};
+    bool repository_impl::get_head_block_pointer(const aux::bytes &chain_id, sha1_hash &hash, std::int64_t &number) {
+        bool found = false;
 
-        sqlite3_stmt * stmt;
-        std::string sql = "SELECT PUBKEY FROM ";
-        sql.append(state_db_name(chain_id));
-        sql.append(" ORDER BY RANDOM() limit 1");
+        std::string table = head_blocks_db_name();
+        std::string sql = "SELECT HASH,NUMBER FROM ";
+        sql.append(table);
+        sql.append(" WHERE CHAIN_ID=?");
 
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            if (sqlite3_step(stmt) == SQLITE_ROW) {
-                const char *pK = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
-                peer = dht::public_key(pK);
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+            sqlite3_bind_blob(stmt.get(), 1, chain_id.data(), chain_id.size(), nullptr);
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                hash = sha1_hash(p);
+                number = sqlite3_column_int64(stmt.get(), 1);
+                found = true;
             }
         }
 
-        sqlite3_finalize(stmt);
-
-        return peer;
+        return found;
     }
 
-    bool repository_impl::create_block_db(const aux::bytes &chain_id) {
-        std::string sql = "CREATE TABLE IF NOT EXISTS ";
-        sql.append(blocks_db_name(chain_id));
-        sql.append("(HASH BLOB PRIMARY KEY NOT NULL,CHAIN_ID BLOB,VERSION INT,TIMESTAMP INTEGER,NUMBER INTEGER,"
-                   "PREVIOUS_HASH BLOB,BASE_TARGET INTEGER,DIFFICULTY INTEGER,GENERATION_SIGNATURE BLOB,"
-                   "STATE_ROOT BLOB,NEWS_ROOT BLOB,TX BLOB,MINER BLOB,SIGNATURE BLOB,MAIN_CHAIN INT);");
+    bool repository_impl::set_head_block_pointer(const aux::bytes &chain_id, const sha1_hash &hash, std::int64_t number) {
+        std::string table = head_blocks_db_name();
+        std::string sql = "REPLACE INTO ";
+        sql.append(table);
+        sql.append(" VALUES(?,?,?)");
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_blob(stmt.get(), 1, chain_id.data(), chain_id.size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 2, hash.data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_int64(stmt.get(), 3, number);
 
-        char *zErrMsg = nullptr;
-        int ok = sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, &zErrMsg);
-        if (ok != SQLITE_OK) {
-            sqlite3_free(zErrMsg);
+        int ok = sqlite3_step(stmt.get());
+        if (ok != SQLITE_DONE) {
             return false;
         }
 
         return true;
     }
 
-    bool repository_impl::delete_block_db(const aux::bytes &chain_id) {
-        std::string sql = "DROP TABLE ";
-        sql.append(blocks_db_name(chain_id));
+    bool repository_impl::delete_head_block_pointer(const aux::bytes &chain_id) {
+        std::string table = head_blocks_db_name();
+        std::string sql = "DELETE FROM ";
+        sql.append(table);
+        sql.append(" WHERE CHAIN_ID=?");
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_blob(stmt.get(), 1, chain_id.data(), chain_id.size(), nullptr);
 
-        char *zErrMsg = nullptr;
-        int ok = sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, &zErrMsg);
-        if (ok != SQLITE_OK) {
-            sqlite3_free(zErrMsg);
+        int ok = sqlite3_step(stmt.get());
+        if (ok != SQLITE_DONE) {
             return false;
         }
 
         return true;
     }
 
+    bool repository_impl::refresh_head_block_pointer(const aux::bytes &chain_id) {
+        sha1_hash hash;
+        std::int64_t number = 0;
+        bool found = false;
+
+        {
+            std::string table = blocks_db_name(chain_id);
+            std::string sql = "SELECT HASH,NUMBER FROM ";
+            sql.append(table);
+            sql.append(" WHERE MAIN_CHAIN=1 ORDER BY NUMBER DESC LIMIT 1");
+
+            auto stmt = prepare_cached(table, sql);
+            if (!stmt) {
+                return false;
+            }
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                hash = sha1_hash(p);
+                number = sqlite3_column_int64(stmt.get(), 1);
+                found = true;
+            }
+        }
+
+        if (found) {
+            return set_head_block_pointer(chain_id, hash, number);
+        } else {
+            return delete_head_block_pointer(chain_id);
+        }
+    }
+
     std::string repository_impl::get_test_tx_string(const aux::bytes &chain_id) {
         std::string ret;
 
-        sqlite3_stmt * stmt;
-        std::string sql = "SELECT TX FROM ";
-        sql.append(blocks_db_name(chain_id));
-        sql.append(" WHERE MAIN_CHAIN=1 ORDER BY NUMBER DESC");
-
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            if (sqlite3_step(stmt) == SQLITE_ROW) {
-                auto tp = sqlite3_column_blob(stmt, 0);
-                auto length = sqlite3_column_bytes(stmt, 0);
+        bool encoded = encoded_block_table(chain_id);
+        std::string table = blocks_db_name(chain_id);
+        std::string sql = encoded ? "SELECT ENCODE FROM " : "SELECT TX FROM ";
+        sql.append(table);
+        sql.append(" WHERE MAIN_CHAIN=1 ORDER BY NUMBER DESC LIMIT 1");
+
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                if (encoded) {
+                    block blk = read_encoded_block(stmt.get(), 0);
+                    auto const& tx = blk.tx();
+                    if (!tx.empty()) {
+                        ret = tx.get_encode();
+                    }
+                    return ret;
+                }
+                auto tp = sqlite3_column_blob(stmt.get(), 0);
+                auto length = sqlite3_column_bytes(stmt.get(), 0);
                 if (length > 0) {
                     const char * p= static_cast<const char *>(tp);
 //                    aux::bytes temp(p, p + length);
@@ -662,24 +1443,30 @@ namespace libTAU::blockchain {
             }
         }
 
-        sqlite3_finalize(stmt);
-
         return ret;
     }
 
     int repository_impl::get_test_tx_size(const aux::bytes &chain_id) {
         int ret = 111;
 
-        sqlite3_stmt * stmt;
-        std::string sql = "SELECT TX FROM ";
-        sql.append(blocks_db_name(chain_id));
-        sql.append(" WHERE MAIN_CHAIN=1 ORDER BY NUMBER DESC");
+        if (encoded_block_table(chain_id)) {
+            std::string tx_encode = get_test_tx_string(chain_id);
+            if (!tx_encode.empty()) {
+                ret = static_cast<int>(strlen(tx_encode.c_str()));
+            }
+            return ret;
+        }
 
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            if (sqlite3_step(stmt) == SQLITE_ROW) {
-                auto tp = sqlite3_column_blob(stmt, 0);
-                auto length = sqlite3_column_bytes(stmt, 0);
+        std::string table = blocks_db_name(chain_id);
+        std::string sql = "SELECT TX FROM ";
+        sql.append(table);
+        sql.append(" WHERE MAIN_CHAIN=1 ORDER BY NUMBER DESC LIMIT 1");
+
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                auto tp = sqlite3_column_blob(stmt.get(), 0);
+                auto length = sqlite3_column_bytes(stmt.get(), 0);
                 if (length > 0) {
                     const char * p= static_cast<const char *>(tp);
                     ret = strlen(p);
@@ -687,377 +1474,437 @@ namespace libTAU::blockchain {
             }
         }
 
-        sqlite3_finalize(stmt);
-
         return ret;
     }
 
     block repository_impl::get_head_block(const aux::bytes &chain_id) {
-        block blk;
-
-        sqlite3_stmt * stmt;
-        std::string sql = "SELECT CHAIN_ID,VERSION,TIMESTAMP,NUMBER,PREVIOUS_HASH,BASE_TARGET,DIFFICULTY,GENERATION_SIGNATURE,STATE_ROOT,NEWS_ROOT,TX,MINER,SIGNATURE,HASH FROM ";
-        sql.append(blocks_db_name(chain_id));
-        sql.append(" WHERE MAIN_CHAIN=1 ORDER BY NUMBER DESC");
-
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            if (sqlite3_step(stmt) == SQLITE_ROW) {
-                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
-                auto length = sqlite3_column_bytes(stmt, 0);
-                aux::bytes chainID(p, p + length);
-
-                auto version = static_cast<block_version>(sqlite3_column_int(stmt, 1));
-
-                std::int64_t timestamp = sqlite3_column_int64(stmt, 2);
-                std::int64_t number = sqlite3_column_int64(stmt, 3);
-
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 4));
-                sha1_hash previous_hash(p);
-
-                auto base_target = static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 5));
-                auto difficulty = static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 6));
-
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 7));
-                sha1_hash generation_signature(p);
-
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 8));
-                sha1_hash state_root(p);
-
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 9));
-                sha1_hash news_root(p);
-
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 10));
-                length = sqlite3_column_bytes(stmt, 10);
-                transaction tx;
-                if (length > 0) {
-                    std::string tx_encode(p, length);
-                    tx = transaction(tx_encode);
-                }
-
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 11));
-                dht::public_key miner(p);
-
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 12));
-                dht::signature sig(p);
-
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 13));
-                sha1_hash hash(p);
-
-                blk = block(chainID, version, timestamp, number, previous_hash, base_target, difficulty, generation_signature, state_root, news_root, tx, miner, sig, hash);
-            }
+        sha1_hash hash;
+        std::int64_t number = 0;
+        if (!get_head_block_pointer(chain_id, hash, number)) {
+            return block();
         }
 
-        sqlite3_finalize(stmt);
-
-        return blk;
+        return get_block_by_hash(chain_id, hash);
     }
 
     block repository_impl::get_block_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
+        auto cached = m_block_cache.get(chain_id, hash);
+        if (cached) {
+            return *cached;
+        }
+
         block blk;
 
-        sqlite3_stmt * stmt;
-        std::string sql = "SELECT CHAIN_ID,VERSION,TIMESTAMP,NUMBER,PREVIOUS_HASH,BASE_TARGET,DIFFICULTY,GENERATION_SIGNATURE,STATE_ROOT,NEWS_ROOT,TX,MINER,SIGNATURE FROM ";
-        sql.append(blocks_db_name(chain_id));
+        bool encoded = encoded_block_table(chain_id);
+        std::string table = blocks_db_name(chain_id);
+        std::string sql = encoded ? "SELECT ENCODE,MAIN_CHAIN FROM "
+            : "SELECT CHAIN_ID,VERSION,TIMESTAMP,NUMBER,PREVIOUS_HASH,BASE_TARGET,DIFFICULTY,GENERATION_SIGNATURE,STATE_ROOT,NEWS_ROOT,TX,MINER,SIGNATURE,MAIN_CHAIN FROM ";
+        sql.append(table);
         sql.append(" WHERE HASH=?");
 
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            sqlite3_bind_blob(stmt, 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
-            if (sqlite3_step(stmt) == SQLITE_ROW) {
-                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
-                auto length = sqlite3_column_bytes(stmt, 0);
-                aux::bytes chainID(p, p + length);
-
-                auto version = static_cast<block_version>(sqlite3_column_int(stmt, 1));
-
-                std::int64_t timestamp = sqlite3_column_int64(stmt, 2);
-                std::int64_t number = sqlite3_column_int64(stmt, 3);
-
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 4));
-                sha1_hash previous_hash(p);
-
-                auto base_target = static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 5));
-                auto difficulty = static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 6));
-
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 7));
-                sha1_hash generation_signature(p);
-
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 8));
-                sha1_hash state_root(p);
-
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 9));
-                sha1_hash news_root(p);
-
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 10));
-                length = sqlite3_column_bytes(stmt, 10);
-                transaction tx;
-                if (length > 0) {
-                    std::string tx_encode(p, length);
-                    tx = transaction(tx_encode);
-                }
-
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 11));
-                dht::public_key miner(p);
-
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 12));
-                dht::signature sig(p);
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
+            // the table may have been dropped and created again since
+            m_encoded_block_tables.erase(chain_id);
+            return blk;
+        }
+
+        sqlite3_bind_blob(stmt.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
+        if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+            int const main_chain_column = encoded ? 1 : 13;
+            // rough memory footprint: the object, chain id and encoding or tx payload
+            std::int64_t size = sizeof(block);
+            if (encoded) {
+                blk = read_encoded_block(stmt.get(), 0);
+                size += blk.chain_id().size() + sqlite3_column_bytes(stmt.get(), 0);
+            } else {
+                blk = read_block_columns(stmt.get(), hash);
+                size += blk.chain_id().size() + sqlite3_column_bytes(stmt.get(), 10);
+            }
 
-                blk = block(chainID, version, timestamp, number, previous_hash, base_target, difficulty, generation_signature, state_root, news_root, tx, miner, sig, hash);
+            if (m_block_cache.enabled() && !blk.empty()) {
+                bool main_chain = sqlite3_column_int(stmt.get(), main_chain_column) != 0;
+                m_block_cache.put(std::make_shared<const block>(blk), main_chain, size);
             }
         }
 
-        sqlite3_finalize(stmt);
-
         return blk;
     }
 
     bool repository_impl::save_block_if_not_exist(const block &blk) {
         const auto& chain_id = blk.chain_id();
-        sqlite3_stmt * stmt;
+        std::string table = blocks_db_name(chain_id);
+        if (encoded_block_table(chain_id)) {
+            // a block is identified by its hash, an existing one is kept as is
+            std::string sql = "INSERT OR IGNORE INTO ";
+            sql.append(table);
+            sql.append(" VALUES(?,?,?,?)");
+            auto stmt = prepare_cached(table, sql);
+            if (!stmt) {
+                return false;
+            }
+
+            std::string encode = blk.get_encode();
+            sqlite3_bind_blob(stmt.get(), 1, blk.sha1().data(), libTAU::sha1_hash::size(), nullptr);
+            sqlite3_bind_int64(stmt.get(), 2, blk.block_number());
+            sqlite3_bind_int(stmt.get(), 3, 0);
+            sqlite3_bind_blob(stmt.get(), 4, encode.data(), encode.size(), nullptr);
+
+            return sqlite3_step(stmt.get()) == SQLITE_DONE;
+        }
+
         std::string sql = "INSERT INTO ";
-        sql.append(blocks_db_name(chain_id));
+        sql.append(table);
         sql.append(" (HASH,CHAIN_ID,VERSION,TIMESTAMP,NUMBER,PREVIOUS_HASH,BASE_TARGET,DIFFICULTY,GENERATION_SIGNATURE,"
                    "STATE_ROOT,NEWS_ROOT,TX,MINER,SIGNATURE,MAIN_CHAIN) SELECT ?,?,?,?,?,?,?,?,?,?,?,?,?,?,? WHERE NOT EXISTS(SELECT * FROM ");
-        sql.append(blocks_db_name(chain_id));
+        sql.append(table);
         sql.append(" WHERE HASH=?)");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
-            return false;
-        }
-
-        sqlite3_bind_blob(stmt, 1, blk.sha1().data(), libTAU::sha1_hash::size(), nullptr);
-        sqlite3_bind_blob(stmt, 2, chain_id.data(), chain_id.size(), nullptr);
-        sqlite3_bind_int(stmt, 3, blk.version());
-        sqlite3_bind_int64(stmt, 4, blk.timestamp());
-        sqlite3_bind_int64(stmt, 5, blk.block_number());
-        sqlite3_bind_blob(stmt, 6, blk.previous_block_hash().data(), libTAU::sha1_hash::size(), nullptr);
-        sqlite3_bind_int64(stmt, 7, static_cast<std::int64_t>(blk.base_target()));
-        sqlite3_bind_int64(stmt, 8, static_cast<std::int64_t>(blk.cumulative_difficulty()));
-        sqlite3_bind_blob(stmt, 9, blk.generation_signature().data(), libTAU::sha1_hash::size(), nullptr);
-        sqlite3_bind_blob(stmt, 10, blk.multiplex_hash().data(), libTAU::sha1_hash::size(), nullptr);
-        sqlite3_bind_blob(stmt, 11, blk.news_root().data(), libTAU::sha1_hash::size(), nullptr);
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
+            return false;
+        }
+
+        sqlite3_bind_blob(stmt.get(), 1, blk.sha1().data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 2, chain_id.data(), chain_id.size(), nullptr);
+        sqlite3_bind_int(stmt.get(), 3, blk.version());
+        sqlite3_bind_int64(stmt.get(), 4, blk.timestamp());
+        sqlite3_bind_int64(stmt.get(), 5, blk.block_number());
+        sqlite3_bind_blob(stmt.get(), 6, blk.previous_block_hash().data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_int64(stmt.get(), 7, static_cast<std::int64_t>(blk.base_target()));
+        sqlite3_bind_int64(stmt.get(), 8, static_cast<std::int64_t>(blk.cumulative_difficulty()));
+        sqlite3_bind_blob(stmt.get(), 9, blk.generation_signature().data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 10, blk.multiplex_hash().data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 11, blk.news_root().data(), libTAU::sha1_hash::size(), nullptr);
         if (blk.tx().empty()) {
-            sqlite3_bind_null(stmt, 12);
+            sqlite3_bind_null(stmt.get(), 12);
         } else {
             std::string tx_encode = blk.tx().get_encode();
-            sqlite3_bind_blob(stmt, 12, tx_encode.data(), tx_encode.size(), SQLITE_TRANSIENT);
+            sqlite3_bind_blob(stmt.get(), 12, tx_encode.data(), tx_encode.size(), SQLITE_TRANSIENT);
         }
-        sqlite3_bind_blob(stmt, 13, blk.miner().bytes.data(), dht::public_key::len, nullptr);
-        sqlite3_bind_blob(stmt, 14, blk.signature().bytes.data(), dht::signature::len, nullptr);
-        sqlite3_bind_int(stmt, 15, 0);
+        sqlite3_bind_blob(stmt.get(), 13, blk.miner().bytes.data(), dht::public_key::len, nullptr);
+        sqlite3_bind_blob(stmt.get(), 14, blk.signature().bytes.data(), dht::signature::len, nullptr);
+        sqlite3_bind_int(stmt.get(), 15, 0);
 
-        sqlite3_bind_blob(stmt, 16, blk.sha1().data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 16, blk.sha1().data(), libTAU::sha1_hash::size(), nullptr);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
 
     bool repository_impl::save_main_chain_block(const block &blk) {
         const auto& chain_id = blk.chain_id();
-        sqlite3_stmt * stmt;
-        std::string sql = "REPLACE INTO ";
-        sql.append(blocks_db_name(chain_id));
-        sql.append(" VALUES(?,?,?,?,?,?,?,?,?,?,?,?,?,?,?)");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        if (encoded_block_table(chain_id)) {
+            std::string table = blocks_db_name(chain_id);
+            std::string sql = "REPLACE INTO ";
+            sql.append(table);
+            sql.append(" VALUES(?,?,?,?)");
+            auto stmt = prepare_cached(table, sql);
+            if (!stmt) {
+                return false;
+            }
+
+            std::string encode = blk.get_encode();
+            sqlite3_bind_blob(stmt.get(), 1, blk.sha1().data(), libTAU::sha1_hash::size(), nullptr);
+            sqlite3_bind_int64(stmt.get(), 2, blk.block_number());
+            sqlite3_bind_int(stmt.get(), 3, 1);
+            sqlite3_bind_blob(stmt.get(), 4, encode.data(), encode.size(), nullptr);
+
+            if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+                return false;
+            }
+        } else if (!save_main_chain_block_columns(blk)) {
             return false;
         }
 
-        sqlite3_bind_blob(stmt, 1, blk.sha1().data(), libTAU::sha1_hash::size(), nullptr);
-        sqlite3_bind_blob(stmt, 2, chain_id.data(), chain_id.size(), nullptr);
-        sqlite3_bind_int(stmt, 3, blk.version());
-        sqlite3_bind_int64(stmt, 4, blk.timestamp());
-        sqlite3_bind_int64(stmt, 5, blk.block_number());
-        sqlite3_bind_blob(stmt, 6, blk.previous_block_hash().data(), libTAU::sha1_hash::size(), nullptr);
-        sqlite3_bind_int64(stmt, 7, static_cast<std::int64_t>(blk.base_target()));
-        sqlite3_bind_int64(stmt, 8, static_cast<std::int64_t>(blk.cumulative_difficulty()));
-        sqlite3_bind_blob(stmt, 9, blk.generation_signature().data(), libTAU::sha1_hash::size(), nullptr);
-        sqlite3_bind_blob(stmt, 10, blk.multiplex_hash().data(), libTAU::sha1_hash::size(), nullptr);
-        sqlite3_bind_blob(stmt, 11, blk.news_root().data(), libTAU::sha1_hash::size(), nullptr);
+        m_block_cache.set_main_chain(chain_id, blk.sha1(), true);
+
+        sha1_hash head_hash;
+        std::int64_t head_number = 0;
+        if (!get_head_block_pointer(chain_id, head_hash, head_number) || blk.block_number() >= head_number) {
+            return set_head_block_pointer(chain_id, blk.sha1(), blk.block_number());
+        }
+
+        return true;
+    }
+
+    bool repository_impl::save_main_chain_block_columns(const block &blk) {
+        const auto& chain_id = blk.chain_id();
+        std::string table = blocks_db_name(chain_id);
+        std::string sql = "REPLACE INTO ";
+        sql.append(table);
+        sql.append(" VALUES(?,?,?,?,?,?,?,?,?,?,?,?,?,?,?)");
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
+            return false;
+        }
+
+        sqlite3_bind_blob(stmt.get(), 1, blk.sha1().data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 2, chain_id.data(), chain_id.size(), nullptr);
+        sqlite3_bind_int(stmt.get(), 3, blk.version());
+        sqlite3_bind_int64(stmt.get(), 4, blk.timestamp());
+        sqlite3_bind_int64(stmt.get(), 5, blk.block_number());
+        sqlite3_bind_blob(stmt.get(), 6, blk.previous_block_hash().data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_int64(stmt.get(), 7, static_cast<std::int64_t>(blk.base_target()));
+        sqlite3_bind_int64(stmt.get(), 8, static_cast<std::int64_t>(blk.cumulative_difficulty()));
+        sqlite3_bind_blob(stmt.get(), 9, blk.generation_signature().data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 10, blk.multiplex_hash().data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 11, blk.news_root().data(), libTAU::sha1_hash::size(), nullptr);
         if (blk.tx().empty()) {
-            sqlite3_bind_null(stmt, 12);
+            sqlite3_bind_null(stmt.get(), 12);
         } else {
             auto tx_encode = blk.tx().get_encode();
-            sqlite3_bind_blob(stmt, 12, tx_encode.data(), tx_encode.size(), SQLITE_TRANSIENT);
+            sqlite3_bind_blob(stmt.get(), 12, tx_encode.data(), tx_encode.size(), SQLITE_TRANSIENT);
         }
-        sqlite3_bind_blob(stmt, 13, blk.miner().bytes.data(), dht::public_key::len, nullptr);
-        sqlite3_bind_blob(stmt, 14, blk.signature().bytes.data(), dht::signature::len, nullptr);
-        sqlite3_bind_int(stmt, 15, 1);
+        sqlite3_bind_blob(stmt.get(), 13, blk.miner().bytes.data(), dht::public_key::len, nullptr);
+        sqlite3_bind_blob(stmt.get(), 14, blk.signature().bytes.data(), dht::signature::len, nullptr);
+        sqlite3_bind_int(stmt.get(), 15, 1);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
 
     bool repository_impl::delete_block_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
-        sqlite3_stmt * stmt;
+        m_block_cache.erase(chain_id, hash);
+
+        std::string table = blocks_db_name(chain_id);
         std::string sql = "DELETE FROM ";
-        sql.append(blocks_db_name(chain_id));
+        sql.append(table);
         sql.append(" WHERE HASH=?");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
-        sqlite3_bind_blob(stmt, 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
-        return true;
+        return refresh_head_block_pointer(chain_id);
     }
 
     block repository_impl::get_main_chain_block_by_number(const aux::bytes &chain_id, std::int64_t block_number) {
         block blk;
 
-        sqlite3_stmt * stmt;
-        std::string sql = "SELECT CHAIN_ID,VERSION,TIMESTAMP,NUMBER,PREVIOUS_HASH,BASE_TARGET,DIFFICULTY,GENERATION_SIGNATURE,STATE_ROOT,NEWS_ROOT,TX,MINER,SIGNATURE,HASH FROM ";
-        sql.append(blocks_db_name(chain_id));
+        bool encoded = encoded_block_table(chain_id);
+        std::string table = blocks_db_name(chain_id);
+        std::string sql = encoded ? "SELECT ENCODE FROM "
+            : "SELECT CHAIN_ID,VERSION,TIMESTAMP,NUMBER,PREVIOUS_HASH,BASE_TARGET,DIFFICULTY,GENERATION_SIGNATURE,STATE_ROOT,NEWS_ROOT,TX,MINER,SIGNATURE,HASH FROM ";
+        sql.append(table);
         sql.append(" WHERE NUMBER=? AND MAIN_CHAIN=1");
 
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            sqlite3_bind_int64(stmt, 1, block_number);
-            if (sqlite3_step(stmt) == SQLITE_ROW) {
-                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
-                auto length = sqlite3_column_bytes(stmt, 0);
-                aux::bytes chainID(p, p + length);
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
+            // the table may have been dropped and created again since
+            m_encoded_block_tables.erase(chain_id);
+            return blk;
+        }
+
+        sqlite3_bind_int64(stmt.get(), 1, block_number);
+        if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+            if (encoded) {
+                blk = read_encoded_block(stmt.get(), 0);
+            } else {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 13));
+                blk = read_block_columns(stmt.get(), sha1_hash(p));
+            }
+        }
 
-                auto version = static_cast<block_version>(sqlite3_column_int(stmt, 1));
+        return blk;
+    }
 
-                std::int64_t timestamp = sqlite3_column_int64(stmt, 2);
-                std::int64_t number = sqlite3_column_int64(stmt, 3);
+    bool repository_impl::delete_all_blocks_less_than_number(const aux::bytes &chain_id, std::int64_t block_number) {
+        m_block_cache.erase_less_than_number(chain_id, block_number);
 
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 4));
-                sha1_hash previous_hash(p);
+        std::string table = blocks_db_name(chain_id);
+        std::string sql = "DELETE FROM ";
+        sql.append(table);
+        sql.append(" WHERE NUMBER<=?");
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, block_number);
 
-                auto base_target = static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 5));
-                auto difficulty = static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 6));
+        int ok = sqlite3_step(stmt.get());
+        if (ok != SQLITE_DONE) {
+            return false;
+        }
 
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 7));
-                sha1_hash generation_signature(p);
+        return refresh_head_block_pointer(chain_id);
+    }
 
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 8));
-                sha1_hash state_root(p);
+    int repository_impl::prune_blocks(const aux::bytes &chain_id, std::int64_t main_number, std::int64_t side_number, int limit) {
+        std::vector<sha1_hash> hashes;
+        std::string table = blocks_db_name(chain_id);
 
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 9));
-                sha1_hash news_root(p);
+        auto collect = [&](cached_stmt stmt) {
+            if (!stmt) {
+                return false;
+            }
 
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 10));
-                length = sqlite3_column_bytes(stmt, 10);
-                transaction tx;
-                if (length > 0) {
-                    std::string tx_encode(p, length);
-                    tx = transaction(tx_encode);
+            int ok;
+            while ((ok = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                if (p != nullptr && sqlite3_column_bytes(stmt.get(), 0) == libTAU::sha1_hash::size()) {
+                    hashes.emplace_back(p);
                 }
+            }
+
+            return ok == SQLITE_DONE;
+        };
+
+        // old blocks first, by the number index
+        {
+            std::string sql = "SELECT HASH FROM ";
+            sql.append(table);
+            sql.append(" WHERE NUMBER<? LIMIT ?");
+            auto stmt = prepare_cached(table, sql);
+            if (stmt) {
+                sqlite3_bind_int64(stmt.get(), 1, main_number);
+                sqlite3_bind_int(stmt.get(), 2, limit);
+            }
+            if (!collect(std::move(stmt))) {
+                return -1;
+            }
+        }
+
+        // then orphaned side branches, by the main chain index
+        if (static_cast<int>(hashes.size()) < limit && side_number > main_number) {
+            std::string sql = "SELECT HASH FROM ";
+            sql.append(table);
+            sql.append(" WHERE MAIN_CHAIN=0 AND NUMBER>=? AND NUMBER<? LIMIT ?");
+            auto stmt = prepare_cached(table, sql);
+            if (stmt) {
+                sqlite3_bind_int64(stmt.get(), 1, main_number);
+                sqlite3_bind_int64(stmt.get(), 2, side_number);
+                sqlite3_bind_int(stmt.get(), 3, limit - static_cast<int>(hashes.size()));
+            }
+            if (!collect(std::move(stmt))) {
+                return -1;
+            }
+        }
 
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 11));
-                dht::public_key miner(p);
+        if (hashes.empty()) {
+            return 0;
+        }
 
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 12));
-                dht::signature sig(p);
+        std::string sql = "DELETE FROM ";
+        sql.append(table);
+        sql.append(" WHERE HASH=?");
+        for (auto const &hash: hashes) {
+            m_block_cache.erase(chain_id, hash);
 
-                p = static_cast<const char *>(sqlite3_column_blob(stmt, 13));
-                sha1_hash hash(p);
+            auto stmt = prepare_cached(table, sql);
+            if (!stmt) {
+                return -1;
+            }
+            sqlite3_bind_blob(stmt.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
 
-                blk = block(chainID, version, timestamp, number, previous_hash, base_target, difficulty, generation_signature, state_root, news_root, tx, miner, sig, hash);
+            if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+                return -1;
             }
         }
 
-        sqlite3_finalize(stmt);
+        if (!refresh_head_block_pointer(chain_id)) {
+            return -1;
+        }
 
-        return blk;
+        return static_cast<int>(hashes.size());
     }
 
-    bool repository_impl::delete_all_blocks_less_than_number(const aux::bytes &chain_id, std::int64_t block_number) {
-        sqlite3_stmt * stmt;
-        std::string sql = "DELETE FROM ";
-        sql.append(blocks_db_name(chain_id));
-        sql.append(" WHERE NUMBER<=?");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
-            return false;
+    std::vector<sha1_hash> repository_impl::get_side_branch_block_hashes(const aux::bytes &chain_id, std::int64_t block_number) {
+        std::vector<sha1_hash> hashes;
+
+        std::string table = blocks_db_name(chain_id);
+        std::string sql = "SELECT HASH FROM ";
+        sql.append(table);
+        sql.append(" WHERE MAIN_CHAIN=0 AND NUMBER>=?");
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
+            return hashes;
         }
-        sqlite3_bind_int64(stmt, 1, block_number);
+        sqlite3_bind_int64(stmt.get(), 1, block_number);
 
-        ok = sqlite3_step(stmt);
-        if (ok != SQLITE_DONE) {
-            return false;
+        while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+            const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+            if (p != nullptr && sqlite3_column_bytes(stmt.get(), 0) == libTAU::sha1_hash::size()) {
+                hashes.emplace_back(p);
+            }
         }
-        sqlite3_finalize(stmt);
 
-        return true;
+        return hashes;
     }
 
     bool repository_impl::set_block_non_main_chain(const aux::bytes &chain_id, const sha1_hash &hash) {
-        sqlite3_stmt * stmt;
+        std::string table = blocks_db_name(chain_id);
         std::string sql = "UPDATE ";
-        sql.append(blocks_db_name(chain_id));
+        sql.append(table);
         sql.append(" SET MAIN_CHAIN=0 WHERE HASH=?");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
-        sqlite3_bind_blob(stmt, 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
-        return true;
+        m_block_cache.set_main_chain(chain_id, hash, false);
+
+        return refresh_head_block_pointer(chain_id);
     }
 
     bool repository_impl::set_block_main_chain(const aux::bytes &chain_id, const sha1_hash &hash) {
-        sqlite3_stmt * stmt;
+        std::string table = blocks_db_name(chain_id);
         std::string sql = "UPDATE ";
-        sql.append(blocks_db_name(chain_id));
+        sql.append(table);
         sql.append(" SET MAIN_CHAIN=1 WHERE HASH=?");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
-        sqlite3_bind_blob(stmt, 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
-        return true;
+        m_block_cache.set_main_chain(chain_id, hash, true);
+
+        return refresh_head_block_pointer(chain_id);
     }
 
     bool repository_impl::set_all_block_non_main_chain(const aux::bytes &chain_id) {
-        sqlite3_stmt * stmt;
+        std::string table = blocks_db_name(chain_id);
         std::string sql = "UPDATE ";
-        sql.append(blocks_db_name(chain_id));
+        sql.append(table);
         sql.append(" SET MAIN_CHAIN=0");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
-        return true;
+        m_block_cache.set_all_non_main_chain(chain_id);
+
+        return delete_head_block_pointer(chain_id);
     }
 
     bool repository_impl::create_peer_db(const aux::bytes &chain_id) {
@@ -1076,6 +1923,7 @@ namespace libTAU::blockchain {
     }
 
     bool repository_impl::delete_peer_db(const aux::bytes &chain_id) {
+        invalidate_stmt_cache(peer_db_name(chain_id));
         std::string sql = "DROP TABLE ";
         sql.append(peer_db_name(chain_id));
 
@@ -1090,101 +1938,73 @@ namespace libTAU::blockchain {
     }
 
     dht::public_key repository_impl::get_peer_from_peer_db_randomly(const aux::bytes &chain_id) {
-        dht::public_key peer{};
-
-        sqlite3_stmt * stmt;
-        std::string sql = "SELECT PUBKEY FROM ";
-        sql.append(peer_db_name(chain_id));
-        sql.append(" ORDER BY RANDOM() limit 1");
-
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            if (sqlite3_step(stmt) == SQLITE_ROW) {
-                const char *pK = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
-                peer = dht::public_key(pK);
-            }
+        auto peers = sample_pubkeys(peer_db_name(chain_id), 1);
+        if (peers.empty()) {
+            return dht::public_key{};
         }
 
-        sqlite3_finalize(stmt);
-
-        return peer;
+        return *peers.begin();
     }
 
     std::set<dht::public_key> repository_impl::get_enough_peers_from_peer_db_randomly(const aux::bytes &chain_id) {
-        std::set<dht::public_key> peers;
-
-        sqlite3_stmt * stmt;
-        std::string sql = "SELECT PUBKEY FROM ";
-        sql.append(peer_db_name(chain_id));
-        sql.append(" ORDER BY RANDOM() limit 10");
-
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            for (;sqlite3_step(stmt) == SQLITE_ROW;) {
-                const char *pK = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
-                peers.insert(dht::public_key(pK));
-            }
-        }
-
-        sqlite3_finalize(stmt);
+        return sample_pubkeys(peer_db_name(chain_id), 10);
+    }
 
-        return peers;
+    std::set<dht::public_key> repository_impl::get_peers_from_peer_db_randomly(const aux::bytes &chain_id, int num) {
+        return sample_pubkeys(peer_db_name(chain_id), num);
     }
 
     bool repository_impl::delete_peer_in_peer_db(const aux::bytes &chain_id, const dht::public_key &pubKey) {
-        sqlite3_stmt * stmt;
+        std::string table = peer_db_name(chain_id);
         std::string sql = "DELETE FROM ";
-        sql.append(peer_db_name(chain_id));
+        sql.append(table);
         sql.append(" WHERE PUBKEY=?");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
-        sqlite3_bind_blob(stmt, 1, pubKey.bytes.data(), dht::public_key::len, nullptr);
+        sqlite3_bind_blob(stmt.get(), 1, pubKey.bytes.data(), dht::public_key::len, nullptr);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
 
     bool repository_impl::add_peer_in_peer_db(const aux::bytes &chain_id, const dht::public_key &pubKey) {
-        sqlite3_stmt * stmt;
+        std::string table = peer_db_name(chain_id);
         std::string sql = "REPLACE INTO ";
-        sql.append(peer_db_name(chain_id));
+        sql.append(table);
         sql.append(" VALUES(?)");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
-        sqlite3_bind_blob(stmt, 1, pubKey.bytes.data(), dht::public_key::len, nullptr);
+        sqlite3_bind_blob(stmt.get(), 1, pubKey.bytes.data(), dht::public_key::len, nullptr);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
 
     bool repository_impl::clear_peer_db(const aux::bytes &chain_id) {
-        sqlite3_stmt * stmt;
+        std::string table = peer_db_name(chain_id);
         std::string sql = "DELETE FROM ";
-        sql.append(peer_db_name(chain_id));
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        sql.append(table);
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
@@ -1205,6 +2025,7 @@ namespace libTAU::blockchain {
     }
 
     bool repository_impl::delete_acl_db(const aux::bytes &chain_id) {
+        invalidate_stmt_cache(acl_db_name(chain_id));
         std::string sql = "DROP TABLE ";
         sql.append(acl_db_name(chain_id));
 
@@ -1221,57 +2042,53 @@ namespace libTAU::blockchain {
     std::set<dht::public_key> repository_impl::get_all_peer_in_acl_db(const aux::bytes &chain_id) {
         std::set<dht::public_key> peers;
 
-        sqlite3_stmt * stmt;
+        std::string table = acl_db_name(chain_id);
         std::string sql = "SELECT PUBKEY FROM ";
-        sql.append(acl_db_name(chain_id));
+        sql.append(table);
 
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            for (;sqlite3_step(stmt) == SQLITE_ROW;) {
-                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+            for (;sqlite3_step(stmt.get()) == SQLITE_ROW;) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
                 peers.insert(dht::public_key(p));
             }
         }
 
-        sqlite3_finalize(stmt);
-
         return peers;
     }
 
     bool repository_impl::clear_acl_db(const aux::bytes &chain_id) {
-        sqlite3_stmt * stmt;
+        std::string table = acl_db_name(chain_id);
         std::string sql = "DELETE FROM ";
-        sql.append(acl_db_name(chain_id));
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        sql.append(table);
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
 
     bool repository_impl::add_peer_in_acl_db(const aux::bytes &chain_id, const dht::public_key &pubKey) {
-        sqlite3_stmt * stmt;
+        std::string table = acl_db_name(chain_id);
         std::string sql = "REPLACE INTO ";
-        sql.append(acl_db_name(chain_id));
+        sql.append(table);
         sql.append(" VALUES(?)");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
-        sqlite3_bind_blob(stmt, 1, pubKey.bytes.data(), dht::public_key::len, nullptr);
+        sqlite3_bind_blob(stmt.get(), 1, pubKey.bytes.data(), dht::public_key::len, nullptr);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
@@ -1292,6 +2109,7 @@ namespace libTAU::blockchain {
     }
 
     bool repository_impl::delete_online_list_db(const aux::bytes &chain_id) {
+        invalidate_stmt_cache(online_list_db_name(chain_id));
         std::string sql = "DROP TABLE ";
         sql.append(online_list_db_name(chain_id));
 
@@ -1308,57 +2126,53 @@ namespace libTAU::blockchain {
     std::set<dht::public_key> repository_impl::get_all_peer_in_online_list_db(const aux::bytes &chain_id) {
         std::set<dht::public_key> peers;
 
-        sqlite3_stmt * stmt;
+        std::string table = online_list_db_name(chain_id);
         std::string sql = "SELECT PUBKEY FROM ";
-        sql.append(online_list_db_name(chain_id));
+        sql.append(table);
 
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            for (;sqlite3_step(stmt) == SQLITE_ROW;) {
-                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+            for (;sqlite3_step(stmt.get()) == SQLITE_ROW;) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
                 peers.insert(dht::public_key(p));
             }
         }
 
-        sqlite3_finalize(stmt);
-
         return peers;
     }
 
     bool repository_impl::clear_online_list_db(const aux::bytes &chain_id) {
-        sqlite3_stmt * stmt;
+        std::string table = online_list_db_name(chain_id);
         std::string sql = "DELETE FROM ";
-        sql.append(online_list_db_name(chain_id));
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        sql.append(table);
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
 
     bool repository_impl::add_peer_in_online_list_db(const aux::bytes &chain_id, const dht::public_key &pubKey) {
-        sqlite3_stmt * stmt;
+        std::string table = online_list_db_name(chain_id);
         std::string sql = "REPLACE INTO ";
-        sql.append(online_list_db_name(chain_id));
+        sql.append(table);
         sql.append(" VALUES(?)");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
-        sqlite3_bind_blob(stmt, 1, pubKey.bytes.data(), dht::public_key::len, nullptr);
+        sqlite3_bind_blob(stmt.get(), 1, pubKey.bytes.data(), dht::public_key::len, nullptr);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
@@ -1379,6 +2193,7 @@ namespace libTAU::blockchain {
     }
 
     bool repository_impl::delete_community_info_db() {
+        invalidate_stmt_cache(community_info_db_name());
         std::string sql = "DROP TABLE ";
         sql.append(community_info_db_name());
 
@@ -1393,23 +2208,22 @@ namespace libTAU::blockchain {
     }
 
     bool repository_impl::update_touching_time(const aux::bytes &chain_id, std::int64_t touching_time) {
-        sqlite3_stmt * stmt;
+        std::string table = community_info_db_name();
         std::string sql = "REPLACE INTO ";
-        sql.append(community_info_db_name());
+        sql.append(table);
         sql.append(" VALUES(?,?)");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
 
-        sqlite3_bind_blob(stmt, 1, chain_id.data(), chain_id.size(), nullptr);
-        sqlite3_bind_int64(stmt, 2, touching_time);
+        sqlite3_bind_blob(stmt.get(), 1, chain_id.data(), chain_id.size(), nullptr);
+        sqlite3_bind_int64(stmt.get(), 2, touching_time);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
@@ -1417,40 +2231,37 @@ namespace libTAU::blockchain {
     int64_t repository_impl::get_touching_time(const aux::bytes &chain_id) {
         std::int64_t touching_time{};
 
-        sqlite3_stmt * stmt;
+        std::string table = community_info_db_name();
         std::string sql = "SELECT TOUCHING_TIME FROM ";
-        sql.append(community_info_db_name());
+        sql.append(table);
         sql.append(" WHERE CHAIN_ID=?");
 
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            sqlite3_bind_blob(stmt, 1, chain_id.data(), chain_id.size(), nullptr);
-            if (sqlite3_step(stmt) == SQLITE_ROW) {
-                touching_time = sqlite3_column_int64(stmt, 0);
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+            sqlite3_bind_blob(stmt.get(), 1, chain_id.data(), chain_id.size(), nullptr);
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                touching_time = sqlite3_column_int64(stmt.get(), 0);
             }
         }
 
-        sqlite3_finalize(stmt);
-
         return touching_time;
     }
 
     bool repository_impl::delete_touching_time(const aux::bytes &chain_id) {
-        sqlite3_stmt * stmt;
+        std::string table = community_info_db_name();
         std::string sql = "DELETE FROM ";
-        sql.append(community_info_db_name());
+        sql.append(table);
         sql.append(" WHERE CHAIN_ID=?");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
-        sqlite3_bind_blob(stmt, 1, chain_id.data(), chain_id.size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 1, chain_id.data(), chain_id.size(), nullptr);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
@@ -1471,6 +2282,7 @@ namespace libTAU::blockchain {
     }
 
     bool repository_impl::delete_news_tx_db(const aux::bytes &chain_id) {
+        invalidate_stmt_cache(news_txs_db_name(chain_id));
         std::string sql = "DROP TABLE ";
         sql.append(news_txs_db_name(chain_id));
 
@@ -1485,25 +2297,24 @@ namespace libTAU::blockchain {
     }
 
     bool repository_impl::save_news_tx(const aux::bytes &chain_id, const transaction &tx) {
-        sqlite3_stmt * stmt;
+        std::string table = news_txs_db_name(chain_id);
         std::string sql = "REPLACE INTO ";
-        sql.append(news_txs_db_name(chain_id));
+        sql.append(table);
         sql.append(" VALUES(?,?,?)");
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok != SQLITE_OK) {
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
             return false;
         }
         sha1_hash hash = tx.sha1();
         std::string e = tx.get_encode();
-        sqlite3_bind_blob(stmt, 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
-        sqlite3_bind_int64(stmt, 2, tx.timestamp());
-        sqlite3_bind_blob(stmt, 3, e.data(), e.size(), nullptr);
+        sqlite3_bind_blob(stmt.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_int64(stmt.get(), 2, tx.timestamp());
+        sqlite3_bind_blob(stmt.get(), 3, e.data(), e.size(), nullptr);
 
-        ok = sqlite3_step(stmt);
+        int ok = sqlite3_step(stmt.get());
         if (ok != SQLITE_DONE) {
             return false;
         }
-        sqlite3_finalize(stmt);
 
         return true;
     }
@@ -1511,50 +2322,46 @@ namespace libTAU::blockchain {
     transaction repository_impl::get_news_tx_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
         transaction tx;
 
-        sqlite3_stmt * stmt;
+        std::string table = news_txs_db_name(chain_id);
         std::string sql = "SELECT VALUE FROM ";
-        sql.append(news_txs_db_name(chain_id));
+        sql.append(table);
         sql.append(" WHERE HASH=?");
 
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            sqlite3_bind_blob(stmt, 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
-            if (sqlite3_step(stmt) == SQLITE_ROW) {
-                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
-                auto length = sqlite3_column_bytes(stmt, 0);
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+            sqlite3_bind_blob(stmt.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                auto length = sqlite3_column_bytes(stmt.get(), 0);
 
                 std::string encode(p, p + length);
                 tx = transaction(encode);
             }
         }
 
-        sqlite3_finalize(stmt);
-
         return tx;
     }
 
     std::vector<transaction> repository_impl::get_latest_news_txs(const aux::bytes &chain_id) {
         std::vector<transaction> txs;
 
-        sqlite3_stmt * stmt;
+        std::string table = news_txs_db_name(chain_id);
         std::string sql = "SELECT VALUE FROM ";
-        sql.append(news_txs_db_name(chain_id));
+        sql.append(table);
         sql.append(" ORDER BY TIMESTAMP DESC LIMIT ?");
 
-        int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-        if (ok == SQLITE_OK) {
-            sqlite3_bind_int(stmt, 1, MAX_NEWS_SIZE_IN_GENESIS_BLOCK);
-            for (;sqlite3_step(stmt) == SQLITE_ROW;) {
-                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
-                auto length = sqlite3_column_bytes(stmt, 0);
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+            sqlite3_bind_int(stmt.get(), 1, MAX_NEWS_SIZE_IN_GENESIS_BLOCK);
+            for (;sqlite3_step(stmt.get()) == SQLITE_ROW;) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                auto length = sqlite3_column_bytes(stmt.get(), 0);
 
                 std::string encode(p, p + length);
                 txs.emplace_back(encode);
             }
         }
 
-        sqlite3_finalize(stmt);
-
         return txs;
     }
 
@@ -0,0 +1,1222 @@
+/*
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <random>
+
+#include <leveldb/write_batch.h>
+
+#include "libTAU/aux_/random.hpp"
+#include "libTAU/aux_/time.hpp"
+#include "libTAU/blockchain/constants.hpp"
+#include "libTAU/blockchain/repository_leveldb.hpp"
+
+namespace libTAU::blockchain {
+
+    namespace {
+        // key tags, one per repository_impl table
+        constexpr char tag_chain = 'c';
+        constexpr char tag_kv = 'k';
+        // prunable kv objects by kv position
+        constexpr char tag_kv_order = 'q';
+        // the last kv position given out
+        constexpr char tag_kv_position = 's';
+        constexpr char tag_account = 'a';
+        // account order of get_all_effective_state
+        constexpr char tag_effective = 'e';
+        constexpr char tag_block = 'b';
+        // all blocks by number, for pruning
+        constexpr char tag_block_number = 'n';
+        // main chain blocks, highest number first
+        constexpr char tag_main_chain = 'm';
+        constexpr char tag_peer = 'p';
+        constexpr char tag_acl = 'l';
+        constexpr char tag_online = 'o';
+        constexpr char tag_touching_time = 't';
+        constexpr char tag_news = 'x';
+        // news txs, latest first
+        constexpr char tag_news_time = 'y';
+
+        constexpr std::uint64_t sign_bit = 0x8000000000000000ULL;
+
+        std::string tag_prefix(char tag) {
+            return std::string{'\0', tag};
+        }
+
+        std::string prefix_of(char tag, const aux::bytes &chain_id) {
+            std::string key = tag_prefix(tag);
+            key.push_back(static_cast<char>((chain_id.size() >> 8) & 0xff));
+            key.push_back(static_cast<char>(chain_id.size() & 0xff));
+            key.append(chain_id.begin(), chain_id.end());
+            return key;
+        }
+
+        void append_uint64(std::string &s, std::uint64_t v) {
+            for (int i = 7; i >= 0; i--) {
+                s.push_back(static_cast<char>((v >> (i * 8)) & 0xff));
+            }
+        }
+
+        std::uint64_t read_uint64(const char *p) {
+            std::uint64_t v = 0;
+            for (int i = 0; i < 8; i++) {
+                v = (v << 8) | static_cast<std::uint8_t>(p[i]);
+            }
+            return v;
+        }
+
+        // big endian with the sign bit flipped sorts like the signed value
+        void append_int64_asc(std::string &s, std::int64_t v) {
+            append_uint64(s, static_cast<std::uint64_t>(v) ^ sign_bit);
+        }
+
+        void append_int64_desc(std::string &s, std::int64_t v) {
+            append_uint64(s, ~(static_cast<std::uint64_t>(v) ^ sign_bit));
+        }
+
+        std::int64_t read_int64_asc(const char *p) {
+            return static_cast<std::int64_t>(read_uint64(p) ^ sign_bit);
+        }
+
+        std::int64_t read_int64_desc(const char *p) {
+            return static_cast<std::int64_t>(~read_uint64(p) ^ sign_bit);
+        }
+
+        std::string account_key(const aux::bytes &chain_id, const dht::public_key &pubKey) {
+            std::string key = prefix_of(tag_account, chain_id);
+            key.append(pubKey.bytes.begin(), pubKey.bytes.end());
+            return key;
+        }
+
+        // balance, power, nonce and public key, all descending
+        std::string effective_key(const aux::bytes &chain_id, const account &act) {
+            std::string key = prefix_of(tag_effective, chain_id);
+            append_int64_desc(key, act.balance());
+            append_int64_desc(key, act.power());
+            append_int64_desc(key, act.nonce());
+            for (auto b: act.peer().bytes) {
+                key.push_back(static_cast<char>(~b));
+            }
+            return key;
+        }
+
+        account account_of_effective_key(const std::string &key, std::size_t prefix_size) {
+            const char *p = key.data() + prefix_size;
+            std::int64_t balance = read_int64_desc(p);
+            std::int64_t power = read_int64_desc(p + 8);
+            std::int64_t nonce = read_int64_desc(p + 16);
+            dht::public_key peer;
+            for (int i = 0; i < dht::public_key::len; i++) {
+                peer.bytes[i] = static_cast<char>(~p[24 + i]);
+            }
+            return account(peer, balance, nonce, power);
+        }
+
+        std::string block_key(const aux::bytes &chain_id, const sha1_hash &hash) {
+            std::string key = prefix_of(tag_block, chain_id);
+            key.append(hash.data(), sha1_hash::size());
+            return key;
+        }
+
+        std::string block_number_key(const aux::bytes &chain_id, std::int64_t number, const sha1_hash &hash) {
+            std::string key = prefix_of(tag_block_number, chain_id);
+            append_int64_asc(key, number);
+            key.append(hash.data(), sha1_hash::size());
+            return key;
+        }
+
+        std::string main_chain_key(const aux::bytes &chain_id, std::int64_t number, const sha1_hash &hash) {
+            std::string key = prefix_of(tag_main_chain, chain_id);
+            append_int64_desc(key, number);
+            key.append(hash.data(), sha1_hash::size());
+            return key;
+        }
+
+        std::string peer_key(char tag, const aux::bytes &chain_id, const dht::public_key &pubKey) {
+            std::string key = prefix_of(tag, chain_id);
+            key.append(pubKey.bytes.begin(), pubKey.bytes.end());
+            return key;
+        }
+
+        std::string kv_order_key(const aux::bytes &chain_id, std::uint64_t position) {
+            std::string key = prefix_of(tag_kv_order, chain_id);
+            append_uint64(key, position);
+            return key;
+        }
+
+        std::string news_key(const aux::bytes &chain_id, const sha1_hash &hash) {
+            std::string key = prefix_of(tag_news, chain_id);
+            key.append(hash.data(), sha1_hash::size());
+            return key;
+        }
+
+        // kv value: kv position, 0 if not prunable, then the object
+        constexpr std::size_t kv_header_size = 8;
+
+        // block value: main chain flag, number, then the block as received
+        constexpr std::size_t block_header_size = 9;
+
+        std::string block_value(const block &blk, bool main_chain) {
+            std::string value;
+            value.push_back(main_chain ? 1 : 0);
+            append_int64_asc(value, blk.block_number());
+            value.append(blk.get_encode());
+            return value;
+        }
+    }
+
+    bool repository_leveldb::init() {
+        return m_db != nullptr;
+    }
+
+    bool repository_leveldb::get(const std::string &key, std::string &value) {
+        auto it = m_pending.find(key);
+        if (it != m_pending.end()) {
+            if (!it->second) {
+                return false;
+            }
+            value = *it->second;
+            return true;
+        }
+
+        return m_db->Get(leveldb::ReadOptions(), key, &value).ok();
+    }
+
+    bool repository_leveldb::put(const std::string &key, std::string value) {
+        return stage(key, std::move(value));
+    }
+
+    bool repository_leveldb::del(const std::string &key) {
+        return stage(key, std::nullopt);
+    }
+
+    bool repository_leveldb::stage(const std::string &key, pending_value value) {
+        if (!m_undo.empty()) {
+            auto it = m_pending.find(key);
+            if (it != m_pending.end()) {
+                m_undo.back().push_back({key, true, it->second});
+            } else {
+                m_undo.back().push_back({key, false, std::nullopt});
+            }
+        }
+
+        m_pending[key] = std::move(value);
+
+        if (m_undo.empty() && !m_group_open) {
+            return write_pending();
+        }
+
+        return true;
+    }
+
+    void repository_leveldb::scan(const std::string &prefix, const std::string &start
+            , const std::function<bool(const std::string &, const std::string &)> &fn) {
+        std::unique_ptr<leveldb::Iterator> it(m_db->NewIterator(leveldb::ReadOptions()));
+        it->Seek(start);
+        auto pit = m_pending.lower_bound(start);
+
+        // std::string and leveldb both compare keys as unsigned bytes
+        for (;;) {
+            bool const db_valid = it->Valid() && it->key().starts_with(prefix);
+            bool const pending_valid = pit != m_pending.end()
+                    && pit->first.compare(0, prefix.size(), prefix) == 0;
+            if (!db_valid && !pending_valid) {
+                break;
+            }
+
+            int cmp = 1;
+            if (db_valid && pending_valid) {
+                cmp = it->key().compare(leveldb::Slice(pit->first));
+            } else if (db_valid) {
+                cmp = -1;
+            }
+
+            if (cmp < 0) {
+                std::string key = it->key().ToString();
+                std::string value = it->value().ToString();
+                it->Next();
+                if (!fn(key, value)) {
+                    break;
+                }
+            } else {
+                // a staged write shadows the stored value
+                if (cmp == 0) {
+                    it->Next();
+                }
+                auto const &entry = *pit;
+                ++pit;
+                if (entry.second && !fn(entry.first, *entry.second)) {
+                    break;
+                }
+            }
+        }
+    }
+
+    bool repository_leveldb::delete_prefix(const std::string &prefix) {
+        std::vector<std::string> keys;
+        scan(prefix, [&](const std::string &key, const std::string &) {
+            keys.push_back(key);
+            return true;
+        });
+
+        bool ok = true;
+        for (auto const &key: keys) {
+            ok = del(key) && ok;
+        }
+
+        return ok;
+    }
+
+    bool repository_leveldb::write_pending() {
+        if (m_pending.empty()) {
+            m_uncommitted_states.clear();
+            return true;
+        }
+
+        leveldb::WriteBatch batch;
+        for (auto const &item: m_pending) {
+            if (item.second) {
+                batch.Put(item.first, *item.second);
+            } else {
+                batch.Delete(item.first);
+            }
+        }
+        m_pending.clear();
+
+        leveldb::Status status = m_db->Write(leveldb::WriteOptions(), &batch);
+        if (!status.ok()) {
+            // blocks read from the staged writes are gone
+            m_block_cache.clear();
+            reset_uncommitted_states();
+            return false;
+        }
+        m_uncommitted_states.clear();
+
+        return true;
+    }
+
+    bool repository_leveldb::begin_transaction() {
+        if (m_undo.empty() && !m_group_open) {
+            m_group_start = aux::time_now();
+        }
+        m_undo.emplace_back();
+
+        return true;
+    }
+
+    bool repository_leveldb::commit() {
+        if (m_undo.empty()) {
+            return flush(true);
+        }
+
+        auto entries = std::move(m_undo.back());
+        m_undo.pop_back();
+        if (!m_undo.empty()) {
+            // merge into the enclosing transaction, its rollback undoes these too
+            auto &parent = m_undo.back();
+            parent.insert(parent.end(), std::make_move_iterator(entries.begin())
+                    , std::make_move_iterator(entries.end()));
+            return true;
+        }
+
+        if (m_group_max_transactions <= 1) {
+            return write_pending();
+        }
+
+        m_group_open = true;
+        m_group_transactions++;
+
+        return flush(m_group_transactions >= m_group_max_transactions);
+    }
+
+    bool repository_leveldb::rollback() {
+        // blocks read inside the transaction may be gone after it
+        m_block_cache.clear();
+
+        if (m_undo.empty()) {
+            // nothing of the caller to undo. The transactions already
+            // merged into the open group stay
+            return true;
+        }
+
+        // the chains written by the group before it are reset too
+        reset_uncommitted_states();
+
+        auto &entries = m_undo.back();
+        for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+            if (it->staged) {
+                m_pending[it->key] = std::move(it->value);
+            } else {
+                m_pending.erase(it->key);
+            }
+        }
+        m_undo.pop_back();
+
+        return true;
+    }
+
+    bool repository_leveldb::transaction_busy() const {
+        return false;
+    }
+
+    bool repository_leveldb::take_lost_group() {
+        bool const lost = m_lost_group;
+        m_lost_group = false;
+        return lost;
+    }
+
+    void repository_leveldb::set_group_commit(int max_transactions, int max_latency) {
+        flush(true);
+
+        m_group_max_transactions = max_transactions;
+        m_group_max_latency = max_latency;
+    }
+
+    bool repository_leveldb::flush(bool force) {
+        if (!m_group_open || !m_undo.empty()) {
+            return true;
+        }
+
+        if (!force && aux::time_now() - m_group_start < milliseconds(m_group_max_latency)) {
+            return true;
+        }
+
+        m_group_open = false;
+        int const transactions = m_group_transactions;
+        m_group_transactions = 0;
+        if (!write_pending()) {
+            m_counters.inc_stats_counter(counters::blockchain_group_commit_failures);
+            // members whose commit() returned true are gone with it
+            if (transactions > 0) {
+                m_lost_group = true;
+            }
+            return false;
+        }
+
+        m_counters.inc_stats_counter(counters::blockchain_group_commits);
+        m_counters.inc_stats_counter(counters::blockchain_group_transactions, transactions);
+
+        return true;
+    }
+
+    void repository_leveldb::set_block_cache_size(std::int64_t size) {
+        m_block_cache.set_budget(size);
+    }
+
+    std::int64_t repository_leveldb::incremental_vacuum(int) {
+        // leveldb compaction returns the space of deleted keys by itself
+        return 0;
+    }
+
+    std::set<aux::bytes> repository_leveldb::get_all_chains() {
+        std::set<aux::bytes> chains;
+
+        std::string const prefix = tag_prefix(tag_chain);
+        scan(prefix, [&](const std::string &key, const std::string &) {
+            chains.insert(aux::bytes(key.begin() + prefix.size() + 2, key.end()));
+            return true;
+        });
+
+        return chains;
+    }
+
+    bool repository_leveldb::add_new_chain(const aux::bytes &chain_id) {
+        return put(prefix_of(tag_chain, chain_id), std::string());
+    }
+
+    bool repository_leveldb::delete_chain(const aux::bytes &chain_id) {
+        return del(prefix_of(tag_chain, chain_id));
+    }
+
+    bool repository_leveldb::put_kv(const aux::bytes &chain_id, const std::string &key, const std::string &value, bool prunable) {
+        // a rewritten object gets a new kv position, like a REPLACE in
+        // repository_impl, so that a sweep started before leaves it alone
+        bool ok = delete_kv(chain_id, key);
+
+        std::uint64_t position = 0;
+        if (prunable) {
+            std::string last;
+            std::string const position_key = prefix_of(tag_kv_position, chain_id);
+            if (get(position_key, last) && last.size() == 8) {
+                position = read_uint64(last.data());
+            }
+            position++;
+
+            std::string next;
+            append_uint64(next, position);
+            ok = put(position_key, std::move(next)) && ok;
+            ok = put(kv_order_key(chain_id, position), key) && ok;
+        }
+
+        std::string v;
+        v.reserve(kv_header_size + value.size());
+        append_uint64(v, position);
+        v.append(value);
+
+        return put(prefix_of(tag_kv, chain_id) + key, std::move(v)) && ok;
+    }
+
+    bool repository_leveldb::get_kv(const aux::bytes &chain_id, const std::string &key, std::string &value) {
+        if (!get(prefix_of(tag_kv, chain_id) + key, value) || value.size() < kv_header_size) {
+            return false;
+        }
+
+        value.erase(0, kv_header_size);
+        return true;
+    }
+
+    bool repository_leveldb::delete_kv(const aux::bytes &chain_id, const std::string &key) {
+        std::string const kv_key = prefix_of(tag_kv, chain_id) + key;
+        std::string value;
+        if (!get(kv_key, value)) {
+            return true;
+        }
+
+        bool ok = true;
+        std::uint64_t const position = value.size() >= kv_header_size ? read_uint64(value.data()) : 0;
+        if (position > 0) {
+            ok = del(kv_order_key(chain_id, position));
+        }
+
+        return del(kv_key) && ok;
+    }
+
+    bool repository_leveldb::create_kv_db(const aux::bytes &) {
+        return true;
+    }
+
+    bool repository_leveldb::delete_kv_db(const aux::bytes &chain_id) {
+        bool ok = delete_prefix(prefix_of(tag_kv, chain_id));
+        ok = delete_prefix(prefix_of(tag_kv_order, chain_id)) && ok;
+        return del(prefix_of(tag_kv_position, chain_id)) && ok;
+    }
+
+    bool repository_leveldb::save_hash_array(const aux::bytes &chain_id, const hash_array &hashArray) {
+        return put_kv(chain_id, hashArray.sha1().to_string(), hashArray.get_encode(), true);
+    }
+
+    hash_array repository_leveldb::get_hash_array_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
+        std::string encode;
+        if (!get_kv(chain_id, hash.to_string(), encode)) {
+            return hash_array();
+        }
+
+        return hash_array(encode);
+    }
+
+    state_array repository_leveldb::get_state_array_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
+        std::string encode;
+        if (!get_kv(chain_id, hash.to_string(), encode)) {
+            return state_array();
+        }
+
+        return state_array(encode);
+    }
+
+    bool repository_leveldb::save_state_array(const aux::bytes &chain_id, const state_array &stateArray) {
+        return put_kv(chain_id, stateArray.sha1().to_string(), stateArray.get_encode(), true);
+    }
+
+    bool repository_leveldb::save_tx(const aux::bytes &chain_id, const transaction &tx) {
+        return put_kv(chain_id, tx.sha1().to_string(), tx.get_encode(), true);
+    }
+
+    transaction repository_leveldb::get_tx_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
+        std::string encode;
+        if (!get_kv(chain_id, hash.to_string(), encode)) {
+            return transaction();
+        }
+
+        return transaction(encode);
+    }
+
+    bool repository_leveldb::save_pic_slice(const aux::bytes &chain_id, const aux::bytes &key, const aux::bytes &slice) {
+        return put_kv(chain_id, std::string(key.begin(), key.end()), std::string(slice.begin(), slice.end()), false);
+    }
+
+    aux::bytes repository_leveldb::get_pic_slice(const aux::bytes &chain_id, const aux::bytes &key) {
+        std::string slice;
+        if (!get_kv(chain_id, std::string(key.begin(), key.end()), slice)) {
+            return aux::bytes();
+        }
+
+        return aux::bytes(slice.begin(), slice.end());
+    }
+
+    bool repository_leveldb::is_data_in_kv_db(const aux::bytes &chain_id, const sha1_hash &hash) {
+        std::string value;
+        return get_kv(chain_id, hash.to_string(), value);
+    }
+
+    bool repository_leveldb::delete_data_in_kv_db_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
+        return delete_kv(chain_id, hash.to_string());
+    }
+
+    std::int64_t repository_leveldb::get_kv_position(const aux::bytes &chain_id) {
+        std::string last;
+        if (!get(prefix_of(tag_kv_position, chain_id), last) || last.size() != 8) {
+            return 0;
+        }
+
+        return static_cast<std::int64_t>(read_uint64(last.data()));
+    }
+
+    std::vector<sha1_hash> repository_leveldb::get_kv_hashes(const aux::bytes &chain_id, std::int64_t &position, std::int64_t end, int limit) {
+        std::vector<sha1_hash> hashes;
+
+        std::string const prefix = prefix_of(tag_kv_order, chain_id);
+        std::string start = prefix;
+        append_uint64(start, static_cast<std::uint64_t>(std::max(position, std::int64_t(0))) + 1);
+
+        bool visited = false;
+        int count = 0;
+        scan(prefix, start, [&](const std::string &key, const std::string &value) {
+            auto const p = static_cast<std::int64_t>(read_uint64(key.data() + prefix.size()));
+            if (p > end || count >= limit) {
+                return false;
+            }
+            visited = true;
+            count++;
+            position = p;
+
+            if (value.size() == sha1_hash::size()) {
+                hashes.emplace_back(value.data());
+            }
+            return true;
+        });
+
+        if (!visited) {
+            position = end;
+        }
+
+        return hashes;
+    }
+
+    void repository_leveldb::touch_account(const aux::bytes &chain_id, const dht::public_key &pubKey) {
+        m_touched_accounts[chain_id].insert(pubKey);
+        if (!m_undo.empty() || m_group_open) {
+            m_uncommitted_states.insert(chain_id);
+        }
+    }
+
+    void repository_leveldb::touch_all_state(const aux::bytes &chain_id) {
+        m_touched_accounts.erase(chain_id);
+        m_reset_states.insert(chain_id);
+        if (!m_undo.empty() || m_group_open) {
+            m_uncommitted_states.insert(chain_id);
+        }
+    }
+
+    void repository_leveldb::reset_uncommitted_states() {
+        for (auto const &chain_id: m_uncommitted_states) {
+            m_touched_accounts.erase(chain_id);
+            m_reset_states.insert(chain_id);
+        }
+        m_uncommitted_states.clear();
+    }
+
+    bool repository_leveldb::create_state_db(const aux::bytes &) {
+        return true;
+    }
+
+    bool repository_leveldb::delete_state_db(const aux::bytes &chain_id) {
+        return clear_all_state(chain_id);
+    }
+
+    bool repository_leveldb::clear_all_state(const aux::bytes &chain_id) {
+        touch_all_state(chain_id);
+
+        bool ok = delete_prefix(prefix_of(tag_account, chain_id));
+        return delete_prefix(prefix_of(tag_effective, chain_id)) && ok;
+    }
+
+    account repository_leveldb::get_account(const aux::bytes &chain_id, const dht::public_key &pubKey) {
+        std::string value;
+        if (!get(account_key(chain_id, pubKey), value) || value.size() < 24) {
+            return account(pubKey);
+        }
+
+        auto balance = static_cast<std::int64_t>(read_uint64(value.data()));
+        auto nonce = static_cast<std::int64_t>(read_uint64(value.data() + 8));
+        auto power = static_cast<std::int64_t>(read_uint64(value.data() + 16));
+
+        return account(pubKey, balance, nonce, power);
+    }
+
+    bool repository_leveldb::is_account_existed(const aux::bytes &chain_id, const dht::public_key &pubKey) {
+        std::string value;
+        return get(account_key(chain_id, pubKey), value);
+    }
+
+    bool repository_leveldb::update_account(const aux::bytes &chain_id, const account &act) {
+        if (act.empty()) {
+            return delete_account(chain_id, act.peer());
+        } else {
+            return save_account(chain_id, act);
+        }
+    }
+
+    bool repository_leveldb::save_account(const aux::bytes &chain_id, const account &act) {
+        touch_account(chain_id, act.peer());
+
+        // move the account in effective state order
+        bool ok = true;
+        if (is_account_existed(chain_id, act.peer())) {
+            ok = del(effective_key(chain_id, get_account(chain_id, act.peer())));
+        }
+
+        std::string value;
+        append_uint64(value, static_cast<std::uint64_t>(act.balance()));
+        append_uint64(value, static_cast<std::uint64_t>(act.nonce()));
+        append_uint64(value, static_cast<std::uint64_t>(act.power()));
+
+        ok = put(account_key(chain_id, act.peer()), std::move(value)) && ok;
+        return put(effective_key(chain_id, act), std::string()) && ok;
+    }
+
+    bool repository_leveldb::delete_account(const aux::bytes &chain_id, const dht::public_key &pubKey) {
+        touch_account(chain_id, pubKey);
+
+        if (!is_account_existed(chain_id, pubKey)) {
+            return true;
+        }
+
+        bool ok = del(effective_key(chain_id, get_account(chain_id, pubKey)));
+        return del(account_key(chain_id, pubKey)) && ok;
+    }
+
+    std::vector<account> repository_leveldb::get_all_effective_state(const aux::bytes &chain_id) {
+        std::vector<account> accounts;
+
+        std::string const prefix = prefix_of(tag_effective, chain_id);
+        scan(prefix, [&](const std::string &key, const std::string &) {
+            if (key.size() == prefix.size() + 24 + dht::public_key::len) {
+                accounts.push_back(account_of_effective_key(key, prefix.size()));
+            }
+            return true;
+        });
+
+        return accounts;
+    }
+
+    std::set<dht::public_key> repository_leveldb::take_touched_accounts(const aux::bytes &chain_id, bool &reset) {
+        std::set<dht::public_key> touched;
+
+        reset = m_reset_states.erase(chain_id) > 0;
+        auto it = m_touched_accounts.find(chain_id);
+        if (it != m_touched_accounts.end()) {
+            touched = std::move(it->second);
+            m_touched_accounts.erase(it);
+        }
+
+        return touched;
+    }
+
+    std::set<dht::public_key> repository_leveldb::sample_pubkeys(const std::string &prefix, int num) {
+        std::set<dht::public_key> peers;
+        if (num <= 0) {
+            return peers;
+        }
+
+        // collect up to limit keys from start on, returns the number of keys seen
+        auto collect = [&](const std::string &start, int limit) {
+            int seen = 0;
+            scan(prefix, start, [&](const std::string &key, const std::string &) {
+                if (key.size() == prefix.size() + dht::public_key::len) {
+                    peers.insert(dht::public_key(key.data() + prefix.size()));
+                }
+                return ++seen < limit && static_cast<int>(peers.size()) < num;
+            });
+            return seen;
+        };
+
+        // public keys are uniformly distributed, the first key at or after
+        // a random one is close to a uniform pick
+        std::uniform_int_distribution<int> dist(0, 255);
+        for (int i = 0; i < 4 * num && static_cast<int>(peers.size()) < num; i++) {
+            std::string start = prefix;
+            for (int j = 0; j < dht::public_key::len; j++) {
+                start.push_back(static_cast<char>(dist(aux::random_engine())));
+            }
+
+            // past the last key, wrap around
+            if (collect(start, 1) == 0 && collect(prefix, 1) == 0) {
+                return peers;
+            }
+        }
+
+        // few keys, fill up in key order
+        if (static_cast<int>(peers.size()) < num) {
+            collect(prefix, 2 * num);
+        }
+
+        return peers;
+    }
+
+    dht::public_key repository_leveldb::get_peer_from_state_db_randomly(const aux::bytes &chain_id) {
+        auto peers = sample_pubkeys(prefix_of(tag_account, chain_id), 1);
+        if (peers.empty()) {
+            return dht::public_key{};
+        }
+
+        return *peers.begin();
+    }
+
+    std::set<dht::public_key> repository_leveldb::get_peers_from_state_db_randomly(const aux::bytes &chain_id, int num) {
+        return sample_pubkeys(prefix_of(tag_account, chain_id), num);
+    }
+
+    bool repository_leveldb::create_block_db(const aux::bytes &) {
+        return true;
+    }
+
+    bool repository_leveldb::delete_block_db(const aux::bytes &chain_id) {
+        m_block_cache.erase_chain(chain_id);
+
+        bool ok = delete_prefix(prefix_of(tag_block, chain_id));
+        ok = delete_prefix(prefix_of(tag_block_number, chain_id)) && ok;
+        return delete_prefix(prefix_of(tag_main_chain, chain_id)) && ok;
+    }
+
+    block repository_leveldb::get_head_block(const aux::bytes &chain_id) {
+        sha1_hash hash;
+        bool found = false;
+
+        std::string const prefix = prefix_of(tag_main_chain, chain_id);
+        scan(prefix, [&](const std::string &key, const std::string &) {
+            hash = sha1_hash(key.data() + prefix.size() + 8);
+            found = true;
+            return false;
+        });
+
+        if (!found) {
+            return block();
+        }
+
+        return get_block_by_hash(chain_id, hash);
+    }
+
+    std::string repository_leveldb::get_test_tx_string(const aux::bytes &chain_id) {
+        auto blk = get_head_block(chain_id);
+        if (blk.empty() || blk.tx().empty()) {
+            return std::string();
+        }
+
+        return blk.tx().get_encode();
+    }
+
+    int repository_leveldb::get_test_tx_size(const aux::bytes &chain_id) {
+        int ret = 111;
+
+        auto tx_encode = get_test_tx_string(chain_id);
+        if (!tx_encode.empty()) {
+            ret = static_cast<int>(strlen(tx_encode.c_str()));
+        }
+
+        return ret;
+    }
+
+    block repository_leveldb::get_block_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
+        auto cached = m_block_cache.get(chain_id, hash);
+        if (cached) {
+            return *cached;
+        }
+
+        std::string value;
+        if (!get(block_key(chain_id, hash), value) || value.size() <= block_header_size) {
+            return block();
+        }
+
+        block blk(value.substr(block_header_size));
+
+        if (m_block_cache.enabled()) {
+            bool main_chain = value[0] != 0;
+            // rough memory footprint: the object, chain id and encoding
+            std::int64_t size = sizeof(block) + chain_id.size() + value.size();
+            m_block_cache.put(std::make_shared<const block>(blk), main_chain, size);
+        }
+
+        return blk;
+    }
+
+    bool repository_leveldb::get_block_info(const aux::bytes &chain_id, const sha1_hash &hash, bool &main_chain, std::int64_t &number) {
+        std::string value;
+        if (!get(block_key(chain_id, hash), value) || value.size() <= block_header_size) {
+            return false;
+        }
+
+        main_chain = value[0] != 0;
+        number = read_int64_asc(value.data() + 1);
+
+        return true;
+    }
+
+    bool repository_leveldb::save_block(const block &blk, bool main_chain) {
+        const auto& chain_id = blk.chain_id();
+
+        bool ok = put(block_key(chain_id, blk.sha1()), block_value(blk, main_chain));
+        ok = put(block_number_key(chain_id, blk.block_number(), blk.sha1()), std::string()) && ok;
+        if (main_chain) {
+            ok = put(main_chain_key(chain_id, blk.block_number(), blk.sha1()), std::string()) && ok;
+        } else {
+            ok = del(main_chain_key(chain_id, blk.block_number(), blk.sha1())) && ok;
+        }
+
+        return ok;
+    }
+
+    bool repository_leveldb::save_block_if_not_exist(const block &blk) {
+        std::string value;
+        if (get(block_key(blk.chain_id(), blk.sha1()), value)) {
+            return true;
+        }
+
+        return save_block(blk, false);
+    }
+
+    bool repository_leveldb::save_main_chain_block(const block &blk) {
+        if (!save_block(blk, true)) {
+            return false;
+        }
+
+        m_block_cache.set_main_chain(blk.chain_id(), blk.sha1(), true);
+
+        return true;
+    }
+
+    bool repository_leveldb::delete_block_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
+        m_block_cache.erase(chain_id, hash);
+
+        bool main_chain = false;
+        std::int64_t number = 0;
+        if (!get_block_info(chain_id, hash, main_chain, number)) {
+            return true;
+        }
+
+        bool ok = del(block_key(chain_id, hash));
+        ok = del(block_number_key(chain_id, number, hash)) && ok;
+        return del(main_chain_key(chain_id, number, hash)) && ok;
+    }
+
+    block repository_leveldb::get_main_chain_block_by_number(const aux::bytes &chain_id, std::int64_t block_number) {
+        sha1_hash hash;
+        bool found = false;
+
+        std::string prefix = prefix_of(tag_main_chain, chain_id);
+        append_int64_desc(prefix, block_number);
+        scan(prefix, [&](const std::string &key, const std::string &) {
+            hash = sha1_hash(key.data() + prefix.size());
+            found = true;
+            return false;
+        });
+
+        if (!found) {
+            return block();
+        }
+
+        return get_block_by_hash(chain_id, hash);
+    }
+
+    bool repository_leveldb::delete_all_blocks_less_than_number(const aux::bytes &chain_id, std::int64_t block_number) {
+        m_block_cache.erase_less_than_number(chain_id, block_number);
+
+        std::vector<std::pair<std::int64_t, sha1_hash>> blocks;
+        std::string const prefix = prefix_of(tag_block_number, chain_id);
+        scan(prefix, [&](const std::string &key, const std::string &) {
+            std::int64_t number = read_int64_asc(key.data() + prefix.size());
+            if (number > block_number) {
+                return false;
+            }
+            blocks.emplace_back(number, sha1_hash(key.data() + prefix.size() + 8));
+            return true;
+        });
+
+        bool ok = true;
+        for (auto const &item: blocks) {
+            ok = del(block_key(chain_id, item.second)) && ok;
+            ok = del(block_number_key(chain_id, item.first, item.second)) && ok;
+            ok = del(main_chain_key(chain_id, item.first, item.second)) && ok;
+        }
+
+        return ok;
+    }
+
+    int repository_leveldb::prune_blocks(const aux::bytes &chain_id, std::int64_t main_number, std::int64_t side_number, int limit) {
+        std::vector<std::pair<std::int64_t, sha1_hash>> blocks;
+
+        // old blocks first, then orphaned side branches
+        std::int64_t const end = std::max(main_number, side_number);
+        std::string const prefix = prefix_of(tag_block_number, chain_id);
+        scan(prefix, [&](const std::string &key, const std::string &) {
+            if (static_cast<int>(blocks.size()) >= limit) {
+                return false;
+            }
+
+            std::int64_t number = read_int64_asc(key.data() + prefix.size());
+            if (number >= end) {
+                return false;
+            }
+
+            sha1_hash hash(key.data() + prefix.size() + 8);
+            bool main_chain = false;
+            std::int64_t n = 0;
+            if (number < main_number || (get_block_info(chain_id, hash, main_chain, n) && !main_chain)) {
+                blocks.emplace_back(number, hash);
+            }
+
+            return true;
+        });
+
+        bool ok = true;
+        for (auto const &item: blocks) {
+            m_block_cache.erase(chain_id, item.second);
+
+            ok = del(block_key(chain_id, item.second)) && ok;
+            ok = del(block_number_key(chain_id, item.first, item.second)) && ok;
+            ok = del(main_chain_key(chain_id, item.first, item.second)) && ok;
+        }
+
+        return ok ? static_cast<int>(blocks.size()) : -1;
+    }
+
+    std::vector<sha1_hash> repository_leveldb::get_side_branch_block_hashes(const aux::bytes &chain_id, std::int64_t block_number) {
+        std::vector<sha1_hash> hashes;
+
+        std::string const prefix = prefix_of(tag_block_number, chain_id);
+        std::string start = prefix;
+        append_int64_asc(start, block_number);
+        scan(prefix, start, [&](const std::string &key, const std::string &) {
+            sha1_hash hash(key.data() + prefix.size() + 8);
+            bool main_chain = false;
+            std::int64_t number = 0;
+            if (get_block_info(chain_id, hash, main_chain, number) && !main_chain) {
+                hashes.push_back(hash);
+            }
+            return true;
+        });
+
+        return hashes;
+    }
+
+    bool repository_leveldb::set_main_chain(const aux::bytes &chain_id, const sha1_hash &hash, bool main_chain) {
+        std::string value;
+        if (!get(block_key(chain_id, hash), value) || value.size() <= block_header_size) {
+            return true;
+        }
+
+        std::int64_t number = read_int64_asc(value.data() + 1);
+        value[0] = main_chain ? 1 : 0;
+
+        bool ok = put(block_key(chain_id, hash), std::move(value));
+        if (main_chain) {
+            ok = put(main_chain_key(chain_id, number, hash), std::string()) && ok;
+        } else {
+            ok = del(main_chain_key(chain_id, number, hash)) && ok;
+        }
+
+        m_block_cache.set_main_chain(chain_id, hash, main_chain);
+
+        return ok;
+    }
+
+    bool repository_leveldb::set_block_non_main_chain(const aux::bytes &chain_id, const sha1_hash &hash) {
+        return set_main_chain(chain_id, hash, false);
+    }
+
+    bool repository_leveldb::set_block_main_chain(const aux::bytes &chain_id, const sha1_hash &hash) {
+        return set_main_chain(chain_id, hash, true);
+    }
+
+    bool repository_leveldb::set_all_block_non_main_chain(const aux::bytes &chain_id) {
+        std::vector<sha1_hash> hashes;
+        std::string const prefix = prefix_of(tag_main_chain, chain_id);
+        scan(prefix, [&](const std::string &key, const std::string &) {
+            hashes.emplace_back(key.data() + prefix.size() + 8);
+            return true;
+        });
+
+        bool ok = true;
+        for (auto const &hash: hashes) {
+            ok = set_main_chain(chain_id, hash, false) && ok;
+        }
+
+        m_block_cache.set_all_non_main_chain(chain_id);
+
+        return ok;
+    }
+
+    bool repository_leveldb::create_peer_db(const aux::bytes &) {
+        return true;
+    }
+
+    bool repository_leveldb::delete_peer_db(const aux::bytes &chain_id) {
+        return delete_prefix(prefix_of(tag_peer, chain_id));
+    }
+
+    dht::public_key repository_leveldb::get_peer_from_peer_db_randomly(const aux::bytes &chain_id) {
+        auto peers = sample_pubkeys(prefix_of(tag_peer, chain_id), 1);
+        if (peers.empty()) {
+            return dht::public_key{};
+        }
+
+        return *peers.begin();
+    }
+
+    std::set<dht::public_key> repository_leveldb::get_enough_peers_from_peer_db_randomly(const aux::bytes &chain_id) {
+        return sample_pubkeys(prefix_of(tag_peer, chain_id), 10);
+    }
+
+    std::set<dht::public_key> repository_leveldb::get_peers_from_peer_db_randomly(const aux::bytes &chain_id, int num) {
+        return sample_pubkeys(prefix_of(tag_peer, chain_id), num);
+    }
+
+    bool repository_leveldb::delete_peer_in_peer_db(const aux::bytes &chain_id, const dht::public_key &pubKey) {
+        return del(peer_key(tag_peer, chain_id, pubKey));
+    }
+
+    bool repository_leveldb::add_peer_in_peer_db(const aux::bytes &chain_id, const dht::public_key &pubKey) {
+        return put(peer_key(tag_peer, chain_id, pubKey), std::string());
+    }
+
+    bool repository_leveldb::clear_peer_db(const aux::bytes &chain_id) {
+        return delete_prefix(prefix_of(tag_peer, chain_id));
+    }
+
+    bool repository_leveldb::create_acl_db(const aux::bytes &) {
+        return true;
+    }
+
+    bool repository_leveldb::delete_acl_db(const aux::bytes &chain_id) {
+        return delete_prefix(prefix_of(tag_acl, chain_id));
+    }
+
+    std::set<dht::public_key> repository_leveldb::get_all_peer_in_acl_db(const aux::bytes &chain_id) {
+        std::set<dht::public_key> peers;
+
+        std::string const prefix = prefix_of(tag_acl, chain_id);
+        scan(prefix, [&](const std::string &key, const std::string &) {
+            peers.insert(dht::public_key(key.data() + prefix.size()));
+            return true;
+        });
+
+        return peers;
+    }
+
+    bool repository_leveldb::clear_acl_db(const aux::bytes &chain_id) {
+        return delete_prefix(prefix_of(tag_acl, chain_id));
+    }
+
+    bool repository_leveldb::add_peer_in_acl_db(const aux::bytes &chain_id, const dht::public_key &pubKey) {
+        return put(peer_key(tag_acl, chain_id, pubKey), std::string());
+    }
+
+    bool repository_leveldb::create_online_list_db(const aux::bytes &) {
+        return true;
+    }
+
+    bool repository_leveldb::delete_online_list_db(const aux::bytes &chain_id) {
+        return delete_prefix(prefix_of(tag_online, chain_id));
+    }
+
+    std::set<dht::public_key> repository_leveldb::get_all_peer_in_online_list_db(const aux::bytes &chain_id) {
+        std::set<dht::public_key> peers;
+
+        std::string const prefix = prefix_of(tag_online, chain_id);
+        scan(prefix, [&](const std::string &key, const std::string &) {
+            peers.insert(dht::public_key(key.data() + prefix.size()));
+            return true;
+        });
+
+        return peers;
+    }
+
+    bool repository_leveldb::clear_online_list_db(const aux::bytes &chain_id) {
+        return delete_prefix(prefix_of(tag_online, chain_id));
+    }
+
+    bool repository_leveldb::add_peer_in_online_list_db(const aux::bytes &chain_id, const dht::public_key &pubKey) {
+        return put(peer_key(tag_online, chain_id, pubKey), std::string());
+    }
+
+    bool repository_leveldb::create_community_info_db() {
+        return true;
+    }
+
+    bool repository_leveldb::delete_community_info_db() {
+        return delete_prefix(tag_prefix(tag_touching_time));
+    }
+
+    bool repository_leveldb::update_touching_time(const aux::bytes &chain_id, std::int64_t touching_time) {
+        std::string value;
+        append_uint64(value, static_cast<std::uint64_t>(touching_time));
+
+        return put(prefix_of(tag_touching_time, chain_id), std::move(value));
+    }
+
+    std::int64_t repository_leveldb::get_touching_time(const aux::bytes &chain_id) {
+        std::string value;
+        if (!get(prefix_of(tag_touching_time, chain_id), value) || value.size() < 8) {
+            return 0;
+        }
+
+        return static_cast<std::int64_t>(read_uint64(value.data()));
+    }
+
+    bool repository_leveldb::delete_touching_time(const aux::bytes &chain_id) {
+        return del(prefix_of(tag_touching_time, chain_id));
+    }
+
+    bool repository_leveldb::create_news_tx_db(const aux::bytes &) {
+        return true;
+    }
+
+    bool repository_leveldb::delete_news_tx_db(const aux::bytes &chain_id) {
+        bool ok = delete_prefix(prefix_of(tag_news, chain_id));
+        return delete_prefix(prefix_of(tag_news_time, chain_id)) && ok;
+    }
+
+    bool repository_leveldb::save_news_tx(const aux::bytes &chain_id, const transaction &tx) {
+        std::string time_key = prefix_of(tag_news_time, chain_id);
+        append_int64_desc(time_key, tx.timestamp());
+        time_key.append(tx.sha1().data(), sha1_hash::size());
+
+        bool ok = put(news_key(chain_id, tx.sha1()), tx.get_encode());
+        return put(time_key, std::string()) && ok;
+    }
+
+    transaction repository_leveldb::get_news_tx_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
+        std::string encode;
+        if (!get(news_key(chain_id, hash), encode)) {
+            return transaction();
+        }
+
+        return transaction(encode);
+    }
+
+    std::vector<transaction> repository_leveldb::get_latest_news_txs(const aux::bytes &chain_id) {
+        std::vector<sha1_hash> hashes;
+
+        std::string const prefix = prefix_of(tag_news_time, chain_id);
+        scan(prefix, [&](const std::string &key, const std::string &) {
+            hashes.emplace_back(key.data() + prefix.size() + 8);
+            return static_cast<int>(hashes.size()) < MAX_NEWS_SIZE_IN_GENESIS_BLOCK;
+        });
+
+        std::vector<transaction> txs;
+        for (auto const &hash: hashes) {
+            auto tx = get_news_tx_by_hash(chain_id, hash);
+            if (!tx.empty()) {
+                txs.push_back(tx);
+            }
+        }
+
+        return txs;
+    }
+}
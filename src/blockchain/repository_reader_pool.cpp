@@ -0,0 +1,109 @@
+/*
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include "libTAU/blockchain/repository_reader_pool.hpp"
+
+namespace libTAU::blockchain {
+
+    repository_reader_pool::reader::reader(repository_reader_pool *pool, int index) : m_pool(pool), m_index(index) {
+        // deferred, the snapshot is taken by the first read
+        sqlite3_exec(m_pool->m_connections[m_index].db, "BEGIN", nullptr, nullptr, nullptr);
+    }
+
+    repository_reader_pool::reader::reader(reader &&other) noexcept : m_pool(other.m_pool), m_index(other.m_index) {
+        other.m_pool = nullptr;
+        other.m_index = -1;
+    }
+
+    repository_reader_pool::reader::~reader() {
+        if (m_pool != nullptr) {
+            sqlite3_exec(m_pool->m_connections[m_index].db, "COMMIT", nullptr, nullptr, nullptr);
+            m_pool->release(m_index);
+        }
+    }
+
+    repository* repository_reader_pool::reader::operator->() const {
+        return m_pool->m_connections[m_index].repo.get();
+    }
+
+    repository_reader_pool::~repository_reader_pool() {
+        close();
+    }
+
+    bool repository_reader_pool::open(const std::string &db_path, int size, bool shared_schema) {
+        std::lock_guard<std::mutex> l(m_mutex);
+        if (m_open) return true;
+
+        for (int i = 0; i < size; i++) {
+            sqlite3 *db = nullptr;
+            int ok = sqlite3_open_v2(db_path.c_str(), &db
+                    , SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_PRIVATECACHE, nullptr);
+            if (ok != SQLITE_OK) {
+                sqlite3_close_v2(db);
+                break;
+            }
+
+            connection c;
+            c.db = db;
+            if (shared_schema) {
+                c.repo = std::make_unique<repository_shared>(db, m_counters);
+            } else {
+                c.repo = std::make_unique<repository_impl>(db, m_counters);
+            }
+            m_connections.push_back(std::move(c));
+            m_free.push_back(i);
+        }
+
+        m_open = !m_connections.empty();
+
+        return m_open;
+    }
+
+    void repository_reader_pool::close() {
+        std::unique_lock<std::mutex> l(m_mutex);
+        if (!m_open) return;
+
+        // no new readers from now on
+        m_open = false;
+        m_cond.wait(l, [this] { return m_free.size() == m_connections.size(); });
+
+        for (auto &c : m_connections) {
+            // cached statements must be finalized before the connection is closed
+            c.repo.reset();
+            sqlite3_close_v2(c.db);
+        }
+        m_connections.clear();
+        m_free.clear();
+    }
+
+    bool repository_reader_pool::is_open() const {
+        std::lock_guard<std::mutex> l(m_mutex);
+        return m_open;
+    }
+
+    repository_reader_pool::reader repository_reader_pool::acquire(time_duration max_wait) {
+        std::unique_lock<std::mutex> l(m_mutex);
+        if (!m_cond.wait_for(l, max_wait, [this] { return !m_open || !m_free.empty(); }) || !m_open) {
+            return reader();
+        }
+
+        int index = m_free.back();
+        m_free.pop_back();
+        l.unlock();
+
+        return reader(this, index);
+    }
+
+    void repository_reader_pool::release(int index) {
+        {
+            std::lock_guard<std::mutex> l(m_mutex);
+            m_free.push_back(index);
+        }
+        m_cond.notify_all();
+    }
+}
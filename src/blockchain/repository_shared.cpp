@@ -0,0 +1,1454 @@
+/*
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include <cstring>
+#include <random>
+
+#include "libTAU/aux_/random.hpp"
+#include "libTAU/aux_/time.hpp"
+#include "libTAU/blockchain/constants.hpp"
+#include "libTAU/blockchain/repository_shared.hpp"
+
+namespace libTAU::blockchain {
+
+    namespace {
+        const std::string shared_prefix = "tshared_";
+
+        const std::string ordinals_table = "t" + table_chain_ordinals;
+        const std::string blocks_table = shared_prefix + table_blocks;
+        const std::string state_table = shared_prefix + table_state;
+        const std::string kv_table = shared_prefix + table_kv;
+        const std::string peer_table = shared_prefix + table_peer;
+        const std::string acl_table = shared_prefix + table_acl;
+        const std::string online_list_table = shared_prefix + table_online_list;
+        const std::string news_txs_table = shared_prefix + table_news_txs;
+
+        // time (ms) spent dropping migrated tables per incremental_vacuum()
+        const int migrated_drop_budget = 20;
+
+        // block columns after CHAIN of rows with a column per field, the
+        // chain id itself is not stored
+        const std::string block_columns = "HASH,VERSION,TIMESTAMP,NUMBER,PREVIOUS_HASH,BASE_TARGET,DIFFICULTY,"
+                                          "GENERATION_SIGNATURE,STATE_ROOT,NEWS_ROOT,TX,MINER,SIGNATURE,MAIN_CHAIN";
+
+        // block columns after CHAIN of rows keeping the encoded block
+        const std::string encoded_block_columns = "HASH,NUMBER,MAIN_CHAIN,ENCODE";
+
+        // selected by read_block(), followed by ENCODE
+        const std::string block_fields = "VERSION,TIMESTAMP,NUMBER,PREVIOUS_HASH,BASE_TARGET,DIFFICULTY,"
+                                         "GENERATION_SIGNATURE,STATE_ROOT,NEWS_ROOT,TX,MINER,SIGNATURE,MAIN_CHAIN";
+
+        block read_block(sqlite3_stmt *stmt, const aux::bytes &chain_id, const sha1_hash &hash) {
+            auto encode_length = sqlite3_column_bytes(stmt, 13);
+            if (encode_length > 0) {
+                const char *encode = static_cast<const char *>(sqlite3_column_blob(stmt, 13));
+                return block(std::string(encode, static_cast<std::size_t>(encode_length)));
+            }
+
+            auto version = static_cast<block_version>(sqlite3_column_int(stmt, 0));
+            std::int64_t timestamp = sqlite3_column_int64(stmt, 1);
+            std::int64_t number = sqlite3_column_int64(stmt, 2);
+            const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, 3));
+            sha1_hash previous_hash(p);
+            auto base_target = static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 4));
+            auto difficulty = static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 5));
+            p = static_cast<const char *>(sqlite3_column_blob(stmt, 6));
+            sha1_hash generation_signature(p);
+            p = static_cast<const char *>(sqlite3_column_blob(stmt, 7));
+            sha1_hash state_root(p);
+            p = static_cast<const char *>(sqlite3_column_blob(stmt, 8));
+            sha1_hash news_root(p);
+            p = static_cast<const char *>(sqlite3_column_blob(stmt, 9));
+            auto length = sqlite3_column_bytes(stmt, 9);
+            transaction tx;
+            if (length > 0) {
+                std::string tx_encode(p, length);
+                tx = transaction(tx_encode);
+            }
+            p = static_cast<const char *>(sqlite3_column_blob(stmt, 10));
+            dht::public_key miner(p);
+            p = static_cast<const char *>(sqlite3_column_blob(stmt, 11));
+            dht::signature sig(p);
+
+            return block(chain_id, version, timestamp, number, previous_hash, base_target, difficulty,
+                         generation_signature, state_root, news_root, tx, miner, sig, hash);
+        }
+    }
+
+    bool repository_shared::init() {
+        std::string sql = "CREATE TABLE IF NOT EXISTS ";
+        sql.append(chains_db_name());
+        sql.append("(CHAIN_ID BLOB PRIMARY KEY NOT NULL);");
+        if (!exec(sql.c_str())) {
+            return false;
+        }
+
+        if (!create_head_block_db() || !create_schema_version_db() || !create_shared_tables()) {
+            return false;
+        }
+
+        int version = get_schema_version(shared_schema_id);
+        if (version >= shared_repository_schema_version) {
+            return true;
+        }
+
+        if (!begin_transaction()) {
+            return false;
+        }
+
+        // version 1: copy the per chain tables into the shared ones
+        if (version < 1 && !migrate_per_chain_tables()) {
+            rollback();
+            return false;
+        }
+
+        // version 2: blocks keep their encoding, tables created before lack
+        // the column
+        if (!has_column(blocks_table, "ENCODE")) {
+            std::string sql = "ALTER TABLE ";
+            sql.append(blocks_table);
+            sql.append(" ADD COLUMN ENCODE BLOB");
+            invalidate_stmt_cache(blocks_table);
+            if (!exec(sql.c_str())) {
+                rollback();
+                return false;
+            }
+        }
+
+        // version 3: kv objects record whether the prune sweep may delete
+        // them, existing ones are never swept
+        if (!has_column(kv_table, "PRUNABLE")) {
+            std::string sql = "ALTER TABLE ";
+            sql.append(kv_table);
+            sql.append(" ADD COLUMN PRUNABLE INT");
+            invalidate_stmt_cache(kv_table);
+            if (!exec(sql.c_str())) {
+                rollback();
+                return false;
+            }
+        }
+
+        if (!set_schema_version(shared_schema_id, shared_repository_schema_version)) {
+            rollback();
+            return false;
+        }
+
+        return commit();
+    }
+
+    bool repository_shared::create_shared_tables() {
+        std::string sql = "CREATE TABLE IF NOT EXISTS ";
+        sql.append(ordinals_table);
+        sql.append("(ORDINAL INTEGER PRIMARY KEY NOT NULL,CHAIN_ID BLOB UNIQUE NOT NULL);");
+
+        sql.append("CREATE TABLE IF NOT EXISTS ");
+        sql.append(blocks_table);
+        sql.append("(CHAIN INTEGER NOT NULL,HASH BLOB NOT NULL,VERSION INT,TIMESTAMP INTEGER,NUMBER INTEGER,"
+                   "PREVIOUS_HASH BLOB,BASE_TARGET INTEGER,DIFFICULTY INTEGER,GENERATION_SIGNATURE BLOB,"
+                   "STATE_ROOT BLOB,NEWS_ROOT BLOB,TX BLOB,MINER BLOB,SIGNATURE BLOB,MAIN_CHAIN INT,ENCODE BLOB,"
+                   "PRIMARY KEY(CHAIN,HASH));");
+        sql.append("CREATE INDEX IF NOT EXISTS ");
+        sql.append(blocks_table);
+        sql.append("_main_chain_number ON ");
+        sql.append(blocks_table);
+        sql.append("(CHAIN,MAIN_CHAIN,NUMBER);");
+        sql.append("CREATE INDEX IF NOT EXISTS ");
+        sql.append(blocks_table);
+        sql.append("_number ON ");
+        sql.append(blocks_table);
+        sql.append("(CHAIN,NUMBER);");
+
+        sql.append("CREATE TABLE IF NOT EXISTS ");
+        sql.append(state_table);
+        sql.append("(CHAIN INTEGER NOT NULL,PUBKEY BLOB NOT NULL,BALANCE INTEGER,NONCE INTEGER,POWER INTEGER,"
+                   "PRIMARY KEY(CHAIN,PUBKEY));");
+        sql.append("CREATE INDEX IF NOT EXISTS ");
+        sql.append(state_table);
+        sql.append("_effective ON ");
+        sql.append(state_table);
+        sql.append("(CHAIN,BALANCE DESC,POWER DESC,NONCE DESC,PUBKEY DESC);");
+
+        sql.append("CREATE TABLE IF NOT EXISTS ");
+        sql.append(kv_table);
+        sql.append("(CHAIN INTEGER NOT NULL,HASH BLOB NOT NULL,VALUE BLOB,PRUNABLE INT,PRIMARY KEY(CHAIN,HASH));");
+        // entries end with the rowid, for the prune sweep of one chain
+        sql.append("CREATE INDEX IF NOT EXISTS ");
+        sql.append(kv_table);
+        sql.append("_chain ON ");
+        sql.append(kv_table);
+        sql.append("(CHAIN);");
+
+        for (auto const &table: {peer_table, acl_table, online_list_table}) {
+            sql.append("CREATE TABLE IF NOT EXISTS ");
+            sql.append(table);
+            sql.append("(CHAIN INTEGER NOT NULL,PUBKEY BLOB NOT NULL,PRIMARY KEY(CHAIN,PUBKEY));");
+        }
+
+        sql.append("CREATE TABLE IF NOT EXISTS ");
+        sql.append(news_txs_table);
+        sql.append("(CHAIN INTEGER NOT NULL,HASH BLOB NOT NULL,TIMESTAMP INTEGER,VALUE BLOB,PRIMARY KEY(CHAIN,HASH));");
+        sql.append("CREATE INDEX IF NOT EXISTS ");
+        sql.append(news_txs_table);
+        sql.append("_timestamp ON ");
+        sql.append(news_txs_table);
+        sql.append("(CHAIN,TIMESTAMP);");
+
+        return exec(sql.c_str());
+    }
+
+    bool repository_shared::migrate_per_chain_tables() {
+        // one schema scan, a lookup per table would scan it again
+        std::set<std::string> tables;
+        {
+            std::string sql = "SELECT name FROM sqlite_master WHERE type='table'";
+            auto stmt = prepare_cached(std::string(), sql);
+            if (!stmt) {
+                return false;
+            }
+            while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                tables.insert(reinterpret_cast<const char *>(sqlite3_column_text(stmt.get(), 0)));
+            }
+        }
+
+        auto migrate = [&](const std::string &from, const std::string &to, const std::string &columns, std::int64_t ordinal) {
+            if (tables.find(from) == tables.end()) {
+                // never created for this chain
+                return true;
+            }
+
+            bool ok;
+            {
+                std::string sql = "INSERT OR REPLACE INTO ";
+                sql.append(to);
+                sql.append("(CHAIN,");
+                sql.append(columns);
+                sql.append(") SELECT ?,");
+                sql.append(columns);
+                sql.append(" FROM ");
+                sql.append(from);
+                auto stmt = prepare_cached(from, sql);
+                if (!stmt) {
+                    return false;
+                }
+                sqlite3_bind_int64(stmt.get(), 1, ordinal);
+                ok = sqlite3_step(stmt.get()) == SQLITE_DONE;
+            }
+
+            // the table is dropped later, by drop_migrated_tables()
+            invalidate_stmt_cache(from);
+            return ok;
+        };
+
+        for (auto const& chain_id: get_all_chains()) {
+            std::int64_t ordinal = chain_ordinal(chain_id, true);
+            if (ordinal == 0) {
+                return false;
+            }
+
+            std::string const blocks = blocks_db_name(chain_id);
+            std::string const kv = kv_db_name(chain_id);
+            if (!migrate(blocks, blocks_table, has_column(blocks, "ENCODE") ? encoded_block_columns : block_columns, ordinal)
+                || !migrate(state_db_name(chain_id), state_table, "PUBKEY,BALANCE,NONCE,POWER", ordinal)
+                || !migrate(kv, kv_table, has_column(kv, "PRUNABLE") ? "HASH,VALUE,PRUNABLE" : "HASH,VALUE", ordinal)
+                || !migrate(peer_db_name(chain_id), peer_table, "PUBKEY", ordinal)
+                || !migrate(acl_db_name(chain_id), acl_table, "PUBKEY", ordinal)
+                || !migrate(online_list_db_name(chain_id), online_list_table, "PUBKEY", ordinal)
+                || !migrate(news_txs_db_name(chain_id), news_txs_table, "HASH,TIMESTAMP,VALUE", ordinal)) {
+                return false;
+            }
+
+            // databases older than per chain schema version 1 have none
+            if (!refresh_head_block_pointer(chain_id)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    int repository_shared::drop_migrated_tables(time_duration budget) {
+        if (!m_migrated_tables_left) {
+            return 0;
+        }
+
+        // 't' + hex(sha1(chain id)) + table, see repository::blocks_db_name()
+        std::string pattern = "t";
+        for (int i = 0; i < 2 * static_cast<int>(libTAU::sha1_hash::size()); i++) {
+            pattern.append("[0-9a-f]");
+        }
+        pattern.append("*");
+
+        std::vector<std::string> tables;
+        {
+            std::string sql = "SELECT name FROM sqlite_master WHERE type='table' AND name GLOB ? LIMIT 64";
+            auto stmt = prepare_cached(std::string(), sql);
+            if (!stmt) {
+                return 0;
+            }
+            sqlite3_bind_text(stmt.get(), 1, pattern.c_str(), static_cast<int>(pattern.size()), nullptr);
+            while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                tables.emplace_back(reinterpret_cast<const char *>(sqlite3_column_text(stmt.get(), 0)));
+            }
+        }
+
+        if (tables.empty()) {
+            m_migrated_tables_left = false;
+            return 0;
+        }
+
+        // a drop scans the whole schema, the first ones are slow
+        auto const start = aux::time_now();
+        int dropped = 0;
+        for (auto const &table: tables) {
+            invalidate_stmt_cache(table);
+            std::string sql = "DROP TABLE ";
+            sql.append(table);
+            if (!exec(sql.c_str())) {
+                break;
+            }
+            dropped++;
+
+            if (aux::time_now() - start >= budget) {
+                break;
+            }
+        }
+
+        return dropped;
+    }
+
+    std::int64_t repository_shared::incremental_vacuum(int pages) {
+        if (pages > 0) {
+            drop_migrated_tables(milliseconds(migrated_drop_budget));
+        }
+
+        return repository_impl::incremental_vacuum(pages);
+    }
+
+    std::int64_t repository_shared::chain_ordinal(const aux::bytes &chain_id, bool create) {
+        auto it = m_ordinals.find(chain_id);
+        if (it != m_ordinals.end()) {
+            return it->second;
+        }
+
+        {
+            std::string sql = "SELECT ORDINAL FROM ";
+            sql.append(ordinals_table);
+            sql.append(" WHERE CHAIN_ID=?");
+            auto stmt = prepare_cached(ordinals_table, sql);
+            if (!stmt) {
+                return 0;
+            }
+            sqlite3_bind_blob(stmt.get(), 1, chain_id.data(), chain_id.size(), nullptr);
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                std::int64_t ordinal = sqlite3_column_int64(stmt.get(), 0);
+                m_ordinals[chain_id] = ordinal;
+                return ordinal;
+            }
+        }
+
+        if (!create) {
+            return 0;
+        }
+
+        // the short chain id as a big endian number
+        std::int64_t ordinal = 0;
+        for (std::size_t i = 0; i < chain_id.size() && i < static_cast<std::size_t>(short_chain_id_length); i++) {
+            ordinal = (ordinal << 8) | static_cast<std::uint8_t>(chain_id[i]);
+        }
+
+        // 0 is no ordinal, a taken one belongs to a chain with the same short id
+        {
+            std::string sql = "SELECT 1 FROM ";
+            sql.append(ordinals_table);
+            sql.append(" WHERE ORDINAL=?");
+            for (;; ordinal++) {
+                if (ordinal == 0) {
+                    continue;
+                }
+                auto stmt = prepare_cached(ordinals_table, sql);
+                if (!stmt) {
+                    return 0;
+                }
+                sqlite3_bind_int64(stmt.get(), 1, ordinal);
+                if (sqlite3_step(stmt.get()) != SQLITE_ROW) {
+                    break;
+                }
+            }
+        }
+
+        std::string sql = "INSERT INTO ";
+        sql.append(ordinals_table);
+        sql.append(" VALUES(?,?)");
+        auto stmt = prepare_cached(ordinals_table, sql);
+        if (!stmt) {
+            return 0;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, ordinal);
+        sqlite3_bind_blob(stmt.get(), 2, chain_id.data(), chain_id.size(), nullptr);
+        if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+            return 0;
+        }
+
+        m_ordinals[chain_id] = ordinal;
+        return ordinal;
+    }
+
+    bool repository_shared::rollback() {
+        // ordinals allocated in the rolled back transaction are gone
+        m_ordinals.clear();
+        return repository_impl::rollback();
+    }
+
+    bool repository_shared::flush(bool force) {
+        if (!repository_impl::flush(force)) {
+            m_ordinals.clear();
+            return false;
+        }
+
+        return true;
+    }
+
+    bool repository_shared::delete_chain_rows(const std::string &table, const aux::bytes &chain_id) {
+        std::int64_t ordinal = chain_ordinal(chain_id, false);
+        if (ordinal == 0) {
+            return true;
+        }
+
+        std::string sql = "DELETE FROM ";
+        sql.append(table);
+        sql.append(" WHERE CHAIN=?");
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, ordinal);
+
+        int ok = sqlite3_step(stmt.get());
+        if (ok != SQLITE_DONE) {
+            return false;
+        }
+
+        return true;
+    }
+
+    bool repository_shared::create_kv_db(const aux::bytes &chain_id) {
+        return chain_ordinal(chain_id, true) != 0;
+    }
+
+    bool repository_shared::delete_kv_db(const aux::bytes &chain_id) {
+        return delete_chain_rows(kv_table, chain_id);
+    }
+
+    bool repository_shared::put_kv(const aux::bytes &chain_id, const char *key, int key_size, const std::string &value, bool prunable) {
+        std::int64_t ordinal = chain_ordinal(chain_id, true);
+        if (ordinal == 0) {
+            return false;
+        }
+
+        std::string sql = "REPLACE INTO ";
+        sql.append(kv_table);
+        sql.append(" VALUES(?,?,?,?)");
+        auto stmt = prepare_cached(kv_table, sql);
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, ordinal);
+        sqlite3_bind_blob(stmt.get(), 2, key, key_size, nullptr);
+        sqlite3_bind_blob(stmt.get(), 3, value.data(), value.size(), nullptr);
+        if (prunable) {
+            sqlite3_bind_int(stmt.get(), 4, 1);
+        } else {
+            sqlite3_bind_null(stmt.get(), 4);
+        }
+
+        int ok = sqlite3_step(stmt.get());
+        if (ok != SQLITE_DONE) {
+            return false;
+        }
+
+        return true;
+    }
+
+    bool repository_shared::get_kv(const aux::bytes &chain_id, const char *key, int key_size, std::string &value) {
+        std::string sql = "SELECT VALUE FROM ";
+        sql.append(kv_table);
+        sql.append(" WHERE CHAIN=? AND HASH=?");
+        auto stmt = prepare_cached(kv_table, sql);
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, chain_ordinal(chain_id, false));
+        sqlite3_bind_blob(stmt.get(), 2, key, key_size, nullptr);
+        if (sqlite3_step(stmt.get()) != SQLITE_ROW) {
+            return false;
+        }
+
+        const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+        auto length = sqlite3_column_bytes(stmt.get(), 0);
+        value.assign(p, p + length);
+
+        return true;
+    }
+
+    bool repository_shared::save_hash_array(const aux::bytes &chain_id, const hash_array &hashArray) {
+        sha1_hash hash = hashArray.sha1();
+        return put_kv(chain_id, hash.data(), libTAU::sha1_hash::size(), hashArray.get_encode(), true);
+    }
+
+    hash_array repository_shared::get_hash_array_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
+        std::string encode;
+        if (!get_kv(chain_id, hash.data(), libTAU::sha1_hash::size(), encode)) {
+            return hash_array();
+        }
+
+        return hash_array(encode);
+    }
+
+    state_array repository_shared::get_state_array_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
+        std::string encode;
+        if (!get_kv(chain_id, hash.data(), libTAU::sha1_hash::size(), encode)) {
+            return state_array();
+        }
+
+        return state_array(encode);
+    }
+
+    bool repository_shared::save_state_array(const aux::bytes &chain_id, const state_array &stateArray) {
+        sha1_hash hash = stateArray.sha1();
+        return put_kv(chain_id, hash.data(), libTAU::sha1_hash::size(), stateArray.get_encode(), true);
+    }
+
+    bool repository_shared::save_tx(const aux::bytes &chain_id, const transaction &tx) {
+        sha1_hash hash = tx.sha1();
+        return put_kv(chain_id, hash.data(), libTAU::sha1_hash::size(), tx.get_encode(), true);
+    }
+
+    transaction repository_shared::get_tx_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
+        std::string encode;
+        if (!get_kv(chain_id, hash.data(), libTAU::sha1_hash::size(), encode)) {
+            return transaction();
+        }
+
+        return transaction(encode);
+    }
+
+    bool repository_shared::save_pic_slice(const aux::bytes &chain_id, const aux::bytes &key, const aux::bytes &slice) {
+        return put_kv(chain_id, key.data(), static_cast<int>(key.size()), std::string(slice.begin(), slice.end()), false);
+    }
+
+    aux::bytes repository_shared::get_pic_slice(const aux::bytes &chain_id, const aux::bytes &key) {
+        std::string value;
+        if (!get_kv(chain_id, key.data(), static_cast<int>(key.size()), value)) {
+            return aux::bytes();
+        }
+
+        return aux::bytes(value.begin(), value.end());
+    }
+
+    bool repository_shared::is_data_in_kv_db(const aux::bytes &chain_id, const sha1_hash &hash) {
+        std::string sql = "SELECT 1 FROM ";
+        sql.append(kv_table);
+        sql.append(" WHERE CHAIN=? AND HASH=?");
+        auto stmt = prepare_cached(kv_table, sql);
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, chain_ordinal(chain_id, false));
+        sqlite3_bind_blob(stmt.get(), 2, hash.data(), libTAU::sha1_hash::size(), nullptr);
+
+        return sqlite3_step(stmt.get()) == SQLITE_ROW;
+    }
+
+    bool repository_shared::delete_data_in_kv_db_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
+        std::string sql = "DELETE FROM ";
+        sql.append(kv_table);
+        sql.append(" WHERE CHAIN=? AND HASH=?");
+        auto stmt = prepare_cached(kv_table, sql);
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, chain_ordinal(chain_id, false));
+        sqlite3_bind_blob(stmt.get(), 2, hash.data(), libTAU::sha1_hash::size(), nullptr);
+
+        int ok = sqlite3_step(stmt.get());
+        if (ok != SQLITE_DONE) {
+            return false;
+        }
+
+        return true;
+    }
+
+    std::int64_t repository_shared::get_kv_position(const aux::bytes &) {
+        std::string sql = "SELECT MAX(rowid) FROM ";
+        sql.append(kv_table);
+        auto stmt = prepare_cached(kv_table, sql);
+        if (!stmt || sqlite3_step(stmt.get()) != SQLITE_ROW) {
+            return 0;
+        }
+
+        return sqlite3_column_int64(stmt.get(), 0);
+    }
+
+    std::vector<sha1_hash> repository_shared::get_kv_hashes(const aux::bytes &chain_id, std::int64_t &position, std::int64_t end, int limit) {
+        std::vector<sha1_hash> hashes;
+
+        std::string sql = "SELECT rowid,HASH FROM ";
+        sql.append(kv_table);
+        sql.append(" WHERE CHAIN=? AND rowid>? AND rowid<=? AND PRUNABLE=1 ORDER BY rowid LIMIT ?");
+        auto stmt = prepare_cached(kv_table, sql);
+        if (!stmt) {
+            return hashes;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, chain_ordinal(chain_id, false));
+        sqlite3_bind_int64(stmt.get(), 2, position);
+        sqlite3_bind_int64(stmt.get(), 3, end);
+        sqlite3_bind_int(stmt.get(), 4, limit);
+
+        bool visited = false;
+        while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+            visited = true;
+            position = sqlite3_column_int64(stmt.get(), 0);
+            const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 1));
+            if (p != nullptr && sqlite3_column_bytes(stmt.get(), 1) == libTAU::sha1_hash::size()) {
+                hashes.emplace_back(p);
+            }
+        }
+
+        if (!visited) {
+            position = end;
+        }
+
+        return hashes;
+    }
+
+    bool repository_shared::create_state_db(const aux::bytes &chain_id) {
+        return chain_ordinal(chain_id, true) != 0;
+    }
+
+    bool repository_shared::delete_state_db(const aux::bytes &chain_id) {
+        touch_all_state(chain_id);
+        return delete_chain_rows(state_table, chain_id);
+    }
+
+    bool repository_shared::clear_all_state(const aux::bytes &chain_id) {
+        touch_all_state(chain_id);
+        return delete_chain_rows(state_table, chain_id);
+    }
+
+    bool repository_shared::replace_all_state(const aux::bytes &chain_id, const std::vector<account> &accounts) {
+        if (!clear_all_state(chain_id)) {
+            return false;
+        }
+
+        std::int64_t ordinal = chain_ordinal(chain_id, true);
+        if (ordinal == 0) {
+            return false;
+        }
+
+        // the index is shared with the other chains, it stays. Rows are
+        // inserted in primary key order by a single statement
+        std::string sql = "INSERT INTO ";
+        sql.append(state_table);
+        sql.append(" VALUES(?,?,?,?,?)");
+        auto stmt = prepare_cached(state_table, sql);
+        if (!stmt) {
+            return false;
+        }
+
+        for (auto const& act: final_accounts(accounts)) {
+            sqlite3_reset(stmt.get());
+            sqlite3_bind_int64(stmt.get(), 1, ordinal);
+            sqlite3_bind_blob(stmt.get(), 2, act.peer().bytes.data(), dht::public_key::len, nullptr);
+            sqlite3_bind_int64(stmt.get(), 3, act.balance());
+            sqlite3_bind_int64(stmt.get(), 4, act.nonce());
+            sqlite3_bind_int64(stmt.get(), 5, act.power());
+            if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    account repository_shared::get_account(const aux::bytes &chain_id, const dht::public_key &pubKey) {
+        account act(pubKey);
+
+        std::string sql = "SELECT BALANCE,NONCE,POWER FROM ";
+        sql.append(state_table);
+        sql.append(" WHERE CHAIN=? AND PUBKEY=?");
+        auto stmt = prepare_cached(state_table, sql);
+        if (stmt) {
+            sqlite3_bind_int64(stmt.get(), 1, chain_ordinal(chain_id, false));
+            sqlite3_bind_blob(stmt.get(), 2, pubKey.bytes.data(), dht::public_key::len, nullptr);
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                act.set_balance(sqlite3_column_int64(stmt.get(), 0));
+                act.set_nonce(sqlite3_column_int64(stmt.get(), 1));
+                act.set_power(sqlite3_column_int64(stmt.get(), 2));
+            }
+        }
+
+        return act;
+    }
+
+    bool repository_shared::is_account_existed(const aux::bytes &chain_id, const dht::public_key &pubKey) {
+        std::string sql = "SELECT 1 FROM ";
+        sql.append(state_table);
+        sql.append(" WHERE CHAIN=? AND PUBKEY=?");
+        auto stmt = prepare_cached(state_table, sql);
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, chain_ordinal(chain_id, false));
+        sqlite3_bind_blob(stmt.get(), 2, pubKey.bytes.data(), dht::public_key::len, nullptr);
+
+        return sqlite3_step(stmt.get()) == SQLITE_ROW;
+    }
+
+    bool repository_shared::save_account(const aux::bytes &chain_id, const account &act) {
+        touch_account(chain_id, act.peer());
+
+        std::int64_t ordinal = chain_ordinal(chain_id, true);
+        if (ordinal == 0) {
+            return false;
+        }
+
+        std::string sql = "REPLACE INTO ";
+        sql.append(state_table);
+        sql.append(" VALUES(?,?,?,?,?)");
+        auto stmt = prepare_cached(state_table, sql);
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, ordinal);
+        sqlite3_bind_blob(stmt.get(), 2, act.peer().bytes.data(), dht::public_key::len, nullptr);
+        sqlite3_bind_int64(stmt.get(), 3, act.balance());
+        sqlite3_bind_int64(stmt.get(), 4, act.nonce());
+        sqlite3_bind_int64(stmt.get(), 5, act.power());
+
+        int ok = sqlite3_step(stmt.get());
+        if (ok != SQLITE_DONE) {
+            return false;
+        }
+
+        return true;
+    }
+
+    bool repository_shared::delete_account(const aux::bytes &chain_id, const dht::public_key &pubKey) {
+        touch_account(chain_id, pubKey);
+        return delete_pubkey(state_table, chain_id, pubKey);
+    }
+
+    std::vector<account> repository_shared::get_all_effective_state(const aux::bytes &chain_id) {
+        std::vector<account> accounts;
+
+        std::string sql = "SELECT PUBKEY,BALANCE,NONCE,POWER FROM ";
+        sql.append(state_table);
+        sql.append(" WHERE CHAIN=? ORDER BY BALANCE DESC,POWER DESC,NONCE DESC,PUBKEY DESC");
+        auto stmt = prepare_cached(state_table, sql);
+        if (stmt) {
+            sqlite3_bind_int64(stmt.get(), 1, chain_ordinal(chain_id, false));
+            for (;sqlite3_step(stmt.get()) == SQLITE_ROW;) {
+                const char *pK = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                dht::public_key peer(pK);
+                std::int64_t balance = sqlite3_column_int64(stmt.get(), 1);
+                std::int64_t nonce = sqlite3_column_int64(stmt.get(), 2);
+                std::int64_t power = sqlite3_column_int64(stmt.get(), 3);
+                accounts.emplace_back(peer, balance, nonce, power);
+            }
+        }
+
+        return accounts;
+    }
+
+    std::set<dht::public_key> repository_shared::sample_chain_pubkeys(const std::string &table, const aux::bytes &chain_id, int num) {
+        std::set<dht::public_key> peers;
+        if (num <= 0) {
+            return peers;
+        }
+
+        std::int64_t ordinal = chain_ordinal(chain_id, false);
+        if (ordinal == 0) {
+            return peers;
+        }
+
+        std::string sql = "SELECT PUBKEY FROM ";
+        sql.append(table);
+        sql.append(" WHERE CHAIN=? AND PUBKEY>=? ORDER BY PUBKEY LIMIT ?");
+
+        // collect up to limit keys from start on, the first key of the chain
+        // without start. Returns the number of keys seen
+        auto collect = [&](const dht::public_key *start, int limit) {
+            auto stmt = prepare_cached(table, sql);
+            if (!stmt) {
+                return 0;
+            }
+            sqlite3_bind_int64(stmt.get(), 1, ordinal);
+            if (start != nullptr) {
+                sqlite3_bind_blob(stmt.get(), 2, start->bytes.data(), dht::public_key::len, nullptr);
+            } else {
+                // every blob sorts at or after the empty one
+                sqlite3_bind_zeroblob(stmt.get(), 2, 0);
+            }
+            sqlite3_bind_int(stmt.get(), 3, limit);
+
+            int seen = 0;
+            while (static_cast<int>(peers.size()) < num && sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                const char *pK = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                peers.insert(dht::public_key(pK));
+                seen++;
+            }
+            return seen;
+        };
+
+        // public keys are uniformly distributed, the first key at or after
+        // a random one is close to a uniform pick
+        std::uniform_int_distribution<int> dist(0, 255);
+        for (int i = 0; i < 4 * num && static_cast<int>(peers.size()) < num; i++) {
+            dht::public_key start;
+            for (auto &b: start.bytes) {
+                b = static_cast<char>(dist(aux::random_engine()));
+            }
+
+            // past the last key, wrap around
+            if (collect(&start, 1) == 0 && collect(nullptr, 1) == 0) {
+                return peers;
+            }
+        }
+
+        // few keys, fill up in key order
+        if (static_cast<int>(peers.size()) < num) {
+            collect(nullptr, 2 * num);
+        }
+
+        return peers;
+    }
+
+    dht::public_key repository_shared::get_peer_from_state_db_randomly(const aux::bytes &chain_id) {
+        auto peers = sample_chain_pubkeys(state_table, chain_id, 1);
+        if (peers.empty()) {
+            return dht::public_key{};
+        }
+
+        return *peers.begin();
+    }
+
+    std::set<dht::public_key> repository_shared::get_peers_from_state_db_randomly(const aux::bytes &chain_id, int num) {
+        return sample_chain_pubkeys(state_table, chain_id, num);
+    }
+
+    bool repository_shared::create_block_db(const aux::bytes &chain_id) {
+        return chain_ordinal(chain_id, true) != 0;
+    }
+
+    bool repository_shared::delete_block_db(const aux::bytes &chain_id) {
+        m_block_cache.erase_chain(chain_id);
+
+        if (!delete_chain_rows(blocks_table, chain_id)) {
+            return false;
+        }
+
+        return delete_head_block_pointer(chain_id);
+    }
+
+    bool repository_shared::refresh_head_block_pointer(const aux::bytes &chain_id) {
+        sha1_hash hash;
+        std::int64_t number = 0;
+        bool found = false;
+
+        {
+            std::string sql = "SELECT HASH,NUMBER FROM ";
+            sql.append(blocks_table);
+            sql.append(" WHERE CHAIN=? AND MAIN_CHAIN=1 ORDER BY NUMBER DESC LIMIT 1");
+            auto stmt = prepare_cached(blocks_table, sql);
+            if (!stmt) {
+                return false;
+            }
+            sqlite3_bind_int64(stmt.get(), 1, chain_ordinal(chain_id, false));
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                hash = sha1_hash(p);
+                number = sqlite3_column_int64(stmt.get(), 1);
+                found = true;
+            }
+        }
+
+        if (found) {
+            return set_head_block_pointer(chain_id, hash, number);
+        } else {
+            return delete_head_block_pointer(chain_id);
+        }
+    }
+
+    std::string repository_shared::get_test_tx_string(const aux::bytes &chain_id) {
+        std::string ret;
+
+        std::string sql = "SELECT TX,ENCODE FROM ";
+        sql.append(blocks_table);
+        sql.append(" WHERE CHAIN=? AND MAIN_CHAIN=1 ORDER BY NUMBER DESC LIMIT 1");
+        auto stmt = prepare_cached(blocks_table, sql);
+        if (stmt) {
+            sqlite3_bind_int64(stmt.get(), 1, chain_ordinal(chain_id, false));
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 1));
+                auto length = sqlite3_column_bytes(stmt.get(), 1);
+                if (length > 0) {
+                    block blk(std::string(p, static_cast<std::size_t>(length)));
+                    auto const& tx = blk.tx();
+                    if (!tx.empty()) {
+                        ret = tx.get_encode();
+                    }
+                    return ret;
+                }
+
+                p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                length = sqlite3_column_bytes(stmt.get(), 0);
+                if (length > 0) {
+                    ret.append(p, length);
+                }
+            }
+        }
+
+        return ret;
+    }
+
+    int repository_shared::get_test_tx_size(const aux::bytes &chain_id) {
+        int ret = 111;
+
+        std::string tx_encode = get_test_tx_string(chain_id);
+        if (!tx_encode.empty()) {
+            ret = static_cast<int>(strlen(tx_encode.c_str()));
+        }
+
+        return ret;
+    }
+
+    block repository_shared::get_block_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
+        auto cached = m_block_cache.get(chain_id, hash);
+        if (cached) {
+            return *cached;
+        }
+
+        block blk;
+
+        std::string sql = "SELECT ";
+        sql.append(block_fields);
+        sql.append(",ENCODE FROM ");
+        sql.append(blocks_table);
+        sql.append(" WHERE CHAIN=? AND HASH=?");
+        auto stmt = prepare_cached(blocks_table, sql);
+        if (stmt) {
+            sqlite3_bind_int64(stmt.get(), 1, chain_ordinal(chain_id, false));
+            sqlite3_bind_blob(stmt.get(), 2, hash.data(), libTAU::sha1_hash::size(), nullptr);
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                blk = read_block(stmt.get(), chain_id, hash);
+
+                if (m_block_cache.enabled()) {
+                    bool main_chain = sqlite3_column_int(stmt.get(), 12) != 0;
+                    std::int64_t size = sizeof(block) + chain_id.size() + sqlite3_column_bytes(stmt.get(), 9)
+                        + sqlite3_column_bytes(stmt.get(), 13);
+                    m_block_cache.put(std::make_shared<const block>(blk), main_chain, size);
+                }
+            }
+        }
+
+        return blk;
+    }
+
+    bool repository_shared::save_block(const block &blk, bool main_chain, bool replace) {
+        std::int64_t ordinal = chain_ordinal(blk.chain_id(), true);
+        if (ordinal == 0) {
+            return false;
+        }
+
+        // a block is identified by its hash, an existing one is kept as is
+        std::string sql = replace ? "REPLACE INTO " : "INSERT OR IGNORE INTO ";
+        sql.append(blocks_table);
+        sql.append("(CHAIN,");
+        sql.append(encoded_block_columns);
+        sql.append(") VALUES(?,?,?,?,?)");
+        auto stmt = prepare_cached(blocks_table, sql);
+        if (!stmt) {
+            return false;
+        }
+
+        std::string encode = blk.get_encode();
+        sqlite3_bind_int64(stmt.get(), 1, ordinal);
+        sqlite3_bind_blob(stmt.get(), 2, blk.sha1().data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_int64(stmt.get(), 3, blk.block_number());
+        sqlite3_bind_int(stmt.get(), 4, main_chain ? 1 : 0);
+        sqlite3_bind_blob(stmt.get(), 5, encode.data(), encode.size(), nullptr);
+
+        int ok = sqlite3_step(stmt.get());
+        if (ok != SQLITE_DONE) {
+            return false;
+        }
+
+        return true;
+    }
+
+    bool repository_shared::save_block_if_not_exist(const block &blk) {
+        return save_block(blk, false, false);
+    }
+
+    bool repository_shared::save_main_chain_block(const block &blk) {
+        const auto& chain_id = blk.chain_id();
+        if (!save_block(blk, true, true)) {
+            return false;
+        }
+
+        m_block_cache.set_main_chain(chain_id, blk.sha1(), true);
+
+        sha1_hash head_hash;
+        std::int64_t head_number = 0;
+        if (!get_head_block_pointer(chain_id, head_hash, head_number) || blk.block_number() >= head_number) {
+            return set_head_block_pointer(chain_id, blk.sha1(), blk.block_number());
+        }
+
+        return true;
+    }
+
+    bool repository_shared::delete_block_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
+        m_block_cache.erase(chain_id, hash);
+
+        std::string sql = "DELETE FROM ";
+        sql.append(blocks_table);
+        sql.append(" WHERE CHAIN=? AND HASH=?");
+        auto stmt = prepare_cached(blocks_table, sql);
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, chain_ordinal(chain_id, false));
+        sqlite3_bind_blob(stmt.get(), 2, hash.data(), libTAU::sha1_hash::size(), nullptr);
+
+        int ok = sqlite3_step(stmt.get());
+        if (ok != SQLITE_DONE) {
+            return false;
+        }
+
+        return refresh_head_block_pointer(chain_id);
+    }
+
+    block repository_shared::get_main_chain_block_by_number(const aux::bytes &chain_id, std::int64_t block_number) {
+        block blk;
+
+        std::string sql = "SELECT ";
+        sql.append(block_fields);
+        sql.append(",ENCODE,HASH FROM ");
+        sql.append(blocks_table);
+        sql.append(" WHERE CHAIN=? AND MAIN_CHAIN=1 AND NUMBER=?");
+        auto stmt = prepare_cached(blocks_table, sql);
+        if (stmt) {
+            sqlite3_bind_int64(stmt.get(), 1, chain_ordinal(chain_id, false));
+            sqlite3_bind_int64(stmt.get(), 2, block_number);
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 14));
+                blk = read_block(stmt.get(), chain_id, sha1_hash(p));
+            }
+        }
+
+        return blk;
+    }
+
+    bool repository_shared::delete_all_blocks_less_than_number(const aux::bytes &chain_id, std::int64_t block_number) {
+        m_block_cache.erase_less_than_number(chain_id, block_number);
+
+        std::string sql = "DELETE FROM ";
+        sql.append(blocks_table);
+        sql.append(" WHERE CHAIN=? AND NUMBER<=?");
+        auto stmt = prepare_cached(blocks_table, sql);
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, chain_ordinal(chain_id, false));
+        sqlite3_bind_int64(stmt.get(), 2, block_number);
+
+        int ok = sqlite3_step(stmt.get());
+        if (ok != SQLITE_DONE) {
+            return false;
+        }
+
+        return refresh_head_block_pointer(chain_id);
+    }
+
+    int repository_shared::prune_blocks(const aux::bytes &chain_id, std::int64_t main_number, std::int64_t side_number, int limit) {
+        std::int64_t ordinal = chain_ordinal(chain_id, false);
+        if (ordinal == 0) {
+            return 0;
+        }
+
+        std::vector<sha1_hash> hashes;
+
+        auto collect = [&](cached_stmt stmt) {
+            if (!stmt) {
+                return false;
+            }
+            int ok;
+            while ((ok = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                if (p != nullptr && sqlite3_column_bytes(stmt.get(), 0) == libTAU::sha1_hash::size()) {
+                    hashes.emplace_back(p);
+                }
+            }
+            return ok == SQLITE_DONE;
+        };
+
+        // every block below the main chain horizon
+        {
+            std::string sql = "SELECT HASH FROM ";
+            sql.append(blocks_table);
+            sql.append(" WHERE CHAIN=? AND NUMBER<? LIMIT ?");
+            auto stmt = prepare_cached(blocks_table, sql);
+            if (stmt) {
+                sqlite3_bind_int64(stmt.get(), 1, ordinal);
+                sqlite3_bind_int64(stmt.get(), 2, main_number);
+                sqlite3_bind_int(stmt.get(), 3, limit);
+            }
+            if (!collect(std::move(stmt))) {
+                return -1;
+            }
+        }
+
+        // side branch blocks up to the side horizon
+        if (static_cast<int>(hashes.size()) < limit && side_number > main_number) {
+            std::string sql = "SELECT HASH FROM ";
+            sql.append(blocks_table);
+            sql.append(" WHERE CHAIN=? AND MAIN_CHAIN=0 AND NUMBER>=? AND NUMBER<? LIMIT ?");
+            auto stmt = prepare_cached(blocks_table, sql);
+            if (stmt) {
+                sqlite3_bind_int64(stmt.get(), 1, ordinal);
+                sqlite3_bind_int64(stmt.get(), 2, main_number);
+                sqlite3_bind_int64(stmt.get(), 3, side_number);
+                sqlite3_bind_int(stmt.get(), 4, limit - static_cast<int>(hashes.size()));
+            }
+            if (!collect(std::move(stmt))) {
+                return -1;
+            }
+        }
+
+        if (hashes.empty()) {
+            return 0;
+        }
+
+        std::string sql = "DELETE FROM ";
+        sql.append(blocks_table);
+        sql.append(" WHERE CHAIN=? AND HASH=?");
+        for (auto const &hash: hashes) {
+            m_block_cache.erase(chain_id, hash);
+
+            auto stmt = prepare_cached(blocks_table, sql);
+            if (!stmt) {
+                return -1;
+            }
+            sqlite3_bind_int64(stmt.get(), 1, ordinal);
+            sqlite3_bind_blob(stmt.get(), 2, hash.data(), libTAU::sha1_hash::size(), nullptr);
+            if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+                return -1;
+            }
+        }
+
+        if (!refresh_head_block_pointer(chain_id)) {
+            return -1;
+        }
+
+        return static_cast<int>(hashes.size());
+    }
+
+    std::vector<sha1_hash> repository_shared::get_side_branch_block_hashes(const aux::bytes &chain_id, std::int64_t block_number) {
+        std::vector<sha1_hash> hashes;
+
+        std::int64_t ordinal = chain_ordinal(chain_id, false);
+        if (ordinal == 0) {
+            return hashes;
+        }
+
+        std::string sql = "SELECT HASH FROM ";
+        sql.append(blocks_table);
+        sql.append(" WHERE CHAIN=? AND MAIN_CHAIN=0 AND NUMBER>=?");
+        auto stmt = prepare_cached(blocks_table, sql);
+        if (!stmt) {
+            return hashes;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, ordinal);
+        sqlite3_bind_int64(stmt.get(), 2, block_number);
+
+        while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+            const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+            if (p != nullptr && sqlite3_column_bytes(stmt.get(), 0) == libTAU::sha1_hash::size()) {
+                hashes.emplace_back(p);
+            }
+        }
+
+        return hashes;
+    }
+
+    bool repository_shared::set_main_chain(const aux::bytes &chain_id, const sha1_hash &hash, bool main_chain) {
+        std::string sql = "UPDATE ";
+        sql.append(blocks_table);
+        sql.append(" SET MAIN_CHAIN=? WHERE CHAIN=? AND HASH=?");
+        auto stmt = prepare_cached(blocks_table, sql);
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_int(stmt.get(), 1, main_chain ? 1 : 0);
+        sqlite3_bind_int64(stmt.get(), 2, chain_ordinal(chain_id, false));
+        sqlite3_bind_blob(stmt.get(), 3, hash.data(), libTAU::sha1_hash::size(), nullptr);
+
+        int ok = sqlite3_step(stmt.get());
+        if (ok != SQLITE_DONE) {
+            return false;
+        }
+
+        m_block_cache.set_main_chain(chain_id, hash, main_chain);
+
+        return refresh_head_block_pointer(chain_id);
+    }
+
+    bool repository_shared::set_block_non_main_chain(const aux::bytes &chain_id, const sha1_hash &hash) {
+        return set_main_chain(chain_id, hash, false);
+    }
+
+    bool repository_shared::set_block_main_chain(const aux::bytes &chain_id, const sha1_hash &hash) {
+        return set_main_chain(chain_id, hash, true);
+    }
+
+    bool repository_shared::set_all_block_non_main_chain(const aux::bytes &chain_id) {
+        std::string sql = "UPDATE ";
+        sql.append(blocks_table);
+        sql.append(" SET MAIN_CHAIN=0 WHERE CHAIN=?");
+        auto stmt = prepare_cached(blocks_table, sql);
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, chain_ordinal(chain_id, false));
+
+        int ok = sqlite3_step(stmt.get());
+        if (ok != SQLITE_DONE) {
+            return false;
+        }
+
+        m_block_cache.set_all_non_main_chain(chain_id);
+
+        return delete_head_block_pointer(chain_id);
+    }
+
+    bool repository_shared::add_pubkey(const std::string &table, const aux::bytes &chain_id, const dht::public_key &pubKey) {
+        std::int64_t ordinal = chain_ordinal(chain_id, true);
+        if (ordinal == 0) {
+            return false;
+        }
+
+        std::string sql = "REPLACE INTO ";
+        sql.append(table);
+        sql.append(" VALUES(?,?)");
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, ordinal);
+        sqlite3_bind_blob(stmt.get(), 2, pubKey.bytes.data(), dht::public_key::len, nullptr);
+
+        int ok = sqlite3_step(stmt.get());
+        if (ok != SQLITE_DONE) {
+            return false;
+        }
+
+        return true;
+    }
+
+    bool repository_shared::delete_pubkey(const std::string &table, const aux::bytes &chain_id, const dht::public_key &pubKey) {
+        std::string sql = "DELETE FROM ";
+        sql.append(table);
+        sql.append(" WHERE CHAIN=? AND PUBKEY=?");
+        auto stmt = prepare_cached(table, sql);
+        if (!stmt) {
+            return false;
+        }
+        sqlite3_bind_int64(stmt.get(), 1, chain_ordinal(chain_id, false));
+        sqlite3_bind_blob(stmt.get(), 2, pubKey.bytes.data(), dht::public_key::len, nullptr);
+
+        int ok = sqlite3_step(stmt.get());
+        if (ok != SQLITE_DONE) {
+            return false;
+        }
+
+        return true;
+    }
+
+    std::set<dht::public_key> repository_shared::get_all_pubkeys(const std::string &table, const aux::bytes &chain_id) {
+        std::set<dht::public_key> peers;
+
+        std::string sql = "SELECT PUBKEY FROM ";
+        sql.append(table);
+        sql.append(" WHERE CHAIN=?");
+        auto stmt = prepare_cached(table, sql);
+        if (stmt) {
+            sqlite3_bind_int64(stmt.get(), 1, chain_ordinal(chain_id, false));
+            for (;sqlite3_step(stmt.get()) == SQLITE_ROW;) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                peers.insert(dht::public_key(p));
+            }
+        }
+
+        return peers;
+    }
+
+    bool repository_shared::create_peer_db(const aux::bytes &chain_id) {
+        return chain_ordinal(chain_id, true) != 0;
+    }
+
+    bool repository_shared::delete_peer_db(const aux::bytes &chain_id) {
+        return delete_chain_rows(peer_table, chain_id);
+    }
+
+    dht::public_key repository_shared::get_peer_from_peer_db_randomly(const aux::bytes &chain_id) {
+        auto peers = sample_chain_pubkeys(peer_table, chain_id, 1);
+        if (peers.empty()) {
+            return dht::public_key{};
+        }
+
+        return *peers.begin();
+    }
+
+    std::set<dht::public_key> repository_shared::get_enough_peers_from_peer_db_randomly(const aux::bytes &chain_id) {
+        return sample_chain_pubkeys(peer_table, chain_id, 10);
+    }
+
+    std::set<dht::public_key> repository_shared::get_peers_from_peer_db_randomly(const aux::bytes &chain_id, int num) {
+        return sample_chain_pubkeys(peer_table, chain_id, num);
+    }
+
+    bool repository_shared::delete_peer_in_peer_db(const aux::bytes &chain_id, const dht::public_key &pubKey) {
+        return delete_pubkey(peer_table, chain_id, pubKey);
+    }
+
+    bool repository_shared::add_peer_in_peer_db(const aux::bytes &chain_id, const dht::public_key &pubKey) {
+        return add_pubkey(peer_table, chain_id, pubKey);
+    }
+
+    bool repository_shared::clear_peer_db(const aux::bytes &chain_id) {
+        return delete_chain_rows(peer_table, chain_id);
+    }
+
+    bool repository_shared::create_acl_db(const aux::bytes &chain_id) {
+        return chain_ordinal(chain_id, true) != 0;
+    }
+
+    bool repository_shared::delete_acl_db(const aux::bytes &chain_id) {
+        return delete_chain_rows(acl_table, chain_id);
+    }
+
+    std::set<dht::public_key> repository_shared::get_all_peer_in_acl_db(const aux::bytes &chain_id) {
+        return get_all_pubkeys(acl_table, chain_id);
+    }
+
+    bool repository_shared::clear_acl_db(const aux::bytes &chain_id) {
+        return delete_chain_rows(acl_table, chain_id);
+    }
+
+    bool repository_shared::add_peer_in_acl_db(const aux::bytes &chain_id, const dht::public_key &pubKey) {
+        return add_pubkey(acl_table, chain_id, pubKey);
+    }
+
+    bool repository_shared::create_online_list_db(const aux::bytes &chain_id) {
+        return chain_ordinal(chain_id, true) != 0;
+    }
+
+    bool repository_shared::delete_online_list_db(const aux::bytes &chain_id) {
+        return delete_chain_rows(online_list_table, chain_id);
+    }
+
+    std::set<dht::public_key> repository_shared::get_all_peer_in_online_list_db(const aux::bytes &chain_id) {
+        return get_all_pubkeys(online_list_table, chain_id);
+    }
+
+    bool repository_shared::clear_online_list_db(const aux::bytes &chain_id) {
+        return delete_chain_rows(online_list_table, chain_id);
+    }
+
+    bool repository_shared::add_peer_in_online_list_db(const aux::bytes &chain_id, const dht::public_key &pubKey) {
+        return add_pubkey(online_list_table, chain_id, pubKey);
+    }
+
+    bool repository_shared::create_news_tx_db(const aux::bytes &chain_id) {
+        return chain_ordinal(chain_id, true) != 0;
+    }
+
+    bool repository_shared::delete_news_tx_db(const aux::bytes &chain_id) {
+        return delete_chain_rows(news_txs_table, chain_id);
+    }
+
+    bool repository_shared::save_news_tx(const aux::bytes &chain_id, const transaction &tx) {
+        std::int64_t ordinal = chain_ordinal(chain_id, true);
+        if (ordinal == 0) {
+            return false;
+        }
+
+        std::string sql = "REPLACE INTO ";
+        sql.append(news_txs_table);
+        sql.append(" VALUES(?,?,?,?)");
+        auto stmt = prepare_cached(news_txs_table, sql);
+        if (!stmt) {
+            return false;
+        }
+        sha1_hash hash = tx.sha1();
+        std::string e = tx.get_encode();
+        sqlite3_bind_int64(stmt.get(), 1, ordinal);
+        sqlite3_bind_blob(stmt.get(), 2, hash.data(), libTAU::sha1_hash::size(), nullptr);
+        sqlite3_bind_int64(stmt.get(), 3, tx.timestamp());
+        sqlite3_bind_blob(stmt.get(), 4, e.data(), e.size(), nullptr);
+
+        int ok = sqlite3_step(stmt.get());
+        if (ok != SQLITE_DONE) {
+            return false;
+        }
+
+        return true;
+    }
+
+    transaction repository_shared::get_news_tx_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
+        transaction tx;
+
+        std::string sql = "SELECT VALUE FROM ";
+        sql.append(news_txs_table);
+        sql.append(" WHERE CHAIN=? AND HASH=?");
+        auto stmt = prepare_cached(news_txs_table, sql);
+        if (stmt) {
+            sqlite3_bind_int64(stmt.get(), 1, chain_ordinal(chain_id, false));
+            sqlite3_bind_blob(stmt.get(), 2, hash.data(), libTAU::sha1_hash::size(), nullptr);
+            if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                auto length = sqlite3_column_bytes(stmt.get(), 0);
+                std::string encode(p, p + length);
+                tx = transaction(encode);
+            }
+        }
+
+        return tx;
+    }
+
+    std::vector<transaction> repository_shared::get_latest_news_txs(const aux::bytes &chain_id) {
+        std::vector<transaction> txs;
+
+        std::string sql = "SELECT VALUE FROM ";
+        sql.append(news_txs_table);
+        sql.append(" WHERE CHAIN=? ORDER BY TIMESTAMP DESC LIMIT ?");
+        auto stmt = prepare_cached(news_txs_table, sql);
+        if (stmt) {
+            sqlite3_bind_int64(stmt.get(), 1, chain_ordinal(chain_id, false));
+            sqlite3_bind_int(stmt.get(), 2, MAX_NEWS_SIZE_IN_GENESIS_BLOCK);
+            for (;sqlite3_step(stmt.get()) == SQLITE_ROW;) {
+                const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                auto length = sqlite3_column_bytes(stmt.get(), 0);
+                std::string encode(p, p + length);
+                txs.emplace_back(encode);
+            }
+        }
+
+        return txs;
+    }
+}
@@ -11,292 +11,603 @@ see LICENSE file.
 namespace libTAU::blockchain {
 
     bool repository_track::init() {
-        return false;
+        return m_repository->init();
     }
 
     bool repository_track::begin_transaction() {
-        return false;
+        // an inner transaction gets its own savepoint in the backing
+        // repository, changes made before it must be there already
+        if (m_depth > 0 && !flush_overlay()) {
+            return false;
+        }
+
+        if (!m_repository->begin_transaction()) {
+            return false;
+        }
+        m_depth++;
+
+        return true;
     }
 
     bool repository_track::commit() {
-        return false;
+        if (m_depth == 0) {
+            return m_repository->commit();
+        }
+
+        if (!flush_overlay()) {
+            // a failed write fails every open transaction up to the outermost
+            rollback();
+            return false;
+        }
+        m_depth--;
+
+        bool const ok = m_repository->commit();
+        if (!ok) {
+            m_failed = m_depth > 0;
+        }
+
+        return ok;
     }
 
     bool repository_track::rollback() {
-        return false;
+        if (m_depth == 0) {
+            return m_repository->rollback();
+        }
+        m_depth--;
+
+        // nothing of the overlay has reached the backing repository since
+        // the matching begin_transaction, or it was part of a failed write
+        discard_overlay();
+        if (m_depth == 0) {
+            m_failed = false;
+        }
+
+        return m_repository->rollback();
+    }
+
+    bool repository_track::transaction_busy() const {
+        return m_repository->transaction_busy();
+    }
+
+    bool repository_track::take_lost_group() {
+        return m_repository->take_lost_group();
+    }
+
+    void repository_track::set_group_commit(int max_transactions, int max_latency) {
+        m_repository->set_group_commit(max_transactions, max_latency);
+    }
+
+    bool repository_track::flush(bool force) {
+        return m_repository->flush(force);
+    }
+
+    void repository_track::set_block_cache_size(std::int64_t size) {
+        m_repository->set_block_cache_size(size);
+    }
+
+    std::int64_t repository_track::incremental_vacuum(int pages) {
+        return m_repository->incremental_vacuum(pages);
     }
 
     std::set<aux::bytes> repository_track::get_all_chains() {
-        return std::set<aux::bytes>();
+        return m_repository->get_all_chains();
     }
 
     bool repository_track::add_new_chain(const aux::bytes &chain_id) {
-        return false;
+        return m_repository->add_new_chain(chain_id);
     }
 
     bool repository_track::delete_chain(const aux::bytes &chain_id) {
-        return false;
+        return m_repository->delete_chain(chain_id);
     }
 
-//    bool repository_track::set_head_block_hash(const aux::bytes &chain_id, const sha256_hash &hash) {
-//        return false;
-//    }
-//
-//    bool repository_track::delete_head_block_hash(const aux::bytes &chain_id) {
-//        return false;
-//    }
-
     bool repository_track::create_kv_db(const aux::bytes &chain_id) {
-        return false;
+        return m_repository->create_kv_db(chain_id);
     }
 
     bool repository_track::delete_kv_db(const aux::bytes &chain_id) {
-        return false;
+        return m_repository->delete_kv_db(chain_id);
     }
 
     bool repository_track::save_hash_array(const aux::bytes &chain_id, const hash_array &hashArray) {
-        return false;
+        return m_repository->save_hash_array(chain_id, hashArray);
     }
 
     hash_array repository_track::get_hash_array_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
-        return hash_array();
+        return m_repository->get_hash_array_by_hash(chain_id, hash);
     }
 
     state_array repository_track::get_state_array_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
-        return state_array(libTAU::entry());
+        return m_repository->get_state_array_by_hash(chain_id, hash);
     }
 
     bool repository_track::save_tx(const aux::bytes &chain_id, const transaction &tx) {
-        return false;
+        return m_repository->save_tx(chain_id, tx);
     }
 
     transaction repository_track::get_tx_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
-        return transaction();
+        return m_repository->get_tx_by_hash(chain_id, hash);
     }
 
     bool repository_track::save_pic_slice(const aux::bytes &chain_id, const aux::bytes &key, const aux::bytes &slice) {
-        return false;
+        return m_repository->save_pic_slice(chain_id, key, slice);
     }
 
     aux::bytes repository_track::get_pic_slice(const aux::bytes &chain_id, const aux::bytes &key) {
-        return libTAU::aux::bytes();
+        return m_repository->get_pic_slice(chain_id, key);
     }
 
     bool repository_track::is_data_in_kv_db(const aux::bytes &chain_id, const sha1_hash &hash) {
-        return false;
+        return m_repository->is_data_in_kv_db(chain_id, hash);
     }
 
     bool repository_track::save_state_array(const aux::bytes &chain_id, const state_array &stateArray) {
-        return false;
+        return m_repository->save_state_array(chain_id, stateArray);
     }
 
     bool repository_track::delete_data_in_kv_db_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
-        return false;
+        return m_repository->delete_data_in_kv_db_by_hash(chain_id, hash);
+    }
+
+    std::int64_t repository_track::get_kv_position(const aux::bytes &chain_id) {
+        return m_repository->get_kv_position(chain_id);
+    }
+
+    std::vector<sha1_hash> repository_track::get_kv_hashes(const aux::bytes &chain_id, std::int64_t &position, std::int64_t end, int limit) {
+        return m_repository->get_kv_hashes(chain_id, position, end, limit);
     }
 
     bool repository_track::create_state_db(const aux::bytes &chain_id) {
-        return false;
+        return m_repository->create_state_db(chain_id);
     }
 
     bool repository_track::delete_state_db(const aux::bytes &chain_id) {
-        return false;
+        if (!flush_overlay()) {
+            return false;
+        }
+
+        return m_repository->delete_state_db(chain_id);
     }
 
     bool repository_track::clear_all_state(const aux::bytes &chain_id) {
-        return false;
+        if (m_depth == 0) {
+            return m_repository->clear_all_state(chain_id);
+        }
+
+        m_cleared_states.insert(chain_id);
+        m_accounts.erase(chain_id);
+        m_dirty_accounts.erase(chain_id);
+
+        return true;
+    }
+
+    bool repository_track::replace_all_state(const aux::bytes &chain_id, const std::vector<account> &accounts) {
+        // the overlay is written first, so that the new state replaces it
+        if (!flush_overlay()) {
+            return false;
+        }
+
+        return m_repository->replace_all_state(chain_id, accounts);
     }
 
     account repository_track::get_account(const aux::bytes &chain_id, const dht::public_key &pubKey) {
-        return account(pubKey);
+        if (m_depth == 0) {
+            return m_repository->get_account(chain_id, pubKey);
+        }
+
+        auto &accounts = m_accounts[chain_id];
+        auto it = accounts.find(pubKey);
+        if (it != accounts.end()) {
+            return it->second;
+        }
+
+        account act = m_cleared_states.count(chain_id) > 0 ? account(pubKey)
+                : m_repository->get_account(chain_id, pubKey);
+        accounts.emplace(pubKey, act);
+
+        return act;
     }
 
     bool repository_track::is_account_existed(const aux::bytes &chain_id, const dht::public_key &pubKey) {
-        return false;
+        if (m_depth == 0) {
+            return m_repository->is_account_existed(chain_id, pubKey);
+        }
+
+        auto dirty = m_dirty_accounts.find(chain_id);
+        if (dirty != m_dirty_accounts.end()) {
+            auto it = dirty->second.find(pubKey);
+            if (it != dirty->second.end()) {
+                switch (it->second) {
+                    case account_op::save:
+                        return true;
+                    case account_op::erase:
+                        return false;
+                    case account_op::update:
+                        return !m_accounts[chain_id].at(pubKey).empty();
+                }
+            }
+        }
+
+        // not written in this transaction
+        return m_cleared_states.count(chain_id) == 0 && m_repository->is_account_existed(chain_id, pubKey);
     }
 
     bool repository_track::update_account(const aux::bytes &chain_id, const account &act) {
-        return false;
+        if (m_depth == 0) {
+            return m_repository->update_account(chain_id, act);
+        }
+
+        m_accounts[chain_id][act.peer()] = act;
+        m_dirty_accounts[chain_id][act.peer()] = account_op::update;
+
+        return true;
     }
 
     bool repository_track::save_account(const aux::bytes &chain_id, const account &act) {
-        return false;
+        if (m_depth == 0) {
+            return m_repository->save_account(chain_id, act);
+        }
+
+        m_accounts[chain_id][act.peer()] = act;
+        m_dirty_accounts[chain_id][act.peer()] = account_op::save;
+
+        return true;
     }
 
     bool repository_track::delete_account(const aux::bytes &chain_id, const dht::public_key &pubKey) {
-        return false;
+        if (m_depth == 0) {
+            return m_repository->delete_account(chain_id, pubKey);
+        }
+
+        m_accounts[chain_id][pubKey] = account(pubKey);
+        m_dirty_accounts[chain_id][pubKey] = account_op::erase;
+
+        return true;
     }
 
     std::vector<account> repository_track::get_all_effective_state(const aux::bytes &chain_id) {
-        return std::vector<account>();
+        if (!flush_overlay()) {
+            return {};
+        }
+
+        return m_repository->get_all_effective_state(chain_id);
+    }
+
+    std::set<dht::public_key> repository_track::take_touched_accounts(const aux::bytes &chain_id, bool &reset) {
+        if (!flush_overlay()) {
+            return {};
+        }
+
+        return m_repository->take_touched_accounts(chain_id, reset);
     }
 
     dht::public_key repository_track::get_peer_from_state_db_randomly(const aux::bytes &chain_id) {
-        return dht::public_key();
+        if (!flush_overlay()) {
+            return {};
+        }
+
+        return m_repository->get_peer_from_state_db_randomly(chain_id);
+    }
+
+    std::set<dht::public_key> repository_track::get_peers_from_state_db_randomly(const aux::bytes &chain_id, int num) {
+        if (!flush_overlay()) {
+            return {};
+        }
+
+        return m_repository->get_peers_from_state_db_randomly(chain_id, num);
     }
 
     bool repository_track::create_block_db(const aux::bytes &chain_id) {
-        return false;
+        return m_repository->create_block_db(chain_id);
     }
 
     bool repository_track::delete_block_db(const aux::bytes &chain_id) {
-        return false;
+        if (!flush_overlay()) {
+            return false;
+        }
+
+        return m_repository->delete_block_db(chain_id);
+    }
+
+    std::string repository_track::get_test_tx_string(const aux::bytes &chain_id) {
+        if (!flush_overlay()) {
+            return {};
+        }
+
+        return m_repository->get_test_tx_string(chain_id);
+    }
+
+    int repository_track::get_test_tx_size(const aux::bytes &chain_id) {
+        if (!flush_overlay()) {
+            return 0;
+        }
+
+        return m_repository->get_test_tx_size(chain_id);
     }
 
     block repository_track::get_head_block(const aux::bytes &chain_id) {
-        return block();
+        if (!flush_overlay()) {
+            return block();
+        }
+
+        return m_repository->get_head_block(chain_id);
     }
 
     block repository_track::get_block_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
-        return block();
+        auto it = m_blocks.find(std::make_pair(chain_id, hash));
+        if (it != m_blocks.end()) {
+            return it->second;
+        }
+
+        return m_repository->get_block_by_hash(chain_id, hash);
     }
 
     bool repository_track::save_block_if_not_exist(const block &blk) {
-        return false;
+        if (m_depth == 0) {
+            return m_repository->save_block_if_not_exist(blk);
+        }
+
+        m_blocks.emplace(std::make_pair(blk.chain_id(), blk.sha1()), blk);
+        m_block_journal.push_back({block_op::save_if_not_exist, blk.chain_id(), blk.sha1(), blk});
+
+        return true;
     }
 
     bool repository_track::save_main_chain_block(const block &blk) {
-        return false;
+        if (m_depth == 0) {
+            return m_repository->save_main_chain_block(blk);
+        }
+
+        m_blocks[std::make_pair(blk.chain_id(), blk.sha1())] = blk;
+        m_block_journal.push_back({block_op::save_main_chain, blk.chain_id(), blk.sha1(), blk});
+
+        return true;
     }
 
     bool repository_track::delete_block_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
-        return false;
+        if (!flush_overlay()) {
+            return false;
+        }
+
+        return m_repository->delete_block_by_hash(chain_id, hash);
     }
 
     block repository_track::get_main_chain_block_by_number(const aux::bytes &chain_id, std::int64_t block_number) {
-        return block();
+        if (!flush_overlay()) {
+            return block();
+        }
+
+        return m_repository->get_main_chain_block_by_number(chain_id, block_number);
     }
 
     bool repository_track::delete_all_blocks_less_than_number(const aux::bytes &chain_id, std::int64_t block_number) {
-        return false;
+        if (!flush_overlay()) {
+            return false;
+        }
+
+        return m_repository->delete_all_blocks_less_than_number(chain_id, block_number);
+    }
+
+    int repository_track::prune_blocks(const aux::bytes &chain_id, std::int64_t main_number, std::int64_t side_number, int limit) {
+        if (!flush_overlay()) {
+            return -1;
+        }
+
+        return m_repository->prune_blocks(chain_id, main_number, side_number, limit);
+    }
+
+    std::vector<sha1_hash> repository_track::get_side_branch_block_hashes(const aux::bytes &chain_id, std::int64_t block_number) {
+        if (!flush_overlay()) {
+            return {};
+        }
+
+        return m_repository->get_side_branch_block_hashes(chain_id, block_number);
     }
 
     bool repository_track::set_block_non_main_chain(const aux::bytes &chain_id, const sha1_hash &hash) {
-        return false;
+        if (m_depth == 0) {
+            return m_repository->set_block_non_main_chain(chain_id, hash);
+        }
+
+        m_block_journal.push_back({block_op::set_non_main_chain, chain_id, hash, block()});
+
+        return true;
     }
 
     bool repository_track::set_block_main_chain(const aux::bytes &chain_id, const sha1_hash &hash) {
-        return false;
+        if (m_depth == 0) {
+            return m_repository->set_block_main_chain(chain_id, hash);
+        }
+
+        m_block_journal.push_back({block_op::set_main_chain, chain_id, hash, block()});
+
+        return true;
     }
 
     bool repository_track::set_all_block_non_main_chain(const aux::bytes &chain_id) {
-        return false;
+        if (!flush_overlay()) {
+            return false;
+        }
+
+        return m_repository->set_all_block_non_main_chain(chain_id);
     }
 
     bool repository_track::create_peer_db(const aux::bytes &chain_id) {
-        return false;
+        return m_repository->create_peer_db(chain_id);
     }
 
     bool repository_track::delete_peer_db(const aux::bytes &chain_id) {
-        return false;
+        return m_repository->delete_peer_db(chain_id);
     }
 
     dht::public_key repository_track::get_peer_from_peer_db_randomly(const aux::bytes &chain_id) {
-        return dht::public_key();
+        return m_repository->get_peer_from_peer_db_randomly(chain_id);
     }
 
     std::set<dht::public_key> repository_track::get_enough_peers_from_peer_db_randomly(const aux::bytes &chain_id) {
-        return std::set<dht::public_key>();
+        return m_repository->get_enough_peers_from_peer_db_randomly(chain_id);
+    }
+
+    std::set<dht::public_key> repository_track::get_peers_from_peer_db_randomly(const aux::bytes &chain_id, int num) {
+        return m_repository->get_peers_from_peer_db_randomly(chain_id, num);
     }
 
     bool repository_track::delete_peer_in_peer_db(const aux::bytes &chain_id, const dht::public_key &pubKey) {
-        return false;
+        return m_repository->delete_peer_in_peer_db(chain_id, pubKey);
     }
 
     bool repository_track::add_peer_in_peer_db(const aux::bytes &chain_id, const dht::public_key &pubKey) {
-        return false;
+        return m_repository->add_peer_in_peer_db(chain_id, pubKey);
     }
 
     bool repository_track::clear_peer_db(const aux::bytes &chain_id) {
-        return false;
-    }
-
-    std::string repository_track::get_test_tx_string(const aux::bytes &chain_id) {
-        return std::string();
-    }
-
-    int repository_track::get_test_tx_size(const aux::bytes &chain_id) {
-        return 0;
+        return m_repository->clear_peer_db(chain_id);
     }
 
     bool repository_track::create_acl_db(const aux::bytes &chain_id) {
-        return false;
+        return m_repository->create_acl_db(chain_id);
     }
 
     bool repository_track::delete_acl_db(const aux::bytes &chain_id) {
-        return false;
+        return m_repository->delete_acl_db(chain_id);
     }
 
     std::set<dht::public_key> repository_track::get_all_peer_in_acl_db(const aux::bytes &chain_id) {
-        return std::set<dht::public_key>();
+        return m_repository->get_all_peer_in_acl_db(chain_id);
     }
 
     bool repository_track::clear_acl_db(const aux::bytes &chain_id) {
-        return false;
+        return m_repository->clear_acl_db(chain_id);
     }
 
     bool repository_track::add_peer_in_acl_db(const aux::bytes &chain_id, const dht::public_key &pubKey) {
-        return false;
+        return m_repository->add_peer_in_acl_db(chain_id, pubKey);
     }
 
     bool repository_track::create_online_list_db(const aux::bytes &chain_id) {
-        return false;
+        return m_repository->create_online_list_db(chain_id);
     }
 
     bool repository_track::delete_online_list_db(const aux::bytes &chain_id) {
-        return false;
+        return m_repository->delete_online_list_db(chain_id);
     }
 
     std::set<dht::public_key> repository_track::get_all_peer_in_online_list_db(const aux::bytes &chain_id) {
-        return std::set<dht::public_key>();
+        return m_repository->get_all_peer_in_online_list_db(chain_id);
     }
 
     bool repository_track::clear_online_list_db(const aux::bytes &chain_id) {
-        return false;
+        return m_repository->clear_online_list_db(chain_id);
     }
 
     bool repository_track::add_peer_in_online_list_db(const aux::bytes &chain_id, const dht::public_key &pubKey) {
-        return false;
+        return m_repository->add_peer_in_online_list_db(chain_id, pubKey);
     }
 
     bool repository_track::create_community_info_db() {
-        return false;
+        return m_repository->create_community_info_db();
     }
 
     bool repository_track::delete_community_info_db() {
-        return false;
+        return m_repository->delete_community_info_db();
     }
 
     bool repository_track::update_touching_time(const aux::bytes &chain_id, std::int64_t touching_time) {
-        return false;
+        return m_repository->update_touching_time(chain_id, touching_time);
     }
 
     int64_t repository_track::get_touching_time(const aux::bytes &chain_id) {
-        return 0;
+        return m_repository->get_touching_time(chain_id);
     }
 
     bool repository_track::delete_touching_time(const aux::bytes &chain_id) {
-        return false;
+        return m_repository->delete_touching_time(chain_id);
     }
 
-
     bool repository_track::create_news_tx_db(const aux::bytes &chain_id) {
-        return false;
+        return m_repository->create_news_tx_db(chain_id);
     }
 
     bool repository_track::delete_news_tx_db(const aux::bytes &chain_id) {
-        return false;
+        return m_repository->delete_news_tx_db(chain_id);
     }
 
     bool repository_track::save_news_tx(const aux::bytes &chain_id, const transaction &tx) {
-        return false;
+        return m_repository->save_news_tx(chain_id, tx);
     }
 
     transaction repository_track::get_news_tx_by_hash(const aux::bytes &chain_id, const sha1_hash &hash) {
-        return transaction();
+        return m_repository->get_news_tx_by_hash(chain_id, hash);
     }
 
     std::vector<transaction> repository_track::get_latest_news_txs(const aux::bytes &chain_id) {
-        return std::vector<transaction>();
+        return m_repository->get_latest_news_txs(chain_id);
+    }
+
+    bool repository_track::flush_overlay() {
+        if (m_failed) {
+            return false;
+        }
+
+        bool ok = true;
+
+        for (auto const &chain_id: m_cleared_states) {
+            ok = m_repository->clear_all_state(chain_id) && ok;
+        }
+
+        for (auto const &item: m_dirty_accounts) {
+            auto const &accounts = m_accounts[item.first];
+            for (auto const &dirty: item.second) {
+                switch (dirty.second) {
+                    case account_op::update:
+                        ok = m_repository->update_account(item.first, accounts.at(dirty.first)) && ok;
+                        break;
+                    case account_op::save:
+                        ok = m_repository->save_account(item.first, accounts.at(dirty.first)) && ok;
+                        break;
+                    case account_op::erase:
+                        ok = m_repository->delete_account(item.first, dirty.first) && ok;
+                        break;
+                }
+            }
+        }
+
+        for (auto const &e: m_block_journal) {
+            switch (e.op) {
+                case block_op::save_if_not_exist:
+                    ok = m_repository->save_block_if_not_exist(e.blk) && ok;
+                    break;
+                case block_op::save_main_chain:
+                    ok = m_repository->save_main_chain_block(e.blk) && ok;
+                    break;
+                case block_op::set_main_chain:
+                    ok = m_repository->set_block_main_chain(e.chain_id, e.hash) && ok;
+                    break;
+                case block_op::set_non_main_chain:
+                    ok = m_repository->set_block_non_main_chain(e.chain_id, e.hash) && ok;
+                    break;
+            }
+        }
+
+        if (!ok) {
+            // part of the overlay may be in the backing repository. It is
+            // kept, so reads still see this transaction's writes, until the
+            // transaction is rolled back
+            m_failed = true;
+            return false;
+        }
+
+        discard_overlay();
+
+        return true;
+    }
+
+    void repository_track::discard_overlay() {
+        m_accounts.clear();
+        m_dirty_accounts.clear();
+        m_cleared_states.clear();
+        m_blocks.clear();
+        m_block_journal.clear();
     }
 
 //    bool repository_track::create_peer_db(const aux::bytes &chain_id) {
@@ -0,0 +1,240 @@
+/*
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+
+#include "libTAU/blockchain/constants.hpp"
+#include "libTAU/blockchain/state_commitment.hpp"
+
+namespace libTAU::blockchain {
+
+    namespace {
+        bool same_account(const account &a, const account &b) {
+            return a.peer() == b.peer() && a.balance() == b.balance()
+                && a.nonce() == b.nonce() && a.power() == b.power();
+        }
+    }
+
+    bool state_commitment::effective_order(const account &a, const account &b) {
+        // same as ORDER BY BALANCE DESC,POWER DESC,NONCE DESC,PUBKEY DESC,
+        // public keys compare as unsigned bytes, like sqlite blobs
+        if (a.balance() != b.balance()) {
+            return a.balance() > b.balance();
+        }
+        if (a.power() != b.power()) {
+            return a.power() > b.power();
+        }
+        if (a.nonce() != b.nonce()) {
+            return a.nonce() > b.nonce();
+        }
+
+        return std::memcmp(a.peer().bytes.data(), b.peer().bytes.data(), dht::public_key::len) > 0;
+    }
+
+    void state_commitment::invalidate() {
+        m_valid = false;
+        m_leaves.clear();
+        m_level0.clear();
+        m_level1 = hash_array();
+        m_dirty_leaves.clear();
+        m_dirty_level0.clear();
+        m_dirty_level1 = false;
+        m_unsaved_leaves.clear();
+        m_unsaved_level0.clear();
+        m_unsaved_level1 = false;
+    }
+
+    void state_commitment::reset(const std::vector<account> &accounts) {
+        invalidate();
+
+        m_dirty_leaves.assign((accounts.size() + MAX_ACCOUNT_SIZE_IN_ENTRY - 1) / MAX_ACCOUNT_SIZE_IN_ENTRY, true);
+        rebuild(accounts);
+
+        m_valid = true;
+    }
+
+    void state_commitment::update(const std::vector<account> &changed, const std::vector<dht::public_key> &removed) {
+        if (changed.empty() && removed.empty()) {
+            return;
+        }
+
+        std::set<dht::public_key> touched;
+        for (auto const &act: changed) {
+            touched.insert(act.peer());
+        }
+        for (auto const &peer: removed) {
+            touched.insert(peer);
+        }
+
+        std::vector<account> added = changed;
+        std::sort(added.begin(), added.end(), effective_order);
+
+        std::vector<account> old;
+        for (auto const &leaf: m_leaves) {
+            old.insert(old.end(), leaf.StateArray().begin(), leaf.StateArray().end());
+        }
+
+        // merge untouched accounts with the changed ones. A position is
+        // clean if it holds the same account as before, accounts after an
+        // insertion or removal all shift and have to be rehashed
+        std::vector<account> accounts;
+        accounts.reserve(old.size() + added.size());
+        m_dirty_leaves.assign((old.size() + added.size() + MAX_ACCOUNT_SIZE_IN_ENTRY - 1) / MAX_ACCOUNT_SIZE_IN_ENTRY, false);
+
+        std::size_t i = 0;
+        auto it = added.begin();
+        while (i < old.size() || it != added.end()) {
+            if (i < old.size() && touched.find(old[i].peer()) != touched.end()) {
+                i++;
+                continue;
+            }
+
+            std::size_t const pos = accounts.size();
+            bool clean;
+            if (it != added.end() && (i == old.size() || effective_order(*it, old[i]))) {
+                accounts.push_back(*it);
+                clean = pos < old.size() && same_account(old[pos], *it);
+                ++it;
+            } else {
+                accounts.push_back(old[i]);
+                clean = (pos == i);
+                i++;
+            }
+
+            if (!clean) {
+                m_dirty_leaves[pos / MAX_ACCOUNT_SIZE_IN_ENTRY] = true;
+            }
+        }
+
+        m_dirty_leaves.resize((accounts.size() + MAX_ACCOUNT_SIZE_IN_ENTRY - 1) / MAX_ACCOUNT_SIZE_IN_ENTRY);
+        rebuild(accounts);
+    }
+
+    void state_commitment::rebuild(const std::vector<account> &accounts) {
+        std::size_t const leaf_num = m_dirty_leaves.size();
+
+        std::vector<state_array> leaves;
+        leaves.reserve(leaf_num);
+        for (std::size_t l = 0; l < leaf_num; l++) {
+            std::size_t const begin = l * MAX_ACCOUNT_SIZE_IN_ENTRY;
+            std::size_t const end = std::min(begin + MAX_ACCOUNT_SIZE_IN_ENTRY, accounts.size());
+
+            // the last array may have grown or shrunk in place
+            if (l >= m_leaves.size() || m_leaves[l].StateArray().size() != end - begin) {
+                m_dirty_leaves[l] = true;
+            }
+
+            if (m_dirty_leaves[l]) {
+                leaves.emplace_back(std::vector<account>(accounts.begin() + begin, accounts.begin() + end));
+            } else {
+                leaves.push_back(std::move(m_leaves[l]));
+            }
+        }
+        m_leaves = std::move(leaves);
+
+        std::size_t const level0_num = (leaf_num + MAX_HASH_SIZE_IN_ENTRY - 1) / MAX_HASH_SIZE_IN_ENTRY;
+        m_dirty_level0.assign(level0_num, false);
+        m_dirty_level1 = m_level0.size() != level0_num;
+
+        std::vector<hash_array> level0;
+        level0.reserve(level0_num);
+        for (std::size_t g = 0; g < level0_num; g++) {
+            std::size_t const begin = g * MAX_HASH_SIZE_IN_ENTRY;
+            std::size_t const end = std::min(begin + MAX_HASH_SIZE_IN_ENTRY, leaf_num);
+
+            bool dirty = g >= m_level0.size() || m_level0[g].HashArray().size() != end - begin;
+            for (std::size_t l = begin; !dirty && l < end; l++) {
+                dirty = m_dirty_leaves[l];
+            }
+
+            if (dirty) {
+                std::vector<sha1_hash> hashes;
+                hashes.reserve(end - begin);
+                for (std::size_t l = begin; l < end; l++) {
+                    hashes.push_back(m_leaves[l].sha1());
+                }
+                level0.emplace_back(std::move(hashes));
+                m_dirty_level0[g] = true;
+                m_dirty_level1 = true;
+            } else {
+                level0.push_back(std::move(m_level0[g]));
+            }
+        }
+        m_level0 = std::move(level0);
+
+        if (m_dirty_level1) {
+            if (m_level0.empty()) {
+                m_level1 = hash_array();
+            } else {
+                std::vector<sha1_hash> hashes;
+                hashes.reserve(m_level0.size());
+                for (auto const &hashArray: m_level0) {
+                    hashes.push_back(hashArray.sha1());
+                }
+                m_level1 = hash_array(std::move(hashes));
+            }
+        }
+
+        // an array kept in place keeps its unsaved flag
+        m_unsaved_leaves.resize(leaf_num, false);
+        for (std::size_t l = 0; l < leaf_num; l++) {
+            m_unsaved_leaves[l] = m_unsaved_leaves[l] || m_dirty_leaves[l];
+        }
+        m_unsaved_level0.resize(level0_num, false);
+        for (std::size_t g = 0; g < level0_num; g++) {
+            m_unsaved_level0[g] = m_unsaved_level0[g] || m_dirty_level0[g];
+        }
+        m_unsaved_level1 = m_unsaved_level1 || m_dirty_level1;
+    }
+
+    std::vector<hash_array> state_commitment::hash_arrays() const {
+        std::vector<hash_array> arrays;
+        if (m_level1.empty()) {
+            return arrays;
+        }
+
+        arrays.reserve(m_level0.size() + 1);
+        arrays.push_back(m_level1);
+        arrays.insert(arrays.end(), m_level0.begin(), m_level0.end());
+
+        return arrays;
+    }
+
+    std::vector<state_array> state_commitment::unsaved_state_arrays() const {
+        std::vector<state_array> arrays;
+        for (std::size_t l = 0; l < m_leaves.size(); l++) {
+            if (m_unsaved_leaves[l]) {
+                arrays.push_back(m_leaves[l]);
+            }
+        }
+
+        return arrays;
+    }
+
+    std::vector<hash_array> state_commitment::unsaved_hash_arrays() const {
+        std::vector<hash_array> arrays;
+        for (std::size_t g = 0; g < m_level0.size(); g++) {
+            if (m_unsaved_level0[g]) {
+                arrays.push_back(m_level0[g]);
+            }
+        }
+        if (m_unsaved_level1 && !m_level1.empty()) {
+            arrays.push_back(m_level1);
+        }
+
+        return arrays;
+    }
+
+    void state_commitment::mark_saved() {
+        std::fill(m_unsaved_leaves.begin(), m_unsaved_leaves.end(), false);
+        std::fill(m_unsaved_level0.begin(), m_unsaved_level0.end(), false);
+        m_unsaved_level1 = false;
+    }
+}
@@ -21,6 +21,12 @@ namespace libTAU::blockchain {
         m_hash = hasher(encode).final();
     }
 
+    transaction::transaction(const bdecode_node& n) {
+        if (populate(n)) {
+            m_hash = hasher(n.data_section()).final();
+        }
+    }
+
     entry transaction::get_entry_without_signature() const {
         entry::list_type lst;
 
@@ -180,6 +186,77 @@ namespace libTAU::blockchain {
         }
     }
 
+    bool transaction::populate(const bdecode_node &n) {
+        if (n.type() != bdecode_node::list_t || n.list_size() <= 2) {
+            return false;
+        }
+
+        auto field = [&](int i, std::size_t len) {
+            auto const v = n.list_at(i);
+            return v.type() == bdecode_node::string_t && static_cast<std::size_t>(v.string_length()) == len;
+        };
+
+        // type
+        int type = aux::intFromLittleEndianString(std::string(n.list_string_value_at(2)));
+        auto const tx_type_value = static_cast<tx_type>(type);
+
+        if (tx_type_value == tx_type::type_transfer && n.list_size() == 11) {
+            if (!field(4, dht::public_key::len) || !field(5, dht::public_key::len) || !field(10, dht::signature::len)) {
+                return false;
+            }
+            m_type = tx_type_value;
+            // chain id
+            auto chain_id = n.list_string_value_at(0);
+            m_chain_id = aux::bytes(chain_id.begin(), chain_id.end());
+            // version
+            int version = aux::intFromLittleEndianString(std::string(n.list_string_value_at(1)));
+            m_version = static_cast<tx_version>(version);
+            // balance
+            m_timestamp = aux::int64FromLittleEndianString(std::string(n.list_string_value_at(3)));
+            // sender
+            m_sender = dht::public_key(n.list_at(4).string_ptr());
+            // receiver
+            m_receiver = dht::public_key(n.list_at(5).string_ptr());
+            // nonce
+            m_nonce = aux::int64FromLittleEndianString(std::string(n.list_string_value_at(6)));
+            // fee
+            m_fee = aux::int64FromLittleEndianString(std::string(n.list_string_value_at(7)));
+            // amount
+            m_amount = aux::int64FromLittleEndianString(std::string(n.list_string_value_at(8)));
+            // payload
+            auto payload = n.list_string_value_at(9);
+            m_payload = aux::bytes(payload.begin(), payload.end());
+            // signature
+            m_signature = dht::signature(n.list_at(10).string_ptr());
+            return true;
+        } else if (tx_type_value == tx_type::type_note && n.list_size() == 8) {
+            if (!field(4, dht::public_key::len) || !field(5, libTAU::sha1_hash::size()) || !field(7, dht::signature::len)) {
+                return false;
+            }
+            m_type = tx_type_value;
+            // chain id
+            auto chain_id = n.list_string_value_at(0);
+            m_chain_id = aux::bytes(chain_id.begin(), chain_id.end());
+            // version
+            int version = aux::intFromLittleEndianString(std::string(n.list_string_value_at(1)));
+            m_version = static_cast<tx_version>(version);
+            // balance
+            m_timestamp = aux::int64FromLittleEndianString(std::string(n.list_string_value_at(3)));
+            // sender
+            m_sender = dht::public_key(n.list_at(4).string_ptr());
+            // previous hash
+            m_previous_hash = sha1_hash(n.list_at(5).string_ptr());
+            // payload
+            auto payload = n.list_string_value_at(6);
+            m_payload = aux::bytes(payload.begin(), payload.end());
+            // signature
+            m_signature = dht::signature(n.list_at(7).string_ptr());
+            return true;
+        }
+
+        return false;
+    }
+
     std::string transaction::to_string() const {
         std::ostringstream os;
         os << *this;
@@ -15,6 +15,7 @@ see LICENSE file.
 #include "libTAU/communication/communication.hpp"
 #include "libTAU/kademlia/dht_tracker.hpp"
 #include "libTAU/aux_/common_data.h"
+#include "libTAU/aux_/edit_distance.hpp"
 
 using namespace std::placeholders;
 
@@ -44,6 +45,9 @@ namespace libTAU {
 //
 //            m_refresh_timer.cancel();
 
+            m_sync_timer.cancel();
+            m_scheduler.clear();
+
             clear();
 
             log(LOG_INFO, "INFO: Stop Communication...");
@@ -234,6 +238,7 @@ namespace libTAU {
 
                 log(LOG_INFO, "INFO: Got signal[%s] from peer[%s]",
                     payload.to_string(true).c_str(), aux::toHex(peer.bytes).c_str());
+                m_scheduler.peer_active(peer, get_current_time());
 
                 switch (signalEntry.m_pid) {
                     case common::COMMUNICATION_NEW_MESSAGE: {
@@ -359,7 +364,9 @@ namespace libTAU {
         }
 
         bool communication::add_new_message(const message &msg, bool post_alert) {
-            if (!m_message_db->save_message_if_not_exist(msg)) {
+            m_scheduler.peer_active(msg.receiver(), get_current_time());
+
+            if (!m_message_db->save_message_if_not_exist(msg, message_write_done())) {
                 log(LOG_ERR, "ERROR: Save message[%s] fail!", msg.to_string().c_str());
             }
 
@@ -379,6 +386,15 @@ namespace libTAU {
             return true;
         }
 
+        message_page communication::get_message_page(const dht::public_key &peer, const message_cursor &cursor, int limit) {
+            return m_message_db->get_message_page(*m_ses.pubkey(), peer, cursor, limit);
+        }
+
+        std::vector<message_match> communication::search_messages(const std::string &query, int limit,
+                                                                  message_search_order order) {
+            return m_message_db->search_messages(query, limit, order);
+        }
+
 //        bool communication::add_new_message(const dht::public_key &peer, const message& msg, bool post_alert) {
 //            if (msg.empty()) {
 //                log(LOG_ERR, "ERROR: Message is empty.");
@@ -519,31 +535,6 @@ namespace libTAU {
 //            return updated;
 //        }
 
-        namespace {
-            /**
-             * 选用编辑代价最小的，并返回该操作代表的操作数
-             * @param swap 替换的代价
-             * @param insert 插入的代价
-             * @param del 删除的代价
-             * @return 0:替换，1：插入，2：删除
-             */
-            size_t optCode(size_t swap, size_t insert, size_t del) {
-                // 如果替换编辑距离最少，则返回0标识，
-                // 即使三种操作距离一样，优先选择替换操作
-                if (swap <= insert && swap <= del) {
-                    return 0;
-                }
-
-                // 如果插入操作编辑最少，返回1标识，如果插入和删除距离一样，优先选择插入
-                if (insert < swap && insert <= del) {
-                    return 1;
-                }
-
-                // 如果删除操作编辑最少，返回2标识
-                return 2;
-            }
-        }
-
         void communication::find_best_solution(const std::vector<message>& messages, const aux::bytes& hash_prefix_array,
                                                std::vector<message> &missing_messages,
                                                std::vector<sha1_hash> &confirmation_roots) {
@@ -577,52 +568,14 @@ namespace libTAU {
                     return;
                 }
 
-                // 状态转移矩阵
-                size_t dist[sourceLength + 1][targetLength + 1];
-                // 操作矩阵
-                size_t operations[sourceLength + 1][targetLength + 1];
-
-                // 初始化，[i, 0]转换到空，需要编辑的距离，也即删除的数量
-                for (size_t i = 0; i < sourceLength + 1; i++) {
-                    dist[i][0] = i;
-                    if (i > 0) {
-                        operations[i][0] = 2;
-                    }
-                }
-
-                // 初始化，空转换到[0, j]，需要编辑的距离，也即增加的数量
-                for (size_t j = 0; j < targetLength + 1; j++) {
-                    dist[0][j] = j;
-                    if (j > 0) {
-                        operations[0][j] = 1;
-                    }
-                }
-
-                // 开始填充状态转移矩阵，第0位为空，所以从1开始有数据，[i, j]为当前子串最小编辑操作
-                for (size_t i = 1; i < sourceLength + 1; i++) {
-                    for (size_t j = 1; j < targetLength + 1; j++) {
-                        // 第i个数据，实际的index需要i-1，替换的代价，相同无需替换，代价为0，不同代价为1
-                        size_t cost = source[i - 1] == target[j - 1] ? 0 : 1;
-                        // [i, j]在[i, j-1]的基础上，最小的编辑操作为增加1
-                        size_t insert = dist[i][j - 1] + 1;
-                        // [i, j]在[i-1, j]的基础上，最小的编辑操作为删除1
-                        size_t del = dist[i - 1][j] + 1;
-                        // [i, j]在[i-1, j-1]的基础上，最大的编辑操作为1次替换
-                        size_t swap = dist[i - 1][j - 1] + cost;
-
-                        // 在[i-1, j]， [i, j-1]， [i-1, j-1]三种转换到[i, j]的最小操作中，取最小值
-                        dist[i][j] = std::min(std::min(insert, del), swap);
-
-                        // 选择一种最少编辑的操作
-                        operations[i][j] = optCode(swap, insert, del);
-                    }
-                }
-
                 // 回溯编辑路径，统计中间信息
-                auto i = sourceLength;
-                auto j = targetLength;
-                while (0 != dist[i][j]) {
-                    if (0 == operations[i][j]) {
+                m_edit_scratch.resize(aux::edit_distance::scratch_size(sourceLength, targetLength));
+                aux::edit_distance distance(source, target, m_edit_scratch);
+                aux::edit_distance::step s{};
+                while (distance.next(s)) {
+                    auto const i = s.source_size;
+                    auto const j = s.target_size;
+                    if (aux::edit_distance::operation::substitute == s.op) {
                         // 如果是替换操作，则将target对应的替换消息加入列表
                         if (source[i - 1] != target[j - 1]) {
                             missing_messages.push_back(messages[j - 1]);
@@ -630,9 +583,7 @@ namespace libTAU {
 //                            log("INFO: Confirm message hash[%s]", aux::toHex(messages[j - 1].sha256().to_string()).c_str());
                             confirmation_roots.push_back(messages[j - 1].sha1());
                         }
-                        i--;
-                        j--;
-                    } else if (1 == operations[i][j]) {
+                    } else if (aux::edit_distance::operation::insert == s.op) {
                         // 如果是插入操作，则将target对应的插入消息加入列表
                         // 注意由于消息是按照时间戳从小到大排列，如果缺第一个，并且此时双方满载，则判定为被挤出去而产生的差异，并非真的缺少
                         if (1 != j || targetLength != communication_max_message_list_size ||
@@ -646,17 +597,14 @@ namespace libTAU {
                                 k++;
                             }
                         }
-
-                        j--;
-                    } else if (2 == operations[i][j]) {
+                    } else if (aux::edit_distance::operation::remove == s.op) {
                         // 如果是删除操作，可能是对方新消息，忽略
-                        i--;
                     }
                 }
 
                 // 找到距离为0可能仍然不够，可能有前缀相同的情况，这时dist[i][j]很多为0的情况，
                 // 因此，需要把剩余的加入confirmation root集合即可
-                for(; j > 0; j--) {
+                for (auto j = distance.target_size(); j > 0; j--) {
 //                    log("INFO: Confirm message hash[%s]", aux::toHex(messages[j - 1].sha256().to_string()).c_str());
                     confirmation_roots.push_back(messages[j - 1].sha1());
                 }
@@ -699,52 +647,14 @@ namespace libTAU {
                     return;
                 }
 
-                // 状态转移矩阵
-                size_t dist[sourceLength + 1][targetLength + 1];
-                // 操作矩阵
-                size_t operations[sourceLength + 1][targetLength + 1];
-
-                // 初始化，[i, 0]转换到空，需要编辑的距离，也即删除的数量
-                for (size_t i = 0; i < sourceLength + 1; i++) {
-                    dist[i][0] = i;
-                    if (i > 0) {
-                        operations[i][0] = 2;
-                    }
-                }
-
-                // 初始化，空转换到[0, j]，需要编辑的距离，也即增加的数量
-                for (size_t j = 0; j < targetLength + 1; j++) {
-                    dist[0][j] = j;
-                    if (j > 0) {
-                        operations[0][j] = 1;
-                    }
-                }
-
-                // 开始填充状态转移矩阵，第0位为空，所以从1开始有数据，[i, j]为当前子串最小编辑操作
-                for (size_t i = 1; i < sourceLength + 1; i++) {
-                    for (size_t j = 1; j < targetLength + 1; j++) {
-                        // 第i个数据，实际的index需要i-1，替换的代价，相同无需替换，代价为0，不同代价为1
-                        size_t cost = source[i - 1] == target[j - 1] ? 0 : 1;
-                        // [i, j]在[i, j-1]的基础上，最小的编辑操作为增加1
-                        size_t insert = dist[i][j - 1] + 1;
-                        // [i, j]在[i-1, j]的基础上，最小的编辑操作为删除1
-                        size_t del = dist[i - 1][j] + 1;
-                        // [i, j]在[i-1, j-1]的基础上，最大的编辑操作为1次替换
-                        size_t swap = dist[i - 1][j - 1] + cost;
-
-                        // 在[i-1, j]， [i, j-1]， [i-1, j-1]三种转换到[i, j]的最小操作中，取最小值
-                        dist[i][j] = std::min(std::min(insert, del), swap);
-
-                        // 选择一种最少编辑的操作
-                        operations[i][j] = optCode(swap, insert, del);
-                    }
-                }
-
                 // 回溯编辑路径，统计中间信息
-                auto i = sourceLength;
-                auto j = targetLength;
-                while (0 != dist[i][j]) {
-                    if (0 == operations[i][j]) {
+                m_edit_scratch.resize(aux::edit_distance::scratch_size(sourceLength, targetLength));
+                aux::edit_distance distance(source, target, m_edit_scratch);
+                aux::edit_distance::step s{};
+                while (distance.next(s)) {
+                    auto const i = s.source_size;
+                    auto const j = s.target_size;
+                    if (aux::edit_distance::operation::substitute == s.op) {
                         // 如果是替换操作，则将target对应的替换消息加入列表
                         if (source[i - 1] != target[j - 1]) {
                             missing_messages.push_back(messages[j - 1]);
@@ -752,9 +662,7 @@ namespace libTAU {
 //                            log("INFO: Confirm message hash[%s]", aux::toHex(messages[j - 1].sha256().to_string()).c_str());
                             confirmed_messages.push_back(messages[j - 1]);
                         }
-                        i--;
-                        j--;
-                    } else if (1 == operations[i][j]) {
+                    } else if (aux::edit_distance::operation::insert == s.op) {
                         // 如果是插入操作，则将target对应的插入消息加入列表
                         // 注意由于消息是按照时间戳从小到大排列，如果缺第一个，并且此时双方满载，则判定为被挤出去而产生的差异，并非真的缺少
                         if (1 != j || targetLength != communication_max_message_list_size ||
@@ -768,17 +676,14 @@ namespace libTAU {
                                 k++;
                             }
                         }
-
-                        j--;
-                    } else if (2 == operations[i][j]) {
+                    } else if (aux::edit_distance::operation::remove == s.op) {
                         // 如果是删除操作，可能是对方新消息，忽略
-                        i--;
                     }
                 }
 
                 // 找到距离为0可能仍然不够，可能有前缀相同的情况，这时dist[i][j]很多为0的情况，
                 // 因此，需要把剩余的加入confirmation root集合即可
-                for(; j > 0; j--) {
+                for (auto j = distance.target_size(); j > 0; j--) {
 //                    log("INFO: Confirm message hash[%s]", aux::toHex(messages[j - 1].sha256().to_string()).c_str());
                     confirmed_messages.push_back(messages[j - 1]);
                 }
@@ -858,7 +763,7 @@ namespace libTAU {
 
                                 m_ses.alerts().emplace_alert<communication_new_message_alert>(msg);
 
-                                if (!m_message_db->save_message_if_not_exist(msg)) {
+                                if (!m_message_db->save_message_if_not_exist(msg, message_write_done())) {
                                     log(LOG_ERR, "INFO: Save message[%s] fail.", msg.to_string().c_str());
                                 }
 
@@ -1055,37 +960,109 @@ namespace libTAU {
 //            }
 //        } // anonymous namespace
 
+        void communication::find_sync_nodes(const sha256_hash &target, sync_scheduler::nodes_callback done) {
+            if (!m_ses.dht()) {
+                done({});
+                return;
+            }
+            // keep communication, and the scheduler waiting for the nodes, alive
+            m_ses.dht()->find_nodes(target, [self = self(), done = std::move(done)](std::vector<dht::node_entry> const& nodes) {
+                done(nodes);
+            });
+        }
+
+        void communication::schedule(sync_operation op) {
+            bool const idle = m_scheduler.pending() == 0 && m_scheduler.in_flight() == 0;
+            m_scheduler.add(std::move(op));
+            if (!idle) return;
+
+            m_scheduler.dispatch(get_current_time());
+            m_sync_timer.expires_after(milliseconds(communication_sync_interval));
+            m_sync_timer.async_wait(std::bind(&communication::sync_timeout, self(), _1));
+        }
+
+        void communication::sync_timeout(const error_code &e) {
+            if (e.value() != 0) return;
+
+            m_scheduler.dispatch(get_current_time());
+            // operations a lookup did not reach go back to the queue when it
+            // completes. A lookup that never completes times out in dispatch
+            if (m_scheduler.pending() > 0 || m_scheduler.in_flight() > 0) {
+                m_sync_timer.expires_after(milliseconds(communication_sync_interval));
+                m_sync_timer.async_wait(std::bind(&communication::sync_timeout, self(), _1));
+            }
+        }
+
         void communication::publish(const std::string& salt, const entry& data) {
             if (!m_ses.dht()) return;
             log(LOG_INFO, "INFO: Publish salt[%s], data[%s]", aux::toHex(salt).c_str(), data.to_string(true).c_str());
-            m_ses.dht()->put_item(data, std::bind(&communication::on_dht_put_mutable_item, self(), _1, _2)
-                    , 1, 8, 16, salt);
+            auto const& pk = *m_ses.pubkey();
+            schedule({dht::item_target_id(salt, pk), pk, [this, salt, data](std::vector<dht::node_entry> const& eps) {
+                if (!m_ses.dht()) return;
+                if (eps.empty()) {
+                    m_ses.dht()->put_item(data, std::bind(&communication::on_dht_put_mutable_item, self(), _1, _2)
+                            , 1, 8, 16, salt);
+                } else {
+                    m_ses.dht()->put_item(data, eps, std::bind(&communication::on_dht_put_mutable_item, self(), _1, _2)
+                            , salt);
+                }
+            }});
         }
 
         void communication::publish_confirmation_roots(const dht::public_key &peer, const sha1_hash &hash, const std::string &salt, const entry &data) {
             if (!m_ses.dht()) return;
             log(LOG_INFO, "INFO: Publish confirmation roots salt[%s], data[%s]", aux::toHex(salt).c_str(), data.to_string(true).c_str());
-            m_ses.dht()->put_item(data, std::bind(&communication::on_dht_put_confirmation_roots, self(), peer, hash, _1, _2)
-                    , 1, 8, 16, salt);
+            schedule({dht::item_target_id(salt, *m_ses.pubkey()), peer, [this, peer, hash, salt, data](std::vector<dht::node_entry> const& eps) {
+                if (!m_ses.dht()) return;
+                if (eps.empty()) {
+                    m_ses.dht()->put_item(data, std::bind(&communication::on_dht_put_confirmation_roots, self(), peer, hash, _1, _2)
+                            , 1, 8, 16, salt);
+                } else {
+                    m_ses.dht()->put_item(data, eps, std::bind(&communication::on_dht_put_confirmation_roots, self(), peer, hash, _1, _2)
+                            , salt);
+                }
+            }});
         }
 
         void communication::publish_message(dht::public_key const& peer, const sha1_hash &hash, const std::string &salt, const entry &data) {
             if (!m_ses.dht()) return;
             log(LOG_INFO, "INFO: Publish message salt[%s], data[%s]", aux::toHex(salt).c_str(), data.to_string(true).c_str());
-            m_ses.dht()->put_item(data, std::bind(&communication::on_dht_put_message, self(), peer, hash, _1, _2)
-                    , 1, 8, 16, salt);
+            schedule({dht::item_target_id(salt, *m_ses.pubkey()), peer, [this, peer, hash, salt, data](std::vector<dht::node_entry> const& eps) {
+                if (!m_ses.dht()) return;
+                if (eps.empty()) {
+                    m_ses.dht()->put_item(data, std::bind(&communication::on_dht_put_message, self(), peer, hash, _1, _2)
+                            , 1, 8, 16, salt);
+                } else {
+                    m_ses.dht()->put_item(data, eps, std::bind(&communication::on_dht_put_message, self(), peer, hash, _1, _2)
+                            , salt);
+                }
+            }});
         }
 
         void communication::subscribe(const dht::public_key &peer, const std::string &salt, COMMUNICATION_GET_ITEM_TYPE type, int times) {
             if (!m_ses.dht()) return;
-            m_ses.dht()->get_item(peer, std::bind(&communication::get_mutable_callback, self(), _1, _2, type, times), 1, 8, 16, salt, 0);
+            schedule({dht::item_target_id(salt, peer), peer, [this, peer, salt, type, times](std::vector<dht::node_entry> const& eps) {
+                if (!m_ses.dht()) return;
+                if (eps.empty()) {
+                    m_ses.dht()->get_item(peer, std::bind(&communication::get_mutable_callback, self(), _1, _2, type, times)
+                            , 1, 8, 16, salt, 0);
+                } else {
+                    m_ses.dht()->get_item(peer, eps, std::bind(&communication::get_mutable_callback, self(), _1, _2, type, times)
+                            , salt, 0);
+                }
+            }});
         }
 
         void communication::send_to(const dht::public_key &peer, const entry &data) {
             if (!m_ses.dht()) return;
             log(LOG_INFO, "Send [%s] to peer[%s]", data.to_string(true).c_str(), aux::toHex(peer.bytes).c_str());
-            m_ses.dht()->send(peer, data, 1, 8, 16, 1,
-                              std::bind(&communication::on_dht_relay_mutable_item, self(), _1, _2, peer));
+            // relays find their own way to peer, they are only paced and
+            // never wait for, or start, a lookup
+            schedule({dht::item_target_id(peer), peer, [this, peer, data](std::vector<dht::node_entry> const&) {
+                if (!m_ses.dht()) return;
+                m_ses.dht()->send(peer, data, 1, 8, 16, 1,
+                                  std::bind(&communication::on_dht_relay_mutable_item, self(), _1, _2, peer));
+            }, false});
         }
 
         void communication::send_new_message_signal(const dht::public_key &peer, const sha1_hash &hash) {
@@ -1289,6 +1266,15 @@ namespace libTAU {
         }
 
         TORRENT_FORMAT(3,4)
+        message_db_interface::message_write_handler communication::message_write_done() {
+            // the write completes after save_message_if_not_exist returned
+            return [self = self()](const sha1_hash &hash, bool ok) {
+                if (!ok) {
+                    self->log(LOG_ERR, "ERROR: Write message[%s] fail!", aux::toHex(hash).c_str());
+                }
+            };
+        }
+
         void communication::log(aux::LOG_LEVEL log_level, char const* fmt, ...) const noexcept try
         {
 #ifndef TORRENT_DISABLE_LOGGING
@@ -0,0 +1,181 @@
+/*
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include "libTAU/communication/message_compressor.hpp"
+
+#ifdef TORRENT_ENABLE_ZSTD
+#include <map>
+
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+namespace libTAU {
+    namespace communication {
+
+#ifdef TORRENT_ENABLE_ZSTD
+
+        namespace {
+            constexpr int compression_level = 3;
+
+            // a payload claiming to be larger than this is corrupt
+            constexpr unsigned long long max_payload_size = 16 * 1024 * 1024;
+        }
+
+        struct message_compressor::impl {
+            impl() {
+                // the dictionary id is stored with the row, not in the frame
+                ZSTD_CCtx_setParameter(cctx, ZSTD_c_dictIDFlag, 0);
+                ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 0);
+                ZSTD_CCtx_setParameter(cctx, ZSTD_c_contentSizeFlag, 1);
+            }
+
+            ~impl() {
+                ZSTD_freeCDict(cdict);
+                for (auto &d : ddicts) {
+                    ZSTD_freeDDict(d.second);
+                }
+                ZSTD_freeCCtx(cctx);
+                ZSTD_freeDCtx(dctx);
+            }
+
+            ZSTD_CCtx *cctx = ZSTD_createCCtx();
+            ZSTD_DCtx *dctx = ZSTD_createDCtx();
+
+            // compression dictionary of the current id
+            ZSTD_CDict *cdict = nullptr;
+
+            // dictionary id -> decompression dictionary
+            std::map<std::int64_t, ZSTD_DDict*> ddicts;
+        };
+
+        message_compressor::message_compressor() : m_impl(std::make_unique<impl>()) {}
+
+        message_compressor::~message_compressor() = default;
+
+        bool message_compressor::available() {
+            return true;
+        }
+
+        std::string message_compressor::train(const std::vector<aux::bytes> &samples, std::size_t dict_size) {
+            std::string buffer;
+            std::vector<std::size_t> sizes;
+            for (auto const &s : samples) {
+                if (s.empty()) continue;
+                buffer.append(s.begin(), s.end());
+                sizes.push_back(s.size());
+            }
+            if (sizes.empty()) {
+                return std::string();
+            }
+
+            std::string dict(dict_size, '\0');
+            std::size_t const size = ZDICT_trainFromBuffer(&dict[0], dict.size(), buffer.data()
+                    , sizes.data(), unsigned(sizes.size()));
+            if (ZDICT_isError(size)) {
+                return std::string();
+            }
+            dict.resize(size);
+
+            return dict;
+        }
+
+        bool message_compressor::add_dictionary(std::int64_t id, const std::string &dict) {
+            if (id <= 0 || dict.empty() || m_impl->ddicts.count(id) > 0) {
+                return false;
+            }
+
+            ZSTD_DDict *ddict = ZSTD_createDDict(dict.data(), dict.size());
+            if (ddict == nullptr) {
+                return false;
+            }
+            m_impl->ddicts.emplace(id, ddict);
+
+            if (id > m_current) {
+                ZSTD_CDict *cdict = ZSTD_createCDict(dict.data(), dict.size(), compression_level);
+                if (cdict != nullptr) {
+                    ZSTD_CCtx_refCDict(m_impl->cctx, cdict);
+                    ZSTD_freeCDict(m_impl->cdict);
+                    m_impl->cdict = cdict;
+                    m_current = id;
+                }
+            }
+
+            return true;
+        }
+
+        bool message_compressor::compress(const aux::bytes &payload, std::string &out) {
+            if (m_impl->cdict == nullptr || payload.empty()) {
+                return false;
+            }
+
+            out.resize(ZSTD_compressBound(payload.size()));
+            std::size_t const size = ZSTD_compress2(m_impl->cctx, &out[0], out.size()
+                    , payload.data(), payload.size());
+            if (ZSTD_isError(size) || size >= payload.size()) {
+                return false;
+            }
+            out.resize(size);
+
+            return true;
+        }
+
+        bool message_compressor::decompress(std::int64_t id, const char *data, int size, aux::bytes &payload) {
+            auto it = m_impl->ddicts.find(id);
+            if (it == m_impl->ddicts.end() || data == nullptr || size <= 0) {
+                return false;
+            }
+
+            unsigned long long const content_size = ZSTD_getFrameContentSize(data, std::size_t(size));
+            if (content_size == ZSTD_CONTENTSIZE_ERROR || content_size == ZSTD_CONTENTSIZE_UNKNOWN
+                || content_size > max_payload_size) {
+                return false;
+            }
+
+            payload.resize(std::size_t(content_size));
+            std::size_t const ret = ZSTD_decompress_usingDDict(m_impl->dctx, payload.data(), payload.size()
+                    , data, std::size_t(size), it->second);
+            if (ZSTD_isError(ret) || ret != payload.size()) {
+                payload.clear();
+                return false;
+            }
+
+            return true;
+        }
+
+#else
+
+        struct message_compressor::impl {};
+
+        message_compressor::message_compressor() = default;
+
+        message_compressor::~message_compressor() = default;
+
+        bool message_compressor::available() {
+            return false;
+        }
+
+        std::string message_compressor::train(const std::vector<aux::bytes> &, std::size_t) {
+            return std::string();
+        }
+
+        bool message_compressor::add_dictionary(std::int64_t, const std::string &) {
+            return false;
+        }
+
+        bool message_compressor::compress(const aux::bytes &, std::string &) {
+            return false;
+        }
+
+        bool message_compressor::decompress(std::int64_t, const char *, int, aux::bytes &) {
+            return false;
+        }
+
+#endif
+    }
+}
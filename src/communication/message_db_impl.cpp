@@ -6,6 +6,9 @@
 // see LICENSE file.
 //
 
+#include <algorithm>
+#include <tuple>
+
 #include "libTAU/aux_/common.h"
 #include "libTAU/aux_/vector_ref.h"
 #include "libTAU/kademlia/types.hpp"
@@ -21,6 +24,313 @@ namespace libTAU {
 //            const std::string key_suffix_message_hash_list = "mhl";
 //        }
 
+        namespace {
+            // smallest message filter, 2 KiB
+            constexpr std::size_t message_filter_min_capacity = 1024;
+
+            // a dictionary is trained once this many messages are stored
+            // uncompressed
+            constexpr int dictionary_training_messages = 1000;
+
+            // the latest messages a dictionary is trained from
+            constexpr int dictionary_samples = 4000;
+
+            // messages indexed per job when building the search index, other
+            // writes queue on the storage thread behind a job
+            constexpr int search_index_batch = 1000;
+
+            aux::cached_stmt prepare(sqlite3 *db, std::map<std::string, aux::stmt_ptr> &stmts, const std::string &sql) {
+                auto it = stmts.find(sql);
+                if (it != stmts.end()) {
+                    return aux::cached_stmt(it->second.get());
+                }
+
+                sqlite3_stmt *stmt = nullptr;
+                int ok = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
+                if (ok != SQLITE_OK) {
+                    sqlite3_finalize(stmt);
+                    return aux::cached_stmt(nullptr);
+                }
+
+                stmts.emplace(sql, aux::stmt_ptr(stmt));
+
+                return aux::cached_stmt(stmt);
+            }
+
+            // add payload to MESSAGES_FTS and link the message of hash to it
+            bool index_message(sqlite3 *db, std::map<std::string, aux::stmt_ptr> &stmts,
+                               const sha1_hash &hash, const aux::bytes &payload) {
+                {
+                    auto insert = prepare(db, stmts, "INSERT INTO MESSAGES_FTS (PAYLOAD) VALUES(?)");
+                    if (!insert) {
+                        return false;
+                    }
+                    sqlite3_bind_text(insert.get(), 1, payload.data(), int(payload.size()), nullptr);
+                    if (sqlite3_step(insert.get()) != SQLITE_DONE) {
+                        return false;
+                    }
+                }
+
+                auto link = prepare(db, stmts, "UPDATE MESSAGES SET SEARCH_ID=? WHERE HASH=?");
+                if (!link) {
+                    return false;
+                }
+                sqlite3_bind_int64(link.get(), 1, sqlite3_last_insert_rowid(db));
+                sqlite3_bind_blob(link.get(), 2, hash.data(), libTAU::sha1_hash::size(), nullptr);
+
+                return sqlite3_step(link.get()) == SQLITE_DONE;
+            }
+
+            struct save_result {
+                bool ok = false;
+
+                // not stored before
+                bool stored = false;
+
+                bool indexed = false;
+            };
+
+            // store msg with its payload compressed by dictionary dict, or
+            // as is if dict is 0, and index it if search is on. The message
+            // is stored either way, if it cannot be indexed it keeps no
+            // SEARCH_ID and is indexed on the next init
+            save_result write_message(sqlite3 *db, std::map<std::string, aux::stmt_ptr> &stmts, const message &msg,
+                                      const std::string &compressed, std::int64_t dict, bool search) {
+                save_result r;
+                {
+                    // a message already stored is ignored by its primary key
+                    auto stmt = prepare(db, stmts, "INSERT OR IGNORE INTO MESSAGES (HASH,SENDER,RECEIVER,TIMESTAMP,PAYLOAD,DICT) VALUES(?,?,?,?,?,?)");
+                    if (!stmt) {
+                        return r;
+                    }
+
+                    sqlite3_bind_blob(stmt.get(), 1, msg.sha1().data(), libTAU::sha1_hash::size(), nullptr);
+                    sqlite3_bind_blob(stmt.get(), 2, msg.sender().bytes.data(), dht::public_key::len, nullptr);
+                    sqlite3_bind_blob(stmt.get(), 3, msg.receiver().bytes.data(), dht::public_key::len, nullptr);
+                    sqlite3_bind_int64(stmt.get(), 4, msg.timestamp());
+                    if (dict != 0) {
+                        sqlite3_bind_blob(stmt.get(), 5, compressed.data(), int(compressed.size()), nullptr);
+                        sqlite3_bind_int64(stmt.get(), 6, dict);
+                    } else {
+                        sqlite3_bind_blob(stmt.get(), 5, msg.payload().data(), int(msg.payload().size()), nullptr);
+                    }
+
+                    if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+                        return r;
+                    }
+                }
+                r.ok = true;
+                r.stored = sqlite3_changes(db) > 0;
+
+                if (r.stored && search
+                    && sqlite3_exec(db, "SAVEPOINT search_index;", nullptr, nullptr, nullptr) == SQLITE_OK) {
+                    r.indexed = index_message(db, stmts, msg.sha1(), msg.payload());
+                    sqlite3_exec(db, r.indexed ? "RELEASE search_index;"
+                                 : "ROLLBACK TO search_index; RELEASE search_index;", nullptr, nullptr, nullptr);
+                }
+
+                return r;
+            }
+
+            // -1 on error, else the number of messages deleted. The index is
+            // kept in step when search_table is set, even while search is off
+            int erase_message(sqlite3 *db, std::map<std::string, aux::stmt_ptr> &stmts,
+                              const sha1_hash &hash, bool search_table) {
+                if (search_table) {
+                    auto index = prepare(db, stmts, "DELETE FROM MESSAGES_FTS WHERE ROWID=(SELECT SEARCH_ID FROM MESSAGES WHERE HASH=?)");
+                    if (!index) {
+                        return -1;
+                    }
+                    sqlite3_bind_blob(index.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
+                    if (sqlite3_step(index.get()) != SQLITE_DONE) {
+                        return -1;
+                    }
+                }
+
+                auto stmt = prepare(db, stmts, "DELETE FROM MESSAGES WHERE HASH=?");
+                if (!stmt) {
+                    return -1;
+                }
+                sqlite3_bind_blob(stmt.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
+                if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+                    return -1;
+                }
+
+                return sqlite3_changes(db);
+            }
+
+            bool write_friend(sqlite3 *db, std::map<std::string, aux::stmt_ptr> &stmts,
+                              const std::string &sql, const dht::public_key &pubKey) {
+                auto stmt = prepare(db, stmts, sql);
+                if (!stmt) {
+                    return false;
+                }
+                sqlite3_bind_blob(stmt.get(), 1, pubKey.bytes.data(), dht::public_key::len, nullptr);
+
+                return sqlite3_step(stmt.get()) == SQLITE_DONE;
+            }
+
+            struct trained_dictionary {
+                // 0 if none was trained
+                std::int64_t id = 0;
+                std::string dict;
+            };
+
+            // train a dictionary from the latest stored messages and store
+            // it. Only uncompressed payloads are sampled, there are no others
+            // before the first dictionary
+            trained_dictionary train_from_messages(sqlite3 *db, std::map<std::string, aux::stmt_ptr> &stmts) {
+                trained_dictionary r;
+
+                std::vector<aux::bytes> samples;
+                {
+                    auto stmt = prepare(db, stmts, "SELECT PAYLOAD FROM MESSAGES WHERE DICT IS NULL ORDER BY ROWID DESC LIMIT ?");
+                    if (!stmt) {
+                        return r;
+                    }
+                    sqlite3_bind_int(stmt.get(), 1, dictionary_samples);
+                    for (;sqlite3_step(stmt.get()) == SQLITE_ROW;) {
+                        const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                        auto length = sqlite3_column_bytes(stmt.get(), 0);
+                        samples.emplace_back(p, p + length);
+                    }
+                }
+
+                std::string dict = message_compressor::train(samples, message_dictionary_size);
+                if (dict.empty()) {
+                    return r;
+                }
+
+                auto stmt = prepare(db, stmts, "INSERT INTO MESSAGE_DICTIONARIES (DICT) VALUES(?)");
+                if (!stmt) {
+                    return r;
+                }
+                sqlite3_bind_blob(stmt.get(), 1, dict.data(), int(dict.size()), nullptr);
+                if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+                    return r;
+                }
+                r.id = sqlite3_last_insert_rowid(db);
+                r.dict = std::move(dict);
+
+                return r;
+            }
+
+            // index up to limit messages without a SEARCH_ID, in the order
+            // they were stored so newest first search results stay in that
+            // order. -1 on error, else the number of messages indexed
+            int index_messages(sqlite3 *db, std::map<std::string, aux::stmt_ptr> &stmts, int limit) {
+                // the compressor of the db is only used on its own thread,
+                // the batch is decompressed with a copy of the dictionaries
+                message_compressor compressor;
+                {
+                    auto stmt = prepare(db, stmts, "SELECT ID,DICT FROM MESSAGE_DICTIONARIES");
+                    if (!stmt) {
+                        return -1;
+                    }
+                    for (;sqlite3_step(stmt.get()) == SQLITE_ROW;) {
+                        const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 1));
+                        auto length = sqlite3_column_bytes(stmt.get(), 1);
+                        compressor.add_dictionary(sqlite3_column_int64(stmt.get(), 0), std::string(p, p + length));
+                    }
+                }
+
+                if (sqlite3_exec(db, "SAVEPOINT search_index;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+                    return -1;
+                }
+
+                int indexed = 0;
+                bool ok = true;
+                {
+                    auto select = prepare(db, stmts, "SELECT HASH,PAYLOAD,DICT FROM MESSAGES WHERE SEARCH_ID IS NULL ORDER BY ROWID LIMIT ?");
+                    if (!select) {
+                        ok = false;
+                    } else {
+                        sqlite3_bind_int(select.get(), 1, limit);
+                        aux::bytes payload;
+                        for (;ok && sqlite3_step(select.get()) == SQLITE_ROW; ++indexed) {
+                            const char *p = static_cast<const char *>(sqlite3_column_blob(select.get(), 1));
+                            auto length = sqlite3_column_bytes(select.get(), 1);
+                            if (sqlite3_column_type(select.get(), 2) == SQLITE_NULL) {
+                                payload.assign(p, p + length);
+                            } else if (!compressor.decompress(sqlite3_column_int64(select.get(), 2), p, length, payload)) {
+                                // a payload that cannot be read is indexed
+                                // empty, so that it is not selected again
+                                payload.clear();
+                            }
+                            ok = index_message(db, stmts
+                                               , sha1_hash(static_cast<const char *>(sqlite3_column_blob(select.get(), 0))), payload);
+                        }
+                    }
+                }
+
+                if (!ok) {
+                    sqlite3_exec(db, "ROLLBACK TO search_index; RELEASE search_index;", nullptr, nullptr, nullptr);
+                    return -1;
+                }
+                if (sqlite3_exec(db, "RELEASE search_index;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+                    return -1;
+                }
+
+                return indexed;
+            }
+        }
+
+        message_db_impl::~message_db_impl() {
+            // the writer statements belong to the executor connection,
+            // finalize them on the storage thread, after any queued write
+            if (m_executor == nullptr || !m_executor->post(aux::storage_subsystem::communication
+                    , [w = m_writer](sqlite3 *) { w->stmts.clear(); })) {
+                m_writer->stmts.clear();
+            }
+        }
+
+        aux::cached_stmt message_db_impl::prepare_cached(const std::string &sql) {
+            return prepare(m_sqlite, m_stmt_cache, sql);
+        }
+
+        template <typename Ret>
+        void message_db_impl::write(std::function<Ret(sqlite3 *, stmt_map &)> job, std::function<void(Ret)> done) {
+            if (m_executor != nullptr) {
+                bool const queued = m_executor->async_call<Ret>(aux::storage_subsystem::communication
+                    , [w = m_writer, job](sqlite3 *db) { return job(db, w->stmts); }
+                    , [pending = std::weak_ptr<pending_messages>(m_pending), done](Ret r) {
+                        // this db has been destructed
+                        if (pending.expired()) return;
+                        done(std::move(r));
+                    });
+                if (queued) {
+                    return;
+                }
+            }
+
+            done(job(m_sqlite, m_stmt_cache));
+        }
+
+        message_db_impl::pending_message const *message_db_impl::find_pending(const sha1_hash &hash) const {
+            auto it = m_pending->find(hash);
+            return it == m_pending->end() ? nullptr : &it->second;
+        }
+
+        void message_db_impl::get_pending_before(const dht::public_key &sender, const dht::public_key &receiver,
+                                                 const message_cursor &cursor,
+                                                 std::vector<std::pair<message_view, bool>> &rows) const {
+            for (auto const &p : *m_pending) {
+                auto const &msg = p.second.msg;
+                if (p.second.deleted || msg.sender() != sender || msg.receiver() != receiver
+                    || std::make_tuple(msg.timestamp(), p.first) >= std::make_tuple(cursor.timestamp, cursor.hash)) {
+                    continue;
+                }
+
+                message_view view;
+                view.hash = p.first;
+                view.sender = sender;
+                view.receiver = receiver;
+                view.timestamp = msg.timestamp();
+                view.payload = msg.payload();
+                rows.emplace_back(std::move(view), true);
+            }
+        }
+
         // table friends: public key
         bool message_db_impl::init() {
             if (!create_table_friends()) {
@@ -31,9 +341,169 @@ namespace libTAU {
                 return false;
             }
 
+            // every dictionary is loaded, compression off or not, the rows
+            // it compressed are read with it
+            {
+                auto stmt = prepare_cached("SELECT ID,DICT FROM MESSAGE_DICTIONARIES");
+                if (!stmt) {
+                    return false;
+                }
+                for (;sqlite3_step(stmt.get()) == SQLITE_ROW;) {
+                    const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 1));
+                    auto length = sqlite3_column_bytes(stmt.get(), 1);
+                    m_compressor.add_dictionary(sqlite3_column_int64(stmt.get(), 0), std::string(p, p + length));
+                }
+            }
+
+            std::size_t messages = 0;
+            {
+                auto stmt = prepare_cached("SELECT COUNT(*) FROM MESSAGES");
+                if (!stmt || sqlite3_step(stmt.get()) != SQLITE_ROW) {
+                    return false;
+                }
+                messages = std::size_t(sqlite3_column_int64(stmt.get(), 0));
+            }
+
+            // room for as many new messages again before the filter grows
+            if (!rebuild_filter(std::max(message_filter_min_capacity, 2 * messages))) {
+                return false;
+            }
+
+            if (m_compress && m_compressor.current_dictionary() == 0
+                && messages >= std::size_t(dictionary_training_messages)) {
+                train_dictionary();
+            }
+
+            {
+                auto stmt = prepare_cached("SELECT 1 FROM sqlite_master WHERE name='MESSAGES_FTS'");
+                m_search_table = stmt && sqlite3_step(stmt.get()) == SQLITE_ROW;
+            }
+            if (m_search) {
+                // without FTS5 in sqlite, messages just cannot be searched
+                m_search = create_search_index();
+            }
+            if (m_search) {
+                update_search_index();
+            }
+
+            return true;
+        }
+
+        bool message_db_impl::create_search_index() {
+            char *zErrMsg = nullptr;
+            int ok = sqlite3_exec(m_sqlite, "CREATE VIRTUAL TABLE IF NOT EXISTS MESSAGES_FTS USING fts5(PAYLOAD);"
+                                  , nullptr, nullptr, &zErrMsg);
+            if (ok != SQLITE_OK) {
+                sqlite3_free(zErrMsg);
+                return false;
+            }
+            m_search_table = true;
+
             return true;
         }
 
+        void message_db_impl::update_search_index() {
+            // messages saved while search was off, or whose indexing failed,
+            // have no SEARCH_ID. Deletes always reach the index
+            m_indexing = true;
+            std::uint32_t const saves = m_unindexed_saves;
+            write<int>([](sqlite3 *db, stmt_map &stmts) {
+                return index_messages(db, stmts, search_index_batch);
+            }, [this, saves](int indexed) {
+                if (indexed < 0) {
+                    // the rest is indexed on the next init
+                    m_counters.inc_stats_counter(counters::communication_message_search_index_failures);
+                    m_indexing = false;
+                    return;
+                }
+
+                // saves queued after this batch are left to the next one
+                if (indexed == search_index_batch || saves != m_unindexed_saves) {
+                    update_search_index();
+                    return;
+                }
+                m_indexing = false;
+            });
+        }
+
+        bool message_db_impl::has_column(const char *table, const char *column) {
+            auto stmt = prepare_cached("SELECT 1 FROM pragma_table_info(?) WHERE name=?");
+            if (!stmt) {
+                return false;
+            }
+            sqlite3_bind_text(stmt.get(), 1, table, -1, nullptr);
+            sqlite3_bind_text(stmt.get(), 2, column, -1, nullptr);
+
+            return sqlite3_step(stmt.get()) == SQLITE_ROW;
+        }
+
+        bool message_db_impl::read_payload(sqlite3_stmt *stmt, int column, aux::bytes &payload) {
+            const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, column));
+            auto length = sqlite3_column_bytes(stmt, column);
+            if (sqlite3_column_type(stmt, column + 1) == SQLITE_NULL) {
+                payload.assign(p, p + length);
+                return true;
+            }
+
+            return m_compressor.decompress(sqlite3_column_int64(stmt, column + 1), p, length, payload);
+        }
+
+        bool message_db_impl::train_dictionary() {
+            if (m_training) {
+                return false;
+            }
+            m_training = true;
+
+            write<trained_dictionary>([](sqlite3 *db, stmt_map &stmts) {
+                return train_from_messages(db, stmts);
+            }, [this](trained_dictionary d) {
+                m_training = false;
+                if (d.id != 0) {
+                    m_compressor.add_dictionary(d.id, d.dict);
+                }
+            });
+
+            return true;
+        }
+
+        bool message_db_impl::rebuild_filter(std::size_t capacity) {
+            for (;;) {
+                m_filter.reset(capacity);
+
+                auto stmt = prepare_cached("SELECT HASH FROM MESSAGES");
+                if (!stmt) {
+                    // a filter without capacity passes every lookup on to the db
+                    m_filter.reset(0);
+                    update_filter_gauges();
+                    return false;
+                }
+
+                bool full = false;
+                for (;sqlite3_step(stmt.get()) == SQLITE_ROW;) {
+                    const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                    if (!m_filter.insert(sha1_hash(p))) {
+                        full = true;
+                        break;
+                    }
+                }
+
+                if (!full) {
+                    break;
+                }
+
+                capacity *= 2;
+            }
+
+            update_filter_gauges();
+
+            return true;
+        }
+
+        void message_db_impl::update_filter_gauges() {
+            m_counters.set_value(counters::communication_message_filter_items, std::int64_t(m_filter.size()));
+            m_counters.set_value(counters::communication_message_filter_size, std::int64_t(m_filter.memory()));
+        }
+
         bool message_db_impl::create_table_friends() {
             std::string sql = "CREATE TABLE IF NOT EXISTS FRIENDS(PUBKEY BLOB PRIMARY KEY NOT NULL);";
             char *zErrMsg = nullptr;
@@ -49,58 +519,49 @@ namespace libTAU {
         std::vector<dht::public_key> message_db_impl::get_all_friends() {
             std::vector<dht::public_key> friends;
 
-            sqlite3_stmt * stmt;
-            std::string sql = "SELECT * FROM FRIENDS";
-            int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-            if (ok == SQLITE_OK) {
-                for (;sqlite3_step(stmt) == SQLITE_ROW;) {
-                    const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
+            auto stmt = prepare_cached("SELECT PUBKEY FROM FRIENDS");
+            if (stmt) {
+                for (;sqlite3_step(stmt.get()) == SQLITE_ROW;) {
+                    const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
                     dht::public_key pubKey(p);
                     friends.push_back(pubKey);
                 }
             }
 
-            sqlite3_finalize(stmt);
-
             return friends;
         }
 
         bool message_db_impl::save_friend(const libTAU::dht::public_key &pubKey) {
-            sqlite3_stmt * stmt;
-            std::string sql = "INSERT INTO FRIENDS VALUES(?)";
-            int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-            if (ok != SQLITE_OK) {
-                return false;
-            }
-            sqlite3_bind_blob(stmt, 1, pubKey.bytes.data(), dht::public_key::len, nullptr);
-            ok = sqlite3_step(stmt);
-            if (ok != SQLITE_DONE) {
-                return false;
-            }
-            sqlite3_finalize(stmt);
+            write<bool>([pubKey](sqlite3 *db, stmt_map &stmts) {
+                return write_friend(db, stmts, "INSERT INTO FRIENDS VALUES(?)", pubKey);
+            }, [this](bool ok) {
+                if (!ok) m_counters.inc_stats_counter(counters::communication_message_write_failures);
+            });
 
             return true;
         }
 
         bool message_db_impl::delete_friend(const dht::public_key &pubKey) {
-            sqlite3_stmt * stmt;
-            std::string sql = "DELETE FROM FRIENDS WHERE PUBKEY=?";
-            int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-            if (ok != SQLITE_OK) {
-                return false;
-            }
-            sqlite3_bind_blob(stmt, 1, pubKey.bytes.data(), dht::public_key::len, nullptr);
-            ok = sqlite3_step(stmt);
-            if (ok != SQLITE_DONE) {
-                return false;
-            }
-            sqlite3_finalize(stmt);
+            write<bool>([pubKey](sqlite3 *db, stmt_map &stmts) {
+                return write_friend(db, stmts, "DELETE FROM FRIENDS WHERE PUBKEY=?", pubKey);
+            }, [this](bool ok) {
+                if (!ok) m_counters.inc_stats_counter(counters::communication_message_write_failures);
+            });
 
             return true;
         }
 
         bool message_db_impl::create_table_messages() {
-            std::string sql = "CREATE TABLE IF NOT EXISTS MESSAGES(HASH BLOB PRIMARY KEY NOT NULL,SENDER BLOB,RECEIVER BLOB,TIMESTAMP INTEGER,PAYLOAD BLOB);";
+            // DICT is the id of the dictionary PAYLOAD is compressed with,
+            // NULL if it is not compressed. SEARCH_ID is the rowid of the
+            // message in MESSAGES_FTS, NULL until it is indexed
+            std::string sql = "CREATE TABLE IF NOT EXISTS MESSAGES(HASH BLOB PRIMARY KEY NOT NULL,SENDER BLOB,RECEIVER BLOB,TIMESTAMP INTEGER,PAYLOAD BLOB,DICT INTEGER,SEARCH_ID INTEGER);";
+            sql.append("CREATE TABLE IF NOT EXISTS MESSAGE_DICTIONARIES(ID INTEGER PRIMARY KEY,DICT BLOB);");
+            // latest messages of a conversation, and pages of its history
+            // ordered by (TIMESTAMP,HASH), without scanning and sorting the
+            // whole table. The index without HASH is replaced
+            sql.append("DROP INDEX IF EXISTS MESSAGES_sender_receiver_timestamp;");
+            sql.append("CREATE INDEX IF NOT EXISTS MESSAGES_sender_receiver_timestamp_hash ON MESSAGES(SENDER,RECEIVER,TIMESTAMP,HASH);");
             char *zErrMsg = nullptr;
             int ok = sqlite3_exec(m_sqlite, sql.c_str(), nullptr, nullptr, &zErrMsg);
             if (ok != SQLITE_OK) {
@@ -108,162 +569,351 @@ namespace libTAU {
                 return false;
             }
 
-            return true;
-        }
-
-        bool message_db_impl::save_message_if_not_exist(const message &msg) {
-            sqlite3_stmt * stmt;
-            std::string sql = "INSERT INTO MESSAGES (HASH,SENDER,RECEIVER,TIMESTAMP,PAYLOAD) SELECT ?,?,?,?,? WHERE NOT EXISTS(SELECT * FROM MESSAGES WHERE HASH=?)";
-            int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-            if (ok != SQLITE_OK) {
-                return false;
+            // tables created before compression
+            if (!has_column("MESSAGES", "DICT")) {
+                ok = sqlite3_exec(m_sqlite, "ALTER TABLE MESSAGES ADD COLUMN DICT INTEGER;", nullptr, nullptr, &zErrMsg);
+                if (ok != SQLITE_OK) {
+                    sqlite3_free(zErrMsg);
+                    return false;
+                }
             }
 
-            sqlite3_bind_blob(stmt, 1, msg.sha1().data(), libTAU::sha1_hash::size(), nullptr);
-            sqlite3_bind_blob(stmt, 2, msg.sender().bytes.data(), dht::public_key::len, nullptr);
-            sqlite3_bind_blob(stmt, 3, msg.receiver().bytes.data(), dht::public_key::len, nullptr);
-            sqlite3_bind_int64(stmt, 4, msg.timestamp());
-            sqlite3_bind_blob(stmt, 5, msg.payload().data(), msg.payload().size(), nullptr);
+            // tables created before SEARCH_ID. Their search index shared the
+            // implicit rowid of MESSAGES, which VACUUM may renumber, so it is
+            // dropped and built again
+            if (!has_column("MESSAGES", "SEARCH_ID")) {
+                ok = sqlite3_exec(m_sqlite, "DROP TABLE IF EXISTS MESSAGES_FTS;ALTER TABLE MESSAGES ADD COLUMN SEARCH_ID INTEGER;"
+                                  , nullptr, nullptr, &zErrMsg);
+                if (ok != SQLITE_OK) {
+                    sqlite3_free(zErrMsg);
+                    return false;
+                }
+            }
 
-            ok = sqlite3_step(stmt);
-            if (ok != SQLITE_DONE) {
+            // matches are joined to their messages by SEARCH_ID, and the
+            // messages not indexed yet are the NULL ones
+            ok = sqlite3_exec(m_sqlite, "CREATE UNIQUE INDEX IF NOT EXISTS MESSAGES_search_id ON MESSAGES(SEARCH_ID);"
+                              , nullptr, nullptr, &zErrMsg);
+            if (ok != SQLITE_OK) {
+                sqlite3_free(zErrMsg);
                 return false;
             }
-            sqlite3_finalize(stmt);
 
             return true;
         }
 
-        message message_db_impl::get_message_by_hash(const sha1_hash &hash) {
-            message msg;
-
-            sqlite3_stmt * stmt;
-            std::string sql = "SELECT SENDER,RECEIVER,TIMESTAMP,PAYLOAD FROM MESSAGES WHERE HASH=?;";
+        bool message_db_impl::save_message_if_not_exist(const message &msg, message_write_handler done) {
+            // compressed here, the dictionaries are only used on this thread
+            std::string compressed;
+            std::int64_t dict = 0;
+            if (m_compress && m_compressor.compress(msg.payload(), compressed)) {
+                dict = m_compressor.current_dictionary();
+            }
 
-            int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-            if (ok == SQLITE_OK) {
-                sqlite3_bind_blob(stmt, 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
-                if (sqlite3_step(stmt) == SQLITE_ROW) {
-                    const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
-                    dht::public_key sender(p);
+            std::uint32_t const seq = ++m_pending_seq;
+            auto &p = (*m_pending)[msg.sha1()];
+            p.msg = msg;
+            p.deleted = false;
+            p.seq = seq;
+
+            // while the history is being indexed, a save is left to it, so
+            // that it is indexed after the older messages
+            bool const search = m_search && !m_indexing;
+            if (m_indexing) {
+                ++m_unindexed_saves;
+            }
+            write<save_result>([msg, compressed = std::move(compressed), dict, search](sqlite3 *db, stmt_map &stmts) {
+                return write_message(db, stmts, msg, compressed, dict, search);
+            }, [this, hash = msg.sha1(), seq, search, done = std::move(done)](save_result r) {
+                auto it = m_pending->find(hash);
+                if (it != m_pending->end() && it->second.seq == seq) {
+                    m_pending->erase(it);
+                }
 
-                    p = static_cast<const char *>(sqlite3_column_blob(stmt, 1));
-                    dht::public_key receiver(p);
+                if (done) {
+                    done(hash, r.ok);
+                }
 
-                    std::int64_t timestamp = sqlite3_column_int64(stmt, 2);
+                if (!r.ok) {
+                    m_counters.inc_stats_counter(counters::communication_message_write_failures);
+                    return;
+                }
+                if (!r.stored) {
+                    return;
+                }
 
-                    p = static_cast<const char *>(sqlite3_column_blob(stmt, 3));
-                    auto length = sqlite3_column_bytes(stmt, 3);
-                    aux::bytes payload(p, p + length);
+                if (!m_filter.insert(hash)) {
+                    rebuild_filter(m_filter.capacity() * 2);
+                }
+                update_filter_gauges();
 
-                    msg = message(timestamp, sender, receiver, payload, hash);
+                if (search && !r.indexed) {
+                    m_counters.inc_stats_counter(counters::communication_message_search_index_failures);
                 }
-            }
 
-            sqlite3_finalize(stmt);
+                if (m_compress && m_compressor.current_dictionary() == 0
+                    && ++m_uncompressed_messages >= dictionary_training_messages) {
+                    m_uncompressed_messages = 0;
+                    train_dictionary();
+                }
+            });
 
-            return msg;
+            return true;
         }
 
-        communication::message
-        message_db_impl::get_latest_transaction(const dht::public_key &sender, const dht::public_key &receiver) {
-            communication::message msg;
+        message message_db_impl::get_message_by_hash(const sha1_hash &hash) {
+            if (auto const *p = find_pending(hash)) {
+                return p->msg;
+            }
 
-            sqlite3_stmt * stmt;
-            std::string sql = "SELECT HASH,TIMESTAMP,PAYLOAD FROM MESSAGES WHERE SENDER=? AND RECEIVER=? ORDER BY TIMESTAMP DESC LIMIT 1";
+            message msg;
 
-            int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-            if (ok == SQLITE_OK) {
-                sqlite3_bind_blob(stmt, 1, sender.bytes.data(), dht::public_key::len, nullptr);
-                sqlite3_bind_blob(stmt, 2, receiver.bytes.data(), dht::public_key::len, nullptr);
-                if (sqlite3_step(stmt) == SQLITE_ROW) {
-                    const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
-                    sha1_hash hash(p);
+            auto stmt = prepare_cached("SELECT SENDER,RECEIVER,TIMESTAMP,PAYLOAD,DICT FROM MESSAGES WHERE HASH=?");
+            if (stmt) {
+                sqlite3_bind_blob(stmt.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
+                if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                    const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
+                    dht::public_key sender(p);
 
-                    std::int64_t timestamp = sqlite3_column_int64(stmt, 1);
+                    p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 1));
+                    dht::public_key receiver(p);
 
-                    p = static_cast<const char *>(sqlite3_column_blob(stmt, 2));
-                    auto length = sqlite3_column_bytes(stmt, 2);
-                    aux::bytes payload(p, p + length);
+                    std::int64_t timestamp = sqlite3_column_int64(stmt.get(), 2);
 
-                    msg = message(timestamp, sender, receiver, payload, hash);
+                    aux::bytes payload;
+                    if (read_payload(stmt.get(), 3, payload)) {
+                        msg = message(timestamp, sender, receiver, payload, hash);
+                    }
                 }
             }
 
-            sqlite3_finalize(stmt);
-
             return msg;
         }
 
+        communication::message
+        message_db_impl::get_latest_transaction(const dht::public_key &sender, const dht::public_key &receiver) {
+            auto messages = get_latest_ten_transactions(sender, receiver);
+
+            return messages.empty() ? communication::message() : messages.back();
+        }
+
         std::vector<communication::message>
         message_db_impl::get_latest_ten_transactions(const dht::public_key &sender, const dht::public_key &receiver) {
             std::vector<communication::message> messages;
 
-            sqlite3_stmt * stmt;
-            std::string sql = "SELECT HASH,TIMESTAMP,PAYLOAD FROM MESSAGES WHERE SENDER=? AND RECEIVER=? ORDER BY TIMESTAMP DESC LIMIT 10";
-
-            int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-            if (ok == SQLITE_OK) {
-                sqlite3_bind_blob(stmt, 1, sender.bytes.data(), dht::public_key::len, nullptr);
-                sqlite3_bind_blob(stmt, 2, receiver.bytes.data(), dht::public_key::len, nullptr);
-                for (;sqlite3_step(stmt) == SQLITE_ROW;) {
-                    const char *p = static_cast<const char *>(sqlite3_column_blob(stmt, 0));
+            // rows with a pending save or delete are served from the pending
+            // map, or not at all
+            auto stmt = prepare_cached("SELECT HASH,TIMESTAMP,PAYLOAD,DICT FROM MESSAGES WHERE SENDER=? AND RECEIVER=? ORDER BY TIMESTAMP DESC");
+            if (stmt) {
+                sqlite3_bind_blob(stmt.get(), 1, sender.bytes.data(), dht::public_key::len, nullptr);
+                sqlite3_bind_blob(stmt.get(), 2, receiver.bytes.data(), dht::public_key::len, nullptr);
+                for (;messages.size() < 10 && sqlite3_step(stmt.get()) == SQLITE_ROW;) {
+                    const char *p = static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0));
                     sha1_hash hash(p);
+                    if (find_pending(hash) != nullptr) {
+                        continue;
+                    }
 
-                    std::int64_t timestamp = sqlite3_column_int64(stmt, 1);
+                    std::int64_t timestamp = sqlite3_column_int64(stmt.get(), 1);
 
-                    p = static_cast<const char *>(sqlite3_column_blob(stmt, 2));
-                    auto length = sqlite3_column_bytes(stmt, 2);
-                    aux::bytes payload(p, p + length);
+                    aux::bytes payload;
+                    if (!read_payload(stmt.get(), 2, payload)) {
+                        continue;
+                    }
 
                     auto msg = message(timestamp, sender, receiver, payload, hash);
                     messages.push_back(msg);
                 }
             }
 
-            sqlite3_finalize(stmt);
+            for (auto const &p : *m_pending) {
+                if (!p.second.deleted && p.second.msg.sender() == sender && p.second.msg.receiver() == receiver) {
+                    messages.push_back(p.second.msg);
+                }
+            }
+            std::stable_sort(messages.begin(), messages.end(), [](const message &lhs, const message &rhs) {
+                return lhs.timestamp() > rhs.timestamp();
+            });
+            if (messages.size() > 10) {
+                messages.resize(10);
+            }
 
             std::reverse(messages.begin(), messages.end());
 
             return messages;
         }
 
-        bool message_db_impl::delete_message_by_hash(const sha1_hash &hash) {
-            sqlite3_stmt * stmt;
-            std::string sql = "DELETE FROM MESSAGES WHERE HASH=?";
-            int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-            if (ok != SQLITE_OK) {
+        bool message_db_impl::get_messages_before(const dht::public_key &sender, const dht::public_key &receiver,
+                                                  const message_cursor &cursor, int limit,
+                                                  std::vector<std::pair<message_view, bool>> &rows) {
+            auto stmt = prepare_cached("SELECT HASH,TIMESTAMP,PAYLOAD,DICT FROM MESSAGES WHERE SENDER=? AND RECEIVER=? AND (TIMESTAMP,HASH)<(?,?) ORDER BY TIMESTAMP DESC,HASH DESC LIMIT ?");
+            if (!stmt) {
                 return false;
             }
-            sqlite3_bind_blob(stmt, 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
 
-            ok = sqlite3_step(stmt);
-            if (ok != SQLITE_DONE) {
-                return false;
+            sqlite3_bind_blob(stmt.get(), 1, sender.bytes.data(), dht::public_key::len, nullptr);
+            sqlite3_bind_blob(stmt.get(), 2, receiver.bytes.data(), dht::public_key::len, nullptr);
+            sqlite3_bind_int64(stmt.get(), 3, cursor.timestamp);
+            sqlite3_bind_blob(stmt.get(), 4, cursor.hash.data(), libTAU::sha1_hash::size(), nullptr);
+            sqlite3_bind_int(stmt.get(), 5, limit);
+            for (;sqlite3_step(stmt.get()) == SQLITE_ROW;) {
+                message_view msg;
+                msg.hash = sha1_hash(static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0)));
+                msg.sender = sender;
+                msg.receiver = receiver;
+                msg.timestamp = sqlite3_column_int64(stmt.get(), 1);
+                // a pending save stands in for its row, a row being deleted
+                // counts but is dropped like one that cannot be read
+                auto const *pending = find_pending(msg.hash);
+                if (pending != nullptr && !pending->deleted) {
+                    continue;
+                }
+                bool const decoded = pending == nullptr && read_payload(stmt.get(), 2, msg.payload);
+
+                rows.emplace_back(std::move(msg), decoded);
+            }
+
+            return true;
+        }
+
+        message_page message_db_impl::get_message_page(const dht::public_key &self, const dht::public_key &peer,
+                                                       const message_cursor &cursor, int limit) {
+            message_page page;
+            if (limit <= 0) {
+                return page;
+            }
+
+            // one row more than asked tells whether there is an older page.
+            // Rows that fail to decode count as well, they are dropped from
+            // the page only after the page is cut
+            std::vector<std::pair<message_view, bool>> rows;
+            if (!get_messages_before(self, peer, cursor, limit + 1, rows)) {
+                return page;
+            }
+            auto const sent = std::ptrdiff_t(rows.size());
+            if (self != peer && !get_messages_before(peer, self, cursor, limit + 1, rows)) {
+                return page;
+            }
+            auto const stored = std::ptrdiff_t(rows.size());
+            get_pending_before(self, peer, cursor, rows);
+            if (self != peer) {
+                get_pending_before(peer, self, cursor, rows);
             }
-            sqlite3_finalize(stmt);
+
+            // both directions are already newest first, merge them, then
+            // the pending saves
+            auto const newer = [](const std::pair<message_view, bool> &lhs, const std::pair<message_view, bool> &rhs) {
+                return std::tie(lhs.first.timestamp, lhs.first.hash) > std::tie(rhs.first.timestamp, rhs.first.hash);
+            };
+            std::inplace_merge(rows.begin(), rows.begin() + sent, rows.begin() + stored, newer);
+            std::sort(rows.begin() + stored, rows.end(), newer);
+            std::inplace_merge(rows.begin(), rows.begin() + stored, rows.end(), newer);
+
+            if (rows.size() > std::size_t(limit)) {
+                rows.resize(std::size_t(limit));
+                page.more = true;
+            }
+            if (!rows.empty()) {
+                page.next.timestamp = rows.back().first.timestamp;
+                page.next.hash = rows.back().first.hash;
+            }
+            for (auto &row: rows) {
+                if (row.second) {
+                    page.messages.push_back(std::move(row.first));
+                }
+            }
+
+            return page;
+        }
+
+        std::vector<message_match> message_db_impl::search_messages(const std::string &query, int limit,
+                                                                    message_search_order order) {
+            std::vector<message_match> matches;
+            if (!m_search || limit <= 0) {
+                return matches;
+            }
+
+            auto stmt = order == message_search_order::best_match
+                ? prepare_cached("SELECT m.HASH,m.SENDER,m.RECEIVER,m.TIMESTAMP,snippet(MESSAGES_FTS,0,'[',']','...',16),MESSAGES_FTS.rank FROM MESSAGES_FTS JOIN MESSAGES m ON m.SEARCH_ID=MESSAGES_FTS.ROWID WHERE MESSAGES_FTS MATCH ? ORDER BY MESSAGES_FTS.rank LIMIT ?")
+                : prepare_cached("SELECT m.HASH,m.SENDER,m.RECEIVER,m.TIMESTAMP,snippet(MESSAGES_FTS,0,'[',']','...',16),0 FROM MESSAGES_FTS JOIN MESSAGES m ON m.SEARCH_ID=MESSAGES_FTS.ROWID WHERE MESSAGES_FTS MATCH ? ORDER BY MESSAGES_FTS.ROWID DESC LIMIT ?");
+            if (!stmt) {
+                return matches;
+            }
+
+            sqlite3_bind_text(stmt.get(), 1, query.data(), int(query.size()), nullptr);
+            sqlite3_bind_int(stmt.get(), 2, limit);
+            // a query that is not valid FTS5 syntax fails on the first step
+            for (;sqlite3_step(stmt.get()) == SQLITE_ROW;) {
+                message_match match;
+                match.hash = sha1_hash(static_cast<const char *>(sqlite3_column_blob(stmt.get(), 0)));
+                match.sender = dht::public_key(static_cast<const char *>(sqlite3_column_blob(stmt.get(), 1)));
+                match.receiver = dht::public_key(static_cast<const char *>(sqlite3_column_blob(stmt.get(), 2)));
+                match.timestamp = sqlite3_column_int64(stmt.get(), 3);
+                const char *p = reinterpret_cast<const char *>(sqlite3_column_text(stmt.get(), 4));
+                if (p != nullptr) {
+                    match.snippet.assign(p, std::size_t(sqlite3_column_bytes(stmt.get(), 4)));
+                }
+                match.rank = sqlite3_column_double(stmt.get(), 5);
+
+                matches.push_back(std::move(match));
+            }
+
+            return matches;
+        }
+
+        bool message_db_impl::delete_message_by_hash(const sha1_hash &hash) {
+            std::uint32_t const seq = ++m_pending_seq;
+            auto &p = (*m_pending)[hash];
+            p.msg = message();
+            p.deleted = true;
+            p.seq = seq;
+
+            bool const search_table = m_search_table;
+            write<int>([hash, search_table](sqlite3 *db, stmt_map &stmts) {
+                return erase_message(db, stmts, hash, search_table);
+            }, [this, hash, seq](int deleted) {
+                auto it = m_pending->find(hash);
+                if (it != m_pending->end() && it->second.seq == seq) {
+                    m_pending->erase(it);
+                }
+
+                if (deleted < 0) {
+                    m_counters.inc_stats_counter(counters::communication_message_write_failures);
+                    return;
+                }
+
+                // only a hash that was inserted may be erased from the filter
+                if (deleted > 0) {
+                    m_filter.erase(hash);
+                    update_filter_gauges();
+                }
+            });
 
             return true;
         }
 
         bool message_db_impl::is_message_in_db(const sha1_hash &hash) {
-            bool ret = false;
+            if (auto const *p = find_pending(hash)) {
+                return !p->deleted;
+            }
 
-            sqlite3_stmt * stmt;
-            std::string sql = "SELECT COUNT(*) FROM MESSAGES WHERE HASH=?";
+            if (!m_filter.find(hash)) {
+                m_counters.inc_stats_counter(counters::communication_message_filter_negatives);
+                return false;
+            }
 
-            int ok = sqlite3_prepare_v2(m_sqlite, sql.c_str(), -1, &stmt, nullptr);
-            if (ok == SQLITE_OK) {
-                sqlite3_bind_blob(stmt, 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
-                if (sqlite3_step(stmt) == SQLITE_ROW) {
-                    int num = sqlite3_column_int(stmt, 0);
-                    if (num > 0) {
-                        ret = true;
-                    }
+            bool ret = false;
+
+            auto stmt = prepare_cached("SELECT 1 FROM MESSAGES WHERE HASH=?");
+            if (stmt) {
+                sqlite3_bind_blob(stmt.get(), 1, hash.data(), libTAU::sha1_hash::size(), nullptr);
+                if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+                    ret = true;
                 }
             }
 
-            sqlite3_finalize(stmt);
+            m_counters.inc_stats_counter(ret ? counters::communication_message_filter_true_positives
+                : counters::communication_message_filter_false_positives);
 
             return ret;
         }
@@ -0,0 +1,196 @@
+/*
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include "libTAU/communication/sync_scheduler.hpp"
+#include "libTAU/kademlia/node_id.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace libTAU {
+    namespace communication {
+
+        sync_scheduler::sync_scheduler(lookup_function lookup, int ops_per_second, int group_prefix_bits)
+            : m_lookup(std::move(lookup)), m_rate(std::max(0, ops_per_second))
+            , m_group_prefix_bits(std::clamp(group_prefix_bits, 0, 256)) {}
+
+        void sync_scheduler::set_rate(int ops_per_second) {
+            m_rate = std::max(0, ops_per_second);
+        }
+
+        void sync_scheduler::set_group_prefix_bits(int bits) {
+            m_group_prefix_bits = std::clamp(bits, 0, 256);
+        }
+
+        void sync_scheduler::peer_active(const dht::public_key &peer, std::int64_t now) {
+            auto &last = m_activity[peer];
+            last = std::max(last, now);
+        }
+
+        void sync_scheduler::add(sync_operation op) {
+            std::int64_t activity = 0;
+            auto it = m_activity.find(op.peer);
+            if (it != m_activity.end()) {
+                activity = it->second;
+            }
+
+            queue_key const key(-activity, m_sequence++);
+            if (!op.lookup) {
+                m_direct.emplace(key, std::move(op));
+                return;
+            }
+
+            insert(pending_operation{std::move(op), key});
+        }
+
+        void sync_scheduler::insert(pending_operation p) {
+            auto const key = p.key;
+            auto const target = p.op.target;
+            auto it = m_operations.emplace(target, std::move(p));
+            m_queue.emplace(key, it);
+        }
+
+        int sync_scheduler::dispatch(std::int64_t now) {
+            if (m_rate > 0) {
+                if (m_last_dispatch < 0) {
+                    m_budget = m_rate;
+                } else if (now > m_last_dispatch) {
+                    m_budget += double(now - m_last_dispatch) * m_rate / 1000;
+                }
+                m_budget = std::min(m_budget, double(m_rate));
+            }
+            m_last_dispatch = now;
+
+            // the operations of a lookup that timed out find their own nodes.
+            // They are run once the timed out groups are taken out, an
+            // operation may add others
+            std::vector<pending_operation> expired;
+            while (!m_in_flight.empty() && now - m_in_flight.begin()->second.start >= lookup_timeout) {
+                auto &group = m_in_flight.begin()->second.operations;
+                std::move(group.begin(), group.end(), std::back_inserter(expired));
+                m_in_flight.erase(m_in_flight.begin());
+            }
+            for (auto &p : expired) {
+                ++m_dispatched;
+                p.op.run({});
+            }
+
+            int started = 0;
+            while ((!m_queue.empty() || !m_direct.empty()) && (m_rate == 0 || m_budget >= 1)) {
+                // an operation without a lookup is run in its turn
+                if (!m_direct.empty() && (m_queue.empty() || m_direct.begin()->first < m_queue.begin()->first)) {
+                    sync_operation op = std::move(m_direct.begin()->second);
+                    m_direct.erase(m_direct.begin());
+                    if (m_rate > 0) {
+                        m_budget -= 1;
+                    }
+                    ++m_dispatched;
+                    op.run({});
+                    continue;
+                }
+
+                auto const lead_it = m_queue.begin()->second;
+                sha256_hash const lead = lead_it->first;
+
+                // the targets sharing the prefix of the lead are a range of
+                // m_operations
+                sha256_hash mask = (sha256_hash::max)();
+                if (m_group_prefix_bits < 256) {
+                    mask <<= 256 - m_group_prefix_bits;
+                }
+                sha256_hash const low = lead & mask;
+                sha256_hash high = lead;
+                high |= ~mask;
+
+                int limit = max_group_size;
+                if (m_rate > 0) {
+                    limit = std::min(limit, int(m_budget));
+                }
+
+                // the lead first, then the others of its range
+                std::uint64_t const id = std::uint64_t(m_lookups++);
+                auto &group = m_in_flight[id];
+                group.start = now;
+                m_queue.erase(m_queue.begin());
+                group.operations.push_back(std::move(lead_it->second));
+                m_operations.erase(lead_it);
+
+                auto it = m_operations.lower_bound(low);
+                auto const end = m_operations.upper_bound(high);
+                while (it != end && int(group.operations.size()) < limit) {
+                    m_queue.erase(it->second.key);
+                    group.operations.push_back(std::move(it->second));
+                    it = m_operations.erase(it);
+                }
+
+                if (m_rate > 0) {
+                    m_budget -= double(group.operations.size());
+                }
+                ++started;
+
+                // a lookup that timed out, or was cleared, is ignored
+                m_lookup(lead, [this, id](std::vector<dht::node_entry> const &nodes) {
+                    auto it = m_in_flight.find(id);
+                    if (it == m_in_flight.end()) return;
+                    auto operations = std::move(it->second.operations);
+                    m_in_flight.erase(it);
+                    complete(operations, nodes);
+                });
+            }
+
+            return started;
+        }
+
+        void sync_scheduler::complete(std::vector<pending_operation> &group
+                , std::vector<dht::node_entry> const &nodes) {
+            sha256_hash const &lead = group.front().op.target;
+
+            // every node closer to the lead than the farthest one found was
+            // found, so are the nodes closest to a target well within that
+            // radius
+            int radius = -1;
+            for (auto const &n : nodes) {
+                radius = std::max(radius, dht::distance_exp(lead, n.id));
+            }
+            radius -= reach_margin_bits;
+
+            std::vector<dht::node_entry> closest;
+            for (std::size_t i = 0; i < group.size(); ++i) {
+                auto &p = group[i];
+                auto const &target = p.op.target;
+                if (i > 0 && dht::distance_exp(lead, target) >= radius) {
+                    // out of reach of this lookup, it waits for its own
+                    if (m_rate > 0) {
+                        m_budget += 1;
+                    }
+                    insert(std::move(p));
+                    continue;
+                }
+
+                closest = nodes;
+                auto const middle = closest.begin()
+                    + std::min(std::ptrdiff_t(nodes_per_operation), std::ptrdiff_t(closest.size()));
+                std::partial_sort(closest.begin(), middle, closest.end()
+                    , [&target](dht::node_entry const &lhs, dht::node_entry const &rhs) {
+                        return dht::compare_ref(lhs.id, rhs.id, target);
+                    });
+                closest.erase(middle, closest.end());
+
+                ++m_dispatched;
+                p.op.run(closest);
+            }
+        }
+
+        void sync_scheduler::clear() {
+            m_queue.clear();
+            m_operations.clear();
+            m_direct.clear();
+            m_in_flight.clear();
+        }
+    }
+}
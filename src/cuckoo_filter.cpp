@@ -0,0 +1,139 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include "libTAU/aux_/cuckoo_filter.hpp"
+#include "libTAU/aux_/random.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace libTAU::aux {
+
+	namespace {
+
+		std::size_t bucket_index(sha1_hash const& k)
+		{
+			auto const* b = reinterpret_cast<std::uint8_t const*>(k.data());
+			return std::size_t(b[0]) | (std::size_t(b[1]) << 8)
+				| (std::size_t(b[2]) << 16) | (std::size_t(b[3]) << 24);
+		}
+
+		// 0 marks an empty slot, it is never a fingerprint
+		std::uint16_t fingerprint(sha1_hash const& k)
+		{
+			auto const* b = reinterpret_cast<std::uint8_t const*>(k.data());
+			std::uint16_t const fp = std::uint16_t(b[4] | (b[5] << 8));
+			return fp == 0 ? 1 : fp;
+		}
+	}
+
+	void cuckoo_filter::reset(std::size_t const capacity)
+	{
+		m_slots.clear();
+		m_mask = 0;
+		m_size = 0;
+		if (capacity == 0) return;
+
+		std::size_t buckets = 1;
+		while (buckets * bucket_size < capacity) buckets <<= 1;
+		m_slots.assign(buckets * bucket_size, 0);
+		m_mask = buckets - 1;
+	}
+
+	bool cuckoo_filter::insert(sha1_hash const& k)
+	{
+		if (m_slots.empty()) return true;
+
+		std::uint16_t fp = fingerprint(k);
+		std::size_t const b1 = bucket_index(k) & m_mask;
+		std::size_t const b2 = alt_bucket(b1, fp);
+		if (bucket_insert(b1, fp) || bucket_insert(b2, fp))
+		{
+			++m_size;
+			return true;
+		}
+
+		// move fingerprints to their other bucket until one finds a free
+		// slot. The moves are undone if none does, so that a failed insert
+		// does not lose a hash inserted before
+		std::vector<std::size_t> moved;
+		std::size_t bucket = random(1) == 0 ? b1 : b2;
+		for (int kick = 0; kick < max_kicks; ++kick)
+		{
+			std::size_t const slot = bucket * bucket_size + random(std::uint32_t(bucket_size - 1));
+			std::swap(fp, m_slots[slot]);
+			moved.push_back(slot);
+
+			bucket = alt_bucket(bucket, fp);
+			if (bucket_insert(bucket, fp))
+			{
+				++m_size;
+				return true;
+			}
+		}
+
+		for (auto it = moved.rbegin(); it != moved.rend(); ++it)
+			std::swap(fp, m_slots[*it]);
+		return false;
+	}
+
+	bool cuckoo_filter::erase(sha1_hash const& k)
+	{
+		if (m_slots.empty()) return false;
+
+		std::uint16_t const fp = fingerprint(k);
+		std::size_t const b1 = bucket_index(k) & m_mask;
+		if (bucket_erase(b1, fp) || bucket_erase(alt_bucket(b1, fp), fp))
+		{
+			--m_size;
+			return true;
+		}
+		return false;
+	}
+
+	bool cuckoo_filter::find(sha1_hash const& k) const
+	{
+		if (m_slots.empty()) return true;
+
+		std::uint16_t const fp = fingerprint(k);
+		std::size_t const b1 = bucket_index(k) & m_mask;
+		return bucket_find(b1, fp) || bucket_find(alt_bucket(b1, fp), fp);
+	}
+
+	std::size_t cuckoo_filter::alt_bucket(std::size_t const bucket, std::uint16_t const fp) const
+	{
+		// an involution, the alternate of the alternate bucket is the
+		// bucket itself, so a fingerprint can move without its hash
+		return (bucket ^ (std::size_t(fp) * 0x5bd1e995)) & m_mask;
+	}
+
+	bool cuckoo_filter::bucket_insert(std::size_t const bucket, std::uint16_t const fp)
+	{
+		auto const begin = m_slots.begin() + std::ptrdiff_t(bucket * bucket_size);
+		auto const it = std::find(begin, begin + bucket_size, std::uint16_t(0));
+		if (it == begin + bucket_size) return false;
+		*it = fp;
+		return true;
+	}
+
+	bool cuckoo_filter::bucket_find(std::size_t const bucket, std::uint16_t const fp) const
+	{
+		auto const begin = m_slots.begin() + std::ptrdiff_t(bucket * bucket_size);
+		return std::find(begin, begin + bucket_size, fp) != begin + bucket_size;
+	}
+
+	bool cuckoo_filter::bucket_erase(std::size_t const bucket, std::uint16_t const fp)
+	{
+		auto const begin = m_slots.begin() + std::ptrdiff_t(bucket * bucket_size);
+		auto const it = std::find(begin, begin + bucket_size, fp);
+		if (it == begin + bucket_size) return false;
+		*it = 0;
+		return true;
+	}
+}
@@ -0,0 +1,252 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include "libTAU/aux_/edit_distance.hpp"
+#include "libTAU/assert.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace libTAU::aux {
+
+	namespace {
+
+		std::uint64_t const high_bit = std::uint64_t(1) << 63;
+
+		int popcount(std::uint64_t v)
+		{
+#if defined __GNUC__ || defined __clang__
+			return __builtin_popcountll(v);
+#else
+			v = v - ((v >> 1) & 0x5555555555555555ULL);
+			v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+			v = (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+			return int((v * 0x0101010101010101ULL) >> 56);
+#endif
+		}
+
+		std::size_t words(std::size_t source_size)
+		{
+			return std::max(std::size_t(1), (source_size + 63) / 64);
+		}
+
+		std::size_t block_size(std::size_t target_size)
+		{
+			auto b = std::size_t(std::ceil(std::sqrt(double(target_size))));
+			return std::max(std::size_t(1), b);
+		}
+
+		// advance 64 rows of a column by one target element. pv and mv are
+		// the rows whose value is one more and one less than the row above,
+		// eq the rows whose source element is the target element and hin
+		// the horizontal delta of the row above the word. Returns the
+		// horizontal delta of the last row
+		int advance_word(std::uint64_t& pv, std::uint64_t& mv, std::uint64_t eq, int hin)
+		{
+			std::uint64_t const hin_neg = hin < 0 ? 1 : 0;
+			std::uint64_t const xv = eq | mv;
+			eq |= hin_neg;
+			std::uint64_t const xh = (((eq & pv) + pv) ^ pv) | eq;
+			std::uint64_t ph = mv | ~(xh | pv);
+			std::uint64_t mh = pv & xh;
+
+			int hout = 0;
+			if (ph & high_bit) hout = 1;
+			else if (mh & high_bit) hout = -1;
+
+			ph <<= 1;
+			mh <<= 1;
+			if (hin < 0) mh |= 1;
+			else if (hin > 0) ph |= 1;
+
+			pv = mh | ~(xv | ph);
+			mv = ph & xv;
+			return hout;
+		}
+	}
+
+	std::size_t edit_distance::scratch_size(std::size_t const source_size, std::size_t const target_size)
+	{
+		std::size_t const w = words(source_size);
+		std::size_t const b = block_size(target_size);
+		return 256 * w + 2 * w * (target_size / b + 1) + 2 * w * (b + 1);
+	}
+
+	edit_distance::edit_distance(span<char const> source, span<char const> target
+		, span<std::uint64_t> scratch)
+		: m_source(source)
+		, m_target(target)
+		, m_words(words(std::size_t(source.size())))
+		, m_block(block_size(std::size_t(target.size())))
+		, m_block_first(0)
+		, m_distance(0)
+		, m_i(std::size_t(source.size()))
+		, m_j(std::size_t(target.size()))
+		, m_value(0)
+	{
+		std::size_t const n = m_i;
+		std::size_t const m = m_j;
+		TORRENT_ASSERT(std::size_t(scratch.size()) >= scratch_size(n, m));
+
+		std::size_t const column_words = 2 * m_words;
+		m_peq = scratch.first(std::ptrdiff_t(256 * m_words));
+		scratch = scratch.subspan(m_peq.size());
+		m_checkpoints = scratch.first(std::ptrdiff_t(column_words * (m / m_block + 1)));
+		scratch = scratch.subspan(m_checkpoints.size());
+		m_columns = scratch.first(std::ptrdiff_t(column_words * (m_block + 1)));
+
+		std::fill(m_peq.begin(), m_peq.end(), std::uint64_t(0));
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			m_peq[std::ptrdiff_t(std::size_t(std::uint8_t(source[std::ptrdiff_t(i)])) * m_words + i / 64)]
+				|= std::uint64_t(1) << (i % 64);
+		}
+
+		// column 0, every row is one more than the row above
+		std::uint64_t* col = m_columns.data();
+		std::fill(col, col + m_words, ~std::uint64_t(0));
+		std::fill(col + m_words, col + column_words, std::uint64_t(0));
+
+		for (std::size_t j = 0; j < m; ++j)
+		{
+			if (j % m_block == 0)
+				std::copy(col, col + column_words, m_checkpoints.data() + j / m_block * column_words);
+			advance(col, j + 1);
+		}
+
+		// the distance, from column m
+		m_block_first = m;
+		m_distance = value(n, m);
+		m_value = m_distance;
+
+		if (m > 0) load_block((m - 1) / m_block * m_block);
+	}
+
+	std::uint64_t* edit_distance::column(std::size_t const j)
+	{
+		TORRENT_ASSERT(j >= m_block_first && j <= m_block_first + m_block);
+		return m_columns.data() + (j - m_block_first) * 2 * m_words;
+	}
+
+	void edit_distance::advance(std::uint64_t* col, std::size_t const j) const
+	{
+		std::uint64_t const* eq = m_peq.data()
+			+ std::size_t(std::uint8_t(m_target[std::ptrdiff_t(j - 1)])) * m_words;
+		std::uint64_t* pv = col;
+		std::uint64_t* mv = col + m_words;
+
+		// the first row is one more than in the previous column
+		int hin = 1;
+		for (std::size_t w = 0; w < m_words; ++w)
+			hin = advance_word(pv[w], mv[w], eq[w], hin);
+	}
+
+	void edit_distance::load_block(std::size_t const first)
+	{
+		std::size_t const column_words = 2 * m_words;
+		std::size_t const last = std::min(first + m_block, std::size_t(m_target.size()));
+		m_block_first = first;
+
+		std::uint64_t const* checkpoint = m_checkpoints.data() + first / m_block * column_words;
+		std::copy(checkpoint, checkpoint + column_words, column(first));
+		for (std::size_t j = first + 1; j <= last; ++j)
+		{
+			std::uint64_t* col = column(j);
+			std::copy(col - column_words, col, col);
+			advance(col, j);
+		}
+	}
+
+	int edit_distance::value(std::size_t const i, std::size_t const j)
+	{
+		if (j == 0) return int(i);
+
+		std::uint64_t const* pv = column(j);
+		std::uint64_t const* mv = pv + m_words;
+		int ret = int(j);
+		std::size_t const full = i / 64;
+		for (std::size_t w = 0; w < full; ++w)
+			ret += popcount(pv[w]) - popcount(mv[w]);
+		if (i % 64 != 0)
+		{
+			std::uint64_t const mask = (std::uint64_t(1) << (i % 64)) - 1;
+			ret += popcount(pv[full] & mask) - popcount(mv[full] & mask);
+		}
+		return ret;
+	}
+
+	int edit_distance::delta(std::size_t const i, std::size_t const j)
+	{
+		TORRENT_ASSERT(i > 0);
+		if (j == 0) return 1;
+
+		std::uint64_t const* pv = column(j);
+		std::uint64_t const* mv = pv + m_words;
+		std::uint64_t const bit = std::uint64_t(1) << ((i - 1) % 64);
+		if (pv[(i - 1) / 64] & bit) return 1;
+		if (mv[(i - 1) / 64] & bit) return -1;
+		return 0;
+	}
+
+	bool edit_distance::next(step& s)
+	{
+		if (m_value == 0) return false;
+
+		s.source_size = m_i;
+		s.target_size = m_j;
+
+		if (m_i == 0)
+		{
+			s.op = operation::insert;
+			--m_j;
+			m_value = int(m_j);
+			return true;
+		}
+
+		if (m_j == 0)
+		{
+			s.op = operation::remove;
+			--m_i;
+			m_value = int(m_i);
+			return true;
+		}
+
+		if (m_j - 1 < m_block_first) load_block(m_block_first - m_block);
+
+		int const up = m_value - delta(m_i, m_j);
+		int const left = value(m_i, m_j - 1);
+		int const diagonal = left - delta(m_i, m_j - 1);
+
+		int const cost = m_source[std::ptrdiff_t(m_i - 1)] == m_target[std::ptrdiff_t(m_j - 1)] ? 0 : 1;
+		int const substitute = diagonal + cost;
+		int const insert = left + 1;
+		int const remove = up + 1;
+
+		if (substitute <= insert && substitute <= remove)
+		{
+			s.op = operation::substitute;
+			--m_i;
+			--m_j;
+			m_value = diagonal;
+		}
+		else if (insert < substitute && insert <= remove)
+		{
+			s.op = operation::insert;
+			--m_j;
+			m_value = left;
+		}
+		else
+		{
+			s.op = operation::remove;
+			--m_i;
+			m_value = up;
+		}
+		return true;
+	}
+}
@@ -169,14 +169,16 @@ bool bs_nodes_db_sqlite::put(std::vector<bs_node_entry> const& nodes)
 
 		time_point const start = aux::time_now();
 
-		int ok = sqlite3_exec(db, "BEGIN TRANSACTION", nullptr, nullptr, &zErrMsg);
+		// a savepoint rather than BEGIN, the shared connection may already be
+		// inside a blockchain group commit transaction
+		int ok = sqlite3_exec(db, "SAVEPOINT put_bs_nodes", nullptr, nullptr, &zErrMsg);
 		if (ok != SQLITE_OK)
 		{
 			sqlite3_free(zErrMsg);
 #ifndef TORRENT_DISABLE_LOGGING
 			if (m_observer->should_log(dht_logger::bs_nodes_db, aux::LOG_ERR))
 			{
-				m_observer->log(dht_logger::bs_nodes_db, "BEGIN TRANSACTION error: %d", ok);
+				m_observer->log(dht_logger::bs_nodes_db, "SAVEPOINT error: %d", ok);
 			}
 #endif
 			return false;
@@ -203,18 +205,20 @@ bool bs_nodes_db_sqlite::put(std::vector<bs_node_entry> const& nodes)
 			if (ok != SQLITE_DONE)
 			{
 				sql_error(ok, "put bs nodes");
+				sqlite3_exec(db, "ROLLBACK TO put_bs_nodes; RELEASE put_bs_nodes"
+					, nullptr, nullptr, nullptr);
 				return false;
 			}
         }
 
-		ok = sqlite3_exec(db, "COMMIT TRANSACTION", nullptr, nullptr, &zErrMsg);
+		ok = sqlite3_exec(db, "RELEASE put_bs_nodes", nullptr, nullptr, &zErrMsg);
 		if (ok != SQLITE_OK)
 		{
 			sqlite3_free(zErrMsg);
 #ifndef TORRENT_DISABLE_LOGGING
 			if (m_observer->should_log(dht_logger::bs_nodes_db, aux::LOG_ERR))
 			{
-				m_observer->log(dht_logger::bs_nodes_db, "COMMIT TRANSACTION error: %d", ok);
+				m_observer->log(dht_logger::bs_nodes_db, "RELEASE SAVEPOINT error: %d", ok);
 			}
 #endif
 			return false;
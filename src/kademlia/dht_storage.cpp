@@ -20,6 +20,7 @@ see LICENSE file.
 
 #include <tuple>
 #include <algorithm>
+#include <cstring>
 #include <utility>
 #include <map>
 #include <set>
@@ -48,22 +49,10 @@ using namespace boost::multi_index;
 namespace libTAU::dht {
 namespace {
 
-	bool compare(const char *a, const char *b, int offset)
-	{
-		int i = 0;
-
-		for (; i < offset && *(a + i) != '\0' && *(b + i) != '\0'; i++)
-		{
-			if (*(a + i) != *(b + i)) return 1;
-		}
-
-		if (i < offset) return 1;
-
-		return 0;
-	}
-
 	struct dht_immutable_item
 	{
+		// the target of the item, the key of the table
+		node_id target;
 		// the actual value
 		std::unique_ptr<char[]> value;
 		// this counts the number of IPs we have seen
@@ -78,6 +67,9 @@ namespace {
 		int num_announcers = 0;
 		// size of malloced space pointed to by value
 		int size = 0;
+		// how much we want to keep this item, see item_importance(). The
+		// least important one is dropped when the table is full
+		int importance = 0;
 	};
 
 	struct dht_mutable_item : dht_immutable_item
@@ -112,46 +104,54 @@ namespace {
 		}
 	}
 
-	// return true of the first argument is a better candidate for removal, i.e.
-	// less important to keep
-	struct immutable_item_comparator
+	// this is a score taking the popularity (number of announcers) and the
+	// fit, in terms of distance from ideal storing node, into account.
+	// each additional 5 announcers is worth one extra bit in the distance.
+	// that is, an item with 10 announcers is allowed to be twice as far
+	// from another item with 5 announcers, from our node ID. Twice as far
+	// because it gets one more bit.
+	int item_importance(dht_immutable_item const& item, std::vector<node_id> const& node_ids)
 	{
-		explicit immutable_item_comparator(std::vector<node_id> const& node_ids) : m_node_ids(node_ids) {}
-		immutable_item_comparator(immutable_item_comparator const&) = default;
+		if (node_ids.empty()) return 0;
+		return item.num_announcers / 5 - min_distance_exp(item.target, node_ids);
+	}
 
-		// explicitly disallow assignment, to silence msvc warning
-		immutable_item_comparator& operator=(immutable_item_comparator const&) = delete;
+	struct item_target{};
+	struct item_importance_time{};
 
-		template <typename Item>
-		bool operator()(std::pair<node_id const, Item> const& lhs
-			, std::pair<node_id const, Item> const& rhs) const
-		{
-			int const l_distance = min_distance_exp(lhs.first, m_node_ids);
-			int const r_distance = min_distance_exp(rhs.first, m_node_ids);
-
-			// this is a score taking the popularity (number of announcers) and the
-			// fit, in terms of distance from ideal storing node, into account.
-			// each additional 5 announcers is worth one extra bit in the distance.
-			// that is, an item with 10 announcers is allowed to be twice as far
-			// from another item with 5 announcers, from our node ID. Twice as far
-			// because it gets one more bit.
-			return lhs.second.num_announcers / 5 - l_distance < rhs.second.num_announcers / 5 - r_distance;
-		}
+	// the immutable or mutable items. This table has two index:
+	//   1. target as primary key.
+	//   2. importance index: when this table is full, remove the least
+	//      important item (i.e. the one the fewest peers are announcing, and
+	//      farthest from our node IDs), the oldest one of those first.
+	template <typename Item>
+	using item_table = multi_index_container<
+		Item,
 
-	private:
+		indexed_by<
+			ordered_unique<
+				tag<item_target>,
+				member<dht_immutable_item, node_id, &dht_immutable_item::target>
+			>,
 
-		std::vector<node_id> const& m_node_ids;
-	};
+			ordered_non_unique<
+				tag<item_importance_time>,
+				composite_key<
+					Item,
+					member<dht_immutable_item, int, &dht_immutable_item::importance>,
+					member<dht_immutable_item, time_point, &dht_immutable_item::last_seen>
+				>
+			>
+		>
+	>;
 
-	// picks the least important one (i.e. the one
-	// the fewest peers are announcing, and farthest
-	// from our node IDs)
-	template<class Item>
-	typename std::map<node_id, Item>::const_iterator pick_least_important_item(
-		std::vector<node_id> const& node_ids, std::map<node_id, Item> const& table)
+	// drops the least important item
+	template <typename Item>
+	void remove_least_important_item(item_table<Item>& table)
 	{
-		return std::min_element(table.begin(), table.end()
-			, immutable_item_comparator(node_ids));
+		auto& importance_index = table.template get<item_importance_time>();
+		TORRENT_ASSERT(!importance_index.empty());
+		importance_index.erase(importance_index.begin());
 	}
 
 	struct relays_bucket
@@ -365,6 +365,10 @@ namespace {
 		void update_node_ids(std::vector<node_id> const& ids) override
 		{
 			m_node_ids = ids;
+
+			// the distances to our node IDs changed
+			update_importance(m_immutable_table);
+			update_importance(m_mutable_table);
 		}
 
 		void set_backend(std::shared_ptr<dht_storage_interface> backend) override
@@ -379,7 +383,7 @@ namespace {
 			if (i == m_immutable_table.end()) return false;
 
 			error_code ec;
-			item["v"] = bdecode({i->second.value.get(), i->second.size}, ec);
+			item["v"] = bdecode({i->value.get(), i->size}, ec);
 			return true;
 		}
 
@@ -394,24 +398,24 @@ namespace {
 				// make sure we don't add too many items
 				if (int(m_immutable_table.size()) >= m_settings.get_int(settings_pack::dht_max_dht_items))
 				{
-					auto const j = pick_least_important_item(m_node_ids
-						, m_immutable_table);
-
-					TORRENT_ASSERT(j != m_immutable_table.end());
-					m_immutable_table.erase(j);
+					remove_least_important_item(m_immutable_table);
 					m_counters.immutable_data -= 1;
 				}
 				dht_immutable_item to_add;
+				to_add.target = target;
 				set_value(to_add, buf);
 
-				std::tie(i, std::ignore) = m_immutable_table.insert(
-					std::make_pair(target, std::move(to_add)));
+				std::tie(i, std::ignore) = m_immutable_table.insert(std::move(to_add));
 				m_counters.immutable_data += 1;
 			}
 
 //			std::fprintf(stderr, "added immutable item (%d)\n", int(m_immutable_table.size()));
 
-			touch_item(i->second, addr);
+			m_immutable_table.modify(i, [&](dht_immutable_item& f)
+				{
+					touch_item(f, addr);
+					f.importance = item_importance(f, m_node_ids);
+				});
 		}
 
 		bool get_mutable_item_timestamp(sha256_hash const& target
@@ -425,7 +429,7 @@ namespace {
 			auto const i = m_mutable_table.find(target);
 			if (i == m_mutable_table.end()) return false;
 
-			ts = i->second.ts;
+			ts = i->ts;
 			return true;
 		}
 
@@ -441,7 +445,7 @@ namespace {
 			auto const i = m_mutable_table.find(target);
 			if (i == m_mutable_table.end()) return false;
 
-			dht_mutable_item const& f = i->second;
+			dht_mutable_item const& f = *i;
 			item["ts"] = f.ts.value;
 			if (force_fill || (timestamp(0) <= ts && ts < f.ts))
 			{
@@ -468,10 +472,10 @@ namespace {
 
 			for (auto it = m_mutable_table.upper_bound(prefix);
 				it != m_mutable_table.end()
-					&& compare(prefix.data(), it->first.data(), 12) == 0;
+					&& std::memcmp(prefix.data(), it->target.data(), 12) == 0;
 				it++)
 			{
-				candidates.push_back(it->first);
+				candidates.push_back(it->target);
 			}
 
 			if (candidates.empty()) return false;
@@ -499,6 +503,7 @@ namespace {
 			}
 
 			TORRENT_ASSERT(!m_node_ids.empty());
+			bool added = false;
 			auto i = m_mutable_table.find(target);
 			if (i == m_mutable_table.end())
 			{
@@ -506,38 +511,34 @@ namespace {
 				// make sure we don't add too many items
 				if (int(m_mutable_table.size()) >= m_settings.get_int(settings_pack::dht_max_dht_items))
 				{
-					auto const j = pick_least_important_item(m_node_ids
-						, m_mutable_table);
-
-					TORRENT_ASSERT(j != m_mutable_table.end());
-					m_mutable_table.erase(j);
+					remove_least_important_item(m_mutable_table);
 					m_counters.mutable_data -= 1;
 				}
 				dht_mutable_item to_add;
+				to_add.target = target;
 				set_value(to_add, buf);
 				to_add.ts = ts;
 				to_add.salt = {salt.begin(), salt.end()};
 				to_add.sig = sig;
 				to_add.key = pk;
 
-				std::tie(i, std::ignore) = m_mutable_table.insert(
-					std::make_pair(target, std::move(to_add)));
+				std::tie(i, std::ignore) = m_mutable_table.insert(std::move(to_add));
 				m_counters.mutable_data += 1;
+				added = true;
 			}
-			else
-			{
-				// this is the case where we already have an item in this slot
-				dht_mutable_item& item = i->second;
 
-				if (item.ts <= ts)
+			m_mutable_table.modify(i, [&](dht_mutable_item& item)
 				{
-					set_value(item, buf);
-					item.ts = ts;
-					item.sig = sig;
-				}
-			}
-
-			touch_item(i->second, addr);
+					// this is the case where we already have an item in this slot
+					if (!added && item.ts <= ts)
+					{
+						set_value(item, buf);
+						item.ts = ts;
+						item.sig = sig;
+					}
+					touch_item(item, addr);
+					item.importance = item_importance(item, m_node_ids);
+				});
 		}
 
 		void remove_mutable_item(sha256_hash const& target) override
@@ -724,7 +725,7 @@ namespace {
 				{
 					for (auto i = m_immutable_table.begin(); i != m_immutable_table.end();)
 					{
-						if (i->second.last_seen + lifetime > now)
+						if (i->last_seen + lifetime > now)
 						{
 							++i;
 							continue;
@@ -740,7 +741,7 @@ namespace {
 				{
 					for (auto i = m_mutable_table.begin(); i != m_mutable_table.end();)
 					{
-						if (i->second.last_seen + lifetime > now)
+						if (i->last_seen + lifetime > now)
 						{
 							++i;
 							continue;
@@ -786,12 +787,22 @@ namespace {
 		dht_storage_counters m_counters;
 
 		std::vector<node_id> m_node_ids;
-		std::map<node_id, dht_immutable_item> m_immutable_table;
-		std::map<node_id, dht_mutable_item> m_mutable_table;
+		item_table<dht_immutable_item> m_immutable_table;
+		item_table<dht_mutable_item> m_mutable_table;
 		std::map<node_id, relays_bucket> m_relays_table;
 
 		relay_table m_relay_entries_table;
 
+		template <typename Item>
+		void update_importance(item_table<Item>& table)
+		{
+			for (auto i = table.begin(); i != table.end(); ++i)
+			{
+				table.modify(i, [this](Item& item)
+					{ item.importance = item_importance(item, m_node_ids); });
+			}
+		}
+
 		void remove_least_important_relay_entry()
 		{
 			if (m_relay_entries_table.size() == 0) return;
@@ -340,6 +340,21 @@ namespace libTAU::dht {
 		}
 	}
 
+	struct find_nodes_ctx
+	{
+		explicit find_nodes_ctx(int traversals) : active_traversals(traversals) {}
+		int active_traversals;
+		std::vector<node_entry> nodes;
+	};
+
+	void find_nodes_callback(std::vector<std::pair<node_entry, std::string>> const& v
+		, std::shared_ptr<find_nodes_ctx> ctx
+		, std::function<void(std::vector<node_entry> const&)> f)
+	{
+		for (auto const& e : v) ctx->nodes.push_back(e.first);
+		if (--ctx->active_traversals == 0) f(ctx->nodes);
+	}
+
 	struct get_mutable_item_ctx
 	{
 		explicit get_mutable_item_ctx(int traversals) : active_traversals(traversals) {}
@@ -537,6 +552,26 @@ namespace libTAU::dht {
 				, std::bind(&get_mutable_item_callback, _1, _2, ctx, cb));
 	}
 
+	void dht_tracker::get_item(public_key const& key
+		, std::vector<node_entry> const& eps
+		, std::function<void(item const&, bool)> cb
+		, std::string salt
+		, std::int64_t timestamp)
+	{
+		// firstly get mutable item from local dht storage.
+		bool const found = get_local_mutable_item(key, cb, salt);
+		if (found)
+		{
+			// ignore result
+		}
+
+		// directly get item from specified endpoints
+		auto ctx = std::make_shared<get_mutable_item_ctx>(int(m_nodes.size()));
+		for (auto& n : m_nodes)
+			n.second.dht.get_item(key, salt, timestamp, eps
+				, std::bind(&get_mutable_item_callback, _1, _2, ctx, cb));
+	}
+
 	void dht_tracker::put_item(entry const& data
 		, std::function<void(int)> cb
 		, public_key const& to)
@@ -648,6 +683,23 @@ namespace libTAU::dht {
 		put_item(self, data, cb, alpha, invoke_window, invoke_limit, salt);
 	}
 
+	void dht_tracker::put_item(entry const& data
+		, std::vector<node_entry> const& eps
+		, std::function<void(item const&, int)> cb
+		, std::string salt)
+	{
+		public_key const pk(m_public_key.data());
+
+		// directly put item into specified endpoints
+		auto ctx = std::make_shared<put_item_ctx>(int(m_nodes.size()));
+		for (auto& n : m_nodes)
+			n.second.dht.put_item(pk, salt, data, eps
+				, std::bind(&put_mutable_item_callback_with_storage, _1, _2
+					, ctx, cb
+					, !m_settings.get_bool(settings_pack::dht_non_referrable)
+					, self()));
+	}
+
 	void dht_tracker::store_mutable_item(item const& it)
 	{
 		if (!it.is_mutable()) return;
@@ -698,6 +750,21 @@ namespace libTAU::dht {
 			n.second.dht.get_peers(pk, salt);
 	}
 
+	void dht_tracker::find_nodes(sha256_hash const& target
+		, std::function<void(std::vector<node_entry> const&)> cb)
+	{
+		if (m_nodes.empty())
+		{
+			cb({});
+			return;
+		}
+
+		auto ctx = std::make_shared<find_nodes_ctx>(int(m_nodes.size()));
+		for (auto& n : m_nodes)
+			n.second.dht.find_nodes(target
+				, std::bind(&find_nodes_callback, _1, ctx, cb));
+	}
+
 	void dht_tracker::find_live_nodes(sha256_hash const& id
 		, std::vector<node_entry>& l
 		, int count)
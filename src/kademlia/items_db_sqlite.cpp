@@ -14,15 +14,140 @@ see LICENSE file.
 #include <libTAU/config.hpp>
 #include <libTAU/aux_/numeric_cast.hpp>
 #include <libTAU/aux_/ip_helpers.hpp> // for is_v4
+#include <libTAU/aux_/random.hpp>
+#include <libTAU/aux_/storage_executor.hpp>
 #include <libTAU/bdecode.hpp>
 #include "libTAU/hex.hpp" // to_hex
 
+#include <cstring>
+
 namespace libTAU { namespace dht {
 
+namespace {
+
+	// the bytes of a target prefix lookups compare, as dht_default_storage
+	// does
+	int const target_prefix_size = 12;
+
+	// the smallest key above every target starting with the prefix of
+	// target_prefix_size bytes
+	std::string prefix_upper_bound(sha256_hash const& prefix)
+	{
+		std::string bound(prefix.data(), target_prefix_size);
+		for (int i = target_prefix_size - 1; i >= 0; --i)
+		{
+			auto& b = bound[std::size_t(i)];
+			b = char(std::uint8_t(b) + 1);
+			if (b != 0) return bound;
+		}
+
+		// the prefix is all ones, a longer key of all ones is above every
+		// target
+		return std::string(sha256_hash::size() + 1, '\xff');
+	}
+
+	int step_insert_item(sqlite3_stmt* stmt, sha256_hash const& target
+		, std::int64_t const ts, std::string const& item)
+	{
+		sqlite3_reset(stmt);
+
+		sqlite3_bind_blob(stmt, 1, target.data(), 32, nullptr);
+		sqlite3_bind_int(stmt, 2, aux::numeric_cast<int>(ts));
+		sqlite3_bind_text(stmt, 3, item.data()
+			, aux::numeric_cast<int>(item.size()), SQLITE_STATIC);
+
+		return sqlite3_step(stmt);
+	}
+
+	struct prune_result
+	{
+		// SQLITE_DONE on success
+		int ok;
+		int count;
+		int deleted;
+	};
+
+	// delete the oldest items, until at most max items are left
+	prune_result prune_items(sqlite3_stmt* count_stmt
+		, sqlite3_stmt* threshold_stmt
+		, sqlite3_stmt* delete_stmt
+		, int const max)
+	{
+		prune_result r{SQLITE_DONE, 0, 0};
+
+		sqlite3_reset(count_stmt);
+		int ok = sqlite3_step(count_stmt);
+		if (ok != SQLITE_ROW)
+		{
+			r.ok = ok;
+			return r;
+		}
+		r.count = sqlite3_column_int(count_stmt, 0);
+		// move to the end
+		sqlite3_step(count_stmt);
+
+		if (r.count <= max) return r;
+
+		sqlite3_reset(threshold_stmt);
+		sqlite3_bind_int(threshold_stmt, 1, r.count - max - 1);
+		ok = sqlite3_step(threshold_stmt);
+		if (ok != SQLITE_ROW)
+		{
+			r.ok = ok;
+			return r;
+		}
+		int const timestamp = sqlite3_column_int(threshold_stmt, 0);
+		// move to the end
+		sqlite3_step(threshold_stmt);
+
+		sqlite3_reset(delete_stmt);
+		sqlite3_bind_int(delete_stmt, 1, timestamp);
+		r.ok = sqlite3_step(delete_stmt);
+		if (r.ok == SQLITE_DONE) r.deleted = r.count - max;
+
+		return r;
+	}
+}
+
+int items_db_sqlite::writer_statements::prepare(sqlite3* db)
+{
+	if (insert_or_replace_items != NULL) return SQLITE_OK;
+
+	int ok = sqlite3_prepare_v2(db, dht::insert_or_replace_items.c_str(), -1
+		, &insert_or_replace_items, nullptr);
+	if (ok == SQLITE_OK) ok = sqlite3_prepare_v2(db, dht::items_count.c_str(), -1
+		, &items_count, nullptr);
+	if (ok == SQLITE_OK) ok = sqlite3_prepare_v2(db, dht::delete_items.c_str(), -1
+		, &delete_items, nullptr);
+	if (ok == SQLITE_OK) ok = sqlite3_prepare_v2(db, dht::select_ts_threshold.c_str(), -1
+		, &select_ts_threshold, nullptr);
+
+	// try again on the next job
+	if (ok != SQLITE_OK) finalize();
+
+	return ok;
+}
+
+void items_db_sqlite::writer_statements::finalize()
+{
+	// finalizing a NULL statement is a no-op
+	sqlite3_finalize(insert_or_replace_items);
+	sqlite3_finalize(items_count);
+	sqlite3_finalize(delete_items);
+	sqlite3_finalize(select_ts_threshold);
+
+	insert_or_replace_items = NULL;
+	items_count = NULL;
+	delete_items = NULL;
+	select_ts_threshold = NULL;
+}
+
 items_db_sqlite::items_db_sqlite(settings_interface const& settings
 	, dht_observer* observer)
 	: m_settings(settings)
 	, m_observer(observer)
+	, m_writer(std::make_shared<writer_statements>())
+	, m_pending(std::make_shared<pending_items>())
 {
 	init();
 	prepare_statements();
@@ -54,6 +179,8 @@ void items_db_sqlite::init()
 			return;
 		}
 
+		if (!migrate_items_target(db)) return;
+
 		// create index
 		ok = sqlite3_exec(db, create_ts_index.c_str(), nullptr, nullptr, &zErrMsg);
 		if (ok != SQLITE_OK)
@@ -88,6 +215,55 @@ void items_db_sqlite::init()
 	}
 }
 
+bool items_db_sqlite::migrate_items_target(sqlite3* db)
+{
+	sqlite3_stmt* stmt = nullptr;
+	int ok = sqlite3_prepare_v2(db, select_items_table_columns.c_str(), -1
+		, &stmt, nullptr);
+	if (ok != SQLITE_OK)
+	{
+		sql_error(ok, select_items_table_columns.c_str());
+		return false;
+	}
+
+	// the declared type of the target column is in column 2
+	bool blob_target = false;
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		auto const name = reinterpret_cast<char const*>(sqlite3_column_text(stmt, 1));
+		auto const type = reinterpret_cast<char const*>(sqlite3_column_text(stmt, 2));
+		if (name != nullptr && type != nullptr && std::strcmp(name, "target") == 0)
+			blob_target = std::strcmp(type, "BLOB") == 0;
+	}
+	sqlite3_finalize(stmt);
+
+	if (blob_target) return true;
+
+	// the database is shared with other tables, which may be in a
+	// transaction, a savepoint nests in it
+	char *zErrMsg = nullptr;
+	std::string const sql = "SAVEPOINT migrate_items;" + migrate_items_table
+		+ "RELEASE migrate_items;";
+	ok = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &zErrMsg);
+	if (ok != SQLITE_OK)
+	{
+		sqlite3_free(zErrMsg);
+		sqlite3_exec(db, "ROLLBACK TO migrate_items; RELEASE migrate_items;"
+			, nullptr, nullptr, nullptr);
+		sql_error(ok, migrate_items_table.c_str());
+		return false;
+	}
+
+#ifndef TORRENT_DISABLE_LOGGING
+	if (m_observer->should_log(dht_logger::items_db, aux::LOG_INFO))
+	{
+		m_observer->log(dht_logger::items_db, "migrate item targets to blob successfully");
+	}
+#endif
+
+	return true;
+}
+
 void items_db_sqlite::prepare_statements()
 {
 	sqlite3* db = m_observer->get_items_database();
@@ -116,6 +292,16 @@ void items_db_sqlite::prepare_statements()
 			return;
 		}
 
+		ok = sqlite3_prepare_v2(db, select_targets_in_range.c_str(), -1
+			, &m_select_targets_in_range_stmt, nullptr);
+		if (ok != SQLITE_OK)
+		{
+			error.append(select_targets_in_range);
+			sql_error(ok, error.c_str());
+
+			return;
+		}
+
 		ok = sqlite3_prepare_v2(db, insert_or_replace_items.c_str(), -1
 			, &m_insert_or_replace_items_stmt, nullptr);
 		if (ok != SQLITE_OK)
@@ -170,13 +356,20 @@ void items_db_sqlite::prepare_statements()
 bool items_db_sqlite::get_mutable_item_timestamp(sha256_hash const& target
 	, timestamp& ts) const
 {
+	auto const p = m_pending->find(target);
+	if (p != m_pending->end())
+	{
+		ts.value = p->second.ts;
+		return true;
+	}
+
 	sqlite3* db = m_observer->get_items_database();
 
 	if (db != NULL && m_select_ts_by_target_stmt != NULL)
 	{
 		sqlite3_reset(m_select_ts_by_target_stmt);
 
-		sqlite3_bind_text(m_select_ts_by_target_stmt, 1
+		sqlite3_bind_blob(m_select_ts_by_target_stmt, 1
 			, target.data(), 32, nullptr);
 
 		time_point const start = aux::time_now();
@@ -220,13 +413,19 @@ bool items_db_sqlite::get_mutable_item(sha256_hash const& target
 	, timestamp ts, bool force_fill
 	, entry& item) const
 {
+	auto const p = m_pending->find(target);
+	if (p != m_pending->end())
+	{
+		return fill_mutable_item(p->second.ts, p->second.item, ts, force_fill, item);
+	}
+
 	sqlite3* db = m_observer->get_items_database();
 
 	if (db != NULL && m_select_item_by_target_stmt != NULL)
 	{
 		sqlite3_reset(m_select_item_by_target_stmt);
 
-		sqlite3_bind_text(m_select_item_by_target_stmt, 1
+		sqlite3_bind_blob(m_select_item_by_target_stmt, 1
 			, target.data(), 32, nullptr);
 
 		time_point const start = aux::time_now();
@@ -238,7 +437,6 @@ bool items_db_sqlite::get_mutable_item(sha256_hash const& target
 
 			std::int64_t ts_value = aux::numeric_cast<std::int64_t>(
 				sqlite3_column_int(m_select_item_by_target_stmt, 1));
-            item["ts"] = ts_value;
 
 			const unsigned char* item_ptr = static_cast<const unsigned char*>(
 				sqlite3_column_text(m_select_item_by_target_stmt, 2));
@@ -256,32 +454,11 @@ bool items_db_sqlite::get_mutable_item(sha256_hash const& target
 			}
 #endif
 
-			if (force_fill || (timestamp(0) <= ts && ts < timestamp(ts_value)))
-			{
-				error_code ec;
-				item = bdecode(item_str, ec);
-				// TODO: how to handle decoding error
-				if (ec.value() != 0)
-				{
-					std::string err_msg("get bdecoding error:");
-					err_msg.append(item_str);
-					err_msg.append(" entry:");
-					err_msg.append(item.to_string(true));
-					sql_error(ec.value(), err_msg.c_str());
-
-					// move to the end
-					sqlite3_step(m_select_item_by_target_stmt);
-					return false;
-				}
-
-				std::string get_log_msg("get item:");
-				get_log_msg.append(item.to_string(true));
-				sql_log(0, get_log_msg.c_str());
-			}
+			bool const ret = fill_mutable_item(ts_value, item_str, ts, force_fill, item);
 
 			// move to the end
 			sqlite3_step(m_select_item_by_target_stmt);
-            return true;
+            return ret;
         }
         else
         {
@@ -305,10 +482,103 @@ bool items_db_sqlite::get_mutable_item(sha256_hash const& target
     }
 }
 
+bool items_db_sqlite::fill_mutable_item(std::int64_t const ts_value
+	, std::string const& item_str
+	, timestamp ts, bool force_fill
+	, entry& item) const
+{
+	item["ts"] = ts_value;
+
+	if (force_fill || (timestamp(0) <= ts && ts < timestamp(ts_value)))
+	{
+		error_code ec;
+		item = bdecode(item_str, ec);
+		// TODO: how to handle decoding error
+		if (ec.value() != 0)
+		{
+			std::string err_msg("get bdecoding error:");
+			err_msg.append(item_str);
+			err_msg.append(" entry:");
+			err_msg.append(item.to_string(true));
+			sql_error(ec.value(), err_msg.c_str());
+
+			return false;
+		}
+
+		std::string get_log_msg("get item:");
+		get_log_msg.append(item.to_string(true));
+		sql_log(0, get_log_msg.c_str());
+	}
+
+	return true;
+}
+
 bool items_db_sqlite::get_mutable_item_target(sha256_hash const& prefix
 	, sha256_hash& target) const
 {
-	return false;
+	std::vector<sha256_hash> candidates;
+
+	// items not written yet
+	for (auto it = m_pending->upper_bound(prefix);
+		it != m_pending->end()
+			&& std::memcmp(prefix.data(), it->first.data(), target_prefix_size) == 0;
+		++it)
+	{
+		candidates.push_back(it->first);
+	}
+
+	sqlite3* db = m_observer->get_items_database();
+
+	if (db != NULL && m_select_targets_in_range_stmt != NULL)
+	{
+		// as dht_default_storage, the targets above the prefix which start
+		// with it. That is a range of the primary key
+		std::string const upper = prefix_upper_bound(prefix);
+
+		sqlite3_reset(m_select_targets_in_range_stmt);
+
+		sqlite3_bind_blob(m_select_targets_in_range_stmt, 1
+			, prefix.data(), 32, nullptr);
+		sqlite3_bind_blob(m_select_targets_in_range_stmt, 2
+			, upper.data(), aux::numeric_cast<int>(upper.size()), nullptr);
+
+		time_point const start = aux::time_now();
+		int ok;
+		while ((ok = sqlite3_step(m_select_targets_in_range_stmt)) == SQLITE_ROW)
+		{
+			if (sqlite3_column_bytes(m_select_targets_in_range_stmt, 0) != 32) continue;
+
+			sha256_hash const t(static_cast<char const*>(
+				sqlite3_column_blob(m_select_targets_in_range_stmt, 0)));
+			if (m_pending->find(t) == m_pending->end()) candidates.push_back(t);
+		}
+		int const cost = aux::numeric_cast<int>(total_microseconds(aux::time_now() - start));
+		sql_time_cost(cost, "select targets by prefix");
+
+		if (ok != SQLITE_DONE)
+		{
+			std::string err_msg("select targets by prefix error:");
+			err_msg.append(aux::to_hex(prefix));
+			sql_error(ok, err_msg.c_str());
+		}
+	}
+	else
+	{
+#ifndef TORRENT_DISABLE_LOGGING
+		if (m_observer->should_log(dht_logger::items_db, aux::LOG_ERR))
+		{
+			m_observer->log(dht_logger::items_db, "get target by prefix: sqlite databse is invalid");
+		}
+#endif
+	}
+
+	if (candidates.empty()) return false;
+
+	// randomly select a item target
+	std::uint32_t const r = aux::random(std::uint32_t(candidates.size() - 1));
+	target = candidates[r];
+
+	return true;
 }
 
 void items_db_sqlite::put_mutable_item(sha256_hash const& target
@@ -320,8 +590,9 @@ void items_db_sqlite::put_mutable_item(sha256_hash const& target
 	, address const& addr)
 {
 	sqlite3* db = m_observer->get_items_database();
+	aux::storage_executor* executor = m_observer->get_storage_executor();
 
-	if (db != NULL && m_insert_or_replace_items_stmt != NULL)
+	if (db != NULL && (executor != nullptr || m_insert_or_replace_items_stmt != NULL))
 	{
 		entry e;
 		error_code ec;
@@ -345,30 +616,43 @@ void items_db_sqlite::put_mutable_item(sha256_hash const& target
 		m_mutable_item.clear();
 		bencode(std::back_inserter(m_mutable_item), e);
 
-		sqlite3_reset(m_insert_or_replace_items_stmt);
-
-		sqlite3_bind_text(m_insert_or_replace_items_stmt, 1
-			, target.data(), 32, nullptr);
-		sqlite3_bind_int(m_insert_or_replace_items_stmt, 2, aux::numeric_cast<int>(ts.value));
-		sqlite3_bind_text(m_insert_or_replace_items_stmt, 3
-			, m_mutable_item.data(), m_mutable_item.size(), SQLITE_STATIC);
+		if (executor != nullptr)
+		{
+			// the write happens on the storage thread, until it completes
+			// the item is served from the pending map
+			std::uint32_t const seq = ++m_pending_seq;
+			(*m_pending)[target] = pending_item{ts.value, m_mutable_item, seq};
+
+			std::weak_ptr<pending_items> pending = m_pending;
+			bool const queued = executor->async_call<int>(aux::storage_subsystem::dht
+				, [w = m_writer, target, ts = ts.value, item = m_mutable_item](sqlite3* edb)
+				{
+					int const ok = w->prepare(edb);
+					if (ok != SQLITE_OK) return ok;
+					return step_insert_item(w->insert_or_replace_items, target, ts, item);
+				}
+				, [this, pending, target, seq](int ok)
+				{
+					auto p = pending.lock();
+					// this items db has been destructed
+					if (!p) return;
+
+					auto const it = p->find(target);
+					if (it != p->end() && it->second.seq == seq) p->erase(it);
+					on_put_done(ok, target);
+				});
+			if (queued) return;
+
+			// the executor is stopping, write on this connection instead
+			m_pending->erase(target);
+			if (m_insert_or_replace_items_stmt == NULL) return;
+		}
 
 		time_point const start = aux::time_now();
-		int ok = sqlite3_step(m_insert_or_replace_items_stmt);
+		int ok = step_insert_item(m_insert_or_replace_items_stmt, target, ts.value, m_mutable_item);
 		int const cost = aux::numeric_cast<int>(total_microseconds(aux::time_now() - start));
-		if (ok == SQLITE_DONE)
-		{
-			sql_time_cost(cost, "put item");
-			std::string log_msg("insert or update successfully:");
-			log_msg.append(e.to_string(true));
-			sql_log(ok, log_msg.c_str());
-		}
-		else
-		{
-			std::string err_msg("insert or update error:");
-			err_msg.append(e.to_string(true));
-			sql_error(ok, err_msg.c_str());
-		}
+		sql_time_cost(cost, "put item");
+		on_put_done(ok, target);
 	}
 	else
 	{
@@ -381,6 +665,22 @@ void items_db_sqlite::put_mutable_item(sha256_hash const& target
 	}
 }
 
+void items_db_sqlite::on_put_done(int const ok, sha256_hash const& target) const
+{
+	if (ok == SQLITE_DONE)
+	{
+		std::string log_msg("insert or update successfully:");
+		log_msg.append(aux::to_hex(target));
+		sql_log(ok, log_msg.c_str());
+	}
+	else
+	{
+		std::string err_msg("insert or update error:");
+		err_msg.append(aux::to_hex(target));
+		sql_error(ok, err_msg.c_str());
+	}
+}
+
 void items_db_sqlite::remove_mutable_item(sha256_hash const& target)
 {
 }
@@ -392,97 +692,39 @@ void items_db_sqlite::tick()
 	if (m_last_refresh + seconds(refresh_period) > now) return;
 	m_last_refresh = now;
 
-	int max = m_settings.get_int(settings_pack::dht_items_db_max_count);
-	int count = 0;
+	int const max = m_settings.get_int(settings_pack::dht_items_db_max_count);
 
 	sqlite3* db = m_observer->get_items_database();
+	aux::storage_executor* executor = m_observer->get_storage_executor();
 
-	if (db != NULL && m_items_count_stmt != NULL
-		&& m_delete_items_stmt != NULL && m_select_ts_threshold_stmt != NULL)
+	if (db != NULL && executor != nullptr)
 	{
-		sqlite3_reset(m_items_count_stmt);
-
-		time_point const start = aux::time_now();
-		int ok = sqlite3_step(m_items_count_stmt);
-		int const cost = aux::numeric_cast<int>(total_microseconds(aux::time_now() - start));
-		if (ok == SQLITE_ROW)
-		{
-			sql_time_cost(cost, "count:");
-
-            count = sqlite3_column_int(m_items_count_stmt, 0);
-#ifndef TORRENT_DISABLE_LOGGING
-			if (m_observer->should_log(dht_logger::items_db, aux::LOG_INFO))
+		// counting and deleting scan the ts index, keep it off the
+		// network thread
+		std::weak_ptr<pending_items> pending = m_pending;
+		executor->async_call<prune_result>(aux::storage_subsystem::dht
+			, [w = m_writer, max](sqlite3* edb)
 			{
-				m_observer->log(dht_logger::items_db, "items count:%d, max:%d"
-					, count, max);
+				int const ok = w->prepare(edb);
+				if (ok != SQLITE_OK) return prune_result{ok, 0, 0};
+				return prune_items(w->items_count, w->select_ts_threshold
+					, w->delete_items, max);
 			}
-#endif
-
-			// move to the end
-			sqlite3_step(m_items_count_stmt);
-        }
-		else
-		{
-			sql_error(ok, items_count.c_str());
-			return;
-		}
-
-		if (count > max)
-		{
-			int timestamp = 0;
-
-			sqlite3_reset(m_select_ts_threshold_stmt);
-			sqlite3_bind_int(m_select_ts_threshold_stmt, 1, count - max - 1);
-
-			time_point const start1 = aux::time_now();
-			ok = sqlite3_step(m_select_ts_threshold_stmt);
-			int const cost1 = aux::numeric_cast<int>(total_microseconds(aux::time_now() - start1));
-			if (ok == SQLITE_ROW)
-			{
-				sql_time_cost(cost1, "timestamp threshold:");
-				timestamp = sqlite3_column_int(m_select_ts_threshold_stmt, 0);
-
-#ifndef TORRENT_DISABLE_LOGGING
-				if (m_observer->should_log(dht_logger::items_db, aux::LOG_DEBUG))
-				{
-					m_observer->log(dht_logger::items_db, "timestamp threshold:%d"
-						, timestamp);
-				}
-#endif
-
-				// move to the end
-				sqlite3_step(m_select_ts_threshold_stmt);
-			}
-			else
+			, [this, pending](prune_result r)
 			{
-				sql_error(ok, select_ts_threshold.c_str());
-				return;
-			}
-
-			sqlite3_reset(m_delete_items_stmt);
-			sqlite3_bind_int(m_delete_items_stmt, 1, timestamp);
-
-			time_point const start2 = aux::time_now();
-			ok = sqlite3_step(m_delete_items_stmt);
-			int const cost2 = aux::numeric_cast<int>(total_microseconds(aux::time_now() - start2));
-			if (ok == SQLITE_DONE)
-			{
-				this->sql_time_cost(cost2, "delete:");
-
-#ifndef TORRENT_DISABLE_LOGGING
-				if (m_observer->should_log(dht_logger::items_db, aux::LOG_INFO))
-				{
-					m_observer->log(dht_logger::items_db, "delete %d items successfully"
-						, count - max);
-				}
-#endif
-			}
-			else
-			{
-				sql_error(ok, delete_items.c_str());
-				return;
-			}
-		}
+				if (pending.expired()) return;
+				on_tick_done(r.ok, r.count, r.deleted);
+			});
+	}
+	else if (db != NULL && m_items_count_stmt != NULL
+		&& m_delete_items_stmt != NULL && m_select_ts_threshold_stmt != NULL)
+	{
+		time_point const start = aux::time_now();
+		prune_result const r = prune_items(m_items_count_stmt
+			, m_select_ts_threshold_stmt, m_delete_items_stmt, max);
+		int const cost = aux::numeric_cast<int>(total_microseconds(aux::time_now() - start));
+		sql_time_cost(cost, "prune:");
+		on_tick_done(r.ok, r.count, r.deleted);
 	}
 	else
 	{
@@ -495,14 +737,42 @@ void items_db_sqlite::tick()
 	}
 }
 
+void items_db_sqlite::on_tick_done(int const ok, int const count, int const deleted) const
+{
+	if (ok != SQLITE_DONE)
+	{
+		sql_error(ok, "prune items");
+		return;
+	}
+
+#ifndef TORRENT_DISABLE_LOGGING
+	if (m_observer->should_log(dht_logger::items_db, aux::LOG_INFO))
+	{
+		m_observer->log(dht_logger::items_db, "items count:%d, max:%d, delete %d items successfully"
+			, count, m_settings.get_int(settings_pack::dht_items_db_max_count), deleted);
+	}
+#endif
+}
+
 void items_db_sqlite::close()
 {
 	if (m_select_ts_by_target_stmt != NULL) sqlite3_finalize(m_select_ts_by_target_stmt);
 	if (m_select_item_by_target_stmt != NULL) sqlite3_finalize(m_select_item_by_target_stmt);
+	if (m_select_targets_in_range_stmt != NULL) sqlite3_finalize(m_select_targets_in_range_stmt);
 	if (m_insert_or_replace_items_stmt != NULL) sqlite3_finalize(m_insert_or_replace_items_stmt);
 	if (m_items_count_stmt != NULL) sqlite3_finalize(m_items_count_stmt);
 	if (m_delete_items_stmt != NULL) sqlite3_finalize(m_delete_items_stmt);
 	if (m_select_ts_threshold_stmt != NULL) sqlite3_finalize(m_select_ts_threshold_stmt);
+
+	// the writer statements belong to the executor connection, finalize
+	// them on the storage thread, after any queued write. If the executor
+	// has stopped, its thread no longer uses them, finalize them here
+	aux::storage_executor* executor = m_observer->get_storage_executor();
+	if (executor == nullptr || !executor->post(aux::storage_subsystem::dht
+		, [w = m_writer](sqlite3*) { w->finalize(); }))
+	{
+		m_writer->finalize();
+	}
 }
 
 void items_db_sqlite::sql_error(int err_code, const char* err_str) const
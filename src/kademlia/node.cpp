@@ -748,6 +748,33 @@ void node::get_item(public_key const& pk, std::string const& salt
 	ta->start();
 }
 
+void node::get_item(public_key const& pk, std::string const& salt
+	, std::int64_t timestamp, std::vector<node_entry> const& eps
+	, std::function<void(item const&, bool)> f)
+{
+#ifndef TORRENT_DISABLE_LOGGING
+	if (m_observer != nullptr && m_observer->should_log(dht_logger::node, aux::LOG_INFO))
+	{
+		char hex_key[65];
+		char hex_salt[129]; // 64*2 + 1
+		aux::to_hex(pk.bytes, hex_key);
+		aux::to_hex(salt, hex_salt);
+		m_observer->log(dht_logger::node, "starting get for [k:%s, s:%s, target endpoints:%" PRId64 "]"
+			, hex_key, hex_salt, eps.size());
+	}
+#endif
+
+	auto ta = std::make_shared<dht::get_item>(*this, pk, salt, std::move(f)
+		, find_data::nodes_callback());
+	ta->set_timestamp(timestamp);
+	// set target endpoints instead of depth traversal
+	ta->set_direct_endpoints(eps);
+	// invoke as soon as possible
+	ta->set_invoke_window(int(eps.size()));
+	ta->set_invoke_limit(int(eps.size()));
+	ta->start();
+}
+
 namespace {
 
 void put(std::vector<std::pair<node_entry, std::string>> const& nodes
@@ -988,6 +1015,39 @@ void node::put_item(public_key const& pk
 	put_ta->start();
 }
 
+void node::put_item(public_key const& pk
+	, std::string const& salt
+	, entry const& data
+	, std::vector<node_entry> const& eps
+	, std::function<void(item const&, int)> f)
+{
+#ifndef TORRENT_DISABLE_LOGGING
+	if (m_observer != nullptr && m_observer->should_log(dht_logger::node, aux::LOG_INFO))
+	{
+		char hex_key[65];
+		char hex_salt[129]; // 64*2 + 1
+		aux::to_hex(pk.bytes, hex_key);
+		aux::to_hex(salt, hex_salt);
+		m_observer->log(dht_logger::node
+			, "starting put for [ key: %s, salt:%s, target endpoints:%" PRId64 " ]"
+			, hex_key, hex_salt, eps.size());
+	}
+#endif
+
+	item i(pk, salt);
+	construct_mutable_item(i, data, salt
+		, m_account_manager->pub_key(), m_account_manager->priv_key());
+
+	auto put_ta = std::make_shared<dht::put_data>(*this, item_target_id(salt, pk), f);
+	put_ta->set_data(std::move(i));
+	// set target endpoints instead of depth traversal
+	put_ta->set_direct_endpoints(eps);
+	put_ta->set_invoke_window(int(eps.size()));
+	put_ta->set_invoke_limit(int(eps.size()));
+
+	put_ta->start();
+}
+
 void node::send(public_key const& to
 	, entry const& payload
 	, std::int8_t alpha
@@ -1147,6 +1207,22 @@ void node::get_peers(public_key const& pk, std::string const& salt)
 	ta->start();
 }
 
+void node::find_nodes(node_id const& target, find_data::nodes_callback f)
+{
+#ifndef TORRENT_DISABLE_LOGGING
+	if (m_observer != nullptr && m_observer->should_log(dht_logger::node, aux::LOG_INFO))
+	{
+		m_observer->log(dht_logger::node, "starting find nodes for [ hash: %s ]"
+			, aux::to_hex(target).c_str());
+	}
+#endif
+
+	auto ta = std::make_shared<dht::get_peers>(*this, target
+		, get_peers::data_callback(), std::move(f), false);
+	ta->set_fixed_distance(256);
+	ta->start();
+}
+
 void node::find_live_nodes(node_id const& id
 	, std::vector<node_entry>& l
 	, int count)
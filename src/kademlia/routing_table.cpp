@@ -21,6 +21,7 @@ see LICENSE file.
 #include <cstdio> // for snprintf
 #include <cinttypes> // for PRId64 et.al.
 #include <cstdint>
+#include <cstring> // for memcpy
 
 #include "libTAU/config.hpp"
 
@@ -88,6 +89,40 @@ void ip_set::erase(address const& addr)
 	}
 }
 
+std::size_t endpoint_hash::operator()(udp::endpoint const& ep) const
+{
+	std::size_t ret = std::hash<std::uint16_t>()(ep.port());
+	if (ep.address().is_v6())
+	{
+		auto const b = ep.address().to_v6().to_bytes();
+		std::uint64_t half[2];
+		std::memcpy(half, b.data(), sizeof(half));
+		ret ^= std::hash<std::uint64_t>()(half[0] ^ (half[1] * 0x9e3779b97f4a7c15ULL));
+	}
+	else
+	{
+		ret ^= std::hash<std::uint32_t>()(ep.address().to_v4().to_uint()) * 31;
+	}
+	return ret;
+}
+
+void endpoint_index::insert(udp::endpoint const& ep, node_location const& l)
+{
+	m_nodes.emplace(ep, l);
+}
+
+void endpoint_index::erase(udp::endpoint const& ep, int const bucket, bool const live)
+{
+	auto const range = m_nodes.equal_range(ep);
+	for (auto i = range.first; i != range.second; ++i)
+	{
+		if (i->second.bucket != bucket || i->second.live != live) continue;
+		m_nodes.erase(i);
+		return;
+	}
+	TORRENT_ASSERT_FAIL();
+}
+
 bool mostly_verified_nodes(bucket_t const& b)
 {
 	int const num_verified = static_cast<int>(std::count_if(b.begin(), b.end()
@@ -131,8 +166,8 @@ std::uint8_t classify_prefix(int const bucket_idx, bool const last_bucket
 }
 
 routing_table::add_node_status_t replace_node_impl(node_entry const& e
-	, bucket_t& b, ip_set& ips, int const bucket_index
-	, int const bucket_size_limit, bool const last_bucket
+	, bucket_t& b, ip_set& ips, endpoint_index& endpoints, int const bucket_index
+	, bool const live, int const bucket_size_limit, bool const last_bucket
 #ifndef TORRENT_DISABLE_LOGGING
 	, dht_logger* log
 #endif
@@ -162,7 +197,9 @@ routing_table::add_node_status_t replace_node_impl(node_entry const& e
 		, log
 #endif
 		);
+		endpoints.erase(j->ep(), bucket_index, live);
 		*j = e;
+		endpoints.insert(e.ep(), {bucket_index, live, int(j - b.begin())});
 		print_ipset("replace_node insert before, l:171", e.addr(), ips
 #ifndef TORRENT_DISABLE_LOGGING
 		, log
@@ -258,7 +295,9 @@ routing_table::add_node_status_t replace_node_impl(node_entry const& e
 		, log
 #endif
 		);
+		endpoints.erase(j->ep(), bucket_index, live);
 		*j = e;
+		endpoints.insert(e.ep(), {bucket_index, live, int(j - b.begin())});
 		print_ipset("replace_node insert before, l:267", e.addr(), ips
 #ifndef TORRENT_DISABLE_LOGGING
 		, log
@@ -488,25 +527,74 @@ bool compare_ip_cidr(address const& lhs, address const& rhs)
 std::tuple<node_entry*, routing_table::table_t::iterator, bucket_t*>
 routing_table::find_node(udp::endpoint const& ep)
 {
-	for (auto i = m_buckets.begin() , end(m_buckets.end()); i != end; ++i)
+	auto const range = m_endpoints.m_nodes.equal_range(ep);
+	for (auto k = range.first; k != range.second; ++k)
 	{
-		for (auto j = i->replacements.begin(); j != i->replacements.end(); ++j)
+		node_location& l = k->second;
+		TORRENT_ASSERT(l.bucket < int(m_buckets.size()));
+		auto const i = m_buckets.begin() + l.bucket;
+		bucket_t& b = l.live ? i->live_nodes : i->replacements;
+
+		// erasing moves nodes toward the front of the bucket, look there
+		// first
+		int const size = int(b.size());
+		for (int j = std::min(l.slot, size - 1); j >= 0; --j)
 		{
-			if (j->addr() != ep.address()) continue;
-			if (j->port() != ep.port()) continue;
-			return std::make_tuple(&*j, i, &i->replacements);
+			if (b[j].ep() != ep) continue;
+			l.slot = j;
+			return std::make_tuple(&b[j], i, &b);
 		}
-		for (auto j = i->live_nodes.begin(); j != i->live_nodes.end(); ++j)
+		for (int j = l.slot + 1; j < size; ++j)
 		{
-			if (j->addr() != ep.address()) continue;
-			if (j->port() != ep.port()) continue;
-			return std::make_tuple(&*j, i, &i->live_nodes);
+			if (b[j].ep() != ep) continue;
+			l.slot = j;
+			return std::make_tuple(&b[j], i, &b);
 		}
+		TORRENT_ASSERT_FAIL();
 	}
 	return std::tuple<node_entry*, routing_table::table_t::iterator, bucket_t*>
 	{nullptr, m_buckets.end(), nullptr};
 }
 
+bool routing_table::endpoint_index_consistent() const
+{
+	using location = std::tuple<udp::endpoint, int, bool>;
+	std::vector<location> nodes;
+	for (int i = 0; i < int(m_buckets.size()); ++i)
+	{
+		for (auto const& j : m_buckets[i].live_nodes)
+			nodes.emplace_back(j.ep(), i, true);
+		for (auto const& j : m_buckets[i].replacements)
+			nodes.emplace_back(j.ep(), i, false);
+	}
+
+	std::vector<location> indexed;
+	for (auto const& n : m_endpoints.m_nodes)
+		indexed.emplace_back(n.first, n.second.bucket, n.second.live);
+
+	std::sort(nodes.begin(), nodes.end());
+	std::sort(indexed.begin(), indexed.end());
+	return nodes == indexed;
+}
+
+void routing_table::index_bucket(int const bucket)
+{
+	routing_table_node const& n = m_buckets[bucket];
+	for (int j = 0; j < int(n.live_nodes.size()); ++j)
+		m_endpoints.insert(n.live_nodes[j].ep(), {bucket, true, j});
+	for (int j = 0; j < int(n.replacements.size()); ++j)
+		m_endpoints.insert(n.replacements[j].ep(), {bucket, false, j});
+}
+
+void routing_table::unindex_bucket(int const bucket)
+{
+	routing_table_node const& n = m_buckets[bucket];
+	for (auto const& j : n.live_nodes)
+		m_endpoints.erase(j.ep(), bucket, true);
+	for (auto const& j : n.replacements)
+		m_endpoints.erase(j.ep(), bucket, false);
+}
+
 node_entry* routing_table::find_node(node_id const& nid)
 {
 	if (nid == m_id) return nullptr;
@@ -569,7 +657,8 @@ void routing_table::fill_from_replacements(table_t::iterator bucket)
 {
 	bucket_t& b = bucket->live_nodes;
 	bucket_t& rb = bucket->replacements;
-	int const bucket_size = bucket_limit(int(std::distance(m_buckets.begin(), bucket)));
+	int const bucket_index = int(std::distance(m_buckets.begin(), bucket));
+	int const bucket_size = bucket_limit(bucket_index);
 
 	if (int(b.size()) >= bucket_size) return;
 
@@ -582,6 +671,8 @@ void routing_table::fill_from_replacements(table_t::iterator bucket)
 		auto j = std::find_if(rb.begin(), rb.end(), std::bind(&node_entry::pinged, _1));
 		if (j == rb.end()) break;
 		b.push_back(*j);
+		m_endpoints.erase(j->ep(), bucket_index, false);
+		m_endpoints.insert(j->ep(), {bucket_index, true, int(b.size()) - 1});
 		rb.erase(j);
 	}
 }
@@ -612,6 +703,10 @@ void routing_table::remove_node(node_entry* n, bucket_t* b)
 	, m_log
 #endif
 	);
+	auto const i = std::find_if(m_buckets.begin(), m_buckets.end()
+		, [b](routing_table_node const& rtn) { return &rtn.live_nodes == b || &rtn.replacements == b; });
+	TORRENT_ASSERT(i != m_buckets.end());
+	m_endpoints.erase(n->ep(), int(std::distance(m_buckets.begin(), i)), b == &i->live_nodes);
 	b->erase(b->begin() + idx);
 }
 
@@ -652,6 +747,7 @@ bool routing_table::add_node(node_entry const& e)
 		// bucket, erase it
 		if (m_buckets.back().live_nodes.empty())
 		{
+			unindex_bucket(int(m_buckets.size()) - 1);
 			m_buckets.erase(m_buckets.end() - 1);
 			// we just split, trying to add the node again should not request
 			// another split
@@ -831,7 +927,9 @@ routing_table::add_node_status_t routing_table::add_node_impl(node_entry e)
                 , m_log
 #endif
 			);
+			m_endpoints.erase(j->ep(), bucket_index, true);
 			j->update_endpoint(e.ep());
+			m_endpoints.insert(e.ep(), {bucket_index, true, int(j - b.begin())});
 			print_ipset("live bucket update ep insert before, l:809", e.addr(), m_ips
 #ifndef TORRENT_DISABLE_LOGGING
 				, m_log
@@ -879,7 +977,9 @@ routing_table::add_node_status_t routing_table::add_node_impl(node_entry e)
 				, m_log
 #endif
 			);
+			m_endpoints.erase(j->ep(), bucket_index, false);
 			j->update_endpoint(e.ep());
+			m_endpoints.insert(e.ep(), {bucket_index, false, int(j - rb.begin())});
 			print_ipset("replacements bucket update ep insert before, l:856", e.addr(), m_ips
 #ifndef TORRENT_DISABLE_LOGGING
 				, m_log
@@ -912,6 +1012,7 @@ routing_table::add_node_status_t routing_table::add_node_impl(node_entry e)
 		, m_log
 #endif
 		);
+		m_endpoints.erase(j->ep(), bucket_index, false);
 		rb.erase(j);
 	}
 
@@ -950,6 +1051,7 @@ ip_ok:
 	{
 		if (b.empty()) b.reserve(bucket_size_limit);
 		b.push_back(e);
+		m_endpoints.insert(e.ep(), {bucket_index, true, int(b.size()) - 1});
 		print_ipset("live bucket insert before, l: 926", e.addr(), m_ips
 #ifndef TORRENT_DISABLE_LOGGING
 		, m_log
@@ -991,7 +1093,8 @@ ip_ok:
 
 	if (e.confirmed())
 	{
-		auto const ret = replace_node_impl(e, b, m_ips, bucket_index, bucket_size_limit, last_bucket
+		auto const ret = replace_node_impl(e, b, m_ips, m_endpoints, bucket_index, true
+			, bucket_size_limit, last_bucket
 #ifndef TORRENT_DISABLE_LOGGING
 			, m_log
 #endif
@@ -1029,8 +1132,10 @@ ip_ok:
 			, [] (node_entry const& ne) { return !ne.pinged(); });
 		if (j == rb.end())
 		{
-			auto const ret = replace_node_impl(e, rb, m_ips, bucket_index
-				, m_replace_bucket_size/*m_bucket_size*/, last_bucket
+			// replace_node_impl() classifies the nodes by no more than 128
+			// prefixes
+			auto const ret = replace_node_impl(e, rb, m_ips, m_endpoints, bucket_index
+				, false, std::min(m_replace_bucket_size, 128)/*m_bucket_size*/, last_bucket
 #ifndef TORRENT_DISABLE_LOGGING
 				, nullptr
 #endif
@@ -1048,12 +1153,14 @@ ip_ok:
 		, m_log
 #endif
 		);
+		m_endpoints.erase(j->ep(), bucket_index, false);
 		rb.erase(j);
 	}
 
 	//if (rb.empty()) rb.reserve(m_replace_bucket_size/*m_bucket_size*/);
 	if (rb.empty()) rb.reserve(1024);
 	rb.push_back(e);
+	m_endpoints.insert(e.ep(), {bucket_index, false, int(rb.size()) - 1});
 	print_ipset("replacements bucket insert before, l:1030", e.addr(), m_ips
 #ifndef TORRENT_DISABLE_LOGGING
 	, m_log
@@ -1076,6 +1183,9 @@ void routing_table::split_bucket()
 	int const bucket_size_limit = bucket_limit(bucket_index);
 	TORRENT_ASSERT(int(m_buckets.back().live_nodes.size()) >= bucket_limit(bucket_index + 1));
 
+	// the nodes are moved around, record them again when done
+	unindex_bucket(bucket_index);
+
 	// this is the last bucket, and it's full already. Split
 	// it by adding another bucket
 	m_buckets.push_back(routing_table_node());
@@ -1137,6 +1247,9 @@ void routing_table::split_bucket()
 		}
 		j = rb.erase(j);
 	}
+
+	index_bucket(bucket_index);
+	index_bucket(bucket_index + 1);
 }
 
 void routing_table::update_node_id(node_id const& id)
@@ -1144,6 +1257,7 @@ void routing_table::update_node_id(node_id const& id)
 	m_id = id;
 
 	m_ips.clear();
+	m_endpoints.clear();
 
 	// pull all nodes out of the routing table, effectively emptying it
 	table_t old_buckets;
@@ -1201,6 +1315,7 @@ void routing_table::node_failed(node_id const& nid, udp::endpoint const& ep)
 	auto const i = find_bucket(nid);
 	bucket_t& b = i->live_nodes;
 	bucket_t& rb = i->replacements;
+	int const bucket_index = int(std::distance(m_buckets.begin(), i));
 
 	auto j = std::find_if(b.begin(), b.end()
 		, [&nid](node_entry const& ne) { return ne.id == nid; });
@@ -1259,6 +1374,7 @@ void routing_table::node_failed(node_id const& nid, udp::endpoint const& ep)
 			, m_log
 #endif
 			);
+			m_endpoints.erase(j->ep(), bucket_index, true);
 			b.erase(j);
 		}
 		return;
@@ -1275,6 +1391,7 @@ void routing_table::node_failed(node_id const& nid, udp::endpoint const& ep)
 	, m_log
 #endif
 	);
+	m_endpoints.erase(j->ep(), bucket_index, true);
 	b.erase(j);
 
 	fill_from_replacements(i);
@@ -1421,6 +1538,7 @@ void routing_table::check_invariant() const
 	}
 
 	TORRENT_ASSERT(all_ips == m_ips);
+	TORRENT_ASSERT(endpoint_index_consistent());
 }
 #endif
 
@@ -58,6 +58,13 @@ namespace libTAU {
 
 	constexpr reopen_network_flags_t session_handle::reopen_map_ports;
 
+namespace {
+
+	// how long a query waits for a reader connection before it is queued
+	// onto the network thread instead
+	constexpr time_duration repository_reader_wait = milliseconds(50);
+}
+
 	template <typename Fun, typename... Args>
 	void session_handle::async_call(Fun f, Args&&... a) const
 	{
@@ -329,6 +336,18 @@ namespace libTAU {
 		return sync_call_ret<bool>(&session_impl::add_new_message, msg);
 	}
 
+	communication::message_page session_handle::get_message_page(const dht::public_key& peer
+		, communication::message_cursor cursor, int limit)
+	{
+		return sync_call_ret<communication::message_page>(&session_impl::get_message_page, peer, cursor, limit);
+	}
+
+	std::vector<communication::message_match> session_handle::search_messages(std::string query, int limit
+		, communication::message_search_order order)
+	{
+		return sync_call_ret<std::vector<communication::message_match>>(&session_impl::search_messages, query, limit, order);
+	}
+
 	std::vector<char> session_handle::create_chain_id(std::vector<char> type, std::vector<char> community_name)
 	{
 		std::string name;
@@ -387,9 +406,17 @@ namespace libTAU {
 		return sync_call_ret<bool>(&session_impl::submit_news_transaction, tx, picSlices);
 	}
 
-	// get account info
+	// get account info. Served by a reader connection, which does not see
+	// a block transaction still open on the network thread. Queued onto the
+	// network thread if no reader is free in time
     blockchain::account session_handle::get_account_info(std::vector<char> chain_id, dht::public_key pub_key)
 	{
+		std::shared_ptr<session_impl> s = m_impl.lock();
+		if (s) {
+			auto r = s->repository_readers().acquire(repository_reader_wait);
+			if (r) return r->get_account(chain_id, pub_key);
+		}
+
 		blockchain::account act;
 		sync_call(&session_impl::get_account_info, chain_id, pub_key, &act);
 		return act;
@@ -398,6 +425,9 @@ namespace libTAU {
 	// get top and tip blocks
     std::vector<blockchain::block> session_handle::get_top_tip_block(std::vector<char> chain_id, int num)
 	{
+		// not served by the reader pool: the chain must be followed and
+		// connected, and the head is the one blockchain holds in memory,
+		// which may not be committed yet
 		std::vector<blockchain::block> blks;
 		sync_call(&session_impl::get_top_tip_block, chain_id, num, &blks);
 		return blks;
@@ -453,9 +483,15 @@ namespace libTAU {
 		return sync_call(&session_impl::unset_priority_chain);
 	}
 
-	// get block by number
+	// get block by number, read like get_account_info()
     blockchain::block session_handle::get_block_by_number(std::vector<char> chain_id, std::int64_t block_number)
 	{
+		std::shared_ptr<session_impl> s = m_impl.lock();
+		if (s) {
+			auto r = s->repository_readers().acquire(repository_reader_wait);
+			if (r) return r->get_main_chain_block_by_number(chain_id, block_number);
+		}
+
 		return sync_call_ret<blockchain::block>(&session_impl::get_block_by_number, chain_id, block_number);
 	}
 
@@ -507,6 +543,17 @@ namespace libTAU {
 		return sync_call_ret<bool>(&session_impl::touch_chain, chain_id);
 	}
 
+	// chain retention
+    void session_handle::set_chain_retention(std::vector<char> chain_id, int epochs)
+	{
+		async_call(&session_impl::set_chain_retention, chain_id, epochs);
+	}
+
+    void session_handle::vacuum_sqldb()
+	{
+		async_call(&session_impl::vacuum_sqldb);
+	}
+
 	// get current time
 	std::int64_t session_handle::get_session_time()
 	{
@@ -168,6 +168,19 @@ namespace boost {
 
 namespace libTAU::aux {
 
+namespace {
+	// STATE of the row of tsqldb_vacuum after vacuum_sqldb() failed to
+	// convert the session database. The table is ours, user_version of the
+	// database file is left alone
+	constexpr int sqldb_vacuum_failed = 1;
+
+	// how long (ms) a write on the network thread waits for the storage
+	// executor to release the write lock. A long executor job, such as the
+	// VACUUM of vacuum_sqldb(), fails the write instead of stalling the
+	// thread
+	constexpr int sqldb_busy_timeout = 100;
+}
+
 #if defined TORRENT_ASIO_DEBUGGING
 	std::map<std::string, async_t> _async_ops;
 	std::deque<wakeup_t> _wakeups;
@@ -469,6 +482,8 @@ void apply_deprecated_dht_settings(settings_pack& sett, bdecode_node const& s)
 		, m_session_time(total_milliseconds(std::chrono::system_clock::now().time_since_epoch()))
 		, m_created(clock_type::now())
 		, m_last_tick(total_milliseconds(std::chrono::system_clock::now().time_since_epoch()))
+		, m_storage_executor(m_io_context, m_stats_counters)
+		, m_repository_readers(m_stats_counters)
 	{
 	}
 
@@ -690,6 +705,10 @@ void apply_deprecated_dht_settings(settings_pack& sett, bdecode_node const& s)
 
     void session_impl::sql_test()
     {
+		// the test tables are written on the session connection, outside of
+		// an open group of block writes
+		if (m_blockchain) m_blockchain->flush_writes();
+
 #ifndef TORRENT_DISABLE_LOGGING
 		if (should_log(aux::LOG_LEVEL::LOG_INFO))
 		{
@@ -938,6 +957,9 @@ void apply_deprecated_dht_settings(settings_pack& sett, bdecode_node const& s)
 		stop_communication();
 		stop_blockchain();
 
+		// flush queued storage jobs before the sqldb is closed
+		m_storage_executor.stop();
+		m_repository_readers.close();
 
 		if(m_kvdb) {
 			delete m_kvdb;
@@ -2837,8 +2859,53 @@ namespace {
 			return;
 		}
 
+		// let blockchain pruning return free pages to the file system. This
+		// only applies to a new database, an older one is converted by
+		// vacuum_sqldb()
+		sqlite3_exec(m_sqldb, "pragma auto_vacuum = INCREMENTAL;", NULL, NULL, NULL);
+#ifndef TORRENT_DISABLE_LOGGING
+		int auto_vacuum = 0;
+		int vacuum_state = 0;
+		sqlite3_stmt* stmt = nullptr;
+		if (sqlite3_prepare_v2(m_sqldb, "pragma auto_vacuum;", -1, &stmt, NULL) == SQLITE_OK
+			&& sqlite3_step(stmt) == SQLITE_ROW) {
+			auto_vacuum = sqlite3_column_int(stmt, 0);
+		}
+		sqlite3_finalize(stmt);
+		// the table is only there once vacuum_sqldb() ran
+		if (sqlite3_prepare_v2(m_sqldb, "SELECT STATE FROM tsqldb_vacuum WHERE ID=0;", -1, &stmt, NULL) == SQLITE_OK
+			&& sqlite3_step(stmt) == SQLITE_ROW) {
+			vacuum_state = sqlite3_column_int(stmt, 0);
+		}
+		sqlite3_finalize(stmt);
+		// 2 is INCREMENTAL
+		if (auto_vacuum != 2) {
+			session_log("sqldb is not incremental auto vacuum%s, see vacuum_sqldb()"
+				, vacuum_state == sqldb_vacuum_failed ? ", the last conversion failed" : "");
+		}
+#endif
+
 		sqlite3_exec(m_sqldb, "pragma journal_mode = WAL;", NULL, NULL, NULL);
 		sqlite3_exec(m_sqldb, "pragma synchronous = normal;", NULL, NULL, NULL);
+		// the storage executor connection may hold the write lock
+		sqlite3_busy_timeout(m_sqldb, sqldb_busy_timeout);
+
+		if (!m_storage_executor.start(sqldb_path)) {
+#ifndef TORRENT_DISABLE_LOGGING
+			session_log("failed to start storage executor, sqldb jobs run on the network thread");
+#endif
+		}
+
+		// readers serve sqlite tables, the leveldb backend has none
+		int const backend = m_settings.get_int(settings_pack::blockchain_repository_backend);
+		int const readers = backend != settings_pack::leveldb_repository
+			? m_settings.get_int(settings_pack::sqldb_reader_connections) : 0;
+		if (readers > 0 && !m_repository_readers.open(sqldb_path, readers
+			, backend == settings_pack::sqlite_shared_repository)) {
+#ifndef TORRENT_DISABLE_LOGGING
+			session_log("failed to open sqldb readers, queries run on the network thread");
+#endif
+		}
     }
 
 	void session_impl::update_dht_bootstrap_nodes()
@@ -3418,6 +3485,24 @@ namespace {
 			return false;
 	}	
 
+	communication::message_page session_impl::get_message_page(const dht::public_key& peer
+		, const communication::message_cursor& cursor, int limit)
+	{
+		if(m_communication)
+			return m_communication->get_message_page(peer, cursor, limit);
+		else
+			return communication::message_page();
+	}
+
+	std::vector<communication::message_match> session_impl::search_messages(const std::string& query, int limit
+		, communication::message_search_order order)
+	{
+		if(m_communication)
+			return m_communication->search_messages(query, limit, order);
+		else
+			return std::vector<communication::message_match>();
+	}
+
 	void session_impl::create_chain_id(const aux::bytes &type, std::string community_name, std::vector<char>* id)
 	{
 		if(m_blockchain)
@@ -3561,6 +3646,48 @@ namespace {
 		return false;
 	}
 
+	void session_impl::set_chain_retention(const aux::bytes &chain_id, int epochs) {
+		if(m_blockchain) {
+			m_blockchain->set_chain_retention(chain_id, epochs);
+		}
+	}
+
+	void session_impl::vacuum_sqldb() {
+		// a full VACUUM takes long on a large database, it runs on the
+		// executor connection, off the network thread. It cannot run inside
+		// a transaction, the session connection may hold a group commit open
+		bool const queued = m_storage_executor.async_call<int>(aux::storage_subsystem::blockchain
+			, [](sqlite3* db) {
+				sqlite3_exec(db, "pragma auto_vacuum = INCREMENTAL;", nullptr, nullptr, nullptr);
+				int rc = sqlite3_exec(db, "VACUUM;", nullptr, nullptr, nullptr);
+				// a busy database is worth another try, e.g. running out
+				// of disk space is not. On a full disk the state may not
+				// be recorded either
+				if (rc != SQLITE_BUSY && rc != SQLITE_LOCKED) {
+					std::string sql = "CREATE TABLE IF NOT EXISTS tsqldb_vacuum(ID INTEGER PRIMARY KEY NOT NULL,STATE INTEGER);"
+						"REPLACE INTO tsqldb_vacuum VALUES(0,";
+					sql.append(std::to_string(rc == SQLITE_OK ? 0 : sqldb_vacuum_failed));
+					sql.append(");");
+					sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr);
+				}
+				return rc;
+			}
+			, [this](int rc) {
+#ifndef TORRENT_DISABLE_LOGGING
+				session_log("sqldb vacuum %s: %s", rc == SQLITE_OK ? "done" : "failed", sqlite3_errstr(rc));
+#else
+				TORRENT_UNUSED(this);
+				TORRENT_UNUSED(rc);
+#endif
+			});
+
+		if (!queued) {
+#ifndef TORRENT_DISABLE_LOGGING
+			session_log("sqldb vacuum skipped, the storage executor is not running");
+#endif
+		}
+	}
+
 	void session_impl::set_priority_chain(const aux::bytes &chain_id) {
         /*
 		if(m_blockchain) {
@@ -4289,6 +4416,11 @@ namespace {
 		return m_sqldb;
 	}
 
+	aux::storage_executor* session_impl::get_storage_executor()
+	{
+		return m_storage_executor.is_running() ? &m_storage_executor : nullptr;
+	}
+
 	void session_impl::set_external_address(
 		tcp::endpoint const& local_endpoint, address const& ip
 		, ip_source_t const source_type, address const& source)
@@ -164,6 +164,50 @@ namespace {
 		// this measure the number of tracker announces currently in the
 		// queue
 		METRIC(tracker, num_queued_tracker_announces)
+
+		// the number of blockchain repository queries served by an
+		// already prepared statement, and the number that had to be
+		// compiled by sqlite first
+		METRIC(blockchain, blockchain_stmt_cache_hits)
+		METRIC(blockchain, blockchain_stmt_cache_misses)
+		METRIC(blockchain, blockchain_group_commits)
+		METRIC(blockchain, blockchain_group_transactions)
+		METRIC(blockchain, blockchain_group_commit_failures)
+		METRIC(blockchain, blockchain_block_cache_hits)
+		METRIC(blockchain, blockchain_block_cache_misses)
+		METRIC(blockchain, blockchain_block_cache_evictions)
+
+		// blocks and kv objects deleted by background pruning, the bytes
+		// returned to the file system by incremental vacuum, and the total
+		// time (in microseconds) spent in prune steps
+		METRIC(blockchain, blockchain_pruned_blocks)
+		METRIC(blockchain, blockchain_pruned_kv_objects)
+		METRIC(blockchain, blockchain_vacuum_bytes)
+		METRIC(blockchain, blockchain_prune_time)
+
+		// the number of jobs run by the storage executor thread, the total
+		// time (in microseconds) they waited in the queue and executed, and
+		// the number of jobs currently queued
+		METRIC(storage, storage_jobs)
+		METRIC(storage, storage_job_queue_time)
+		METRIC(storage, storage_job_exec_time)
+		METRIC(storage, storage_queue_depth)
+		METRIC(blockchain, blockchain_block_cache_size)
+
+		// lookups of a message hash answered by the message filter alone,
+		// and those passed on to the database that found, or did not find,
+		// the message. The false positive rate of the filter is
+		// false_positives / (negatives + false_positives). The number of
+		// hashes in the filter and its size in bytes
+		METRIC(communication, communication_message_filter_negatives)
+		METRIC(communication, communication_message_filter_true_positives)
+		METRIC(communication, communication_message_filter_false_positives)
+		METRIC(communication, communication_message_filter_items)
+		METRIC(communication, communication_message_filter_size)
+		// messages saved without being added to the search index
+		METRIC(communication, communication_message_search_index_failures)
+		// message and friend writes that failed
+		METRIC(communication, communication_message_write_failures)
 		// ... more
 	}});
 #undef METRIC
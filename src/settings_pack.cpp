@@ -198,6 +198,8 @@ namespace libTAU {
 		SET(auto_relay, false, &session_impl::update_auto_relay),
 		SET(enable_communication, true, nullptr),
 		SET(enable_blockchain, true, nullptr),
+		SET(compress_messages, false, nullptr),
+		SET(enable_message_search, false, nullptr),
 	}});
 
 	CONSTEXPR_SETTINGS
@@ -371,6 +373,16 @@ namespace libTAU {
 		SET(reopen_time_interval, 1000, nullptr),
 		SET(max_time_peers_zero, 10000, nullptr),
 		SET(log_level, aux::LOG_LEVEL::LOG_DEBUG, &session_impl::update_log_level),
+		SET(sqldb_reader_connections, 4, nullptr),
+		SET(blockchain_group_commit_transactions, 1, nullptr),
+		SET(blockchain_group_commit_latency, 100, nullptr),
+		SET(blockchain_block_cache_size, 8192, nullptr),
+		SET(blockchain_repository_backend, settings_pack::sqlite_repository, nullptr),
+		SET(blockchain_prune_epochs, 0, nullptr),
+		SET(blockchain_prune_interval, 1000, nullptr),
+		SET(blockchain_prune_batch_size, 128, nullptr),
+		SET(blockchain_vacuum_pages, 256, nullptr),
+		SET(communication_sync_rate, 100, nullptr),
 	}});
 
 #undef SET
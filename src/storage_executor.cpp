@@ -0,0 +1,115 @@
+/*
+
+Copyright (c) 2022, Xianshui Sheng
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include "libTAU/aux_/storage_executor.hpp"
+#include "libTAU/aux_/time.hpp" // for time_now
+
+namespace libTAU {
+namespace aux {
+
+	storage_executor::storage_executor(io_context& ioc, counters& cnt)
+		: m_ioc(ioc)
+		, m_counters(cnt)
+	{}
+
+	storage_executor::~storage_executor()
+	{
+		stop();
+	}
+
+	bool storage_executor::start(std::string const& db_path)
+	{
+		if (m_running) return true;
+
+		// a private cache connection, so that readers on the network thread
+		// connection are not blocked by table locks held by this one
+		int const ok = sqlite3_open_v2(db_path.c_str(), &m_db
+			, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE
+			| SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_PRIVATECACHE, nullptr);
+		if (ok != SQLITE_OK)
+		{
+			sqlite3_close_v2(m_db);
+			m_db = nullptr;
+			return false;
+		}
+
+		sqlite3_exec(m_db, "pragma journal_mode = WAL;", nullptr, nullptr, nullptr);
+		sqlite3_exec(m_db, "pragma synchronous = normal;", nullptr, nullptr, nullptr);
+		// the network thread connection may hold the write lock briefly
+		sqlite3_busy_timeout(m_db, 5000);
+
+		{
+			std::lock_guard<std::mutex> l(m_mutex);
+			m_abort = false;
+		}
+		m_running = true;
+		m_thread = std::thread([this] { thread_fun(); });
+		return true;
+	}
+
+	void storage_executor::stop()
+	{
+		if (!m_running) return;
+
+		{
+			std::lock_guard<std::mutex> l(m_mutex);
+			m_abort = true;
+		}
+		m_cond.notify_all();
+		m_thread.join();
+		m_running = false;
+
+		sqlite3_close_v2(m_db);
+		m_db = nullptr;
+	}
+
+	bool storage_executor::post(storage_subsystem const s
+		, std::function<void(sqlite3*)> job)
+	{
+		{
+			std::lock_guard<std::mutex> l(m_mutex);
+			if (m_abort || !m_running) return false;
+			m_queue.push_back({s, std::move(job), time_now()});
+		}
+		m_counters.inc_stats_counter(counters::storage_queue_depth);
+		m_cond.notify_one();
+		return true;
+	}
+
+	void storage_executor::thread_fun()
+	{
+		std::unique_lock<std::mutex> l(m_mutex);
+		for (;;)
+		{
+			m_cond.wait(l, [this] { return m_abort || !m_queue.empty(); });
+
+			// drain the queue before honoring abort, queued writes must
+			// not be lost on shutdown
+			if (m_queue.empty()) break;
+
+			storage_job j = std::move(m_queue.front());
+			m_queue.pop_front();
+			l.unlock();
+
+			time_point const start = time_now();
+			m_counters.inc_stats_counter(counters::storage_queue_depth, -1);
+			m_counters.inc_stats_counter(counters::storage_job_queue_time
+				, total_microseconds(start - j.queued));
+
+			j.fun(m_db);
+
+			m_counters.inc_stats_counter(counters::storage_job_exec_time
+				, total_microseconds(time_now() - start));
+			m_counters.inc_stats_counter(counters::storage_jobs);
+
+			l.lock();
+		}
+	}
+}
+}
@@ -0,0 +1,125 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include "test.hpp"
+#include "libTAU/bencode.hpp"
+#include "libTAU/hasher.hpp"
+#include "libTAU/kademlia/ed25519.hpp"
+#include "libTAU/blockchain/block.hpp"
+
+#include <string>
+
+using namespace lt;
+using namespace lt::blockchain;
+
+namespace {
+
+struct keys
+{
+	keys() { std::tie(pk, sk) = dht::ed25519_create_keypair(dht::ed25519_create_seed()); }
+	dht::public_key pk;
+	dht::secret_key sk;
+};
+
+block make_block(keys const& k, bool with_tx)
+{
+	aux::bytes chain_id{'c', 'h', 'a', 'i', 'n'};
+	transaction tx;
+	if (with_tx)
+	{
+		std::string note = "note";
+		tx = transaction(chain_id, 1000, k.pk, sha1_hash(), aux::bytes(note.begin(), note.end()));
+		tx.sign(k.pk, k.sk);
+	}
+
+	sha1_hash previous;
+	previous[0] = 1;
+	block b(chain_id, block_version_1, 1000, 7, previous, 100, 200
+		, sha1_hash(), sha1_hash(), sha1_hash(), tx, k.pk);
+	b.sign(k.pk, k.sk);
+	return b;
+}
+
+void check_round_trip(block const& b)
+{
+	TEST_CHECK(!b.empty());
+	TEST_CHECK(b.verify_signature());
+
+	block from_entry(b.get_entry());
+	block from_encode(b.get_encode());
+
+	TEST_CHECK(from_entry.sha1() == b.sha1());
+	TEST_CHECK(from_encode.sha1() == b.sha1());
+	TEST_CHECK(from_entry.get_encode() == b.get_encode());
+	TEST_CHECK(from_encode.get_encode() == b.get_encode());
+	TEST_CHECK(from_entry.verify_signature());
+	TEST_CHECK(from_encode.verify_signature());
+	TEST_EQUAL(from_encode.block_number(), b.block_number());
+	TEST_CHECK(from_encode.tx() == b.tx());
+}
+
+} // anonymous namespace
+
+TORRENT_TEST(block_round_trip)
+{
+	keys k;
+	check_round_trip(make_block(k, false));
+	check_round_trip(make_block(k, true));
+}
+
+TORRENT_TEST(block_tampered_signature)
+{
+	keys k;
+	for (bool with_tx : {false, true})
+	{
+		block b = make_block(k, with_tx);
+		std::string encode = b.get_encode();
+		// the signature is the last string of the list
+		encode[encode.size() - 2] ^= 0x01;
+
+		block tampered(encode);
+		TEST_CHECK(!tampered.empty());
+		TEST_CHECK(!tampered.verify_signature());
+
+		entry e = b.get_entry();
+		std::string& sig = e.list().back().string();
+		sig[0] ^= 0x01;
+		TEST_CHECK(!block(e).verify_signature());
+	}
+}
+
+TORRENT_TEST(block_non_canonical)
+{
+	keys k;
+	block b = make_block(k, true);
+
+	// a timestamp padded with a zero byte still decodes to the same value
+	entry e = b.get_entry();
+	e.list()[2].string().push_back('\0');
+	TEST_EQUAL(e.list()[2].string().size(), 3);
+
+	std::string encode;
+	bencode(std::back_inserter(encode), e);
+
+	// accepted as received: hashed over the received bytes, signed over
+	// the fields
+	for (block const& p : {block(e), block(encode)})
+	{
+		TEST_CHECK(!p.empty());
+		TEST_CHECK(p.get_encode() == encode);
+		TEST_CHECK(p.sha1() == hasher(encode).final());
+		TEST_CHECK(p.sha1() != b.sha1());
+		TEST_EQUAL(p.timestamp(), b.timestamp());
+		TEST_CHECK(p.verify_signature());
+	}
+
+	// malformed
+	TEST_CHECK(block(std::string("le")).empty());
+	TEST_CHECK(block(b.get_encode().substr(1)).empty());
+}
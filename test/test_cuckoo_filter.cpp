@@ -0,0 +1,108 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include "test.hpp"
+#include "libTAU/aux_/cuckoo_filter.hpp"
+#include "libTAU/hasher.hpp"
+#include "libTAU/sha1_hash.hpp"
+
+#include <string>
+#include <vector>
+
+using namespace lt;
+
+namespace {
+
+std::vector<sha1_hash> make_keys(int const num, char const* prefix)
+{
+	std::vector<sha1_hash> ret;
+	for (int i = 0; i < num; ++i)
+	{
+		std::string const s = prefix + std::to_string(i);
+		ret.push_back(hasher(s.c_str(), int(s.size())).final());
+	}
+	return ret;
+}
+
+} // anonymous namespace
+
+TORRENT_TEST(cuckoo_filter_insert_find_erase)
+{
+	aux::cuckoo_filter filter(64);
+	sha1_hash const k1 = hasher("test1", 5).final();
+	sha1_hash const k2 = hasher("test2", 5).final();
+	TEST_CHECK(!filter.find(k1));
+	TEST_CHECK(!filter.find(k2));
+
+	TEST_CHECK(filter.insert(k1));
+	TEST_CHECK(filter.find(k1));
+	TEST_CHECK(!filter.find(k2));
+	TEST_EQUAL(filter.size(), 1);
+
+	// a hash inserted twice stays until erased twice
+	TEST_CHECK(filter.insert(k1));
+	TEST_CHECK(filter.erase(k1));
+	TEST_CHECK(filter.find(k1));
+	TEST_CHECK(filter.erase(k1));
+	TEST_CHECK(!filter.find(k1));
+	TEST_CHECK(!filter.erase(k1));
+	TEST_EQUAL(filter.size(), 0);
+}
+
+TORRENT_TEST(cuckoo_filter_no_capacity)
+{
+	// without capacity every hash may be present
+	aux::cuckoo_filter filter;
+	sha1_hash const k = hasher("test1", 5).final();
+	TEST_CHECK(filter.find(k));
+	TEST_CHECK(filter.insert(k));
+	TEST_EQUAL(filter.memory(), 0);
+}
+
+TORRENT_TEST(cuckoo_filter_no_false_negatives)
+{
+	auto const keys = make_keys(10000, "key");
+	aux::cuckoo_filter filter(20000);
+	for (auto const& k : keys) TEST_CHECK(filter.insert(k));
+	for (auto const& k : keys) TEST_CHECK(filter.find(k));
+
+	// erasing half the hashes keeps the other half
+	for (std::size_t i = 0; i < keys.size(); i += 2) TEST_CHECK(filter.erase(keys[i]));
+	for (std::size_t i = 1; i < keys.size(); i += 2) TEST_CHECK(filter.find(keys[i]));
+	TEST_EQUAL(filter.size(), 5000);
+}
+
+TORRENT_TEST(cuckoo_filter_false_positives)
+{
+	aux::cuckoo_filter filter(20000);
+	for (auto const& k : make_keys(10000, "key")) filter.insert(k);
+
+	int false_positives = 0;
+	for (auto const& k : make_keys(100000, "other")) false_positives += filter.find(k);
+	// about 1 in 8000 expected
+	TEST_CHECK(false_positives < 100);
+}
+
+TORRENT_TEST(cuckoo_filter_full)
+{
+	auto const keys = make_keys(2000, "key");
+	aux::cuckoo_filter filter(1024);
+	std::vector<sha1_hash> inserted;
+	for (auto const& k : keys)
+	{
+		if (!filter.insert(k)) break;
+		inserted.push_back(k);
+	}
+	TEST_CHECK(inserted.size() < keys.size());
+	TEST_CHECK(inserted.size() > 900);
+	TEST_EQUAL(filter.size(), inserted.size());
+
+	// a failed insert does not lose any hash inserted before
+	for (auto const& k : inserted) TEST_CHECK(filter.find(k));
+}
@@ -3134,6 +3134,62 @@ TORRENT_TEST(routing_table_for_each)
 	TEST_EQUAL(v.size(), 8);
 }
 
+TORRENT_TEST(routing_table_endpoint_index)
+{
+	auto sett = test_settings();
+	obs observer;
+
+	sett.set_bool(settings_pack::dht_extended_routing_table, false);
+	sett.set_bool(settings_pack::dht_prefer_verified_node_ids, false);
+	node_id id = to_hash("1234876923549721020394873245098347598635");
+
+	routing_table tbl(id, udp::v4(), 8, sett, &observer);
+
+	// nodes come, fail, change endpoint and change ID. The index must follow
+	// them within and between the live and replacement lists
+	std::vector<std::pair<node_id, udp::endpoint>> nodes;
+	for (int i = 0; i < 2000; ++i)
+	{
+		int const action = int(aux::random(9));
+		if (nodes.empty() || action < 4)
+		{
+			nodes.emplace_back(generate_random_id(), rand_udp_ep());
+			if (action % 2 == 0) tbl.heard_about(nodes.back().first, nodes.back().second);
+			else tbl.node_seen(nodes.back().first, nodes.back().second, 20 + action, false);
+			continue;
+		}
+
+		auto& n = nodes[aux::random(std::uint32_t(nodes.size() - 1))];
+		if (action < 6) tbl.node_failed(n.first, n.second);
+		else if (action == 6)
+		{
+			n.second = rand_udp_ep();
+			tbl.node_seen(n.first, n.second, 10, false);
+		}
+		else if (action == 7)
+		{
+			n.first = generate_random_id();
+			tbl.node_seen(n.first, n.second, 10, false);
+		}
+		else tbl.remove_node(n.first);
+
+		if (i % 100 == 0) TEST_CHECK(tbl.endpoint_index_consistent());
+	}
+	TEST_CHECK(tbl.endpoint_index_consistent());
+
+	int found = 0;
+	tbl.for_each_node([&](node_entry const& e)
+	{
+		node_entry const* n = std::get<0>(tbl.find_node(e.ep()));
+		TEST_CHECK(n != nullptr && n->ep() == e.ep());
+		++found;
+	});
+	TEST_CHECK(found > 0);
+
+	tbl.update_node_id(generate_random_id());
+	TEST_CHECK(tbl.endpoint_index_consistent());
+}
+
 TORRENT_TEST(node_set_id)
 {
 	dht_test_setup t(udp::endpoint(rand_v4(), 20));
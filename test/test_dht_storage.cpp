@@ -25,7 +25,12 @@ see LICENSE file.
 #include "libTAU/kademlia/routing_table.hpp"
 #include "libTAU/kademlia/item.hpp"
 #include "libTAU/kademlia/dht_observer.hpp"
+#include "libTAU/kademlia/items_db_sqlite.hpp"
+#include "libTAU/aux_/storage_executor.hpp"
 
+#include <sqlite3.h>
+
+#include <cstdio>
 #include <numeric>
 
 #include "test.hpp"
@@ -66,6 +71,120 @@ namespace
 
 		return s;
 	}
+
+	// items_db_sqlite only asks the observer for its database and storage
+	// executor. Without a running executor, items are written on the
+	// calling thread
+	struct items_observer final : dht_observer
+	{
+		explicit items_observer(sqlite3* db, aux::storage_executor* executor = nullptr)
+			: m_db(db), m_executor(executor) {}
+
+#ifndef TORRENT_DISABLE_LOGGING
+		bool should_log(module_t) const override { return false; }
+		bool should_log(module_t, aux::LOG_LEVEL) const override { return false; }
+		void log(module_t, char const*, ...) override {}
+		void log_packet(message_direction_t, span<char const>
+			, udp::endpoint const&) override {}
+#endif
+		void set_external_address(aux::listen_socket_handle const&
+			, address const&, address const&) override {}
+		int get_listen_port(aux::transport, aux::listen_socket_handle const&) override { return 0; }
+		void get_peers(sha256_hash const&) override {}
+		void outgoing_get_peers(sha256_hash const&, sha256_hash const&
+			, udp::endpoint const&) override {}
+		void announce(sha256_hash const&, address const&, int) override {}
+		bool on_dht_request(string_view, msg const&, entry&) override { return false; }
+		void on_dht_item(item&) override {}
+		std::int64_t get_time() override { return 0; }
+		void on_dht_relay(public_key const&, entry const&) override {}
+		sqlite3* get_items_database() override { return m_db; }
+		aux::storage_executor* get_storage_executor() override
+		{ return m_executor != nullptr && m_executor->is_running() ? m_executor : nullptr; }
+
+	private:
+		sqlite3* m_db;
+		aux::storage_executor* m_executor;
+	};
+
+	// a target starting with 11 zero bytes and prefix_byte, the 12 bytes
+	// prefix lookups compare, and ending with tail_byte
+	sha256_hash item_target(int prefix_byte, int tail_byte)
+	{
+		sha256_hash ret;
+		ret[11] = std::uint8_t(prefix_byte);
+		ret[31] = std::uint8_t(tail_byte);
+		return ret;
+	}
+
+	// mutable item behaviour every storage backend must have
+	void test_mutable_items(dht_storage_interface& s)
+	{
+		public_key pk;
+		signature sig;
+		sha256_hash const t1 = item_target(1, 1);
+		sha256_hash const t2 = item_target(1, 2);
+		sha256_hash const t3 = item_target(2, 1);
+
+		entry item;
+		timestamp ts;
+		TEST_CHECK(!s.get_mutable_item(t1, timestamp(0), false, item));
+		TEST_CHECK(!s.get_mutable_item_timestamp(t1, ts));
+
+		s.put_mutable_item(t1, {"1:a", 3}, sig, timestamp(1), pk, {"salt", 4}
+			, addr("124.31.75.21"));
+		TEST_CHECK(s.get_mutable_item(t1, timestamp(0), false, item));
+		TEST_EQUAL(item["v"].string(), "a");
+		TEST_EQUAL(item["ts"].integer(), 1);
+		TEST_CHECK(s.get_mutable_item_timestamp(t1, ts));
+		TEST_CHECK(ts == timestamp(1));
+
+		// the caller has this one, only the timestamp is filled in
+		entry ts_only;
+		TEST_CHECK(s.get_mutable_item(t1, timestamp(1), false, ts_only));
+		TEST_CHECK(ts_only.find_key("v") == nullptr);
+		TEST_EQUAL(ts_only["ts"].integer(), 1);
+
+		s.put_mutable_item(t1, {"1:b", 3}, sig, timestamp(2), pk, {"salt", 4}
+			, addr("124.31.75.21"));
+		entry updated;
+		TEST_CHECK(s.get_mutable_item(t1, timestamp(0), false, updated));
+		TEST_EQUAL(updated["v"].string(), "b");
+
+		// prefix lookups return the targets above the prefix, starting with
+		// its first 12 bytes
+		sha256_hash target;
+		TEST_CHECK(s.get_mutable_item_target(item_target(1, 0), target));
+		TEST_CHECK(target == t1);
+		TEST_CHECK(!s.get_mutable_item_target(t1, target));
+		TEST_CHECK(!s.get_mutable_item_target(item_target(0, 0), target));
+		TEST_CHECK(!s.get_mutable_item_target(item_target(3, 0), target));
+
+		s.put_mutable_item(t2, {"1:c", 3}, sig, timestamp(1), pk, {"salt", 4}
+			, addr("124.31.75.21"));
+		s.put_mutable_item(t3, {"1:d", 3}, sig, timestamp(1), pk, {"salt", 4}
+			, addr("124.31.75.21"));
+		for (int i = 0; i < 20; ++i)
+		{
+			TEST_CHECK(s.get_mutable_item_target(item_target(1, 0), target));
+			TEST_CHECK(target == t1 || target == t2);
+		}
+		TEST_CHECK(s.get_mutable_item_target(t1, target));
+		TEST_CHECK(target == t2);
+		TEST_CHECK(s.get_mutable_item_target(item_target(2, 0), target));
+		TEST_CHECK(target == t3);
+
+		// a prefix of all ones has no 12 byte upper bound
+		sha256_hash ones;
+		for (int i = 0; i < 12; ++i) ones[i] = 0xff;
+		TEST_CHECK(!s.get_mutable_item_target(ones, target));
+		sha256_hash t4 = ones;
+		t4[31] = 1;
+		s.put_mutable_item(t4, {"1:e", 3}, sig, timestamp(1), pk, {"salt", 4}
+			, addr("124.31.75.21"));
+		TEST_CHECK(s.get_mutable_item_target(ones, target));
+		TEST_CHECK(target == t4);
+	}
 }
 
 sha1_hash const n1 = to_hash("5fbfbff10c5d6a4ec8a88e4c6ab4c28b95eee401");
@@ -412,6 +531,142 @@ TORRENT_TEST(update_node_ids)
 	TEST_CHECK(r);
 }
 
+TORRENT_TEST(update_node_ids_eviction)
+{
+	auto const sett = test_settings();
+	std::unique_ptr<dht_storage_interface> s(dht_default_storage_constructor(sett));
+
+	sha256_hash const h1 = item_target(0, 0x10);
+	sha256_hash const h2 = item_target(1, 1);
+	sha256_hash const h3 = item_target(1, 2);
+
+	s->update_node_ids({item_target(0, 2)});
+	s->put_immutable_item(h1, {"123", 3}, addr("124.31.75.21"));
+	s->put_immutable_item(h2, {"123", 3}, addr("124.31.75.21"));
+
+	// h2 is our node ID now, h1 is the farthest item from it and is the one
+	// removed to make room for h3
+	s->update_node_ids({h2});
+	s->put_immutable_item(h3, {"123", 3}, addr("124.31.75.21"));
+	TEST_EQUAL(s->counters().immutable_data, 2);
+
+	entry item;
+	TEST_CHECK(!s->get_immutable_item(h1, item));
+	TEST_CHECK(s->get_immutable_item(h2, item));
+	TEST_CHECK(s->get_immutable_item(h3, item));
+}
+
+TORRENT_TEST(mutable_items_default_storage)
+{
+	auto sett = test_settings();
+	sett.set_int(settings_pack::dht_max_dht_items, 10);
+	std::unique_ptr<dht_storage_interface> s(dht_default_storage_constructor(sett));
+	s->update_node_ids({item_target(0x80, 0)});
+	test_mutable_items(*s);
+}
+
+TORRENT_TEST(mutable_items_sqlite)
+{
+	sqlite3* db = nullptr;
+	TEST_EQUAL(sqlite3_open(":memory:", &db), SQLITE_OK);
+	{
+		auto const sett = test_settings();
+		items_observer observer(db);
+		items_db_sqlite s(sett, &observer);
+		test_mutable_items(s);
+		s.close();
+	}
+	sqlite3_close(db);
+}
+
+TORRENT_TEST(mutable_items_sqlite_executor_stopped)
+{
+	std::string const path = "test_items_executor.sqlite";
+	std::remove(path.c_str());
+
+	sqlite3* db = nullptr;
+	TEST_EQUAL(sqlite3_open(path.c_str(), &db), SQLITE_OK);
+	io_context ios;
+	counters cnt;
+	aux::storage_executor executor(ios, cnt);
+	TEST_CHECK(executor.start(path));
+	{
+		auto const sett = test_settings();
+		items_observer observer(db, &executor);
+		items_db_sqlite s(sett, &observer);
+
+		// prepares the writer statements on the executor connection
+		public_key pk;
+		signature sig;
+		s.put_mutable_item(item_target(1, 1), {"1:a", 3}, sig, timestamp(1), pk
+			, {"salt", 4}, addr("124.31.75.21"));
+
+		executor.stop();
+		ios.run();
+		TEST_CHECK(!executor.post(aux::storage_subsystem::dht, [](sqlite3*) {}));
+
+		// written on this connection now
+		s.put_mutable_item(item_target(1, 2), {"1:b", 3}, sig, timestamp(1), pk
+			, {"salt", 4}, addr("124.31.75.21"));
+		entry item;
+		TEST_CHECK(s.get_mutable_item(item_target(1, 1), timestamp(0), true, item));
+		TEST_CHECK(s.get_mutable_item(item_target(1, 2), timestamp(0), true, item));
+
+		// the finalize job is rejected, the writer statements are finalized
+		// here
+		s.close();
+	}
+	sqlite3_close(db);
+	std::remove(path.c_str());
+}
+
+TORRENT_TEST(mutable_items_sqlite_migration)
+{
+	sqlite3* db = nullptr;
+	TEST_EQUAL(sqlite3_open(":memory:", &db), SQLITE_OK);
+
+	// the table as it was created before, targets stored as text
+	TEST_EQUAL(sqlite3_exec(db, "CREATE TABLE mutable_items ("
+		"target VARCHAR(32) NOT NULL PRIMARY KEY, ts INT, item VARCHAR(2000) NOT NULL);"
+		"CREATE INDEX index_ts ON mutable_items (ts);"
+		, nullptr, nullptr, nullptr), SQLITE_OK);
+
+	sha256_hash const t1 = item_target(1, 1);
+	std::string value;
+	entry e;
+	e["v"] = "a";
+	e["ts"] = 1;
+	bencode(std::back_inserter(value), e);
+	sqlite3_stmt* stmt = nullptr;
+	TEST_EQUAL(sqlite3_prepare_v2(db, "INSERT INTO mutable_items VALUES (?, 1, ?);"
+		, -1, &stmt, nullptr), SQLITE_OK);
+	sqlite3_bind_text(stmt, 1, t1.data(), 32, nullptr);
+	sqlite3_bind_text(stmt, 2, value.data(), int(value.size()), nullptr);
+	TEST_EQUAL(sqlite3_step(stmt), SQLITE_DONE);
+	sqlite3_finalize(stmt);
+
+	{
+		auto const sett = test_settings();
+		items_observer observer(db);
+		items_db_sqlite s(sett, &observer);
+
+		entry item;
+		TEST_CHECK(s.get_mutable_item(t1, timestamp(0), true, item));
+		TEST_EQUAL(item["v"].string(), "a");
+		sha256_hash target;
+		TEST_CHECK(s.get_mutable_item_target(item_target(1, 0), target));
+		TEST_CHECK(target == t1);
+		s.close();
+	}
+
+	TEST_EQUAL(sqlite3_prepare_v2(db, "SELECT typeof(target) FROM mutable_items;"
+		, -1, &stmt, nullptr), SQLITE_OK);
+	TEST_EQUAL(sqlite3_step(stmt), SQLITE_ROW);
+	TEST_EQUAL(std::string(reinterpret_cast<char const*>(sqlite3_column_text(stmt, 0))), "blob");
+	sqlite3_finalize(stmt);
+	sqlite3_close(db);
+}
+
 TORRENT_TEST(infohashes_sample)
 {
 	auto sett = test_settings();
@@ -0,0 +1,204 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include "test.hpp"
+#include "libTAU/aux_/edit_distance.hpp"
+
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace lt;
+
+namespace {
+
+using step = aux::edit_distance::step;
+using operation = aux::edit_distance::operation;
+
+// the full matrix and traceback find_best_solution() used to compute
+std::vector<step> reference_path(std::string const& source, std::string const& target
+	, std::size_t& final_target_size)
+{
+	std::size_t const n = source.size();
+	std::size_t const m = target.size();
+	std::vector<std::vector<std::size_t>> dist(n + 1, std::vector<std::size_t>(m + 1));
+	std::vector<std::vector<std::size_t>> ops(n + 1, std::vector<std::size_t>(m + 1));
+
+	for (std::size_t i = 0; i < n + 1; ++i)
+	{
+		dist[i][0] = i;
+		if (i > 0) ops[i][0] = 2;
+	}
+	for (std::size_t j = 0; j < m + 1; ++j)
+	{
+		dist[0][j] = j;
+		if (j > 0) ops[0][j] = 1;
+	}
+	for (std::size_t i = 1; i < n + 1; ++i)
+	{
+		for (std::size_t j = 1; j < m + 1; ++j)
+		{
+			std::size_t const cost = source[i - 1] == target[j - 1] ? 0 : 1;
+			std::size_t const insert = dist[i][j - 1] + 1;
+			std::size_t const del = dist[i - 1][j] + 1;
+			std::size_t const swap = dist[i - 1][j - 1] + cost;
+			dist[i][j] = std::min(std::min(insert, del), swap);
+			if (swap <= insert && swap <= del) ops[i][j] = 0;
+			else if (insert < swap && insert <= del) ops[i][j] = 1;
+			else ops[i][j] = 2;
+		}
+	}
+
+	std::vector<step> path;
+	std::size_t i = n;
+	std::size_t j = m;
+	while (dist[i][j] != 0)
+	{
+		switch (ops[i][j])
+		{
+			case 0: path.push_back({operation::substitute, i, j}); --i; --j; break;
+			case 1: path.push_back({operation::insert, i, j}); --j; break;
+			default: path.push_back({operation::remove, i, j}); --i; break;
+		}
+	}
+	final_target_size = j;
+	return path;
+}
+
+std::vector<step> engine_path(std::string const& source, std::string const& target
+	, int& distance, std::size_t& final_target_size)
+{
+	std::vector<std::uint64_t> scratch(aux::edit_distance::scratch_size(source.size(), target.size()));
+	aux::edit_distance ed(source, target, scratch);
+	distance = ed.distance();
+
+	std::vector<step> path;
+	step s{};
+	while (ed.next(s)) path.push_back(s);
+	final_target_size = ed.target_size();
+	return path;
+}
+
+std::string random_sequence(std::mt19937& rng, std::size_t size, int alphabet)
+{
+	std::uniform_int_distribution<int> element(0, alphabet - 1);
+	std::string ret;
+	for (std::size_t i = 0; i < size; ++i) ret.push_back(char(element(rng)));
+	return ret;
+}
+
+// a copy of source with a few elements inserted, removed or replaced, as
+// two peers' lists differ
+std::string mutate(std::mt19937& rng, std::string s, int edits, int alphabet)
+{
+	std::uniform_int_distribution<int> element(0, alphabet - 1);
+	for (int e = 0; e < edits; ++e)
+	{
+		std::uniform_int_distribution<std::size_t> pos(0, s.size());
+		std::size_t const p = pos(rng);
+		switch (rng() % 3)
+		{
+			case 0: s.insert(s.begin() + std::ptrdiff_t(p), char(element(rng))); break;
+			case 1: if (p < s.size()) s.erase(s.begin() + std::ptrdiff_t(p)); break;
+			default: if (p < s.size()) s[p] = char(element(rng)); break;
+		}
+	}
+	return s;
+}
+
+bool same_path(std::string const& source, std::string const& target)
+{
+	std::size_t ref_final = 0;
+	auto const ref = reference_path(source, target, ref_final);
+
+	int distance = 0;
+	std::size_t final_size = 0;
+	auto const path = engine_path(source, target, distance, final_size);
+
+	if (ref.size() != path.size() || ref_final != final_size) return false;
+	for (std::size_t k = 0; k < ref.size(); ++k)
+	{
+		if (ref[k].op != path[k].op
+			|| ref[k].source_size != path[k].source_size
+			|| ref[k].target_size != path[k].target_size)
+			return false;
+	}
+	return true;
+}
+
+} // anonymous namespace
+
+TORRENT_TEST(edit_distance_empty)
+{
+	std::string const empty;
+	std::string const abc = "abc";
+	int distance = 0;
+	std::size_t final_size = 0;
+
+	auto path = engine_path(empty, abc, distance, final_size);
+	TEST_EQUAL(distance, 3);
+	TEST_EQUAL(path.size(), 3);
+	TEST_CHECK(path[0].op == operation::insert);
+	TEST_EQUAL(final_size, 0);
+
+	path = engine_path(abc, empty, distance, final_size);
+	TEST_EQUAL(distance, 3);
+	TEST_EQUAL(path.size(), 3);
+	TEST_CHECK(path[0].op == operation::remove);
+
+	path = engine_path(abc, abc, distance, final_size);
+	TEST_EQUAL(distance, 0);
+	TEST_CHECK(path.empty());
+	TEST_EQUAL(final_size, 3);
+}
+
+TORRENT_TEST(edit_distance_known)
+{
+	int distance = 0;
+	std::size_t final_size = 0;
+	engine_path("kitten", "sitting", distance, final_size);
+	TEST_EQUAL(distance, 3);
+	engine_path("flaw", "lawn", distance, final_size);
+	TEST_EQUAL(distance, 2);
+
+	// the rest of both is equal once the path reaches distance 0
+	auto const path = engine_path("abcdx", "abcd", distance, final_size);
+	TEST_EQUAL(distance, 1);
+	TEST_EQUAL(path.size(), 1);
+	TEST_CHECK(path[0].op == operation::remove);
+	TEST_EQUAL(final_size, 4);
+}
+
+TORRENT_TEST(edit_distance_matches_full_matrix)
+{
+	std::mt19937 rng(0x5eed);
+
+	// few element values make many equal cost paths, the ties must be
+	// broken as the full matrix did. Sizes cross the 64 row words
+	int const alphabets[] = {2, 4, 256};
+	for (int const alphabet : alphabets)
+	{
+		for (int round = 0; round < 300; ++round)
+		{
+			std::size_t const size = rng() % 200;
+			std::string const source = random_sequence(rng, size, alphabet);
+			std::string const target = (round % 2 == 0)
+				? mutate(rng, source, int(rng() % 8), alphabet)
+				: random_sequence(rng, rng() % 200, alphabet);
+			TEST_CHECK(same_path(source, target));
+		}
+	}
+
+	// the peer lists find_best_solution() compares
+	for (int round = 0; round < 1000; ++round)
+	{
+		std::string const source = random_sequence(rng, rng() % 11, 256);
+		TEST_CHECK(same_path(source, mutate(rng, source, int(rng() % 4), 256)));
+	}
+}
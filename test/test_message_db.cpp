@@ -0,0 +1,235 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include "test.hpp"
+#include "libTAU/io_context.hpp"
+#include "libTAU/performance_counters.hpp"
+#include "libTAU/aux_/storage_executor.hpp"
+#include "libTAU/communication/message_db_impl.hpp"
+
+#include <sqlite3.h>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace lt;
+using namespace lt::communication;
+
+namespace {
+
+dht::public_key make_peer(char c)
+{
+	dht::public_key p;
+	p.bytes.fill(c);
+	return p;
+}
+
+aux::bytes make_payload(int i)
+{
+	std::string const s = "{\"type\":\"chat\",\"id\":" + std::to_string(i)
+		+ ",\"content\":\"see you at the meeting about release " + std::to_string(i % 17) + "\"}";
+	return aux::bytes(s.begin(), s.end());
+}
+
+std::int64_t query_int(sqlite3* db, char const* sql)
+{
+	sqlite3_stmt* stmt = nullptr;
+	std::int64_t r = -1;
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK
+		&& sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		r = sqlite3_column_int64(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+	return r;
+}
+
+struct memory_db
+{
+	memory_db() { sqlite3_open(":memory:", &db); }
+	~memory_db() { sqlite3_close(db); }
+	sqlite3* db = nullptr;
+};
+
+// run the completion handlers of the storage thread
+void drain(io_context& ioc)
+{
+	for (int i = 0; i < 50; ++i)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		ioc.restart();
+		ioc.poll();
+	}
+}
+
+} // anonymous namespace
+
+TORRENT_TEST(message_db_round_trip)
+{
+	memory_db m;
+	counters cnt;
+	message_db_impl mdb(m.db, cnt);
+	TEST_CHECK(mdb.init());
+
+	message const msg(100, make_peer('a'), make_peer('b'), make_payload(1));
+	TEST_CHECK(!mdb.is_message_in_db(msg.sha1()));
+
+	int calls = 0;
+	bool written = false;
+	TEST_CHECK(mdb.save_message_if_not_exist(msg, [&](sha1_hash const& h, bool ok)
+	{
+		++calls;
+		written = ok && h == msg.sha1();
+	}));
+	TEST_EQUAL(calls, 1);
+	TEST_CHECK(written);
+	TEST_CHECK(mdb.is_message_in_db(msg.sha1()));
+	TEST_CHECK(mdb.get_message_by_hash(msg.sha1()).payload() == msg.payload());
+
+	// a message stored already counts as written
+	written = false;
+	TEST_CHECK(mdb.save_message_if_not_exist(msg, [&](sha1_hash const&, bool ok) { written = ok; }));
+	TEST_CHECK(written);
+	TEST_EQUAL(query_int(m.db, "SELECT COUNT(*) FROM MESSAGES"), 1);
+
+	TEST_CHECK(mdb.delete_message_by_hash(msg.sha1()));
+	TEST_CHECK(!mdb.is_message_in_db(msg.sha1()));
+	TEST_CHECK(mdb.get_message_by_hash(msg.sha1()).empty());
+}
+
+TORRENT_TEST(message_db_write_failure)
+{
+	memory_db m;
+	counters cnt;
+	message_db_impl mdb(m.db, cnt);
+	TEST_CHECK(mdb.init());
+	TEST_CHECK(sqlite3_exec(m.db, "DROP TABLE MESSAGES;", nullptr, nullptr, nullptr) == SQLITE_OK);
+
+	message const msg(100, make_peer('a'), make_peer('b'), make_payload(1));
+	int failed = 0;
+	mdb.save_message_if_not_exist(msg, [&](sha1_hash const& h, bool ok)
+	{
+		if (!ok && h == msg.sha1()) ++failed;
+	});
+	TEST_EQUAL(failed, 1);
+	TEST_EQUAL(cnt[counters::communication_message_write_failures], 1);
+	TEST_CHECK(!mdb.is_message_in_db(msg.sha1()));
+}
+
+TORRENT_TEST(message_db_page)
+{
+	memory_db m;
+	counters cnt;
+	message_db_impl mdb(m.db, cnt);
+	TEST_CHECK(mdb.init());
+
+	auto const self = make_peer('s');
+	auto const peer = make_peer('p');
+	std::set<sha1_hash> sent;
+	for (int i = 0; i < 25; ++i)
+	{
+		// timestamps repeat, pages are ordered by (timestamp, hash)
+		message const msg(100 + i / 3, i % 2 ? self : peer, i % 2 ? peer : self, make_payload(i));
+		mdb.save_message_if_not_exist(msg);
+		sent.insert(msg.sha1());
+	}
+	// another conversation
+	mdb.save_message_if_not_exist(message(110, self, make_peer('x'), make_payload(99)));
+
+	std::set<sha1_hash> seen;
+	message_cursor cursor;
+	std::int64_t last = (std::numeric_limits<std::int64_t>::max)();
+	for (int pages = 0; pages < 10; ++pages)
+	{
+		auto const page = mdb.get_message_page(self, peer, cursor, 10);
+		for (auto const& v : page.messages)
+		{
+			TEST_CHECK(v.timestamp <= last);
+			last = v.timestamp;
+			TEST_CHECK(seen.insert(v.hash).second);
+		}
+		if (!page.more) break;
+		TEST_EQUAL(int(page.messages.size()), 10);
+		cursor = page.next;
+	}
+	TEST_CHECK(seen == sent);
+}
+
+TORRENT_TEST(message_db_compress_and_search)
+{
+	memory_db m;
+	counters cnt;
+	message_db_impl mdb(m.db, cnt, true, true);
+	TEST_CHECK(mdb.init());
+
+	// a dictionary is trained once enough messages are stored, the ones
+	// saved after are compressed with it
+	std::vector<message> messages;
+	for (int i = 0; i < 1010; ++i)
+	{
+		messages.emplace_back(100 + i, make_peer('a'), make_peer('b'), make_payload(i));
+		mdb.save_message_if_not_exist(messages.back());
+	}
+#ifdef TORRENT_ENABLE_ZSTD
+	TEST_EQUAL(query_int(m.db, "SELECT COUNT(*) FROM MESSAGE_DICTIONARIES"), 1);
+	TEST_CHECK(query_int(m.db, "SELECT COUNT(*) FROM MESSAGES WHERE DICT IS NOT NULL") > 0);
+#endif
+
+	for (auto const& msg : messages)
+		TEST_CHECK(mdb.get_message_by_hash(msg.sha1()).payload() == msg.payload());
+
+	auto const matches = mdb.search_messages("meeting", 2000, message_search_order::newest);
+	TEST_EQUAL(matches.size(), messages.size());
+	TEST_CHECK(!matches.empty() && matches.front().hash == messages.back().sha1());
+}
+
+TORRENT_TEST(message_db_executor)
+{
+	char const* path = "test_message_db.sqlite";
+	std::remove(path);
+
+	io_context ioc;
+	counters cnt;
+	aux::storage_executor executor(ioc, cnt);
+	TEST_CHECK(executor.start(path));
+
+	sqlite3* db = nullptr;
+	sqlite3_open(path, &db);
+	{
+		message_db_impl mdb(db, cnt, false, false, &executor);
+		TEST_CHECK(mdb.init());
+
+		message const msg(100, make_peer('a'), make_peer('b'), make_payload(1));
+		int calls = 0;
+		bool written = false;
+		TEST_CHECK(mdb.save_message_if_not_exist(msg, [&](sha1_hash const&, bool ok)
+		{
+			++calls;
+			written = ok;
+		}));
+
+		// served from the pending map until the write completes
+		TEST_EQUAL(calls, 0);
+		TEST_CHECK(mdb.is_message_in_db(msg.sha1()));
+		TEST_CHECK(mdb.get_message_by_hash(msg.sha1()).payload() == msg.payload());
+
+		drain(ioc);
+		TEST_EQUAL(calls, 1);
+		TEST_CHECK(written);
+		TEST_EQUAL(query_int(db, "SELECT COUNT(*) FROM MESSAGES"), 1);
+		TEST_CHECK(mdb.is_message_in_db(msg.sha1()));
+	}
+	executor.stop();
+	sqlite3_close(db);
+	std::remove(path);
+}
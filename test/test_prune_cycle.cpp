@@ -0,0 +1,211 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include "test.hpp"
+#include "libTAU/performance_counters.hpp"
+#include "libTAU/kademlia/ed25519.hpp"
+#include "libTAU/blockchain/prune_cycle.hpp"
+#include "libTAU/blockchain/repository_impl.hpp"
+
+#include <sqlite3.h>
+#include <string>
+#include <vector>
+
+using namespace lt;
+using namespace lt::blockchain;
+
+namespace {
+
+struct chain_fixture
+{
+	chain_fixture()
+	{
+		std::tie(pk, sk) = dht::ed25519_create_keypair(dht::ed25519_create_seed());
+		sqlite3_open(":memory:", &db);
+		repo.reset(new repository_impl(db, cnt));
+		repo->init();
+		repo->add_new_chain(chain_id);
+		repo->create_block_db(chain_id);
+		repo->create_state_db(chain_id);
+		repo->create_kv_db(chain_id);
+	}
+
+	~chain_fixture()
+	{
+		repo.reset();
+		sqlite3_close(db);
+	}
+
+	// a note tx, saved in the kv db
+	transaction make_tx(std::string const& note)
+	{
+		transaction tx(chain_id, 1, pk, sha1_hash(), aux::bytes(note.begin(), note.end()));
+		tx.sign(pk, sk);
+		repo->save_tx(chain_id, tx);
+		return tx;
+	}
+
+	block make_block(std::int64_t number, sha1_hash const& previous, transaction const& tx)
+	{
+		block b(chain_id, block_version_1, number, number, previous, 1, std::uint64_t(number)
+			, sha1_hash(), sha1_hash(), sha1_hash(), tx, pk);
+		b.sign(pk, sk);
+		return b;
+	}
+
+	bool in_kv(transaction const& tx)
+	{
+		return repo->is_data_in_kv_db(chain_id, tx.sha1());
+	}
+
+	// run the cycle to the end of its marks, or to done
+	void run_to(prune_cycle& cycle, block const& head, prune_cycle::phase_t phase)
+	{
+		for (int i = 0; i < 10000 && cycle.phase != phase && cycle.phase != prune_cycle::done; ++i)
+			cycle.step(*repo, cnt, chain_id, head, 1, 1, nullptr);
+	}
+
+	aux::bytes chain_id = aux::bytes{'p', 'r', 'u', 'n', 'e'};
+	dht::public_key pk;
+	dht::secret_key sk;
+	sqlite3* db = nullptr;
+	counters cnt;
+	std::unique_ptr<repository_impl> repo;
+};
+
+} // anonymous namespace
+
+TORRENT_TEST(prune_cycle_rebranch_mid_cycle)
+{
+	chain_fixture f;
+
+	// main chain A 0..120, with a fork at 110
+	std::vector<block> a;
+	std::vector<transaction> a_txs;
+	sha1_hash previous;
+	for (std::int64_t i = 0; i <= 120; ++i)
+	{
+		a_txs.push_back(f.make_tx("a" + std::to_string(i)));
+		a.push_back(f.make_block(i, previous, a_txs.back()));
+		TEST_CHECK(f.repo->save_main_chain_block(a.back()));
+		previous = a.back().sha1();
+	}
+	transaction fork_tx = f.make_tx("fork");
+	block fork = f.make_block(110, a[109].sha1(), fork_tx);
+	TEST_CHECK(f.repo->save_block_if_not_exist(fork));
+
+	// the txs of branch B, stored before the cycle starts
+	std::vector<transaction> b_txs;
+	for (std::int64_t i = 101; i <= 125; ++i)
+		b_txs.push_back(f.make_tx("b" + std::to_string(i)));
+	transaction garbage = f.make_tx("garbage");
+
+	prune_cycle cycle;
+	f.run_to(cycle, a.back(), prune_cycle::sweep);
+	TEST_CHECK(cycle.phase == prune_cycle::sweep);
+	TEST_EQUAL(cycle.main_number, 50);
+
+	// rebranch to B, forking off A at 100, once A is marked
+	for (std::int64_t i = 101; i <= 120; ++i)
+		TEST_CHECK(f.repo->set_block_non_main_chain(f.chain_id, a[std::size_t(i)].sha1()));
+	previous = a[100].sha1();
+	block head;
+	for (std::int64_t i = 101; i <= 125; ++i)
+	{
+		head = f.make_block(i, previous, b_txs[std::size_t(i - 101)]);
+		TEST_CHECK(f.repo->save_main_chain_block(head));
+		previous = head.sha1();
+	}
+
+	f.run_to(cycle, head, prune_cycle::done);
+	TEST_CHECK(cycle.phase == prune_cycle::done);
+	TEST_CHECK(!cycle.failed);
+
+	// blocks below the horizon go, and so do their txs
+	for (std::int64_t i = 0; i < 50; ++i)
+		TEST_CHECK(!f.in_kv(a_txs[std::size_t(i)]));
+	// the retained main chain, and blocks the rebranch replaced
+	for (std::int64_t i = 50; i <= 120; ++i)
+		TEST_CHECK(f.in_kv(a_txs[std::size_t(i)]));
+	for (auto const& tx : b_txs)
+		TEST_CHECK(f.in_kv(tx));
+	// a side branch within an epoch of the head
+	TEST_CHECK(f.in_kv(fork_tx));
+	TEST_CHECK(!f.in_kv(garbage));
+}
+
+TORRENT_TEST(prune_cycle_extends_marks)
+{
+	chain_fixture f;
+
+	std::vector<block> a;
+	std::vector<transaction> a_txs;
+	sha1_hash previous;
+	for (std::int64_t i = 0; i <= 100; ++i)
+	{
+		a_txs.push_back(f.make_tx("a" + std::to_string(i)));
+		a.push_back(f.make_block(i, previous, a_txs.back()));
+		TEST_CHECK(f.repo->save_main_chain_block(a.back()));
+		previous = a.back().sha1();
+	}
+	// txs of blocks to come, stored before the cycle starts
+	std::vector<transaction> next_txs;
+	for (std::int64_t i = 101; i <= 110; ++i)
+		next_txs.push_back(f.make_tx("a" + std::to_string(i)));
+
+	prune_cycle cycle;
+	f.run_to(cycle, a.back(), prune_cycle::sweep);
+
+	block head;
+	for (auto const& tx : next_txs)
+	{
+		head = f.make_block(a.size(), previous, tx);
+		a.push_back(head);
+		TEST_CHECK(f.repo->save_main_chain_block(head));
+		previous = head.sha1();
+	}
+
+	f.run_to(cycle, head, prune_cycle::done);
+	TEST_CHECK(cycle.phase == prune_cycle::done);
+	TEST_EQUAL(cycle.head_number, 110);
+	for (std::int64_t i = 50; i <= 100; ++i)
+		TEST_CHECK(f.in_kv(a_txs[std::size_t(i)]));
+	for (auto const& tx : next_txs)
+		TEST_CHECK(f.in_kv(tx));
+}
+
+TORRENT_TEST(prune_cycle_keeps_published_data)
+{
+	chain_fixture f;
+
+	std::vector<block> a;
+	sha1_hash previous;
+	for (std::int64_t i = 0; i <= 60; ++i)
+	{
+		a.push_back(f.make_block(i, previous, f.make_tx("a" + std::to_string(i))));
+		TEST_CHECK(f.repo->save_main_chain_block(a.back()));
+		previous = a.back().sha1();
+	}
+	transaction garbage = f.make_tx("garbage");
+
+	// published data may have any key, a 20 byte one included
+	aux::bytes const published(sha1_hash::size(), 'k');
+	aux::bytes const slice{'s'};
+	TEST_CHECK(f.repo->save_pic_slice(f.chain_id, published, slice));
+	TEST_CHECK(f.repo->save_pic_slice(f.chain_id, aux::bytes{'p', '0'}, slice));
+
+	prune_cycle cycle;
+	f.run_to(cycle, a.back(), prune_cycle::done);
+	TEST_CHECK(cycle.phase == prune_cycle::done);
+	TEST_CHECK(!cycle.failed);
+
+	TEST_CHECK(!f.in_kv(garbage));
+	TEST_CHECK(f.repo->get_pic_slice(f.chain_id, published) == slice);
+	TEST_CHECK(f.repo->get_pic_slice(f.chain_id, aux::bytes{'p', '0'}) == slice);
+}
@@ -0,0 +1,290 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include "test.hpp"
+#include "libTAU/performance_counters.hpp"
+#include "libTAU/kademlia/ed25519.hpp"
+#include "libTAU/blockchain/repository_impl.hpp"
+#include "libTAU/blockchain/repository_shared.hpp"
+
+#include <sqlite3.h>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace lt;
+using namespace lt::blockchain;
+
+namespace {
+
+dht::public_key make_peer(char c)
+{
+	dht::public_key p;
+	p.bytes.fill(c);
+	return p;
+}
+
+// the objects written to both repositories, signed once
+struct chain_data
+{
+	chain_data()
+	{
+		std::tie(pk, sk) = dht::ed25519_create_keypair(dht::ed25519_create_seed());
+
+		sha1_hash previous;
+		for (int i = 0; i < 12; ++i)
+		{
+			transaction tx(chain_id, 1, pk, sha1_hash(), note(i));
+			tx.sign(pk, sk);
+			txs.push_back(tx);
+
+			block b(chain_id, block_version_1, i, i, previous, 1, std::uint64_t(i)
+				, sha1_hash(), sha1_hash(), sha1_hash(), tx, pk);
+			b.sign(pk, sk);
+			main_chain.push_back(b);
+			previous = b.sha1();
+		}
+
+		// a side branch off block 8
+		previous = main_chain[8].sha1();
+		for (int i = 9; i < 12; ++i)
+		{
+			block b(chain_id, block_version_1, i + 100, i, previous, 1, std::uint64_t(i)
+				, sha1_hash(), sha1_hash(), sha1_hash(), transaction(), pk);
+			b.sign(pk, sk);
+			side_branch.push_back(b);
+			previous = b.sha1();
+		}
+
+		for (int i = 0; i < 30; ++i)
+			accounts.emplace_back(make_peer(char('A' + i)), 1000 - i * 7, i % 5, i % 3);
+	}
+
+	static aux::bytes note(int i)
+	{
+		std::string const s = "note " + std::to_string(i);
+		return aux::bytes(s.begin(), s.end());
+	}
+
+	aux::bytes chain_id = aux::bytes{'s', 'h', 'a', 'r', 'e', 'd'};
+	dht::public_key pk;
+	dht::secret_key sk;
+	std::vector<transaction> txs;
+	std::vector<block> main_chain;
+	std::vector<block> side_branch;
+	std::vector<account> accounts;
+};
+
+struct sqlite_db
+{
+	sqlite_db() { sqlite3_open(":memory:", &db); }
+	~sqlite_db() { sqlite3_close(db); }
+	sqlite3* db = nullptr;
+};
+
+// follow the chain and write the first part of the data
+void write_first(repository& r, chain_data const& d)
+{
+	auto const& id = d.chain_id;
+	TEST_CHECK(r.add_new_chain(id));
+	TEST_CHECK(r.create_block_db(id));
+	TEST_CHECK(r.create_state_db(id));
+	TEST_CHECK(r.create_kv_db(id));
+	TEST_CHECK(r.create_peer_db(id));
+	TEST_CHECK(r.create_acl_db(id));
+	TEST_CHECK(r.create_online_list_db(id));
+	TEST_CHECK(r.create_news_tx_db(id));
+	TEST_CHECK(r.create_community_info_db());
+
+	TEST_CHECK(r.begin_transaction());
+	for (int i = 0; i < 8; ++i)
+		TEST_CHECK(r.save_main_chain_block(d.main_chain[std::size_t(i)]));
+	for (std::size_t i = 0; i < 20; ++i)
+		TEST_CHECK(r.save_account(id, d.accounts[i]));
+	TEST_CHECK(r.commit());
+
+	for (std::size_t i = 0; i < 8; ++i)
+		TEST_CHECK(r.save_tx(id, d.txs[i]));
+	TEST_CHECK(r.save_state_array(id, state_array(std::vector<account>(d.accounts.begin(), d.accounts.begin() + 10))));
+	TEST_CHECK(r.save_hash_array(id, hash_array(std::vector<sha1_hash>{d.txs[0].sha1(), d.txs[1].sha1()})));
+	TEST_CHECK(r.save_pic_slice(id, aux::bytes{'p', 'i', 'c'}, aux::bytes{'s', 'l', 'i', 'c', 'e'}));
+
+	TEST_CHECK(r.add_peer_in_peer_db(id, make_peer('p')));
+	TEST_CHECK(r.add_peer_in_acl_db(id, make_peer('q')));
+	TEST_CHECK(r.add_peer_in_online_list_db(id, make_peer('o')));
+	TEST_CHECK(r.save_news_tx(id, d.txs[2]));
+	TEST_CHECK(r.update_touching_time(id, 1234));
+}
+
+// the rest, with updates and deletes of what write_first() wrote
+void write_second(repository& r, chain_data const& d)
+{
+	auto const& id = d.chain_id;
+	TEST_CHECK(r.begin_transaction());
+	for (std::size_t i = 8; i < 12; ++i)
+		TEST_CHECK(r.save_main_chain_block(d.main_chain[i]));
+	for (auto const& b : d.side_branch)
+		TEST_CHECK(r.save_block_if_not_exist(b));
+	for (std::size_t i = 20; i < d.accounts.size(); ++i)
+		TEST_CHECK(r.save_account(id, d.accounts[i]));
+	account changed = d.accounts[3];
+	changed.add_balance(500);
+	TEST_CHECK(r.update_account(id, changed));
+	TEST_CHECK(r.delete_account(id, d.accounts[4].peer()));
+	TEST_CHECK(r.commit());
+
+	// rolled back, in neither repository
+	TEST_CHECK(r.begin_transaction());
+	TEST_CHECK(r.delete_account(id, d.accounts[5].peer()));
+	TEST_CHECK(r.rollback());
+
+	for (std::size_t i = 8; i < d.txs.size(); ++i)
+		TEST_CHECK(r.save_tx(id, d.txs[i]));
+	TEST_CHECK(r.delete_data_in_kv_db_by_hash(id, d.txs[1].sha1()));
+	TEST_CHECK(r.delete_peer_in_peer_db(id, make_peer('p')));
+	TEST_CHECK(r.add_peer_in_peer_db(id, make_peer('r')));
+	TEST_CHECK(r.save_news_tx(id, d.txs[9]));
+	TEST_CHECK(r.update_touching_time(id, 5678));
+
+	TEST_CHECK(r.prune_blocks(id, 2, 0, 100) >= 0);
+}
+
+std::set<sha1_hash> all_kv_hashes(repository& r, aux::bytes const& id)
+{
+	std::set<sha1_hash> hashes;
+	std::int64_t position = 0;
+	std::int64_t const end = r.get_kv_position(id);
+	for (int i = 0; i < 100; ++i)
+	{
+		auto const batch = r.get_kv_hashes(id, position, end, 4);
+		if (batch.empty()) break;
+		hashes.insert(batch.begin(), batch.end());
+	}
+	return hashes;
+}
+
+std::set<sha1_hash> hashes_of(std::vector<transaction> const& txs)
+{
+	std::set<sha1_hash> hashes;
+	for (auto const& tx : txs) hashes.insert(tx.sha1());
+	return hashes;
+}
+
+// everything read back from a and b is the same
+void compare(repository& a, repository& b, chain_data const& d)
+{
+	auto const& id = d.chain_id;
+	TEST_CHECK(a.get_all_chains() == b.get_all_chains());
+	TEST_CHECK(a.get_head_block(id) == b.get_head_block(id));
+
+	for (std::int64_t n = 0; n < 12; ++n)
+		TEST_CHECK(a.get_main_chain_block_by_number(id, n) == b.get_main_chain_block_by_number(id, n));
+	for (auto const& blk : d.main_chain)
+		TEST_CHECK(a.get_block_by_hash(id, blk.sha1()) == b.get_block_by_hash(id, blk.sha1()));
+	for (auto const& blk : d.side_branch)
+		TEST_CHECK(a.get_block_by_hash(id, blk.sha1()) == b.get_block_by_hash(id, blk.sha1()));
+	TEST_CHECK(a.get_side_branch_block_hashes(id, 0) == b.get_side_branch_block_hashes(id, 0));
+
+	auto const state_a = a.get_all_effective_state(id);
+	auto const state_b = b.get_all_effective_state(id);
+	TEST_EQUAL(state_a.size(), state_b.size());
+	for (std::size_t i = 0; i < state_a.size() && i < state_b.size(); ++i)
+	{
+		TEST_CHECK(state_a[i].peer() == state_b[i].peer());
+		TEST_EQUAL(state_a[i].balance(), state_b[i].balance());
+		TEST_EQUAL(state_a[i].nonce(), state_b[i].nonce());
+		TEST_EQUAL(state_a[i].power(), state_b[i].power());
+	}
+	for (auto const& act : d.accounts)
+		TEST_EQUAL(a.is_account_existed(id, act.peer()), b.is_account_existed(id, act.peer()));
+
+	for (auto const& tx : d.txs)
+	{
+		TEST_EQUAL(a.is_data_in_kv_db(id, tx.sha1()), b.is_data_in_kv_db(id, tx.sha1()));
+		TEST_CHECK(a.get_tx_by_hash(id, tx.sha1()) == b.get_tx_by_hash(id, tx.sha1()));
+		TEST_CHECK(a.get_news_tx_by_hash(id, tx.sha1()) == b.get_news_tx_by_hash(id, tx.sha1()));
+	}
+	TEST_CHECK(all_kv_hashes(a, id) == all_kv_hashes(b, id));
+	TEST_CHECK(a.get_pic_slice(id, aux::bytes{'p', 'i', 'c'}) == b.get_pic_slice(id, aux::bytes{'p', 'i', 'c'}));
+	TEST_CHECK(hashes_of(a.get_latest_news_txs(id)) == hashes_of(b.get_latest_news_txs(id)));
+
+	TEST_CHECK(a.get_peers_from_peer_db_randomly(id, 10) == b.get_peers_from_peer_db_randomly(id, 10));
+	TEST_CHECK(a.get_all_peer_in_acl_db(id) == b.get_all_peer_in_acl_db(id));
+	TEST_CHECK(a.get_all_peer_in_online_list_db(id) == b.get_all_peer_in_online_list_db(id));
+	TEST_EQUAL(a.get_touching_time(id), b.get_touching_time(id));
+}
+
+} // anonymous namespace
+
+TORRENT_TEST(shared_repository_same_as_per_chain)
+{
+	chain_data d;
+	sqlite_db db_a;
+	sqlite_db db_b;
+	counters cnt;
+	repository_impl a(db_a.db, cnt);
+	repository_shared b(db_b.db, cnt);
+	TEST_CHECK(a.init());
+	TEST_CHECK(b.init());
+
+	write_first(a, d);
+	write_first(b, d);
+	compare(a, b, d);
+
+	write_second(a, d);
+	write_second(b, d);
+	compare(a, b, d);
+
+	// the data written is there at all
+	TEST_CHECK(a.get_head_block(d.chain_id) == d.main_chain.back());
+	TEST_CHECK(!a.is_data_in_kv_db(d.chain_id, d.txs[1].sha1()));
+	TEST_CHECK(a.is_account_existed(d.chain_id, d.accounts[5].peer()));
+	TEST_CHECK(!a.is_account_existed(d.chain_id, d.accounts[4].peer()));
+
+	TEST_CHECK(a.delete_chain(d.chain_id));
+	TEST_CHECK(b.delete_chain(d.chain_id));
+	TEST_CHECK(a.get_all_chains() == b.get_all_chains());
+}
+
+TORRENT_TEST(shared_repository_migrates_per_chain_tables)
+{
+	chain_data d;
+	sqlite_db db_a;
+	sqlite_db db_b;
+	counters cnt;
+	repository_impl a(db_a.db, cnt);
+	TEST_CHECK(a.init());
+	write_first(a, d);
+
+	// the same database, written by the per chain backend first
+	{
+		repository_impl old(db_b.db, cnt);
+		TEST_CHECK(old.init());
+		write_first(old, d);
+	}
+
+	repository_shared b(db_b.db, cnt);
+	TEST_CHECK(b.init());
+	compare(a, b, d);
+
+	// and written by the shared backend after
+	write_second(a, d);
+	write_second(b, d);
+	compare(a, b, d);
+
+	// the per chain tables are dropped in the background
+	for (int i = 0; i < 100 && b.drop_migrated_tables(seconds(1)) > 0; ++i);
+	compare(a, b, d);
+
+	// opening it again does not migrate again
+	repository_shared c(db_b.db, cnt);
+	TEST_CHECK(c.init());
+	compare(a, c, d);
+}
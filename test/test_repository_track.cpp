@@ -0,0 +1,197 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include "test.hpp"
+#include "libTAU/performance_counters.hpp"
+#include "libTAU/kademlia/ed25519.hpp"
+#include "libTAU/blockchain/repository_impl.hpp"
+#include "libTAU/blockchain/repository_track.hpp"
+
+#include <sqlite3.h>
+
+using namespace lt;
+using namespace lt::blockchain;
+
+namespace {
+
+struct track_fixture
+{
+	track_fixture()
+	{
+		std::tie(pk, sk) = dht::ed25519_create_keypair(dht::ed25519_create_seed());
+		sqlite3_open(":memory:", &db);
+		repo = std::make_shared<repository_impl>(db, cnt);
+		repo->init();
+		repo->add_new_chain(chain_id);
+		repo->create_block_db(chain_id);
+		repo->create_state_db(chain_id);
+		repo->create_kv_db(chain_id);
+		track = std::make_shared<repository_track>(repo);
+	}
+
+	~track_fixture()
+	{
+		track.reset();
+		repo.reset();
+		sqlite3_close(db);
+	}
+
+	dht::public_key peer(char c)
+	{
+		dht::public_key p;
+		p.bytes.fill(c);
+		return p;
+	}
+
+	block make_block(std::int64_t number)
+	{
+		block b(chain_id, block_version_1, number, number, sha1_hash(), 1, std::uint64_t(number)
+			, sha1_hash(), sha1_hash(), sha1_hash(), transaction(), pk);
+		b.sign(pk, sk);
+		return b;
+	}
+
+	aux::bytes chain_id = aux::bytes{'t', 'r', 'a', 'c', 'k'};
+	dht::public_key pk;
+	dht::secret_key sk;
+	sqlite3* db = nullptr;
+	counters cnt;
+	std::shared_ptr<repository_impl> repo;
+	std::shared_ptr<repository_track> track;
+};
+
+} // anonymous namespace
+
+TORRENT_TEST(track_read_your_writes)
+{
+	track_fixture f;
+	auto const a = f.peer('a');
+	block const b = f.make_block(1);
+
+	TEST_CHECK(f.track->begin_transaction());
+	TEST_CHECK(f.track->save_account(f.chain_id, account(a, 10, 1, 0)));
+	TEST_CHECK(f.track->save_main_chain_block(b));
+
+	// served from the overlay, not written yet
+	TEST_EQUAL(f.track->get_account(f.chain_id, a).balance(), 10);
+	TEST_CHECK(f.track->is_account_existed(f.chain_id, a));
+	TEST_CHECK(f.track->get_block_by_hash(f.chain_id, b.sha1()) == b);
+	TEST_CHECK(!f.repo->is_account_existed(f.chain_id, a));
+
+	TEST_CHECK(f.track->commit());
+	TEST_EQUAL(f.repo->get_account(f.chain_id, a).balance(), 10);
+	TEST_CHECK(f.repo->get_block_by_hash(f.chain_id, b.sha1()) == b);
+}
+
+TORRENT_TEST(track_save_and_update)
+{
+	track_fixture f;
+	auto const a = f.peer('a');
+	auto const u = f.peer('u');
+	f.repo->save_account(f.chain_id, account(u, 5, 1, 0));
+
+	// an account saved with all zeros is kept, an updated one is deleted
+	TEST_CHECK(f.track->begin_transaction());
+	TEST_CHECK(f.track->save_account(f.chain_id, account(a)));
+	TEST_CHECK(f.track->update_account(f.chain_id, account(u)));
+	TEST_CHECK(f.track->is_account_existed(f.chain_id, a));
+	TEST_CHECK(!f.track->is_account_existed(f.chain_id, u));
+	TEST_CHECK(f.track->commit());
+
+	TEST_CHECK(f.repo->is_account_existed(f.chain_id, a));
+	TEST_CHECK(!f.repo->is_account_existed(f.chain_id, u));
+}
+
+TORRENT_TEST(track_erase)
+{
+	track_fixture f;
+	auto const a = f.peer('a');
+	f.repo->save_account(f.chain_id, account(a, 5, 1, 0));
+
+	TEST_CHECK(f.track->begin_transaction());
+	TEST_CHECK(f.track->delete_account(f.chain_id, a));
+	TEST_CHECK(!f.track->is_account_existed(f.chain_id, a));
+	TEST_CHECK(f.track->get_account(f.chain_id, a).empty());
+	TEST_CHECK(f.repo->is_account_existed(f.chain_id, a));
+	TEST_CHECK(f.track->commit());
+
+	TEST_CHECK(!f.repo->is_account_existed(f.chain_id, a));
+}
+
+TORRENT_TEST(track_nested_rollback)
+{
+	track_fixture f;
+	auto const a = f.peer('a');
+	auto const b = f.peer('b');
+
+	TEST_CHECK(f.track->begin_transaction());
+	TEST_CHECK(f.track->save_account(f.chain_id, account(a, 1, 1, 0)));
+
+	TEST_CHECK(f.track->begin_transaction());
+	TEST_CHECK(f.track->save_account(f.chain_id, account(b, 2, 1, 0)));
+	TEST_CHECK(f.track->update_account(f.chain_id, account(a, 3, 2, 0)));
+	TEST_CHECK(f.track->rollback());
+
+	// only the inner writes are gone
+	TEST_EQUAL(f.track->get_account(f.chain_id, a).balance(), 1);
+	TEST_CHECK(!f.track->is_account_existed(f.chain_id, b));
+	TEST_CHECK(f.track->commit());
+
+	TEST_EQUAL(f.repo->get_account(f.chain_id, a).balance(), 1);
+	TEST_CHECK(!f.repo->is_account_existed(f.chain_id, b));
+}
+
+TORRENT_TEST(track_flush_failure)
+{
+	track_fixture f;
+	auto const a = f.peer('a');
+	// no state table, writing to it fails
+	aux::bytes const missing{'n', 'o', 'n', 'e'};
+
+	TEST_CHECK(f.track->begin_transaction());
+	TEST_CHECK(f.track->save_account(f.chain_id, account(a, 1, 1, 0)));
+	TEST_CHECK(f.track->save_account(missing, account(a, 1, 1, 0)));
+	TEST_CHECK(!f.track->commit());
+
+	// nothing of the transaction is left
+	TEST_CHECK(!f.repo->is_account_existed(f.chain_id, a));
+
+	// a read that flushes fails the transaction, the overlay is kept
+	TEST_CHECK(f.track->begin_transaction());
+	TEST_CHECK(f.track->save_account(f.chain_id, account(a, 1, 1, 0)));
+	TEST_CHECK(f.track->save_account(missing, account(a, 1, 1, 0)));
+	TEST_CHECK(f.track->get_head_block(f.chain_id).empty());
+	TEST_EQUAL(f.track->get_account(f.chain_id, a).balance(), 1);
+	TEST_CHECK(!f.track->delete_block_by_hash(f.chain_id, sha1_hash()));
+	TEST_CHECK(!f.track->commit());
+	TEST_CHECK(!f.repo->is_account_existed(f.chain_id, a));
+
+	// and the next transaction starts clean
+	TEST_CHECK(f.track->begin_transaction());
+	TEST_CHECK(f.track->save_account(f.chain_id, account(a, 1, 1, 0)));
+	TEST_CHECK(f.track->commit());
+	TEST_CHECK(f.repo->is_account_existed(f.chain_id, a));
+}
+
+TORRENT_TEST(track_nested_flush_failure)
+{
+	track_fixture f;
+	auto const a = f.peer('a');
+	aux::bytes const missing{'n', 'o', 'n', 'e'};
+
+	TEST_CHECK(f.track->begin_transaction());
+	TEST_CHECK(f.track->save_account(f.chain_id, account(a, 1, 1, 0)));
+	TEST_CHECK(f.track->begin_transaction());
+	TEST_CHECK(f.track->save_account(missing, account(a, 1, 1, 0)));
+	TEST_CHECK(!f.track->commit());
+
+	// the outer transaction fails with its inner one
+	TEST_CHECK(!f.track->commit());
+	TEST_CHECK(!f.repo->is_account_existed(f.chain_id, a));
+}
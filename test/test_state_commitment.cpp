@@ -0,0 +1,138 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include "test.hpp"
+#include "libTAU/blockchain/state_commitment.hpp"
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <set>
+#include <vector>
+
+using namespace lt;
+using namespace lt::blockchain;
+
+namespace {
+
+dht::public_key make_peer(int i)
+{
+	dht::public_key p;
+	p.bytes.fill(0);
+	p.bytes[0] = char(i & 0xff);
+	p.bytes[1] = char((i >> 8) & 0xff);
+	return p;
+}
+
+std::vector<account> effective_state(std::map<dht::public_key, account> const& state)
+{
+	std::vector<account> accounts;
+	for (auto const& item : state) accounts.push_back(item.second);
+	std::sort(accounts.begin(), accounts.end(), state_commitment::effective_order);
+	return accounts;
+}
+
+// the hashes of every array in the tree
+std::set<sha1_hash> tree_hashes(state_commitment const& c)
+{
+	std::set<sha1_hash> hashes;
+	for (auto const& a : c.state_arrays()) hashes.insert(a.sha1());
+	for (auto const& a : c.hash_arrays()) hashes.insert(a.sha1());
+	return hashes;
+}
+
+// write the unsaved arrays into kv, like generate_genesis_state()
+void save(state_commitment& c, std::set<sha1_hash>& kv)
+{
+	for (auto const& a : c.unsaved_state_arrays()) kv.insert(a.sha1());
+	for (auto const& a : c.unsaved_hash_arrays()) kv.insert(a.sha1());
+	c.mark_saved();
+}
+
+} // anonymous namespace
+
+TORRENT_TEST(state_commitment_matches_full_rebuild)
+{
+	std::mt19937 rng(0x5eed);
+	std::map<dht::public_key, account> state;
+	for (int i = 0; i < 2000; ++i)
+	{
+		auto const p = make_peer(i);
+		state.emplace(p, account(p, std::int64_t(rng() % 1000), 1, 0));
+	}
+
+	state_commitment incremental;
+	incremental.reset(effective_state(state));
+	std::set<sha1_hash> kv;
+	save(incremental, kv);
+
+	for (int round = 0; round < 40; ++round)
+	{
+		std::vector<account> changed;
+		std::vector<dht::public_key> removed;
+		std::set<dht::public_key> touched;
+		for (int k = 0; k < 20; ++k)
+		{
+			auto const p = make_peer(int(rng() % 2200));
+			if (!touched.insert(p).second) continue;
+			if (rng() % 5 == 0 && state.count(p) > 0)
+			{
+				state.erase(p);
+				removed.push_back(p);
+			}
+			else
+			{
+				account a(p, std::int64_t(rng() % 1000), std::int64_t(rng() % 10), std::int64_t(rng() % 3));
+				state[p] = a;
+				changed.push_back(a);
+			}
+		}
+		incremental.update(changed, removed);
+
+		state_commitment full;
+		full.reset(effective_state(state));
+		TEST_CHECK(incremental.root() == full.root());
+		TEST_CHECK(tree_hashes(incremental) == tree_hashes(full));
+
+		// saved only every few rounds, like touches consumed by
+		// is_state_in_place() between epochs. Nothing may be missed
+		if (round % 3 == 2)
+		{
+			save(incremental, kv);
+			for (auto const& h : tree_hashes(incremental))
+				TEST_CHECK(kv.count(h) > 0);
+		}
+	}
+}
+
+TORRENT_TEST(state_commitment_unsaved_until_marked)
+{
+	std::map<dht::public_key, account> state;
+	for (int i = 0; i < 100; ++i)
+	{
+		auto const p = make_peer(i);
+		state.emplace(p, account(p, i, 1, 0));
+	}
+
+	state_commitment c;
+	c.reset(effective_state(state));
+	TEST_EQUAL(c.unsaved_state_arrays().size(), c.state_arrays().size());
+	c.mark_saved();
+	TEST_CHECK(c.unsaved_state_arrays().empty());
+	TEST_CHECK(c.unsaved_hash_arrays().empty());
+
+	// an array changed by one update is still unsaved after an empty one
+	auto const p = make_peer(0);
+	c.update({account(p, 5000, 1, 0)}, {});
+	auto const unsaved = c.unsaved_state_arrays().size();
+	TEST_CHECK(unsaved > 0);
+	c.update({}, {});
+	TEST_EQUAL(c.unsaved_state_arrays().size(), unsaved);
+	TEST_CHECK(!c.unsaved_hash_arrays().empty());
+}
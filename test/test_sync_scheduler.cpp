@@ -0,0 +1,206 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+#include "test.hpp"
+#include "libTAU/communication/sync_scheduler.hpp"
+
+#include <vector>
+
+using namespace lt;
+using namespace lt::communication;
+
+namespace {
+
+sha256_hash make_target(std::uint8_t first, std::uint8_t last, std::uint8_t second = 0)
+{
+	sha256_hash h;
+	h[0] = first;
+	h[1] = second;
+	h[31] = last;
+	return h;
+}
+
+dht::public_key make_peer(char c)
+{
+	dht::public_key pk;
+	pk.bytes.fill(c);
+	return pk;
+}
+
+dht::node_entry make_node(sha256_hash const& id, std::uint32_t addr)
+{
+	return dht::node_entry(id, udp::endpoint(address_v4(addr), 6881));
+}
+
+} // anonymous namespace
+
+TORRENT_TEST(sync_scheduler_shares_lookup)
+{
+	std::vector<sha256_hash> lookups;
+	sync_scheduler s([&](sha256_hash const& target, sync_scheduler::nodes_callback done)
+		{
+			lookups.push_back(target);
+			// nodes around 0x10.., the farthest one differs in the 5th bit
+			done({make_node(make_target(0x10, 1), 1), make_node(make_target(0x10, 9), 2)
+				, make_node(make_target(0x18, 0), 3)});
+		});
+
+	std::vector<std::vector<dht::node_entry>> given(3);
+	s.add({make_target(0x10, 2), make_peer('a'), [&](std::vector<dht::node_entry> const& n) { given[0] = n; }});
+	s.add({make_target(0x10, 8), make_peer('b'), [&](std::vector<dht::node_entry> const& n) { given[1] = n; }});
+	s.add({make_target(0x20, 0), make_peer('c'), [&](std::vector<dht::node_entry> const& n) { given[2] = n; }});
+	TEST_EQUAL(s.pending(), 3);
+
+	// the first two share a lookup, the third one has its own
+	TEST_EQUAL(s.dispatch(0), 2);
+	TEST_EQUAL(lookups.size(), 2);
+	TEST_CHECK(lookups[0] == make_target(0x10, 2));
+	TEST_CHECK(lookups[1] == make_target(0x20, 0));
+	TEST_EQUAL(s.pending(), 0);
+	TEST_EQUAL(s.operations(), 3);
+
+	// the nodes are closest first to each target
+	TEST_EQUAL(given[1].size(), 3);
+	TEST_CHECK(given[0][0].id == make_target(0x10, 1));
+	TEST_CHECK(given[1][0].id == make_target(0x10, 9));
+	TEST_CHECK(given[1][2].id == make_target(0x18, 0));
+}
+
+TORRENT_TEST(sync_scheduler_out_of_reach)
+{
+	int lookups = 0;
+	sync_scheduler s([&](sha256_hash const&, sync_scheduler::nodes_callback done)
+		{
+			++lookups;
+			// every node found is close to the lead
+			done({make_node(make_target(0x10, 1), 1)});
+		});
+
+	int ran = 0;
+	s.add({make_target(0x10, 0), make_peer('a'), [&](std::vector<dht::node_entry> const&) { ++ran; }});
+	// same group prefix, but farther from the lead than the nodes found
+	s.add({make_target(0x10, 0, 0x80), make_peer('b'), [&](std::vector<dht::node_entry> const&) { ++ran; }});
+
+	s.dispatch(0);
+	TEST_EQUAL(lookups, 2);
+	TEST_EQUAL(ran, 2);
+	TEST_EQUAL(s.pending(), 0);
+}
+
+TORRENT_TEST(sync_scheduler_pending_lookup)
+{
+	std::vector<sync_scheduler::nodes_callback> waiting;
+	sync_scheduler s([&](sha256_hash const&, sync_scheduler::nodes_callback done)
+		{ waiting.push_back(std::move(done)); });
+
+	int ran = 0;
+	s.add({make_target(0x10, 0), make_peer('a'), [&](std::vector<dht::node_entry> const&) { ++ran; }});
+	s.add({make_target(0x10, 0, 0x80), make_peer('b'), [&](std::vector<dht::node_entry> const&) { ++ran; }});
+	TEST_EQUAL(s.dispatch(0), 1);
+	TEST_EQUAL(s.in_flight(), 1);
+	TEST_EQUAL(s.pending(), 0);
+
+	// nothing found: the lead runs without nodes, the other one waits for
+	// its own lookup
+	waiting[0]({});
+	TEST_EQUAL(ran, 1);
+	TEST_EQUAL(s.in_flight(), 0);
+	TEST_EQUAL(s.pending(), 1);
+
+	// completions after clear() are ignored
+	TEST_EQUAL(s.dispatch(0), 1);
+	s.clear();
+	waiting[1]({});
+	TEST_EQUAL(ran, 1);
+	TEST_EQUAL(s.pending(), 0);
+}
+
+TORRENT_TEST(sync_scheduler_rate)
+{
+	sync_scheduler s([](sha256_hash const&, sync_scheduler::nodes_callback done)
+		{ done({}); }, 10);
+
+	int ran = 0;
+	for (int i = 0; i < 25; ++i)
+	{
+		s.add({make_target(std::uint8_t(i * 8), 0), make_peer('a')
+			, [&](std::vector<dht::node_entry> const&) { ++ran; }});
+	}
+
+	// a second worth of operations at once, then 10 per second
+	s.dispatch(0);
+	TEST_EQUAL(ran, 10);
+	s.dispatch(500);
+	TEST_EQUAL(ran, 15);
+	s.dispatch(500);
+	TEST_EQUAL(ran, 15);
+	s.dispatch(5000);
+	TEST_EQUAL(ran, 25);
+}
+
+TORRENT_TEST(sync_scheduler_active_first)
+{
+	std::vector<char> order;
+	sync_scheduler s([](sha256_hash const&, sync_scheduler::nodes_callback done)
+		{ done({}); }, 1);
+
+	s.peer_active(make_peer('b'), 100);
+	s.peer_active(make_peer('c'), 200);
+	s.add({make_target(0x10, 0), make_peer('a'), [&](std::vector<dht::node_entry> const&) { order.push_back('a'); }});
+	s.add({make_target(0x20, 0), make_peer('b'), [&](std::vector<dht::node_entry> const&) { order.push_back('b'); }});
+	s.add({make_target(0x30, 0), make_peer('c'), [&](std::vector<dht::node_entry> const&) { order.push_back('c'); }});
+
+	for (int i = 0; i < 3; ++i) s.dispatch(i * 1000);
+	TEST_CHECK((order == std::vector<char>{'c', 'b', 'a'}));
+}
+
+TORRENT_TEST(sync_scheduler_lookup_timeout)
+{
+	std::vector<sync_scheduler::nodes_callback> waiting;
+	sync_scheduler s([&](sha256_hash const&, sync_scheduler::nodes_callback done)
+		{ waiting.push_back(std::move(done)); });
+
+	std::vector<std::size_t> given;
+	s.add({make_target(0x10, 0), make_peer('a'), [&](std::vector<dht::node_entry> const& n) { given.push_back(n.size()); }});
+	TEST_EQUAL(s.dispatch(0), 1);
+	TEST_EQUAL(s.in_flight(), 1);
+
+	// the lookup never completes, its operation runs without nodes
+	s.dispatch(sync_scheduler::lookup_timeout - 1);
+	TEST_EQUAL(given.size(), 0);
+	s.dispatch(sync_scheduler::lookup_timeout);
+	TEST_EQUAL(given.size(), 1);
+	TEST_EQUAL(given[0], 0);
+	TEST_EQUAL(s.in_flight(), 0);
+
+	// a late completion is ignored
+	waiting[0]({make_node(make_target(0x10, 1), 1)});
+	TEST_EQUAL(given.size(), 1);
+}
+
+TORRENT_TEST(sync_scheduler_without_lookup)
+{
+	int lookups = 0;
+	sync_scheduler s([&](sha256_hash const&, sync_scheduler::nodes_callback done)
+		{ ++lookups; done({}); }, 1);
+
+	std::vector<char> order;
+	s.peer_active(make_peer('b'), 100);
+	s.add({make_target(0x10, 0), make_peer('a'), [&](std::vector<dht::node_entry> const&) { order.push_back('a'); }});
+	s.add({make_target(0x10, 1), make_peer('b'), [&](std::vector<dht::node_entry> const&) { order.push_back('b'); }, false});
+	TEST_EQUAL(s.pending(), 2);
+
+	// paced in its turn, but never part of a lookup
+	TEST_EQUAL(s.dispatch(0), 0);
+	TEST_CHECK((order == std::vector<char>{'b'}));
+	TEST_EQUAL(s.dispatch(1000), 1);
+	TEST_CHECK((order == std::vector<char>{'b', 'a'}));
+	TEST_EQUAL(lookups, 1);
+	TEST_EQUAL(s.pending(), 0);
+}
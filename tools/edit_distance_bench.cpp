@@ -0,0 +1,185 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+// measures aux::edit_distance against the full distance and operation
+// matrices find_best_solution() used to fill, on hash prefix arrays of 50,
+// 500 and 5000 elements. The peer's array is our own with a few elements
+// inserted, removed or replaced (the usual reconciliation), or unrelated to
+// it. The full matrices are on the heap here, as stack arrays of 5000 x 5000
+// would not fit. Both walk the whole edit path, and every path is checked to
+// be the same.
+
+#include "libTAU/aux_/edit_distance.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace lt;
+
+namespace {
+
+using clk = std::chrono::steady_clock;
+
+std::mt19937 random_engine(1);
+
+int const sizes[] = {50, 500, 5000};
+
+// edits between the arrays, per 100 elements
+int const edit_rate = 2;
+
+struct path_summary
+{
+	std::size_t steps = 0;
+	std::size_t checksum = 0;
+
+	bool operator==(path_summary const& o) const
+	{ return steps == o.steps && checksum == o.checksum; }
+};
+
+void add_step(path_summary& p, int op, std::size_t i, std::size_t j)
+{
+	++p.steps;
+	p.checksum = p.checksum * 31 + std::size_t(op) * 1000003 + i * 7919 + j;
+}
+
+path_summary full_matrix(std::string const& source, std::string const& target
+	, std::size_t& bytes)
+{
+	std::size_t const n = source.size();
+	std::size_t const m = target.size();
+	std::size_t const stride = m + 1;
+	std::vector<std::size_t> dist((n + 1) * stride);
+	std::vector<std::size_t> ops((n + 1) * stride);
+	bytes = (dist.size() + ops.size()) * sizeof(std::size_t);
+
+	for (std::size_t i = 1; i < n + 1; ++i) { dist[i * stride] = i; ops[i * stride] = 2; }
+	for (std::size_t j = 1; j < m + 1; ++j) { dist[j] = j; ops[j] = 1; }
+	for (std::size_t i = 1; i < n + 1; ++i)
+	{
+		for (std::size_t j = 1; j < m + 1; ++j)
+		{
+			std::size_t const cost = source[i - 1] == target[j - 1] ? 0 : 1;
+			std::size_t const insert = dist[i * stride + j - 1] + 1;
+			std::size_t const del = dist[(i - 1) * stride + j] + 1;
+			std::size_t const swap = dist[(i - 1) * stride + j - 1] + cost;
+			dist[i * stride + j] = std::min(std::min(insert, del), swap);
+			if (swap <= insert && swap <= del) ops[i * stride + j] = 0;
+			else if (insert < swap && insert <= del) ops[i * stride + j] = 1;
+			else ops[i * stride + j] = 2;
+		}
+	}
+
+	path_summary ret;
+	std::size_t i = n;
+	std::size_t j = m;
+	while (dist[i * stride + j] != 0)
+	{
+		int const op = int(ops[i * stride + j]);
+		add_step(ret, op, i, j);
+		if (op != 1) --i;
+		if (op != 2) --j;
+	}
+	return ret;
+}
+
+path_summary bit_parallel(std::string const& source, std::string const& target
+	, std::vector<std::uint64_t>& scratch)
+{
+	scratch.resize(aux::edit_distance::scratch_size(source.size(), target.size()));
+	aux::edit_distance distance(source, target, scratch);
+
+	path_summary ret;
+	aux::edit_distance::step s{};
+	while (distance.next(s))
+		add_step(ret, int(s.op), s.source_size, s.target_size);
+	return ret;
+}
+
+std::string random_array(std::size_t size)
+{
+	std::uniform_int_distribution<int> byte(0, 255);
+	std::string ret;
+	for (std::size_t i = 0; i < size; ++i) ret.push_back(char(byte(random_engine)));
+	return ret;
+}
+
+std::string edit(std::string s, int edits)
+{
+	std::uniform_int_distribution<int> byte(0, 255);
+	for (int e = 0; e < edits; ++e)
+	{
+		std::uniform_int_distribution<std::size_t> pos(0, s.size() - 1);
+		std::size_t const p = pos(random_engine);
+		switch (random_engine() % 3)
+		{
+			case 0: s.insert(s.begin() + std::ptrdiff_t(p), char(byte(random_engine))); break;
+			case 1: s.erase(s.begin() + std::ptrdiff_t(p)); break;
+			default: s[p] = char(byte(random_engine)); break;
+		}
+	}
+	return s;
+}
+
+template <typename F>
+double time_us(int rounds, F f)
+{
+	auto const start = clk::now();
+	for (int r = 0; r < rounds; ++r) f();
+	return std::chrono::duration<double, std::micro>(clk::now() - start).count() / rounds;
+}
+
+bool run(char const* name, std::string const& source, std::string const& target)
+{
+	// about 100 ms of the slower one
+	int const rounds = std::max(1, int(2000000 / (source.size() * target.size())));
+
+	std::size_t matrix_bytes = 0;
+	path_summary full;
+	double const full_us = time_us(rounds, [&] { full = full_matrix(source, target, matrix_bytes); });
+
+	std::vector<std::uint64_t> scratch;
+	path_summary bits;
+	double const bits_us = time_us(rounds, [&] { bits = bit_parallel(source, target, scratch); });
+
+	std::printf("%5d %-9s %8zu %12.1f %12.1f %8.1fx %12zu %10zu %s\n"
+		, int(target.size()), name, bits.steps, full_us, bits_us, full_us / bits_us
+		, matrix_bytes, scratch.size() * sizeof(std::uint64_t)
+		, full == bits ? "same" : "DIFFERENT");
+	return full == bits;
+}
+
+} // anonymous namespace
+
+int main(int argc, char*[])
+{
+	if (argc > 1)
+	{
+		std::fprintf(stderr, "USAGE: edit_distance_bench\n");
+		return 1;
+	}
+
+	std::printf("%5s %-9s %8s %12s %12s %9s %12s %10s\n", "size", "peer", "steps"
+		, "matrix(us)", "bits(us)", "speedup", "matrix(B)", "scratch(B)");
+
+	bool ok = true;
+	for (int const size : sizes)
+	{
+		std::string const ours = random_array(std::size_t(size));
+		int const edits = std::max(1, size * edit_rate / 100);
+		ok &= run("edited", edit(ours, edits), ours);
+		ok &= run("unrelated", random_array(std::size_t(size)), ours);
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,332 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+// compares the per chain tables of repository_impl with the shared tables
+// of repository_shared for a growing number of followed chains:
+//
+//   startup  open the database, init() and load the head block of every
+//            chain, as blockchain::init() does
+//   query    random main chain block and account lookups across all chains
+//   follow   create the tables of one more chain, a schema change for the
+//            per chain layout
+//
+// the per chain database is then migrated to the shared layout: init()
+// copies the rows, the old tables are dropped afterwards
+
+#include "libTAU/performance_counters.hpp"
+#include "libTAU/blockchain/repository_impl.hpp"
+#include "libTAU/blockchain/repository_shared.hpp"
+
+#include <sqlite3.h>
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace lt;
+using namespace lt::blockchain;
+
+namespace {
+
+using clk = std::chrono::steady_clock;
+
+std::mt19937 random_engine(1);
+
+int num_blocks = 20;
+int num_queries = 20000;
+
+// followed chains of each run
+int const chain_counts[] = {1, 100, 5000};
+
+// chains followed in the follow phase
+int const follow_chains = 10;
+
+[[noreturn]] void usage()
+{
+	std::fprintf(stderr, "USAGE: multichain_schema_bench [blocks] [queries]\n\n"
+		"blocks   blocks and accounts of every chain (default 20)\n"
+		"queries  random block and account lookups (default 20000)\n");
+	std::exit(1);
+}
+
+double elapsed_ms(clk::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(clk::now() - start).count();
+}
+
+aux::bytes random_chain_id()
+{
+	std::uniform_int_distribution<int> byte(0, 255);
+	aux::bytes chain_id(16);
+	for (auto& b : chain_id) b = char(byte(random_engine));
+	return chain_id;
+}
+
+dht::public_key random_key()
+{
+	std::uniform_int_distribution<int> byte(0, 255);
+	dht::public_key pk;
+	for (auto& b : pk.bytes) b = char(byte(random_engine));
+	return pk;
+}
+
+struct chain_data
+{
+	aux::bytes id;
+	std::vector<block> blocks;
+	std::vector<dht::public_key> accounts;
+};
+
+std::vector<chain_data> make_chains(int num_chains)
+{
+	std::vector<chain_data> chains;
+	chains.resize(std::size_t(num_chains));
+	for (auto& c : chains)
+	{
+		c.id = random_chain_id();
+		for (int i = 0; i < num_blocks; ++i)
+			c.accounts.push_back(random_key());
+
+		sha1_hash previous;
+		for (int i = 1; i <= num_blocks; ++i)
+		{
+			block const b(c.id, block_version::block_version_1, 1600000000 + i, i, previous
+				, 1, std::uint64_t(i), sha1_hash(), sha1_hash(), sha1_hash(), transaction()
+				, c.accounts[std::size_t(i - 1)]);
+			// round trip so the hash matches what the repositories decode
+			c.blocks.emplace_back(b.get_encode());
+			previous = c.blocks.back().sha1();
+		}
+	}
+	return chains;
+}
+
+sqlite3* open_db(std::string const& path)
+{
+	sqlite3* db = nullptr;
+	if (sqlite3_open(path.c_str(), &db) != SQLITE_OK)
+	{
+		std::fprintf(stderr, "failed to open %s\n", path.c_str());
+		std::exit(1);
+	}
+	// same as the session
+	sqlite3_exec(db, "pragma journal_mode = WAL;", nullptr, nullptr, nullptr);
+	sqlite3_exec(db, "pragma synchronous = normal;", nullptr, nullptr, nullptr);
+	return db;
+}
+
+void remove_db(std::string const& path)
+{
+	for (auto const& p : {path, path + "-wal", path + "-shm"})
+		std::filesystem::remove_all(p);
+}
+
+std::shared_ptr<repository> make_repository(bool shared, sqlite3* db, counters& cnt)
+{
+	if (shared) return std::make_shared<repository_shared>(db, cnt);
+	return std::make_shared<repository_impl>(db, cnt);
+}
+
+// the tables blockchain::create_chain_db() creates
+bool create_chain(repository& repo, aux::bytes const& chain_id)
+{
+	return repo.create_block_db(chain_id) && repo.create_state_db(chain_id)
+		&& repo.create_kv_db(chain_id) && repo.create_peer_db(chain_id)
+		&& repo.create_news_tx_db(chain_id) && repo.add_new_chain(chain_id);
+}
+
+void populate(repository& repo, std::vector<chain_data> const& chains)
+{
+	repo.init();
+	repo.set_group_commit(64, 100);
+	for (auto const& c : chains)
+	{
+		repo.begin_transaction();
+		if (!create_chain(repo, c.id))
+		{
+			std::fprintf(stderr, "failed to create chain\n");
+			std::exit(1);
+		}
+		for (std::size_t i = 0; i < c.blocks.size(); ++i)
+		{
+			repo.save_main_chain_block(c.blocks[i]);
+			repo.save_account(c.id, account(c.accounts[i], 100, 1, 1));
+		}
+		repo.commit();
+	}
+	repo.flush(true);
+}
+
+int schema_entries(sqlite3* db)
+{
+	int entries = 0;
+	sqlite3_stmt* stmt = nullptr;
+	if (sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM sqlite_master", -1, &stmt, nullptr) == SQLITE_OK
+		&& sqlite3_step(stmt) == SQLITE_ROW)
+		entries = sqlite3_column_int(stmt, 0);
+	sqlite3_finalize(stmt);
+	return entries;
+}
+
+struct result
+{
+	int schema_entries = 0;
+	double startup_ms = 0;
+	double block_query_us = 0;
+	double account_query_us = 0;
+	std::int64_t prepared = 0;
+	double follow_ms = 0;
+};
+
+result run(bool shared, std::string const& path, std::vector<chain_data> const& chains)
+{
+	result r;
+
+	remove_db(path);
+	{
+		sqlite3* db = open_db(path);
+		counters cnt;
+		{
+			auto repo = make_repository(shared, db, cnt);
+			populate(*repo, chains);
+		}
+		r.schema_entries = schema_entries(db);
+		sqlite3_close(db);
+	}
+
+	sqlite3* db = nullptr;
+	counters cnt;
+	std::shared_ptr<repository> repo;
+
+	auto start = clk::now();
+	db = open_db(path);
+	repo = make_repository(shared, db, cnt);
+	repo->init();
+	for (auto const& chain_id : repo->get_all_chains())
+	{
+		if (repo->get_head_block(chain_id).empty())
+		{
+			std::fprintf(stderr, "head block missing\n");
+			std::exit(1);
+		}
+	}
+	r.startup_ms = elapsed_ms(start);
+
+	std::uniform_int_distribution<std::size_t> pick_chain(0, chains.size() - 1);
+	std::uniform_int_distribution<int> pick(0, num_blocks - 1);
+	std::int64_t const misses = cnt[counters::blockchain_stmt_cache_misses];
+
+	start = clk::now();
+	for (int i = 0; i < num_queries; ++i)
+	{
+		auto const& c = chains[pick_chain(random_engine)];
+		if (repo->get_main_chain_block_by_number(c.id, pick(random_engine) + 1).empty())
+		{
+			std::fprintf(stderr, "block missing\n");
+			std::exit(1);
+		}
+	}
+	r.block_query_us = elapsed_ms(start) * 1000 / num_queries;
+
+	start = clk::now();
+	for (int i = 0; i < num_queries; ++i)
+	{
+		auto const& c = chains[pick_chain(random_engine)];
+		if (repo->get_account(c.id, c.accounts[std::size_t(pick(random_engine))]).balance() != 100)
+		{
+			std::fprintf(stderr, "account missing\n");
+			std::exit(1);
+		}
+	}
+	r.account_query_us = elapsed_ms(start) * 1000 / num_queries;
+	r.prepared = cnt[counters::blockchain_stmt_cache_misses] - misses;
+
+	start = clk::now();
+	for (int i = 0; i < follow_chains; ++i)
+	{
+		repo->begin_transaction();
+		create_chain(*repo, random_chain_id());
+		repo->commit();
+	}
+	r.follow_ms = elapsed_ms(start) / follow_chains;
+
+	repo.reset();
+	sqlite3_close(db);
+
+	return r;
+}
+
+void print(char const* name, int num_chains, result const& r)
+{
+	std::printf("%-9s %5d chains  schema: %6d  startup: %9.1f ms  block query: %6.2f us  "
+		"account query: %6.2f us  prepared: %6" PRId64 "  follow: %7.2f ms\n"
+		, name, num_chains, r.schema_entries, r.startup_ms, r.block_query_us
+		, r.account_query_us, r.prepared, r.follow_ms);
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+	if (argc > 3) usage();
+	if (argc > 1) num_blocks = std::atoi(argv[1]);
+	if (argc > 2) num_queries = std::atoi(argv[2]);
+	if (num_blocks <= 0 || num_queries <= 0) usage();
+
+	std::string const per_chain_path = "multichain_bench_per_chain.sqlite";
+	std::string const shared_path = "multichain_bench_shared.sqlite";
+
+	for (int const num_chains : chain_counts)
+	{
+		auto const chains = make_chains(num_chains);
+
+		print("per-chain", num_chains, run(false, per_chain_path, chains));
+		print("shared", num_chains, run(true, shared_path, chains));
+
+		// move the per chain tables into the shared ones
+		sqlite3* db = open_db(per_chain_path);
+		counters cnt;
+		{
+			repository_shared repo(db, cnt);
+			auto start = clk::now();
+			if (!repo.init())
+			{
+				std::fprintf(stderr, "migration failed\n");
+				return 1;
+			}
+			double const copy_ms = elapsed_ms(start);
+			auto const& c = chains.back();
+			if (repo.get_main_chain_block_by_number(c.id, num_blocks).empty()
+				|| repo.get_account(c.id, c.accounts.front()).balance() != 100)
+			{
+				std::fprintf(stderr, "migrated data missing\n");
+				return 1;
+			}
+
+			// normally done a little at a time by incremental_vacuum()
+			start = clk::now();
+			while (repo.drop_migrated_tables(seconds(1)) > 0);
+			double const drop_ms = elapsed_ms(start);
+			std::printf("migrate   %5d chains  copy: %9.1f ms  drop: %9.1f ms  schema: %6d\n"
+				, num_chains, copy_ms, drop_ms, schema_entries(db));
+		}
+		sqlite3_close(db);
+	}
+
+	remove_db(per_chain_path);
+	remove_db(shared_path);
+
+	return 0;
+}
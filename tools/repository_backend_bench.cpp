@@ -0,0 +1,259 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+// compares the sqlite and leveldb blockchain repositories on the two
+// workloads that dominate: applying synced blocks (one transaction per
+// block: the block, its tx in kv and a handful of account updates) and
+// point lookups of blocks, txs and accounts by key. Both run with every
+// block committed on its own, the settings_pack default, and with group
+// commit
+
+#include "libTAU/performance_counters.hpp"
+#include "libTAU/blockchain/repository_impl.hpp"
+#include "libTAU/blockchain/repository_leveldb.hpp"
+
+#include <leveldb/db.h>
+#include <sqlite3.h>
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace lt;
+using namespace lt::blockchain;
+
+namespace {
+
+using clk = std::chrono::steady_clock;
+
+std::mt19937 random_engine(1);
+
+int num_blocks = 20000;
+int num_accounts = 10000;
+int num_lookups = 100000;
+int group_transactions = 64;
+
+// accounts updated by every synced block
+int const accounts_per_block = 4;
+
+aux::bytes const chain_id{'b', 'e', 'n', 'c', 'h'};
+
+[[noreturn]] void usage()
+{
+	std::fprintf(stderr, "USAGE: repository_backend_bench [blocks] [accounts] [lookups] [group]\n\n"
+		"blocks    blocks applied in the sync phase (default 20000)\n"
+		"accounts  distinct accounts updated by the blocks (default 10000)\n"
+		"lookups   random block, tx and account lookups (default 100000)\n"
+		"group     block transactions per group commit (default 64)\n");
+	std::exit(1);
+}
+
+double elapsed_ms(clk::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(clk::now() - start).count();
+}
+
+struct workload
+{
+	std::vector<block> blocks;
+	std::vector<dht::public_key> accounts;
+};
+
+workload make_workload()
+{
+	workload w;
+
+	std::uniform_int_distribution<int> byte(0, 255);
+	w.accounts.resize(std::size_t(num_accounts));
+	for (auto& pk : w.accounts)
+		for (auto& b : pk.bytes) b = char(byte(random_engine));
+
+	sha1_hash previous;
+	w.blocks.reserve(std::size_t(num_blocks));
+	for (int i = 1; i <= num_blocks; ++i)
+	{
+		auto const& miner = w.accounts[std::size_t(i % num_accounts)];
+		std::string const note = "note " + std::to_string(i);
+		transaction const tx(chain_id, 1600000000 + i, miner, sha1_hash()
+			, aux::bytes(note.begin(), note.end()));
+		block const b(chain_id, block_version::block_version_1, 1600000000 + i, i, previous
+			, 1, std::uint64_t(i), sha1_hash(), sha1_hash(), sha1_hash(), tx, miner);
+		// round trip so the hash matches what the repositories decode
+		w.blocks.emplace_back(b.get_encode());
+		previous = w.blocks.back().sha1();
+	}
+
+	return w;
+}
+
+struct result
+{
+	double sync_ms = 0;
+	double block_lookup_us = 0;
+	double tx_lookup_us = 0;
+	double account_lookup_us = 0;
+	std::int64_t group_commits = 0;
+};
+
+result run(repository& repo, counters& cnt, workload const& w, int group)
+{
+	result r;
+
+	repo.init();
+	repo.add_new_chain(chain_id);
+	repo.create_block_db(chain_id);
+	repo.create_state_db(chain_id);
+	repo.create_kv_db(chain_id);
+	// the settings_pack default latency
+	repo.set_group_commit(group, 100);
+
+	std::uniform_int_distribution<int> pick(0, num_accounts - 1);
+
+	auto start = clk::now();
+	for (auto const& blk : w.blocks)
+	{
+		repo.begin_transaction();
+		repo.save_main_chain_block(blk);
+		repo.save_tx(chain_id, blk.tx());
+		for (int i = 0; i < accounts_per_block; ++i)
+		{
+			auto const& pk = w.accounts[std::size_t(pick(random_engine))];
+			auto act = repo.get_account(chain_id, pk);
+			repo.update_account(chain_id, account(pk, act.balance() + 1, act.nonce() + 1, act.power()));
+		}
+		repo.commit();
+	}
+	repo.flush(true);
+	r.sync_ms = elapsed_ms(start);
+	r.group_commits = cnt[counters::blockchain_group_commits];
+
+	std::uniform_int_distribution<int> pick_block(0, num_blocks - 1);
+
+	start = clk::now();
+	for (int i = 0; i < num_lookups; ++i)
+	{
+		auto const& blk = w.blocks[std::size_t(pick_block(random_engine))];
+		if (repo.get_block_by_hash(chain_id, blk.sha1()).empty())
+		{
+			std::fprintf(stderr, "block %" PRId64 " missing\n", blk.block_number());
+			std::exit(1);
+		}
+	}
+	r.block_lookup_us = elapsed_ms(start) * 1000 / num_lookups;
+
+	start = clk::now();
+	for (int i = 0; i < num_lookups; ++i)
+	{
+		auto const& blk = w.blocks[std::size_t(pick_block(random_engine))];
+		if (repo.get_tx_by_hash(chain_id, blk.tx().sha1()).empty())
+		{
+			std::fprintf(stderr, "tx of block %" PRId64 " missing\n", blk.block_number());
+			std::exit(1);
+		}
+	}
+	r.tx_lookup_us = elapsed_ms(start) * 1000 / num_lookups;
+
+	start = clk::now();
+	for (int i = 0; i < num_lookups; ++i)
+		repo.get_account(chain_id, w.accounts[std::size_t(pick(random_engine))]);
+	r.account_lookup_us = elapsed_ms(start) * 1000 / num_lookups;
+
+	return r;
+}
+
+void print(char const* name, int group, result const& r)
+{
+	std::printf("%-8s group %3d  sync: %9.1f ms (%6.1f us/block, %" PRId64 " group commits)  "
+		"block lookup: %6.2f us  tx lookup: %6.2f us  account lookup: %6.2f us\n"
+		, name, group, r.sync_ms, r.sync_ms * 1000 / num_blocks, r.group_commits
+		, r.block_lookup_us, r.tx_lookup_us, r.account_lookup_us);
+}
+
+void remove_databases(std::string const& sqldb_path, std::string const& kvdb_path)
+{
+	for (auto const& p : {sqldb_path, sqldb_path + "-wal", sqldb_path + "-shm", kvdb_path})
+		std::filesystem::remove_all(p);
+}
+
+bool run_sqlite(std::string const& path, workload const& w, int group)
+{
+	sqlite3* sqldb = nullptr;
+	if (sqlite3_open(path.c_str(), &sqldb) != SQLITE_OK)
+	{
+		std::fprintf(stderr, "failed to open %s\n", path.c_str());
+		sqlite3_close(sqldb);
+		return false;
+	}
+	// same as the session
+	sqlite3_exec(sqldb, "pragma journal_mode = WAL;", nullptr, nullptr, nullptr);
+	sqlite3_exec(sqldb, "pragma synchronous = normal;", nullptr, nullptr, nullptr);
+
+	counters cnt;
+	{
+		repository_impl repo(sqldb, cnt);
+		print("sqlite", group, run(repo, cnt, w, group));
+	}
+	sqlite3_close(sqldb);
+	return true;
+}
+
+bool run_leveldb(std::string const& path, workload const& w, int group)
+{
+	leveldb::Options options;
+	options.create_if_missing = true;
+	leveldb::DB* kvdb = nullptr;
+	leveldb::Status const status = leveldb::DB::Open(options, path, &kvdb);
+	if (!status.ok())
+	{
+		std::fprintf(stderr, "failed to open %s: %s\n", path.c_str(), status.ToString().c_str());
+		return false;
+	}
+
+	counters cnt;
+	{
+		repository_leveldb repo(kvdb, cnt);
+		print("leveldb", group, run(repo, cnt, w, group));
+	}
+	delete kvdb;
+	return true;
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+	if (argc > 5) usage();
+	if (argc > 1) num_blocks = std::atoi(argv[1]);
+	if (argc > 2) num_accounts = std::atoi(argv[2]);
+	if (argc > 3) num_lookups = std::atoi(argv[3]);
+	if (argc > 4) group_transactions = std::atoi(argv[4]);
+	if (num_blocks <= 0 || num_accounts <= 0 || num_lookups <= 0 || group_transactions <= 0) usage();
+
+	workload const w = make_workload();
+
+	std::string const sqldb_path = "repository_bench.sqlite";
+	std::string const kvdb_path = "repository_bench.leveldb";
+
+	for (int const group : {1, group_transactions})
+	{
+		remove_databases(sqldb_path, kvdb_path);
+		if (!run_sqlite(sqldb_path, w, group)) return 1;
+		if (!run_leveldb(kvdb_path, w, group)) return 1;
+	}
+	remove_databases(sqldb_path, kvdb_path);
+
+	return 0;
+}
@@ -0,0 +1,173 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+// measures dht::routing_table under churn. The table is filled with live
+// nodes and a full replacement list, then a stream of incoming packets is
+// replayed against it: most from nodes already in the table (node_seen),
+// some from nodes never seen before (heard_about), some timing out
+// (node_failed). It reports the packets handled per second, and how long
+// finding the node of a packet by its endpoint takes with the endpoint index
+// of the table and with a scan of every bucket, as find_node() did before.
+// The endpoint index is checked against the buckets at the end.
+
+#include "libTAU/kademlia/routing_table.hpp"
+#include "libTAU/kademlia/node_id.hpp"
+#include "libTAU/aux_/session_settings.hpp"
+#include "libTAU/settings_pack.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+using namespace lt;
+using namespace lt::dht;
+
+namespace {
+
+using clk = std::chrono::steady_clock;
+
+std::mt19937 random_engine(1);
+
+int num_packets = 200000;
+
+// nodes heard about to fill the table with
+int const initial_nodes = 5000;
+
+// share of packets, in percent, from new nodes and of timeouts. The rest
+// is from nodes in the table
+int const new_node_share = 20;
+int const failed_share = 10;
+
+[[noreturn]] void usage()
+{
+	std::fprintf(stderr, "USAGE: routing_table_bench [packets]\n\n"
+		"packets  incoming packets replayed (default 200000)\n");
+	std::exit(1);
+}
+
+node_id random_id()
+{
+	node_id ret;
+	for (auto& b : ret) b = std::uint8_t(random_engine());
+	return ret;
+}
+
+udp::endpoint random_endpoint()
+{
+	return udp::endpoint(address_v4(std::uint32_t(random_engine()))
+		, std::uint16_t(random_engine() % 65535 + 1));
+}
+
+// the linear scan find_node(udp::endpoint) used to be
+node_entry const* scan(routing_table const& table, udp::endpoint const& ep)
+{
+	for (auto const& b : table.buckets())
+	{
+		for (auto const& n : b.replacements)
+			if (n.ep() == ep) return &n;
+		for (auto const& n : b.live_nodes)
+			if (n.ep() == ep) return &n;
+	}
+	return nullptr;
+}
+
+double elapsed_ns(clk::time_point start, int count)
+{
+	return double(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		clk::now() - start).count()) / count;
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+	if (argc > 2) usage();
+	if (argc > 1) num_packets = std::atoi(argv[1]);
+	if (num_packets <= 0) usage();
+
+	aux::session_settings settings;
+	settings.set_bool(settings_pack::dht_prefer_verified_node_ids, false);
+	routing_table table(random_id(), udp::v4(), 8, settings, nullptr);
+
+	std::vector<std::pair<node_id, udp::endpoint>> nodes;
+	for (int i = 0; i < initial_nodes; ++i)
+	{
+		nodes.emplace_back(random_id(), random_endpoint());
+		if (i % 4 == 0) table.node_seen(nodes.back().first, nodes.back().second, 50, false);
+		else table.heard_about(nodes.back().first, nodes.back().second);
+	}
+
+	int live = 0;
+	int replacements = 0;
+	std::tie(live, replacements, std::ignore) = table.size();
+	std::printf("table: %d buckets, %d live nodes, %d replacements\n"
+		, table.num_active_buckets(), live, replacements);
+
+	// the packet stream
+	std::vector<std::pair<int, std::size_t>> packets;
+	packets.reserve(std::size_t(num_packets));
+	for (int i = 0; i < num_packets; ++i)
+	{
+		int const r = int(random_engine() % 100);
+		int const kind = r < new_node_share ? 0 : r < new_node_share + failed_share ? 1 : 2;
+		if (kind == 0) nodes.emplace_back(random_id(), random_endpoint());
+		packets.emplace_back(kind, kind == 0 ? nodes.size() - 1 : random_engine() % nodes.size());
+	}
+
+	auto start = clk::now();
+	for (auto const& p : packets)
+	{
+		auto const& n = nodes[p.second];
+		switch (p.first)
+		{
+			case 0: table.heard_about(n.first, n.second); break;
+			case 1: table.node_failed(n.first, n.second); break;
+			default: table.node_seen(n.first, n.second, 50, false); break;
+		}
+	}
+	double const packet_ns = elapsed_ns(start, num_packets);
+	std::printf("churn: %.0f packets/s (%.0f ns per packet)\n", 1e9 / packet_ns, packet_ns);
+
+	std::tie(live, replacements, std::ignore) = table.size();
+	std::printf("table: %d buckets, %d live nodes, %d replacements\n"
+		, table.num_active_buckets(), live, replacements);
+
+	// endpoint lookups alone, of nodes in the table and of unknown ones
+	int const lookups = std::min(num_packets, 200000);
+	std::vector<udp::endpoint> endpoints;
+	for (int i = 0; i < lookups; ++i)
+	{
+		endpoints.push_back(i % 2 == 0
+			? nodes[random_engine() % nodes.size()].second : random_endpoint());
+	}
+
+	int found = 0;
+	start = clk::now();
+	for (auto const& ep : endpoints)
+		if (std::get<0>(table.find_node(ep)) != nullptr) ++found;
+	double const index_ns = elapsed_ns(start, lookups);
+
+	int scan_found = 0;
+	start = clk::now();
+	for (auto const& ep : endpoints)
+		if (scan(table, ep) != nullptr) ++scan_found;
+	double const scan_ns = elapsed_ns(start, lookups);
+
+	std::printf("find_node(endpoint): index %.1f ns, scan %.1f ns (%.1fx), found %d / %d\n"
+		, index_ns, scan_ns, scan_ns / index_ns, found, scan_found);
+
+	bool const consistent = table.endpoint_index_consistent() && found == scan_found;
+	std::printf("endpoint index: %s\n", consistent ? "consistent" : "INCONSISTENT");
+	return consistent ? 0 : 1;
+}
@@ -0,0 +1,1154 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+// benchmarks the sqlite storage of a node on a synthetic workload, built
+// locally in a temporary directory:
+//
+//   blockchain  repository_impl: applying a chain of the given height, as
+//               blockchain::process_block() does, the epoch state root every
+//               CHAIN_EPOCH_BLOCK_SIZE blocks, point lookups of blocks and
+//               accounts, and rebranching to a fork of the given depth
+//   messages    message_db_impl: message inserts, lookups by hash and the
+//               latest messages of a friend pair
+//   message_history
+//               message_db_impl: the latest messages of every conversation
+//               of a long history, and paging back through it
+//   message_compression
+//               message_compressor: compression ratio and encode and decode
+//               time of chat payloads with a trained dictionary, only when
+//               built with zstd
+//   message_search
+//               message_db_impl: building the full text index of a long
+//               history, and searching it
+//   items       items_db_sqlite: DHT mutable item puts, gets and lookups of
+//               targets by prefix
+//   dht_storage dht_default_storage: DHT items put to the in memory store of
+//               the given size once it is full, each evicting the least
+//               important item, items refreshed, and node ID changes
+//
+// results are written as JSON, so that runs can be compared by a script
+
+#include "libTAU/performance_counters.hpp"
+#include "libTAU/blockchain/constants.hpp"
+#include "libTAU/blockchain/repository_impl.hpp"
+#include "libTAU/blockchain/repository_track.hpp"
+#include "libTAU/blockchain/state_commitment.hpp"
+#include "libTAU/communication/message_compressor.hpp"
+#include "libTAU/communication/message_db_impl.hpp"
+#include "libTAU/kademlia/dht_observer.hpp"
+#include "libTAU/kademlia/dht_storage.hpp"
+#include "libTAU/kademlia/items_db_sqlite.hpp"
+#include "libTAU/aux_/session_settings.hpp"
+#include "libTAU/bencode.hpp"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace lt;
+using namespace lt::blockchain;
+
+namespace {
+
+using clk = std::chrono::steady_clock;
+
+std::mt19937 random_engine(1);
+
+int height = 2000;
+int num_accounts = 1000;
+// percentage of blocks carrying a transfer, the others are empty or notes
+int transfer_percent = 60;
+int note_percent = 20;
+int rebranch_depth = 20;
+int num_messages = 20000;
+int num_history_messages = 1000000;
+int num_friends = 50;
+int num_items = 20000;
+int num_queries = 20000;
+int num_import_accounts = 100000;
+int num_store_items = 10000;
+char const* out_file = nullptr;
+
+// rebranches measured, each to a new fork of rebranch_depth blocks
+int const rebranch_rounds = 5;
+
+// full rebuilds of the epoch state measured
+int const full_rebuild_rounds = 5;
+
+aux::bytes const chain_id{'b', 'e', 'n', 'c', 'h'};
+
+[[noreturn]] void usage()
+{
+	std::fprintf(stderr, "USAGE: storage_bench [options]\n\n"
+		"OPTIONS:\n"
+		"-h <blocks>     height of the generated chain (default 2000)\n"
+		"-a <accounts>   accounts of the chain (default 1000)\n"
+		"-t <percent>    blocks carrying a transfer (default 60)\n"
+		"-n <percent>    blocks carrying a note (default 20)\n"
+		"-r <depth>      depth of the forks rebranched to (default 20)\n"
+		"-m <messages>   messages inserted (default 20000)\n"
+		"-f <friends>    friends the messages are exchanged with (default 50)\n"
+		"-M <messages>   messages of the history queried (default 1000000)\n"
+		"-i <items>      DHT items put (default 20000)\n"
+		"-q <queries>    random lookups of every kind (default 20000)\n"
+		"-s <accounts>   accounts of the imported genesis state (default 100000)\n"
+		"-d <items>      size of the in memory DHT item store (default 10000)\n"
+		"-o <file>       write the JSON results to file instead of stdout\n");
+	std::exit(1);
+}
+
+double elapsed_ms(clk::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(clk::now() - start).count();
+}
+
+double per_op_us(double ms, int ops)
+{
+	return ops > 0 ? ms * 1000 / ops : 0;
+}
+
+double per_second(double ms, int ops)
+{
+	return ms > 0 ? ops * 1000 / ms : 0;
+}
+
+template <typename T>
+T random_bytes()
+{
+	std::uniform_int_distribution<int> byte(0, 255);
+	T ret;
+	for (auto& b : ret) b = char(byte(random_engine));
+	return ret;
+}
+
+dht::public_key random_key()
+{
+	dht::public_key pk;
+	pk.bytes = random_bytes<std::array<char, dht::public_key::len>>();
+	return pk;
+}
+
+sqlite3* open_db(std::string const& path)
+{
+	sqlite3* db = nullptr;
+	if (sqlite3_open(path.c_str(), &db) != SQLITE_OK)
+	{
+		std::fprintf(stderr, "failed to open %s\n", path.c_str());
+		std::exit(1);
+	}
+	// same as the session
+	sqlite3_exec(db, "pragma auto_vacuum = INCREMENTAL;", nullptr, nullptr, nullptr);
+	sqlite3_exec(db, "pragma journal_mode = WAL;", nullptr, nullptr, nullptr);
+	sqlite3_exec(db, "pragma synchronous = normal;", nullptr, nullptr, nullptr);
+	return db;
+}
+
+void fail(char const* what)
+{
+	std::fprintf(stderr, "%s\n", what);
+	std::exit(1);
+}
+
+// results, in insertion order
+struct json_writer
+{
+	void begin(char const* name)
+	{
+		separate();
+		m_out.append("\"").append(name).append("\": {");
+		m_first = true;
+	}
+
+	void end()
+	{
+		m_out.append("}");
+		m_first = false;
+	}
+
+	void value(char const* name, double v)
+	{
+		char buf[64];
+		std::snprintf(buf, sizeof(buf), "%.3f", v);
+		separate();
+		m_out.append("\"").append(name).append("\": ").append(buf);
+	}
+
+	void value(char const* name, std::int64_t v)
+	{
+		separate();
+		m_out.append("\"").append(name).append("\": ").append(std::to_string(v));
+	}
+
+	std::string str() const { return "{" + m_out + "}\n"; }
+
+private:
+
+	void separate()
+	{
+		if (!m_first) m_out.append(", ");
+		m_first = false;
+	}
+
+	std::string m_out;
+	bool m_first = true;
+};
+
+// blockchain
+
+block make_block(dht::public_key const& miner, std::int64_t number
+	, sha1_hash const& previous, std::vector<dht::public_key> const& accounts, int salt)
+{
+	transaction tx;
+	std::uniform_int_distribution<int> percent(0, 99);
+	std::uniform_int_distribution<std::size_t> pick(0, accounts.size() - 1);
+	int const kind = percent(random_engine);
+	aux::bytes chain = chain_id;
+	aux::bytes payload(32, 'p');
+	if (kind < transfer_percent)
+	{
+		tx = transaction::create_transfer_transaction(chain, 1600000000 + number
+			, accounts[pick(random_engine)], accounts[pick(random_engine)], number, 5, 1, payload);
+	}
+	else if (kind < transfer_percent + note_percent)
+	{
+		tx = transaction::create_note_transaction(chain, 1600000000 + number
+			, accounts[pick(random_engine)], sha1_hash(), payload);
+	}
+
+	// salt keeps forks apart from the main chain
+	block const b(chain_id, block_version::block_version_1, 1600000000 + number * 10 + salt
+		, number, previous, 1, std::uint64_t(number), sha1_hash(), sha1_hash(), sha1_hash()
+		, tx, miner);
+	// round trip so the hash matches what the repository decodes
+	return block(b.get_encode());
+}
+
+std::vector<block> make_chain(std::vector<dht::public_key> const& accounts
+	, block const& parent, int length, int salt)
+{
+	std::uniform_int_distribution<std::size_t> pick(0, accounts.size() - 1);
+	std::vector<block> blocks;
+	sha1_hash previous = parent.empty() ? sha1_hash() : parent.sha1();
+	std::int64_t number = parent.empty() ? 0 : parent.block_number();
+	for (int i = 0; i < length; ++i)
+	{
+		blocks.push_back(make_block(accounts[pick(random_engine)], ++number, previous, accounts, salt));
+		previous = blocks.back().sha1();
+	}
+	return blocks;
+}
+
+// account changes of a block, as blockchain::process_block() and
+// blockchain::try_to_rebranch() apply them. sign is -1 to roll back
+bool apply_block(repository& repo, block const& blk, int const sign)
+{
+	std::map<dht::public_key, account> accounts;
+	for (auto const& peer : blk.get_block_peers())
+		accounts[peer] = repo.get_account(chain_id, peer);
+
+	auto const& tx = blk.tx();
+	if (!tx.empty() && tx.type() == type_transfer)
+	{
+		accounts[tx.receiver()].add_balance(sign * tx.amount());
+		accounts[tx.sender()].subtract_balance(sign * tx.cost());
+		if (sign > 0) accounts[tx.sender()].increase_nonce();
+		else accounts[tx.sender()].decrease_nonce();
+	}
+	accounts[blk.miner()].add_balance(sign * MINER_BONUS);
+	if (sign > 0) accounts[blk.miner()].increase_power();
+	else accounts[blk.miner()].decrease_power();
+
+	for (auto const& item : accounts)
+	{
+		if (!repo.update_account(chain_id, item.second)) return false;
+	}
+	return true;
+}
+
+// the epoch state root, as blockchain::generate_genesis_state() does
+void generate_state(repository& repo, state_commitment& commitment)
+{
+	bool reset = false;
+	auto const touched = repo.take_touched_accounts(chain_id, reset);
+	if (reset || !commitment.valid())
+	{
+		commitment.reset(repo.get_all_effective_state(chain_id));
+	}
+	else
+	{
+		std::vector<account> changed;
+		std::vector<dht::public_key> removed;
+		for (auto const& peer : touched)
+		{
+			auto act = repo.get_account(chain_id, peer);
+			if (!act.empty() || repo.is_account_existed(chain_id, peer)) changed.push_back(act);
+			else removed.push_back(peer);
+		}
+		commitment.update(changed, removed);
+	}
+
+	for (auto const& a : commitment.unsaved_state_arrays()) repo.save_state_array(chain_id, a);
+	for (auto const& a : commitment.unsaved_hash_arrays()) repo.save_hash_array(chain_id, a);
+	commitment.mark_saved();
+}
+
+void bench_blockchain(std::string const& dir, json_writer& out)
+{
+	std::vector<dht::public_key> accounts;
+	for (int i = 0; i < num_accounts; ++i) accounts.push_back(random_key());
+	auto const blocks = make_chain(accounts, block(), height, 0);
+
+	sqlite3* db = open_db(dir + "/blockchain.sqlite");
+	counters cnt;
+	{
+		repository_impl repo(db, cnt);
+		if (!repo.init() || !repo.create_block_db(chain_id) || !repo.create_state_db(chain_id)
+			|| !repo.create_kv_db(chain_id) || !repo.add_new_chain(chain_id))
+			fail("failed to create chain");
+		// same defaults as settings_pack
+		repo.set_group_commit(64, 100);
+
+		// every account starts with some balance, as after a genesis block
+		repo.begin_transaction();
+		for (auto const& pk : accounts)
+			repo.save_account(chain_id, account(pk, 1000000, 0, 0));
+		repo.commit();
+
+		state_commitment commitment;
+		double epoch_ms = 0;
+		int epochs = 0;
+
+		double apply_ms = 0;
+		for (auto const& blk : blocks)
+		{
+			auto start = clk::now();
+			repo.begin_transaction();
+			if (!apply_block(repo, blk, 1) || !repo.save_main_chain_block(blk))
+				fail("failed to apply block");
+			repo.commit();
+			apply_ms += elapsed_ms(start);
+
+			if (blk.block_number() % CHAIN_EPOCH_BLOCK_SIZE == 0)
+			{
+				start = clk::now();
+				repo.begin_transaction();
+				generate_state(repo, commitment);
+				repo.commit();
+				// the first one is a full rebuild, measured below
+				if (epochs > 0) epoch_ms += elapsed_ms(start);
+				++epochs;
+			}
+		}
+		auto start = clk::now();
+		repo.flush(true);
+		apply_ms += elapsed_ms(start);
+
+		// after a restart, or a state reset
+		double full_epoch_ms = 0;
+		for (int i = 0; i < full_rebuild_rounds; ++i)
+		{
+			commitment.invalidate();
+			start = clk::now();
+			repo.begin_transaction();
+			generate_state(repo, commitment);
+			repo.commit();
+			full_epoch_ms += elapsed_ms(start);
+		}
+		start = clk::now();
+		repo.flush(true);
+		full_epoch_ms += elapsed_ms(start);
+
+		out.begin("block_apply");
+		out.value("blocks", std::int64_t(height));
+		out.value("total_ms", apply_ms);
+		out.value("blocks_per_second", per_second(apply_ms, height));
+		out.value("us_per_block", per_op_us(apply_ms, height));
+		out.value("group_commits", cnt[counters::blockchain_group_commits]);
+		out.end();
+
+		out.begin("epoch_state");
+		out.value("accounts", std::int64_t(num_accounts));
+		out.value("epochs", std::int64_t(epochs));
+		out.value("full_rebuild_ms", full_epoch_ms / full_rebuild_rounds);
+		out.value("incremental_ms", epochs > 1 ? epoch_ms / (epochs - 1) : 0.0);
+		out.end();
+
+		std::uniform_int_distribution<std::size_t> pick_block(0, blocks.size() - 1);
+		std::uniform_int_distribution<std::size_t> pick_account(0, accounts.size() - 1);
+
+		start = clk::now();
+		for (int i = 0; i < num_queries; ++i)
+		{
+			if (repo.get_block_by_hash(chain_id, blocks[pick_block(random_engine)].sha1()).empty())
+				fail("block missing");
+		}
+		double const by_hash_ms = elapsed_ms(start);
+
+		start = clk::now();
+		for (int i = 0; i < num_queries; ++i)
+		{
+			if (repo.get_main_chain_block_by_number(chain_id
+				, blocks[pick_block(random_engine)].block_number()).empty())
+				fail("main chain block missing");
+		}
+		double const by_number_ms = elapsed_ms(start);
+
+		start = clk::now();
+		for (int i = 0; i < num_queries; ++i)
+		{
+			if (repo.get_account(chain_id, accounts[pick_account(random_engine)]).empty())
+				fail("account missing");
+		}
+		double const account_ms = elapsed_ms(start);
+
+		out.begin("point_lookups");
+		out.value("queries", std::int64_t(num_queries));
+		out.value("block_by_hash_us", per_op_us(by_hash_ms, num_queries));
+		out.value("block_by_number_us", per_op_us(by_number_ms, num_queries));
+		out.value("account_us", per_op_us(account_ms, num_queries));
+		out.end();
+
+		// forks of rebranch_depth blocks, one block longer than the main
+		// chain they replace, so the head moves on every round
+		int const depth = std::min(rebranch_depth, height - 1);
+		block head = blocks.back();
+		double rebranch_ms = 0;
+		for (int round = 0; round < rebranch_rounds; ++round)
+		{
+			std::vector<block> rollback;
+			block fork_point = head;
+			for (int i = 0; i < depth; ++i)
+			{
+				rollback.push_back(fork_point);
+				fork_point = repo.get_block_by_hash(chain_id, fork_point.previous_block_hash());
+				if (fork_point.empty()) fail("fork point missing");
+			}
+
+			auto const fork = make_chain(accounts, fork_point, depth + 1, round + 1);
+			for (auto const& blk : fork) repo.save_block_if_not_exist(blk);
+			repo.flush(true);
+
+			start = clk::now();
+			repo.begin_transaction();
+			for (auto const& blk : rollback)
+			{
+				if (!apply_block(repo, blk, -1) || !repo.set_block_non_main_chain(chain_id, blk.sha1()))
+					fail("failed to roll back block");
+			}
+			for (auto const& blk : fork)
+			{
+				if (!apply_block(repo, blk, 1) || !repo.save_main_chain_block(blk))
+					fail("failed to connect block");
+			}
+			repo.commit();
+			repo.flush(true);
+			rebranch_ms += elapsed_ms(start);
+
+			head = fork.back();
+		}
+
+		out.begin("rebranch");
+		out.value("depth", std::int64_t(depth));
+		out.value("rounds", std::int64_t(rebranch_rounds));
+		out.value("ms", rebranch_ms / rebranch_rounds);
+		out.end();
+	}
+	sqlite3_close(db);
+}
+
+// the state of a genesis block, written account by account and in bulk.
+// Through repository_track, as blockchain imports it
+void bench_state_import(std::string const& dir, json_writer& out)
+{
+	std::vector<account> state;
+	for (int i = 0; i < num_import_accounts; ++i)
+		state.emplace_back(random_key(), 1000000, 0, 0);
+
+	sqlite3* db = open_db(dir + "/state_import.sqlite");
+	counters cnt;
+	{
+		repository_track repo(std::make_shared<repository_impl>(db, cnt));
+		if (!repo.init() || !repo.create_state_db(chain_id) || !repo.add_new_chain(chain_id))
+			fail("failed to create chain");
+
+		auto start = clk::now();
+		repo.begin_transaction();
+		if (!repo.clear_all_state(chain_id)) fail("failed to clear state");
+		for (auto const& act : state)
+		{
+			if (!repo.update_account(chain_id, act)) fail("failed to save account");
+		}
+		repo.commit();
+		repo.flush(true);
+		double const per_account_ms = elapsed_ms(start);
+
+		start = clk::now();
+		repo.begin_transaction();
+		if (!repo.replace_all_state(chain_id, state)) fail("failed to import state");
+		repo.commit();
+		repo.flush(true);
+		double const bulk_ms = elapsed_ms(start);
+
+		out.begin("state_import");
+		out.value("accounts", std::int64_t(num_import_accounts));
+		out.value("per_account_ms", per_account_ms);
+		out.value("bulk_ms", bulk_ms);
+		out.value("accounts_per_second", per_second(bulk_ms, num_import_accounts));
+		out.end();
+	}
+	sqlite3_close(db);
+}
+
+// messages
+
+void bench_messages(std::string const& dir, json_writer& out)
+{
+	dht::public_key const self = random_key();
+	std::vector<dht::public_key> friends;
+	for (int i = 0; i < num_friends; ++i) friends.push_back(random_key());
+
+	std::uniform_int_distribution<std::size_t> pick_friend(0, friends.size() - 1);
+	std::uniform_int_distribution<int> payload_size(16, 256);
+	std::vector<communication::message> messages;
+	for (int i = 0; i < num_messages; ++i)
+	{
+		auto const& peer = friends[pick_friend(random_engine)];
+		bool const sent = i % 2 == 0;
+		aux::bytes payload(std::size_t(payload_size(random_engine)), char('a' + i % 26));
+		messages.emplace_back(1600000000 + i, sent ? self : peer, sent ? peer : self, payload);
+	}
+
+	sqlite3* db = open_db(dir + "/messages.sqlite");
+	counters cnt;
+	{
+		communication::message_db_impl msg_db(db, cnt);
+		if (!msg_db.init()) fail("failed to create message tables");
+		for (auto const& f : friends) msg_db.save_friend(f);
+
+		// messages arrive one at a time, each its own transaction
+		auto start = clk::now();
+		for (auto const& msg : messages)
+		{
+			if (!msg_db.save_message_if_not_exist(msg)) fail("failed to save message");
+		}
+		double const insert_ms = elapsed_ms(start);
+
+		// a message arriving again, from another peer
+		start = clk::now();
+		for (int i = 0; i < num_queries; ++i)
+			msg_db.save_message_if_not_exist(messages[std::size_t(i) % messages.size()]);
+		double const duplicate_ms = elapsed_ms(start);
+
+		std::uniform_int_distribution<std::size_t> pick_message(0, messages.size() - 1);
+		start = clk::now();
+		for (int i = 0; i < num_queries; ++i)
+		{
+			if (msg_db.get_message_by_hash(messages[pick_message(random_engine)].sha1()).empty())
+				fail("message missing");
+		}
+		double const by_hash_ms = elapsed_ms(start);
+
+		start = clk::now();
+		for (int i = 0; i < num_queries; ++i)
+		{
+			if (msg_db.is_message_in_db(random_bytes<sha1_hash>()))
+				fail("unexpected message");
+		}
+		double const miss_ms = elapsed_ms(start);
+
+		// the slowest kind of query, run fewer of them
+		int const history_queries = std::max(1, num_queries / 10);
+		start = clk::now();
+		for (int i = 0; i < history_queries; ++i)
+			msg_db.get_latest_ten_transactions(self, friends[pick_friend(random_engine)]);
+		double const latest_ms = elapsed_ms(start);
+
+		out.begin("messages");
+		out.value("messages", std::int64_t(num_messages));
+		out.value("friends", std::int64_t(num_friends));
+		out.value("inserts_per_second", per_second(insert_ms, num_messages));
+		out.value("insert_us", per_op_us(insert_ms, num_messages));
+		out.value("duplicate_insert_us", per_op_us(duplicate_ms, num_queries));
+		out.value("by_hash_us", per_op_us(by_hash_ms, num_queries));
+		out.value("missing_us", per_op_us(miss_ms, num_queries));
+		out.value("filter_false_positives", cnt[counters::communication_message_filter_false_positives]);
+		out.value("filter_bytes", cnt[counters::communication_message_filter_size]);
+		out.value("latest_ten_us", per_op_us(latest_ms, history_queries));
+		out.end();
+	}
+	sqlite3_close(db);
+}
+
+// the latest messages of every conversation, both directions, with the
+// history of all friends in the table
+void bench_message_history(std::string const& dir, json_writer& out)
+{
+	dht::public_key const self = random_key();
+	std::vector<dht::public_key> friends;
+	for (int i = 0; i < num_friends; ++i) friends.push_back(random_key());
+
+	sqlite3* db = open_db(dir + "/message_history.sqlite");
+	counters cnt;
+	{
+		communication::message_db_impl msg_db(db, cnt);
+		if (!msg_db.init()) fail("failed to create message tables");
+
+		// too many to generate up front, and loading is not what is measured
+		std::uniform_int_distribution<std::size_t> pick_friend(0, friends.size() - 1);
+		std::uniform_int_distribution<int> payload_size(16, 256);
+		auto start = clk::now();
+		sqlite3_exec(db, "BEGIN", nullptr, nullptr, nullptr);
+		for (int i = 0; i < num_history_messages; ++i)
+		{
+			auto const& peer = friends[pick_friend(random_engine)];
+			bool const sent = i % 2 == 0;
+			aux::bytes payload(std::size_t(payload_size(random_engine)), char('a' + i % 26));
+			communication::message const msg(1600000000 + i, sent ? self : peer, sent ? peer : self, payload);
+			if (!msg_db.save_message_if_not_exist(msg)) fail("failed to save message");
+		}
+		sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr);
+		double const load_ms = elapsed_ms(start);
+
+		// every conversation is queried the same number of times, the
+		// slowest one shows a conversation that is not served by the index
+		int const rounds = std::max(1, num_queries / (2 * num_friends));
+		double latest_ms = 0;
+		double latest_ten_ms = 0;
+		double slowest_ten_us = 0;
+		for (auto const& peer : friends)
+		{
+			start = clk::now();
+			for (int i = 0; i < rounds; ++i)
+			{
+				bool const sent = !msg_db.get_latest_transaction(self, peer).empty();
+				bool const received = !msg_db.get_latest_transaction(peer, self).empty();
+				if (!sent && !received) fail("conversation missing");
+			}
+			latest_ms += elapsed_ms(start);
+
+			start = clk::now();
+			for (int i = 0; i < rounds; ++i)
+			{
+				msg_db.get_latest_ten_transactions(self, peer);
+				msg_db.get_latest_ten_transactions(peer, self);
+			}
+			double const ms = elapsed_ms(start);
+			latest_ten_ms += ms;
+			slowest_ten_us = std::max(slowest_ten_us, per_op_us(ms, 2 * rounds));
+		}
+		int const queries = 2 * rounds * num_friends;
+
+		// scrolling back through a conversation, a page at a time, as far
+		// as the history goes
+		int pages = 0;
+		int paged_messages = 0;
+		start = clk::now();
+		for (auto const& peer : friends)
+		{
+			communication::message_cursor cursor;
+			for (int i = 0; i < rounds; ++i)
+			{
+				auto const page = msg_db.get_message_page(self, peer, cursor, 50);
+				++pages;
+				paged_messages += int(page.messages.size());
+				if (!page.more) break;
+				cursor = page.next;
+			}
+		}
+		double const page_ms = elapsed_ms(start);
+
+		out.begin("message_history");
+		out.value("messages", std::int64_t(num_history_messages));
+		out.value("conversations", std::int64_t(num_friends));
+		out.value("load_ms", load_ms);
+		out.value("latest_us", per_op_us(latest_ms, queries));
+		out.value("latest_ten_us", per_op_us(latest_ten_ms, queries));
+		out.value("slowest_conversation_latest_ten_us", slowest_ten_us);
+		out.value("page_of_50_us", per_op_us(page_ms, pages));
+		out.value("paged_messages", std::int64_t(paged_messages));
+		out.end();
+	}
+	sqlite3_close(db);
+}
+
+// chat payloads, as the apps send them: short JSON documents, mostly text
+// drawn from a small vocabulary
+char const* const chat_words[] = {"hello", "are", "we", "still", "meeting"
+	, "at", "the", "station", "tomorrow", "I", "will", "be", "late", "sorry"
+	, "see", "you", "there", "thanks", "ok", "what", "time", "is", "it"
+	, "dinner", "tonight", "sounds", "good", "call", "me", "when", "home"};
+
+aux::bytes make_chat_payload(int const id)
+{
+	static char const* const types[] = {"text", "text", "text", "picture", "reply"};
+	std::uniform_int_distribution<std::size_t> pick_word(0, std::size(chat_words) - 1);
+	std::uniform_int_distribution<std::size_t> pick_type(0, std::size(types) - 1);
+	std::uniform_int_distribution<int> length(3, 30);
+
+	std::string text;
+	for (int w = length(random_engine); w > 0; --w)
+	{
+		if (!text.empty()) text += ' ';
+		text += chat_words[pick_word(random_engine)];
+	}
+	std::string const doc = "{\"version\":1,\"type\":\"" + std::string(types[pick_type(random_engine)])
+		+ "\",\"id\":" + std::to_string(1600000000 + id)
+		+ ",\"content\":\"" + text + "\"}";
+	return aux::bytes(doc.begin(), doc.end());
+}
+
+std::vector<aux::bytes> make_chat_corpus(int const num)
+{
+	std::vector<aux::bytes> ret;
+	for (int i = 0; i < num; ++i) ret.push_back(make_chat_payload(i));
+	return ret;
+}
+
+void bench_message_compression(json_writer& out)
+{
+	if (!communication::message_compressor::available()) return;
+
+	auto const corpus = make_chat_corpus(num_messages);
+
+	// message_db_impl trains from the latest stored messages, the oldest
+	// ones here
+	std::vector<aux::bytes> const samples(corpus.begin()
+		, corpus.begin() + std::min(std::ptrdiff_t(4000), std::ptrdiff_t(corpus.size())));
+	auto start = clk::now();
+	std::string const dict = communication::message_compressor::train(samples
+		, communication::message_dictionary_size);
+	double const train_ms = elapsed_ms(start);
+
+	communication::message_compressor compressor;
+	if (!compressor.add_dictionary(1, dict)) fail("failed to train dictionary");
+
+	std::int64_t raw_bytes = 0;
+	std::int64_t stored_bytes = 0;
+	std::vector<std::string> compressed(corpus.size());
+	start = clk::now();
+	for (std::size_t i = 0; i < corpus.size(); ++i)
+	{
+		// a payload that does not shrink is stored as it is
+		if (!compressor.compress(corpus[i], compressed[i])) compressed[i].clear();
+	}
+	double const encode_ms = elapsed_ms(start);
+
+	aux::bytes payload;
+	start = clk::now();
+	for (auto const& c : compressed)
+	{
+		if (c.empty()) continue;
+		if (!compressor.decompress(1, c.data(), int(c.size()), payload)) fail("failed to decompress");
+	}
+	double const decode_ms = elapsed_ms(start);
+
+	int stored_compressed = 0;
+	for (std::size_t i = 0; i < corpus.size(); ++i)
+	{
+		raw_bytes += std::int64_t(corpus[i].size());
+		if (compressed[i].empty())
+		{
+			stored_bytes += std::int64_t(corpus[i].size());
+			continue;
+		}
+		stored_bytes += std::int64_t(compressed[i].size());
+		++stored_compressed;
+		if (!compressor.decompress(1, compressed[i].data(), int(compressed[i].size()), payload)
+			|| payload != corpus[i])
+			fail("payload does not round trip");
+	}
+
+	out.begin("message_compression");
+	out.value("messages", std::int64_t(corpus.size()));
+	out.value("compressed_messages", std::int64_t(stored_compressed));
+	out.value("dictionary_bytes", std::int64_t(dict.size()));
+	out.value("train_ms", train_ms);
+	out.value("raw_bytes", raw_bytes);
+	out.value("stored_bytes", stored_bytes);
+	out.value("ratio", stored_bytes > 0 ? double(raw_bytes) / double(stored_bytes) : 0.0);
+	out.value("encode_ns", per_op_us(encode_ms, int(corpus.size())) * 1000);
+	out.value("decode_ns", per_op_us(decode_ms, std::max(1, stored_compressed)) * 1000);
+	out.end();
+}
+
+// text of a large vocabulary, with word frequencies following Zipf's law
+// as in natural language. A few ranks are named, to be searched for
+struct zipf_text
+{
+	zipf_text()
+	{
+		std::vector<double> weights;
+		for (int i = 0; i < vocabulary; ++i)
+		{
+			words.push_back("w" + std::to_string(i));
+			weights.push_back(1.0 / (i + 1));
+		}
+		words[0] = "the";
+		words[5] = "dinner";
+		words[300] = "tonight";
+		pick = std::discrete_distribution<int>(weights.begin(), weights.end());
+	}
+
+	aux::bytes operator()()
+	{
+		std::uniform_int_distribution<int> length(3, 30);
+		std::string text;
+		for (int w = length(random_engine); w > 0; --w)
+		{
+			if (!text.empty()) text += ' ';
+			text += words[std::size_t(pick(random_engine))];
+		}
+		return aux::bytes(text.begin(), text.end());
+	}
+
+	static constexpr int vocabulary = 20000;
+	std::vector<std::string> words;
+	std::discrete_distribution<int> pick;
+};
+
+// building the full text index over a long history, as when search is
+// turned on, and searching it. Without an executor the batches run inline
+// in init, so the build is timed there
+void bench_message_search(std::string const& dir, json_writer& out)
+{
+	dht::public_key const self = random_key();
+	std::vector<dht::public_key> friends;
+	for (int i = 0; i < num_friends; ++i) friends.push_back(random_key());
+
+	sqlite3* db = open_db(dir + "/message_search.sqlite");
+	counters cnt;
+	{
+		communication::message_db_impl msg_db(db, cnt);
+		if (!msg_db.init()) fail("failed to create message tables");
+
+		zipf_text text;
+		std::uniform_int_distribution<std::size_t> pick_friend(0, friends.size() - 1);
+		sqlite3_exec(db, "BEGIN", nullptr, nullptr, nullptr);
+		for (int i = 0; i < num_history_messages; ++i)
+		{
+			auto const& peer = friends[pick_friend(random_engine)];
+			bool const sent = i % 2 == 0;
+			communication::message const msg(1600000000 + i, sent ? self : peer, sent ? peer : self, text());
+			if (!msg_db.save_message_if_not_exist(msg)) fail("failed to save message");
+		}
+		sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr);
+	}
+
+	auto const page_count = [db]
+	{
+		sqlite3_stmt* stmt = nullptr;
+		std::int64_t pages = 0;
+		if (sqlite3_prepare_v2(db, "pragma page_count", -1, &stmt, nullptr) == SQLITE_OK
+			&& sqlite3_step(stmt) == SQLITE_ROW)
+			pages = sqlite3_column_int64(stmt, 0);
+		sqlite3_finalize(stmt);
+		return pages;
+	};
+	std::int64_t const pages_before = page_count();
+
+	{
+		auto start = clk::now();
+		communication::message_db_impl msg_db(db, cnt, false, true);
+		if (!msg_db.init()) fail("failed to build the search index");
+		double const build_ms = elapsed_ms(start);
+		std::int64_t const index_pages = page_count() - pages_before;
+
+		out.begin("message_search");
+		out.value("messages", std::int64_t(num_history_messages));
+		out.value("index_build_ms", build_ms);
+		out.value("index_build_messages_per_second", per_second(build_ms, num_history_messages));
+		out.value("index_pages", index_pages);
+
+		// a word in about 1 in 4 messages, one in most of them, a rare one,
+		// two words, a phrase and a prefix
+		struct query { char const* name; char const* text; };
+		query const queries[] = {{"word", "dinner"}, {"common_word", "the"}
+			, {"rare_word", "w15000"}, {"two_words", "dinner tonight"}
+			, {"phrase", "\"dinner tonight\""}, {"prefix", "w19*"}};
+		int const rounds = std::max(1, num_queries / 2000);
+		for (auto const& q : queries)
+		{
+			for (auto const order : {communication::message_search_order::best_match
+				, communication::message_search_order::newest})
+			{
+				start = clk::now();
+				for (int i = 0; i < rounds; ++i)
+					msg_db.search_messages(q.text, 20, order);
+				std::string const name = std::string(q.name)
+					+ (order == communication::message_search_order::best_match ? "_best_us" : "_newest_us");
+				out.value(name.c_str(), per_op_us(elapsed_ms(start), rounds));
+			}
+		}
+		out.end();
+	}
+	sqlite3_close(db);
+}
+
+// DHT items
+
+// items_db_sqlite only asks the observer for its database. Without a
+// storage executor, items are written on the calling thread
+struct items_observer final : dht::dht_observer
+{
+	explicit items_observer(sqlite3* db) : m_db(db) {}
+
+#ifndef TORRENT_DISABLE_LOGGING
+	bool should_log(module_t) const override { return false; }
+	bool should_log(module_t, aux::LOG_LEVEL) const override { return false; }
+	void log(module_t, char const*, ...) override {}
+	void log_packet(message_direction_t, span<char const>
+		, udp::endpoint const&) override {}
+#endif
+	void set_external_address(aux::listen_socket_handle const&
+		, address const&, address const&) override {}
+	int get_listen_port(aux::transport, aux::listen_socket_handle const&) override { return 0; }
+	void get_peers(sha256_hash const&) override {}
+	void outgoing_get_peers(sha256_hash const&, sha256_hash const&
+		, udp::endpoint const&) override {}
+	void announce(sha256_hash const&, address const&, int) override {}
+	bool on_dht_request(string_view, dht::msg const&, entry&) override { return false; }
+	void on_dht_item(dht::item&) override {}
+	std::int64_t get_time() override { return 0; }
+	void on_dht_relay(dht::public_key const&, entry const&) override {}
+	sqlite3* get_items_database() override { return m_db; }
+	aux::storage_executor* get_storage_executor() override { return nullptr; }
+
+private:
+	sqlite3* m_db;
+};
+
+void bench_items(std::string const& dir, json_writer& out)
+{
+	std::vector<sha256_hash> targets;
+	for (int i = 0; i < num_items; ++i) targets.push_back(random_bytes<sha256_hash>());
+
+	std::string value;
+	bencode(std::back_inserter(value), entry(std::string(200, 'v')));
+	dht::public_key const pk = random_key();
+	dht::signature sig;
+
+	sqlite3* db = open_db(dir + "/items.sqlite");
+	{
+		aux::session_settings settings;
+		// keep everything, pruning is not measured
+		settings.set_int(settings_pack::dht_items_db_max_count, num_items * 2);
+		items_observer observer(db);
+		dht::items_db_sqlite items(settings, &observer);
+
+		auto start = clk::now();
+		std::int64_t ts = 1;
+		for (auto const& target : targets)
+		{
+			items.put_mutable_item(target, value, sig, dht::timestamp(ts++), pk
+				, span<char const>(), address());
+		}
+		double const put_ms = elapsed_ms(start);
+
+		std::uniform_int_distribution<std::size_t> pick(0, targets.size() - 1);
+		start = clk::now();
+		for (int i = 0; i < num_queries; ++i)
+		{
+			entry item;
+			if (!items.get_mutable_item(targets[pick(random_engine)], dht::timestamp(0), true, item))
+				fail("item missing");
+		}
+		double const get_ms = elapsed_ms(start);
+
+		// the first 12 bytes of a stored target
+		start = clk::now();
+		for (int i = 0; i < num_queries; ++i)
+		{
+			sha256_hash prefix = targets[pick(random_engine)];
+			std::fill(prefix.begin() + 12, prefix.end(), std::uint8_t(0));
+			sha256_hash target;
+			if (!items.get_mutable_item_target(prefix, target))
+				fail("item target missing");
+		}
+		double const prefix_ms = elapsed_ms(start);
+
+		items.close();
+
+		out.begin("dht_items");
+		out.value("items", std::int64_t(num_items));
+		out.value("puts_per_second", per_second(put_ms, num_items));
+		out.value("put_us", per_op_us(put_ms, num_items));
+		out.value("get_us", per_op_us(get_ms, num_queries));
+		out.value("target_by_prefix_us", per_op_us(prefix_ms, num_queries));
+		out.end();
+	}
+	sqlite3_close(db);
+}
+
+void bench_dht_storage(json_writer& out)
+{
+	aux::session_settings settings;
+	settings.set_int(settings_pack::dht_max_dht_items, num_store_items);
+	std::unique_ptr<dht::dht_storage_interface> store(dht::dht_default_storage_constructor(settings));
+
+	std::vector<sha256_hash> node_ids;
+	for (int i = 0; i < 3; ++i) node_ids.push_back(random_bytes<sha256_hash>());
+	store->update_node_ids(node_ids);
+
+	std::string value;
+	bencode(std::back_inserter(value), entry(std::string(200, 'v')));
+	dht::public_key const pk = random_key();
+	dht::signature sig;
+
+	auto random_address = [] { return address(address_v4(std::uint32_t(random_engine()))); };
+
+	std::vector<sha256_hash> immutable_targets;
+	std::vector<sha256_hash> mutable_targets;
+	for (int i = 0; i < num_store_items; ++i)
+	{
+		immutable_targets.push_back(random_bytes<sha256_hash>());
+		mutable_targets.push_back(random_bytes<sha256_hash>());
+	}
+
+	auto start = clk::now();
+	std::int64_t ts = 1;
+	for (int i = 0; i < num_store_items; ++i)
+	{
+		store->put_immutable_item(immutable_targets[std::size_t(i)], value, random_address());
+		store->put_mutable_item(mutable_targets[std::size_t(i)], value, sig
+			, dht::timestamp(ts++), pk, span<char const>(), random_address());
+	}
+	double const fill_ms = elapsed_ms(start);
+
+	// the store is full, every new item evicts one
+	start = clk::now();
+	for (int i = 0; i < num_items; ++i)
+		store->put_immutable_item(random_bytes<sha256_hash>(), value, random_address());
+	double const immutable_churn_ms = elapsed_ms(start);
+
+	start = clk::now();
+	for (int i = 0; i < num_items; ++i)
+	{
+		store->put_mutable_item(random_bytes<sha256_hash>(), value, sig
+			, dht::timestamp(ts++), pk, span<char const>(), random_address());
+	}
+	double const mutable_churn_ms = elapsed_ms(start);
+
+	// items put again by other nodes, whether or not they are still stored
+	std::uniform_int_distribution<std::size_t> pick(0, std::size_t(num_store_items) - 1);
+	start = clk::now();
+	for (int i = 0; i < num_queries; ++i)
+		store->put_immutable_item(immutable_targets[pick(random_engine)], value, random_address());
+	double const refresh_ms = elapsed_ms(start);
+
+	int const id_changes = 10;
+	start = clk::now();
+	for (int i = 0; i < id_changes; ++i)
+	{
+		node_ids[std::size_t(i) % node_ids.size()] = random_bytes<sha256_hash>();
+		store->update_node_ids(node_ids);
+	}
+	double const id_change_ms = elapsed_ms(start);
+
+	auto const cnt = store->counters();
+	if (cnt.immutable_data != num_store_items || cnt.mutable_data != num_store_items)
+		fail("dht store size mismatch");
+
+	out.begin("dht_storage");
+	out.value("items", std::int64_t(num_store_items));
+	out.value("fill_put_us", per_op_us(fill_ms, num_store_items * 2));
+	out.value("immutable_evicting_put_us", per_op_us(immutable_churn_ms, num_items));
+	out.value("mutable_evicting_put_us", per_op_us(mutable_churn_ms, num_items));
+	out.value("evicting_puts_per_second", per_second(immutable_churn_ms + mutable_churn_ms, num_items * 2));
+	out.value("refresh_put_us", per_op_us(refresh_ms, num_queries));
+	out.value("node_id_change_ms", id_change_ms / id_changes);
+	out.end();
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		char const* arg = argv[i];
+		if (arg[0] != '-' || std::strlen(arg) != 2 || i + 1 >= argc) usage();
+		char const* v = argv[++i];
+		switch (arg[1])
+		{
+			case 'h': height = std::atoi(v); break;
+			case 'a': num_accounts = std::atoi(v); break;
+			case 't': transfer_percent = std::atoi(v); break;
+			case 'n': note_percent = std::atoi(v); break;
+			case 'r': rebranch_depth = std::atoi(v); break;
+			case 'm': num_messages = std::atoi(v); break;
+			case 'M': num_history_messages = std::atoi(v); break;
+			case 'f': num_friends = std::atoi(v); break;
+			case 'i': num_items = std::atoi(v); break;
+			case 'q': num_queries = std::atoi(v); break;
+			case 's': num_import_accounts = std::atoi(v); break;
+			case 'd': num_store_items = std::atoi(v); break;
+			case 'o': out_file = v; break;
+			default: usage();
+		}
+	}
+	if (height < 2 || num_accounts <= 0 || transfer_percent < 0 || note_percent < 0
+		|| transfer_percent + note_percent > 100 || rebranch_depth <= 0
+		|| num_messages <= 0 || num_history_messages <= 0 || num_friends <= 0 || num_items <= 0 || num_queries <= 0
+		|| num_import_accounts <= 0 || num_store_items <= 0)
+		usage();
+
+	namespace fs = std::filesystem;
+	fs::path const dir = fs::temp_directory_path()
+		/ ("libTAU-storage-bench-" + std::to_string(std::random_device()()));
+	fs::create_directories(dir);
+
+	json_writer out;
+	out.begin("workload");
+	out.value("height", std::int64_t(height));
+	out.value("accounts", std::int64_t(num_accounts));
+	out.value("transfer_percent", std::int64_t(transfer_percent));
+	out.value("note_percent", std::int64_t(note_percent));
+	out.value("sqlite_version", std::int64_t(sqlite3_libversion_number()));
+	out.end();
+
+	bench_blockchain(dir.string(), out);
+	bench_state_import(dir.string(), out);
+	bench_messages(dir.string(), out);
+	bench_message_history(dir.string(), out);
+	bench_message_compression(out);
+	bench_message_search(dir.string(), out);
+	bench_items(dir.string(), out);
+	bench_dht_storage(out);
+
+	std::error_code ec;
+	fs::remove_all(dir, ec);
+
+	std::string const json = out.str();
+	if (out_file == nullptr)
+	{
+		std::fputs(json.c_str(), stdout);
+		return 0;
+	}
+
+	FILE* f = std::fopen(out_file, "w");
+	if (f == nullptr)
+	{
+		std::fprintf(stderr, "failed to open %s\n", out_file);
+		return 1;
+	}
+	std::fputs(json.c_str(), f);
+	std::fclose(f);
+	return 0;
+}
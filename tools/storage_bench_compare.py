@@ -0,0 +1,53 @@
+#!/usr/bin/env python3
+# vim: tabstop=8 expandtab shiftwidth=4 softtabstop=4
+
+# compares two result files of storage_bench and fails if a timing got
+# worse by more than the threshold. Timings are the "_us" and "_ms" values
+# (lower is better) and the "_per_second" values (higher is better)
+
+import argparse
+import json
+import sys
+
+parser = argparse.ArgumentParser(description='compare storage_bench results')
+parser.add_argument('baseline', help='JSON results of the reference build')
+parser.add_argument('current', help='JSON results of the build to check')
+parser.add_argument('--threshold', type=float, default=20,
+                    help='percent a timing may get worse (default 20)')
+args = parser.parse_args()
+
+with open(args.baseline) as f:
+    baseline = json.load(f)
+with open(args.current) as f:
+    current = json.load(f)
+
+regressions = 0
+for section in sorted(baseline.keys()):
+    if section not in current:
+        print('%s: missing' % section)
+        regressions += 1
+        continue
+    for name, old in sorted(baseline[section].items()):
+        new = current[section].get(name)
+        if new is None:
+            continue
+
+        if name.endswith('_per_second'):
+            lower_is_better = False
+        elif name.endswith('_us') or name.endswith('_ms'):
+            lower_is_better = True
+        else:
+            continue
+
+        if old == 0:
+            continue
+        change = (new - old) * 100.0 / old
+        worse = change > args.threshold if lower_is_better else change < -args.threshold
+        print('%-40s %12.3f %12.3f %+7.1f%%%s' % ('%s.%s' % (section, name), old, new, change,
+              '  REGRESSION' if worse else ''))
+        if worse:
+            regressions += 1
+
+if regressions > 0:
+    print('%d regressions' % regressions)
+    sys.exit(1)
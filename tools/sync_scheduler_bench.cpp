@@ -0,0 +1,404 @@
+/*
+
+Copyright (c) 2022, TaiXiang Cui
+All rights reserved.
+
+You may use, distribute and modify this code under the terms of the BSD license,
+see LICENSE file.
+*/
+
+// measures communication::sync_scheduler against an in-process simulated
+// DHT. Every simulated node has a Kademlia routing table of 8 nodes per
+// bucket, and a lookup is the iterative traversal of the DHT (3 requests in
+// flight, the 8 closest nodes found) starting from the routing table of our
+// own node. For a growing number of friends, each with one item target, it
+// compares:
+//
+//   per-op   one lookup per operation, as the DHT calls of communication
+//            did before the scheduler
+//   grouped  the operations go through the scheduler, for a few group
+//            prefix lengths
+//
+// and reports the lookups and the requests sent per operation, the recall of
+// the nodes an operation is given (the share of the 8 nodes truly closest to
+// its target among them), then how long the operations take to drain at the
+// default rate and when those toward recently active friends run.
+
+#include "libTAU/communication/sync_scheduler.hpp"
+#include "libTAU/kademlia/node_id.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace lt;
+using namespace lt::communication;
+
+namespace {
+
+using clk = std::chrono::steady_clock;
+
+std::mt19937 random_engine(1);
+
+int num_nodes = 10000;
+
+// friends of each run
+int const friend_counts[] = {100, 1000, 3000};
+
+int const group_prefix_bits[] = {4, 8, 12};
+
+// kademlia parameters of the simulated DHT
+int const bucket_size = 8;
+int const alpha = 3;
+
+// the operations rate of the pacing run
+int const sync_rate = 100;
+
+// share of the friends that were active recently
+double const active_share = 0.1;
+
+[[noreturn]] void usage()
+{
+	std::fprintf(stderr, "USAGE: sync_scheduler_bench [nodes]\n\n"
+		"nodes  nodes of the simulated DHT (default 10000)\n");
+	std::exit(1);
+}
+
+sha256_hash random_hash()
+{
+	std::uniform_int_distribution<int> byte(0, 255);
+	sha256_hash h;
+	for (auto& b : h) b = std::uint8_t(byte(random_engine));
+	return h;
+}
+
+dht::public_key random_key()
+{
+	std::uniform_int_distribution<int> byte(0, 255);
+	dht::public_key pk;
+	for (auto& b : pk.bytes) b = char(byte(random_engine));
+	return pk;
+}
+
+struct network
+{
+	// sorted ids of the nodes
+	std::vector<sha256_hash> ids;
+
+	// routing table of every node, and of our own one, node indices
+	std::vector<std::vector<int>> tables;
+	std::vector<int> own_table;
+
+	// requests sent by all lookups
+	std::int64_t requests = 0;
+
+	// lookup scratch, the lookup a node was last seen by
+	std::vector<int> seen;
+	int lookup_id = 0;
+};
+
+sha256_hash bit(int n)
+{
+	sha256_hash h;
+	h[n / 8] = std::uint8_t(0x80 >> (n % 8));
+	return h;
+}
+
+// the nodes sharing the first bits bits of prefix
+std::pair<int, int> prefix_range(network const& net, sha256_hash const& prefix, int bits)
+{
+	sha256_hash mask = (sha256_hash::max)();
+	if (bits < 256) mask <<= 256 - bits;
+	sha256_hash const low = prefix & mask;
+	sha256_hash high = low;
+	high |= ~mask;
+	auto const first = std::lower_bound(net.ids.begin(), net.ids.end(), low);
+	auto const last = std::upper_bound(first, net.ids.end(), high);
+	return {int(first - net.ids.begin()), int(last - net.ids.begin())};
+}
+
+std::vector<int> make_table(network const& net, sha256_hash const& id)
+{
+	std::vector<int> table;
+	for (int bits = 0; bits < 256; ++bits)
+	{
+		// bucket number bits: the nodes sharing bits bits with id, and not
+		// the next one
+		auto const range = prefix_range(net, id ^ bit(bits), bits + 1);
+		int const size = range.second - range.first;
+		if (size <= bucket_size)
+		{
+			for (int i = range.first; i < range.second; ++i) table.push_back(i);
+		}
+		else
+		{
+			std::uniform_int_distribution<int> pick(range.first, range.second - 1);
+			std::vector<int> bucket;
+			while (int(bucket.size()) < bucket_size)
+			{
+				int const n = pick(random_engine);
+				if (std::find(bucket.begin(), bucket.end(), n) == bucket.end()) bucket.push_back(n);
+			}
+			table.insert(table.end(), bucket.begin(), bucket.end());
+		}
+
+		// stop when no other node shares more bits with id
+		auto const rest = prefix_range(net, id, bits + 1);
+		if (rest.second - rest.first == 0
+			|| (rest.second - rest.first == 1 && net.ids[std::size_t(rest.first)] == id))
+			break;
+	}
+	return table;
+}
+
+network make_network(int nodes)
+{
+	network net;
+	for (int i = 0; i < nodes; ++i) net.ids.push_back(random_hash());
+	std::sort(net.ids.begin(), net.ids.end());
+	for (auto const& id : net.ids) net.tables.push_back(make_table(net, id));
+	net.own_table = make_table(net, random_hash());
+	net.seen.assign(net.ids.size(), -1);
+	return net;
+}
+
+void sort_by_distance(network const& net, std::vector<int>& nodes, sha256_hash const& target)
+{
+	std::sort(nodes.begin(), nodes.end(), [&](int lhs, int rhs)
+		{ return dht::compare_ref(net.ids[std::size_t(lhs)], net.ids[std::size_t(rhs)], target); });
+}
+
+// the iterative lookup of target, the bucket_size closest nodes found
+std::vector<int> lookup(network& net, sha256_hash const& target)
+{
+	++net.lookup_id;
+	std::vector<int> results;
+	auto add = [&](int n)
+	{
+		if (net.seen[std::size_t(n)] == net.lookup_id) return;
+		net.seen[std::size_t(n)] = net.lookup_id;
+		results.push_back(n);
+	};
+	for (int n : net.own_table) add(n);
+
+	std::vector<int> queried;
+	std::vector<int> answer;
+	for (;;)
+	{
+		sort_by_distance(net, results, target);
+		if (int(results.size()) > 4 * bucket_size) results.resize(4 * bucket_size);
+
+		// the closest nodes not queried yet
+		std::vector<int> next;
+		for (int i = 0; i < std::min(int(results.size()), bucket_size) && int(next.size()) < alpha; ++i)
+		{
+			int const n = results[std::size_t(i)];
+			if (std::find(queried.begin(), queried.end(), n) == queried.end()) next.push_back(n);
+		}
+		if (next.empty()) break;
+
+		for (int n : next)
+		{
+			queried.push_back(n);
+			++net.requests;
+			answer = net.tables[std::size_t(n)];
+			sort_by_distance(net, answer, target);
+			for (int i = 0; i < std::min(int(answer.size()), bucket_size); ++i)
+				add(answer[std::size_t(i)]);
+		}
+	}
+
+	if (int(results.size()) > bucket_size) results.resize(bucket_size);
+	return results;
+}
+
+std::vector<dht::node_entry> entries(network const& net, std::vector<int> const& nodes)
+{
+	std::vector<dht::node_entry> ret;
+	for (int n : nodes)
+		ret.emplace_back(net.ids[std::size_t(n)]
+			, udp::endpoint(address_v4(std::uint32_t(n)), 6881));
+	return ret;
+}
+
+// share of the bucket_size nodes closest to target among nodes
+double recall(network const& net, sha256_hash const& target, std::vector<dht::node_entry> const& nodes)
+{
+	std::vector<int> all(net.ids.size());
+	for (std::size_t i = 0; i < all.size(); ++i) all[i] = int(i);
+	std::nth_element(all.begin(), all.begin() + bucket_size, all.end(), [&](int lhs, int rhs)
+		{ return dht::compare_ref(net.ids[std::size_t(lhs)], net.ids[std::size_t(rhs)], target); });
+
+	int found = 0;
+	for (int i = 0; i < bucket_size; ++i)
+	{
+		auto const& id = net.ids[std::size_t(all[std::size_t(i)])];
+		for (auto const& n : nodes)
+			if (n.id == id) { ++found; break; }
+	}
+	return double(found) / bucket_size;
+}
+
+struct friend_data
+{
+	dht::public_key peer;
+	sha256_hash target;
+	bool active = false;
+};
+
+std::vector<friend_data> make_friends(int num_friends)
+{
+	std::vector<friend_data> friends(static_cast<std::size_t>(num_friends));
+	std::bernoulli_distribution active(active_share);
+	for (auto& f : friends)
+	{
+		f.peer = random_key();
+		f.target = random_hash();
+		f.active = active(random_engine);
+	}
+	return friends;
+}
+
+struct result
+{
+	std::int64_t lookups = 0;
+	double requests_per_op = 0;
+	double recall = 0;
+	double cpu_us_per_op = 0;
+};
+
+void print(char const* name, int bits, int num_friends, result const& r)
+{
+	if (bits < 0)
+		std::printf("%-8s          %5d friends  lookups: %6" PRId64 "  requests/op: %6.2f  recall: %5.3f\n"
+			, name, num_friends, r.lookups, r.requests_per_op, r.recall);
+	else
+		std::printf("%-8s %2d bits  %5d friends  lookups: %6" PRId64 "  requests/op: %6.2f  recall: %5.3f"
+			"  scheduler cpu: %5.2f us/op\n"
+			, name, bits, num_friends, r.lookups, r.requests_per_op, r.recall, r.cpu_us_per_op);
+}
+
+result run_per_op(network& net, std::vector<friend_data> const& friends)
+{
+	result r;
+	std::int64_t const requests = net.requests;
+	double total_recall = 0;
+	for (auto const& f : friends)
+	{
+		auto const nodes = entries(net, lookup(net, f.target));
+		++r.lookups;
+		total_recall += recall(net, f.target, nodes);
+	}
+	r.requests_per_op = double(net.requests - requests) / double(friends.size());
+	r.recall = total_recall / double(friends.size());
+	return r;
+}
+
+result run_grouped(network& net, std::vector<friend_data> const& friends, int bits)
+{
+	result r;
+	std::int64_t const requests = net.requests;
+	std::vector<std::vector<dht::node_entry>> given(friends.size());
+	double lookup_ms = 0;
+
+	sync_scheduler scheduler([&](sha256_hash const& target, sync_scheduler::nodes_callback done)
+		{
+			auto const start = clk::now();
+			auto const nodes = entries(net, lookup(net, target));
+			lookup_ms += std::chrono::duration<double, std::milli>(clk::now() - start).count();
+			done(nodes);
+		}, 0, bits);
+
+	auto const start = clk::now();
+	for (std::size_t i = 0; i < friends.size(); ++i)
+	{
+		scheduler.add({friends[i].target, friends[i].peer
+			, [&given, i](std::vector<dht::node_entry> const& nodes) { given[i] = nodes; }});
+	}
+	while (scheduler.pending() > 0) scheduler.dispatch(0);
+	double const total_ms = std::chrono::duration<double, std::milli>(clk::now() - start).count();
+
+	double total_recall = 0;
+	for (std::size_t i = 0; i < friends.size(); ++i)
+		total_recall += recall(net, friends[i].target, given[i]);
+
+	r.lookups = scheduler.lookups();
+	r.requests_per_op = double(net.requests - requests) / double(friends.size());
+	r.recall = total_recall / double(friends.size());
+	r.cpu_us_per_op = (total_ms - lookup_ms) * 1000 / double(friends.size());
+	return r;
+}
+
+// dispatch at the interval of communication until every operation ran, and
+// return the average time (ms) the operations toward active and other
+// friends ran at
+void run_paced(network& net, std::vector<friend_data> const& friends, int bits)
+{
+	std::int64_t now = 0;
+	std::int64_t drained = 0;
+	double active_ms = 0;
+	double other_ms = 0;
+	int active = 0;
+
+	sync_scheduler scheduler([&](sha256_hash const& target, sync_scheduler::nodes_callback done)
+		{ done(entries(net, lookup(net, target))); }, sync_rate, bits);
+
+	for (auto const& f : friends)
+	{
+		if (f.active) scheduler.peer_active(f.peer, 1);
+	}
+
+	for (auto const& f : friends)
+	{
+		bool const is_active = f.active;
+		scheduler.add({f.target, f.peer, [&, is_active](std::vector<dht::node_entry> const&)
+			{
+				if (is_active) { active_ms += double(now); ++active; }
+				else other_ms += double(now);
+				drained = now;
+			}});
+	}
+
+	while (scheduler.pending() > 0)
+	{
+		scheduler.dispatch(now);
+		now += 100;
+	}
+
+	int const others = int(friends.size()) - active;
+	std::printf("paced    %2d bits  %5d friends  rate: %d ops/s  drain: %7.1f s  "
+		"active friends: %6.1f s  others: %6.1f s\n"
+		, bits, int(friends.size()), sync_rate, double(drained) / 1000
+		, active > 0 ? active_ms / active / 1000 : 0.
+		, others > 0 ? other_ms / others / 1000 : 0.);
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+	if (argc > 2) usage();
+	if (argc > 1) num_nodes = std::atoi(argv[1]);
+	if (num_nodes < 2 * bucket_size) usage();
+
+	auto start = clk::now();
+	network net = make_network(num_nodes);
+	std::printf("simulated DHT of %d nodes built in %.1f ms\n", num_nodes
+		, std::chrono::duration<double, std::milli>(clk::now() - start).count());
+
+	for (int const num_friends : friend_counts)
+	{
+		auto const friends = make_friends(num_friends);
+
+		print("per-op", -1, num_friends, run_per_op(net, friends));
+		for (int const bits : group_prefix_bits)
+			print("grouped", bits, num_friends, run_grouped(net, friends, bits));
+		run_paced(net, friends, sync_scheduler::default_group_prefix_bits);
+	}
+
+	return 0;
+}